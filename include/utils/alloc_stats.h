@@ -0,0 +1,124 @@
+/*
+Heap allocation counters
+- opt-in: only a build that defines BEZIER_ALLOC_STATS (e.g. -DBEZIER_ALLOC_STATS, for the storage benchmark) counts the
+  allocations. Otherwise nothing is replaced, AllocationScope is empty and its stats are not valid (shown as n/a)
+- the global operator new / delete are replaced: every allocation stores its size in front of the block,
+  so the live bytes (and their peak) are known when the block is released
+- AllocationScope measures the allocations made (by any thread) between its creation and measure()
+- over-aligned allocations (operator new with std::align_val_t) keep the standard implementation and are not counted
+With BEZIER_ALLOC_STATS this header replaces the global operators, so it can only be part of one translation unit
+(the whole application is main.cpp)
+*/
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// Allocations made inside a scope: count, bytes requested and peak of the live bytes above the ones at the start of the scope
+struct AllocationStats {
+    // false when the allocations are not counted (build without BEZIER_ALLOC_STATS)
+    bool valid = false;
+    std::uint64_t count = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t peakBytes = 0;
+};
+
+#ifdef BEZIER_ALLOC_STATS
+namespace alloc_detail
+{
+    // the prefix keeps the alignment of a plain operator new
+    constexpr std::size_t prefix = alignof(std::max_align_t) > sizeof(std::size_t) ? alignof(std::max_align_t) : sizeof(std::size_t);
+
+    inline std::atomic<std::uint64_t> count{ 0 };
+    inline std::atomic<std::uint64_t> bytes{ 0 };
+    inline std::atomic<std::uint64_t> liveBytes{ 0 };
+    inline std::atomic<std::uint64_t> peakBytes{ 0 };
+
+    inline void* allocate(std::size_t size) noexcept
+    {
+        void* block = std::malloc(size + prefix);
+        if (!block)
+            return nullptr;
+        *static_cast<std::size_t*>(block) = size;
+        count.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(size, std::memory_order_relaxed);
+        const std::uint64_t live = liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+        std::uint64_t peak = peakBytes.load(std::memory_order_relaxed);
+        while (live > peak && !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+            ;
+        return static_cast<char*>(block) + prefix;
+    }
+
+    inline void release(void* p) noexcept
+    {
+        if (!p)
+            return;
+        void* block = static_cast<char*>(p) - prefix;
+        liveBytes.fetch_sub(*static_cast<std::size_t*>(block), std::memory_order_relaxed);
+        std::free(block);
+    }
+
+    inline void* allocateOrThrow(std::size_t size)
+    {
+        for (;;)
+        {
+            if (void* p = allocate(size ? size : 1))
+                return p;
+            std::new_handler handler = std::get_new_handler();
+            if (!handler)
+                throw std::bad_alloc();
+            handler();
+        }
+    }
+}
+
+/////////////////// ALLOCATION SCOPE class ///////////////////////
+class AllocationScope
+{
+public:
+
+    // the peak is restarted from the current live bytes: nested scopes are not supported
+    AllocationScope() noexcept
+        : count(alloc_detail::count.load()), bytes(alloc_detail::bytes.load()), liveBytes(alloc_detail::liveBytes.load())
+    {
+        alloc_detail::peakBytes.store(liveBytes);
+    }
+
+    AllocationStats measure() const noexcept
+    {
+        AllocationStats stats;
+        stats.valid = true;
+        stats.count = alloc_detail::count.load() - count;
+        stats.bytes = alloc_detail::bytes.load() - bytes;
+        const std::uint64_t peak = alloc_detail::peakBytes.load();
+        stats.peakBytes = peak > liveBytes ? peak - liveBytes : 0;
+        return stats;
+    }
+
+private:
+    std::uint64_t count, bytes, liveBytes;
+};
+
+// Replaced global operators (the array and sized forms are replaced too, since their default versions may skip the ones above)
+void* operator new(std::size_t size) { return alloc_detail::allocateOrThrow(size); }
+void* operator new[](std::size_t size) { return alloc_detail::allocateOrThrow(size); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { try { return alloc_detail::allocateOrThrow(size); } catch (...) { return nullptr; } }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { try { return alloc_detail::allocateOrThrow(size); } catch (...) { return nullptr; } }
+void operator delete(void* p) noexcept { alloc_detail::release(p); }
+void operator delete[](void* p) noexcept { alloc_detail::release(p); }
+void operator delete(void* p, std::size_t) noexcept { alloc_detail::release(p); }
+void operator delete[](void* p, std::size_t) noexcept { alloc_detail::release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { alloc_detail::release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { alloc_detail::release(p); }
+
+#else
+/////////////////// ALLOCATION SCOPE class ///////////////////////
+// Allocations are not counted: the stats of a scope are never valid
+class AllocationScope
+{
+public:
+    AllocationStats measure() const noexcept { return AllocationStats(); }
+};
+#endif
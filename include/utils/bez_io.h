@@ -0,0 +1,427 @@
+/*
+Bezier Surfaces models I/O
+- legacy .bez text format: first line with the number of patches, then 4 lines of 4 control points for each patch, separated by an empty line
+  (some models store one control point per line)
+- .bbez binary format: header (patch count, point count, bounding box) followed by the tightly packed
+  unique control points (3 floats each) and the 16 indices of each patch (uint32), ready to be mapped and uploaded as they are
+*/
+#pragma once
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <utils/bezier_surface.h>
+#include <utils/control_net.h>
+
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    // windows.h defines these as empty macros, but they are common variable names (e.g. near/far planes)
+    #undef near
+    #undef far
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// Header of the .bbez binary format (40 bytes, followed by pointCount * 3 floats and patchCount * 16 uint32 indices)
+struct BinaryPatchHeader
+{
+    char magic[4];
+    std::uint32_t version;
+    std::uint32_t patchCount;
+    std::uint32_t pointCount;
+    float bboxMin[3];
+    float bboxMax[3];
+};
+static_assert(sizeof(BinaryPatchHeader) == 40, "BinaryPatchHeader must be tightly packed");
+
+constexpr char BINARY_PATCH_MAGIC[4] = { 'B', 'E', 'Z', 'B' };
+constexpr std::uint32_t BINARY_PATCH_VERSION = 1;
+
+// Loading times of the same model from the text and the binary format
+struct BezLoadBenchmark
+{
+    std::string model;
+    std::size_t patches = 0;
+    double textMs = 0.0;
+    double binaryMs = 0.0;
+    // text parsing alone (best of a few runs): read_BezText against the previous getline/istringstream reader
+    double parseMs = 0.0;
+    double legacyParseMs = 0.0;
+};
+
+/////////////////// MAPPED FILE class ///////////////////////
+// Read-only memory mapping of a whole file (move-only, the mapping is released by the destructor)
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string& path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            return;
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+        {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping)
+                bytes = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            if (bytes)
+                length = (std::size_t)fileSize.QuadPart;
+        }
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            void* mapped = mmap(nullptr, (std::size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                bytes = mapped;
+                length = (std::size_t)st.st_size;
+            }
+        }
+        // the mapping stays valid after closing the descriptor
+        close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& move) noexcept { swap(move); }
+
+    MappedFile& operator=(MappedFile&& move) noexcept
+    {
+        MappedFile released(std::move(*this));
+        swap(move);
+        return *this;
+    }
+
+    ~MappedFile() noexcept
+    {
+#ifdef _WIN32
+        if (bytes)
+            UnmapViewOfFile(bytes);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (bytes)
+            munmap(bytes, length);
+#endif
+    }
+
+    bool valid() const noexcept { return bytes != nullptr; }
+    const unsigned char* data() const noexcept { return static_cast<const unsigned char*>(bytes); }
+    std::size_t size() const noexcept { return length; }
+
+private:
+    void* bytes = nullptr;
+    std::size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+    void swap(MappedFile& other) noexcept
+    {
+        std::swap(bytes, other.bytes);
+        std::swap(length, other.length);
+#ifdef _WIN32
+        std::swap(file, other.file);
+        std::swap(mapping, other.mapping);
+#endif
+    }
+};
+
+// Pointers inside a mapped .bbez file (no copies): header, control points and patch indices
+struct BinaryPatchView
+{
+    const BinaryPatchHeader* header = nullptr;
+    const glm::vec3* points = nullptr;
+    const GLuint* indices = nullptr;
+
+    bool valid() const noexcept { return header != nullptr; }
+};
+
+//Methods definition
+std::vector<BezierSurface> read_BezText(const std::string& path, std::string* error = nullptr);
+BinaryPatchView view_BezBinary(const MappedFile& file);
+std::vector<BezierSurface> read_BezBinary(const BinaryPatchView& view);
+bool write_BezBinary(const std::string& path, const ControlNet& net);
+bool convert_BezToBinary(const std::string& textPath, const std::string& binaryPath);
+BezLoadBenchmark bench_BezLoading(const std::string& textPath, const std::string& binaryPath);
+
+//Methods implementation
+// Skips blanks counting the lines, returns false at the end of the buffer
+static bool skip_BezBlanks(const char*& it, const char* end, std::size_t& line) noexcept
+{
+    while (it != end && (*it == ' ' || *it == '\t' || *it == '\r' || *it == '\n'))
+    {
+        if (*it == '\n')
+            line++;
+        ++it;
+    }
+    return it != end;
+}
+
+// Parses a float token at it (advanced after the number), false if the token is not a number
+static bool parse_BezFloat(const char*& it, const char* end, float& value) noexcept
+{
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    // from_chars does not accept an explicit '+' sign
+    if (it != end && *it == '+')
+        ++it;
+    auto result = std::from_chars(it, end, value);
+    if (result.ec != std::errc())
+        return false;
+    it = result.ptr;
+    return true;
+#else
+    // the buffer is a null terminated std::string, so strtof cannot run past the end
+    char* next = nullptr;
+    value = std::strtof(it, &next);
+    if (next == it)
+        return false;
+    it = next;
+    return true;
+#endif
+}
+
+// Previous reader, kept only as the reference of the loading benchmark: a getline and an istringstream for every line
+// (counting the floats instead of the lines, so that it also reads the one control point per line layout of gumbo.bez)
+static std::vector<BezierSurface> read_BezTextLegacy(const std::string& path)
+{
+    std::vector<BezierSurface> surfaces;
+    std::ifstream infile(path);
+    std::string line;
+    // first line: number of patches, skipped
+    std::getline(infile, line);
+    BezierSurface bs;
+    std::size_t coordinate = 0;
+    while (std::getline(infile, line))
+    {
+        std::istringstream iss(line);
+        float value;
+        while (iss >> value)
+        {
+            bs[coordinate / 12][(coordinate / 3) % 4][coordinate % 3] = value;
+            if (++coordinate == 48)
+            {
+                surfaces.push_back(bs);
+                coordinate = 0;
+            }
+        }
+    }
+    return surfaces;
+}
+
+// The whole file is read in a single buffer and parsed in place: the first token is the number of patches (used
+// to reserve the output), then every 48 floats (16 control points, row by row) are a patch, whatever the line layout
+// (4 control points per line, or 1 control point per line as in gumbo.bez). Blank lines between patches are optional.
+// Malformed input is reported with its line number (in error, if given) and the complete patches read so far are returned.
+std::vector<BezierSurface> read_BezText(const std::string& path, std::string* error)
+{
+    std::vector<BezierSurface> surfaces;
+    auto fail = [&](std::size_t line, const std::string& message) {
+        std::string text = path + ":" + std::to_string(line) + ": " + message;
+        std::cout << "ERROR::BEZ_MODEL::PARSING_FAILED " << text << std::endl;
+        if (error)
+            *error = text;
+        return surfaces;
+    };
+
+    std::ifstream infile(path, std::ios::binary | std::ios::ate);
+    if (!infile)
+        return fail(0, "cannot open the file");
+    std::string buffer;
+    buffer.resize((std::size_t)infile.tellg());
+    infile.seekg(0);
+    infile.read(&buffer[0], buffer.size());
+
+    const char* it = buffer.data();
+    const char* end = buffer.data() + buffer.size();
+    std::size_t line = 1;
+
+    // header: number of patches
+    unsigned long declaredPatches = 0;
+    if (!skip_BezBlanks(it, end, line))
+        return fail(line, "empty file");
+    auto header = std::from_chars(it, end, declaredPatches);
+    if (header.ec != std::errc())
+        return fail(line, "expected the number of patches");
+    it = header.ptr;
+    // a patch takes at least 96 bytes (48 one digit numbers and their separators): a corrupt count cannot reserve more than the file holds
+    surfaces.reserve(std::min<std::size_t>(declaredPatches, buffer.size() / 96 + 1));
+
+    std::size_t coordinate = 0;
+    std::size_t patchLine = line;
+    while (skip_BezBlanks(it, end, line))
+    {
+        if (coordinate == 0)
+        {
+            surfaces.emplace_back();
+            patchLine = line;
+        }
+        float value;
+        if (!parse_BezFloat(it, end, value))
+        {
+            surfaces.pop_back();
+            return fail(line, "expected a control point coordinate, found '" + std::string(it, std::find_if(it, end, [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; })) + "'");
+        }
+        // coordinate = 12 * row + 3 * column + component, written straight in the output patch
+        surfaces.back()[coordinate / 12][(coordinate / 3) % 4][coordinate % 3] = value;
+        coordinate = (coordinate + 1) % 48;
+    }
+
+    if (coordinate != 0)
+    {
+        surfaces.pop_back();
+        return fail(patchLine, "incomplete patch (" + std::to_string(coordinate) + " of 48 coordinates)");
+    }
+    if (surfaces.size() != declaredPatches)
+        std::cout << "WARNING::BEZ_MODEL " << path << ": header declares " << declaredPatches << " patches, read " << surfaces.size() << std::endl;
+    return surfaces;
+}
+
+// Validates the header, the size and the indices of a mapped .bbez file, returns an invalid view if the file is not a valid .bbez
+BinaryPatchView view_BezBinary(const MappedFile& file)
+{
+    BinaryPatchView view;
+    if (!file.valid() || file.size() < sizeof(BinaryPatchHeader))
+        return view;
+    const auto* header = reinterpret_cast<const BinaryPatchHeader*>(file.data());
+    if (std::memcmp(header->magic, BINARY_PATCH_MAGIC, 4) != 0 || header->version != BINARY_PATCH_VERSION)
+        return view;
+    const std::size_t expected = sizeof(BinaryPatchHeader) + (std::size_t)header->pointCount * sizeof(glm::vec3) + (std::size_t)header->patchCount * 16 * sizeof(GLuint);
+    if (file.size() < expected)
+        return view;
+    // every index must address a stored point: a corrupt index block would be read out of bounds here and by the GPU
+    const GLuint* indices = reinterpret_cast<const GLuint*>(file.data() + sizeof(BinaryPatchHeader) + (std::size_t)header->pointCount * sizeof(glm::vec3));
+    const std::size_t indexCount = (std::size_t)header->patchCount * 16;
+    for (std::size_t k = 0; k != indexCount; k++)
+        if (indices[k] >= header->pointCount)
+            return view;
+
+    view.header = header;
+    view.points = reinterpret_cast<const glm::vec3*>(file.data() + sizeof(BinaryPatchHeader));
+    view.indices = indices;
+    return view;
+}
+
+// Expands the indexed patches of a .bbez file (needed only when the patches are drawn one by one)
+std::vector<BezierSurface> read_BezBinary(const BinaryPatchView& view)
+{
+    std::vector<BezierSurface> surfaces;
+    if (!view.valid())
+        return surfaces;
+    surfaces.resize(view.header->patchCount);
+    for (std::size_t p = 0; p != surfaces.size(); p++)
+        for (unsigned int i = 0; i != 4; i++)
+            for (unsigned int j = 0; j != 4; j++)
+                surfaces[p][i][j] = view.points[view.indices[16 * p + 4 * i + j]];
+    return surfaces;
+}
+
+bool write_BezBinary(const std::string& path, const ControlNet& net)
+{
+    BinaryPatchHeader header;
+    std::memcpy(header.magic, BINARY_PATCH_MAGIC, 4);
+    header.version = BINARY_PATCH_VERSION;
+    header.patchCount = (std::uint32_t)net.patchCount();
+    header.pointCount = (std::uint32_t)net.points.size();
+    glm::vec3 bboxMin(0.0f), bboxMax(0.0f);
+    if (!net.points.empty())
+    {
+        bboxMin = bboxMax = net.points[0];
+        for (const auto& point : net.points)
+        {
+            bboxMin = glm::min(bboxMin, point);
+            bboxMax = glm::max(bboxMax, point);
+        }
+    }
+    for (int c = 0; c != 3; c++)
+    {
+        header.bboxMin[c] = bboxMin[c];
+        header.bboxMax[c] = bboxMax[c];
+    }
+
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(net.points.data()), net.points.size() * sizeof(glm::vec3));
+    out.write(reinterpret_cast<const char*>(net.indices.data()), net.indices.size() * sizeof(GLuint));
+    return (bool)out;
+}
+
+// Converts a .bez text model in the .bbez binary format (shared control points are stored once)
+bool convert_BezToBinary(const std::string& textPath, const std::string& binaryPath)
+{
+    auto surfaces = read_BezText(textPath);
+    if (surfaces.empty())
+        return false;
+    return write_BezBinary(binaryPath, index_BezierSurfaces(surfaces));
+}
+
+// Time to get from the file on disk to buffers ready for the GPU upload:
+// text parsing + control points indexing against mapping + header validation of the binary file
+BezLoadBenchmark bench_BezLoading(const std::string& textPath, const std::string& binaryPath)
+{
+    BezLoadBenchmark result;
+    result.model = textPath.substr(textPath.find_last_of("/\\") + 1);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    auto net = index_BezierSurfaces(read_BezText(textPath));
+    auto middle = std::chrono::high_resolution_clock::now();
+    MappedFile file(binaryPath);
+    auto view = view_BezBinary(file);
+    // touch every page, as the upload would do
+    volatile unsigned char sink = 0;
+    for (std::size_t offset = 0; offset < file.size(); offset += 4096)
+        sink = sink + file.data()[offset];
+    auto end = std::chrono::high_resolution_clock::now();
+
+    result.patches = view.valid() ? view.header->patchCount : net.patchCount();
+    result.textMs = std::chrono::duration<double, std::milli>(middle - start).count();
+    result.binaryMs = std::chrono::duration<double, std::milli>(end - middle).count();
+
+    // parsers alone, best of 10 runs (the files are small, a single run is mostly noise)
+    auto bestOf = [](auto&& parse) {
+        double best = 0.0;
+        for (int run = 0; run != 10; run++)
+        {
+            auto runStart = std::chrono::high_resolution_clock::now();
+            volatile std::size_t patches = parse().size();
+            (void)patches;
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - runStart).count();
+            best = run == 0 ? ms : std::min(best, ms);
+        }
+        return best;
+    };
+    result.parseMs = bestOf([&]() { return read_BezText(textPath); });
+    result.legacyParseMs = bestOf([&]() { return read_BezTextLegacy(textPath); });
+    return result;
+}
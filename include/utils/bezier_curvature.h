@@ -0,0 +1,226 @@
+/*
+Curvature of bicubic Bezier Surfaces (CPU reference of terrainBezierTessellation_tes.glsl)
+- evaluation of the position and of the first and second partial derivatives of a patch at (u, v)
+- closed form principal curvatures and directions from the Weingarten matrix (computeCurvature in the shader)
+- port of the previous shader solver (pivot based eigenvalues + inverse power iteration), kept to compare the two
+*/
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/bezier_surface.h>
+#include <utils/simd.h>
+
+// Position and partial derivatives of a patch at (u, v)
+struct BezierSurfaceSample {
+	glm::vec3 position;
+	glm::vec3 tangent;			// dS/du
+	glm::vec3 bitangent;		// dS/dv
+	glm::vec3 normal;			// normalize(dS/du x dS/dv)
+	glm::vec3 uu, uv, vv;		// second partial derivatives
+};
+
+// Principal curvatures (k1 >= k2), mean and Gaussian curvature and principal directions (unit, in 3D)
+struct SurfaceCurvature {
+	float k1 = 0.0f;
+	float k2 = 0.0f;
+	float meanCurvature = 0.0f;
+	float gaussianCurvature = 0.0f;
+	glm::vec3 principalDirection1 = glm::vec3(0.0f);
+	glm::vec3 principalDirection2 = glm::vec3(0.0f);
+};
+
+// Agreement of the closed form solver with the previous one and with a double precision eigen decomposition
+struct CurvatureSolverCheck {
+	std::string model;
+	std::size_t samples = 0;
+	// largest relative difference of the Gaussian curvature (k1 * k2 of the previous solver)
+	double maxGaussianError = 0.0;
+	// largest relative error of k1 and k2 against the double precision eigenvalues
+	double maxCurvatureError = 0.0;
+	// largest angle (radians) between the principal directions and the double precision eigenvectors (non umbilic samples)
+	double maxDirectionError = 0.0;
+	// samples where the previous solver did not return the eigenvalues (relative error above 1e-3)
+	std::size_t legacyCurvatureMismatches = 0;
+};
+
+//Methods definition
+BezierSurfaceSample eval_BezierSurface(const BezierSurface& bsurface, float u, float v) noexcept;
+SurfaceCurvature calc_SurfaceCurvature(const BezierSurfaceSample& sample) noexcept;
+SurfaceCurvature calc_SurfaceCurvatureLegacy(const BezierSurfaceSample& sample) noexcept;
+CurvatureSolverCheck check_CurvatureSolver(const std::string& model, const std::vector<BezierSurface>& bsurfaces, unsigned int grid = 8);
+
+//Methods implementation
+// no floating point contraction: the scalar references and the vectorized kernels round the same way (see utils/simd.h)
+NPR_FP_CONTRACT_OFF_BEGIN
+// Same weights of the shader: control point (i, j) of the shader (i follows u, j follows v) is bsurface[j][i]
+BezierSurfaceSample eval_BezierSurface(const BezierSurface& bsurface, float u, float v) noexcept
+{
+	const float bu[4] = { (1 - u) * (1 - u) * (1 - u), 3 * u * (1 - u) * (1 - u), 3 * u * u * (1 - u), u * u * u };
+	const float bv[4] = { (1 - v) * (1 - v) * (1 - v), 3 * v * (1 - v) * (1 - v), 3 * v * v * (1 - v), v * v * v };
+	const float dbu[4] = { -3 * (1 - u) * (1 - u), 3 * (1 - u) * (1 - u) - 6 * u * (1 - u), 6 * u * (1 - u) - 3 * u * u, 3 * u * u };
+	const float dbv[4] = { -3 * (1 - v) * (1 - v), 3 * (1 - v) * (1 - v) - 6 * v * (1 - v), 6 * v * (1 - v) - 3 * v * v, 3 * v * v };
+	const float ddbu[4] = { 6 * (1 - u), -6 * (1 - u) - (6 * (1 - u) - 6 * u), 6 * (1 - u) - 6 * u - 6 * u, 6 * u };
+	const float ddbv[4] = { 6 * (1 - v), -6 * (1 - v) - (6 * (1 - v) - 6 * v), 6 * (1 - v) - 6 * v - 6 * v, 6 * v };
+
+	BezierSurfaceSample s{};
+	for (unsigned int i = 0; i != 4; i++)
+	{
+		// curves along v of the column i, and of their derivatives
+		glm::vec3 c(0.0f), dc(0.0f), ddc(0.0f);
+		for (unsigned int j = 0; j != 4; j++)
+		{
+			c += bv[j] * bsurface[j][i];
+			dc += dbv[j] * bsurface[j][i];
+			ddc += ddbv[j] * bsurface[j][i];
+		}
+		s.position += bu[i] * c;
+		s.tangent += dbu[i] * c;
+		s.bitangent += bu[i] * dc;
+		s.uu += ddbu[i] * c;
+		s.uv += dbu[i] * dc;
+		s.vv += bu[i] * ddc;
+	}
+	s.normal = glm::normalize(glm::cross(s.tangent, s.bitangent));
+	return s;
+}
+
+// Weingarten map built once, in the orthonormal tangent frame (t1 = dS/du / |dS/du|, t2 = n x t1) where it is symmetric:
+// with dS/du = p t1 and dS/dv = q t1 + r t2 it is S = J^-T II J^-1, J = [p q; 0 r] (only a triangular inverse, well conditioned
+// even on skewed parametrizations). Its 2x2 eigenproblem is then solved in closed form, k = H +- sqrt(((s11 - s22) / 2)^2 + s12^2),
+// with the first principal direction from the better conditioned row of S - k1 I and the second one orthogonal to it
+SurfaceCurvature calc_SurfaceCurvature(const BezierSurfaceSample& sample) noexcept
+{
+	const glm::vec3& n = sample.normal;
+	const float p = glm::length(sample.tangent);
+	const glm::vec3 t1 = sample.tangent / p;
+	const glm::vec3 t2 = glm::cross(n, t1);
+	const float q = glm::dot(sample.bitangent, t1), r = glm::dot(sample.bitangent, t2);
+	// second fundamental form
+	const float L = glm::dot(n, sample.uu), M = glm::dot(n, sample.uv), N = glm::dot(n, sample.vv);
+	const float alpha = q / p;
+	const float s11 = L / (p * p);
+	const float s12 = (M - alpha * L) / (p * r);
+	const float s22 = (N - alpha * (2.0f * M - alpha * L)) / (r * r);
+
+	SurfaceCurvature k;
+	k.meanCurvature = 0.5f * (s11 + s22);
+	k.gaussianCurvature = s11 * s22 - s12 * s12;
+	const float halfGap = 0.5f * (s11 - s22);
+	const float root = std::sqrt(halfGap * halfGap + s12 * s12);
+	k.k1 = k.meanCurvature + root;
+	k.k2 = k.meanCurvature - root;
+
+	// (s12, k1 - s11) and (k1 - s22, s12) both solve (S - k1 I) x = 0: the longer one is the better conditioned
+	const glm::vec2 fromRow0(s12, k.k1 - s11), fromRow1(k.k1 - s22, s12);
+	const glm::vec2 e1 = glm::dot(fromRow0, fromRow0) >= glm::dot(fromRow1, fromRow1) ? fromRow0 : fromRow1;
+	const float e1Length = glm::length(e1);
+	// umbilic points: every direction is principal
+	k.principalDirection1 = e1Length > 0.0f ? (e1.x * t1 + e1.y * t2) / e1Length : t1;
+	k.principalDirection2 = glm::cross(n, k.principalDirection1);
+	return k;
+}
+
+// Previous solver of the shader: eigenvalues from the pivots of II * I^-1 and eigenvectors by 10 steps of inverse power iteration,
+// mapped on the normalized tangent and bitangent (kept only as a reference for check_CurvatureSolver)
+SurfaceCurvature calc_SurfaceCurvatureLegacy(const BezierSurfaceSample& sample) noexcept
+{
+	const glm::vec3& Su = sample.tangent;
+	const glm::vec3& Sv = sample.bitangent;
+	const glm::vec3& n = sample.normal;
+	const glm::mat2 first(glm::dot(Su, Su), glm::dot(Su, Sv), glm::dot(Su, Sv), glm::dot(Sv, Sv));
+	const glm::mat2 second(glm::dot(n, sample.uu), glm::dot(n, sample.uv), glm::dot(n, sample.uv), glm::dot(n, sample.vv));
+	const glm::mat2 m = second * glm::inverse(first);
+
+	SurfaceCurvature k;
+	if (m[1][0] == 0)
+	{
+		k.k1 = m[0][0];
+		k.k2 = m[1][1];
+	}
+	else if (m[0][0] == 0)
+	{
+		k.k1 = m[0][1];
+		k.k2 = m[1][0];
+	}
+	else
+	{
+		k.k1 = m[0][0];
+		k.k2 = m[1][1] - m[1][0] / m[0][0] * m[0][1];
+	}
+	k.meanCurvature = k.k1 + k.k2 / 2;
+	k.gaussianCurvature = k.k1 * k.k2;
+
+	auto eigenVector = [&](float eigenValue) {
+		glm::vec2 e(1.0f, 0.0f);
+		for (int count = 0; count < 10; count++)
+		{
+			glm::mat2 t = m - eigenValue * glm::mat2(1.0f);
+			t = glm::mat2(t[1][1], -t[0][1], -t[1][0], t[0][0]);
+			e = glm::normalize(t * e);
+		}
+		return e.x * glm::normalize(Su) + e.y * glm::normalize(Sv);
+	};
+	k.principalDirection1 = eigenVector(k.k1);
+	k.principalDirection2 = eigenVector(k.k2);
+	return k;
+}
+
+// Samples every patch on a (grid + 1) x (grid + 1) uv grid and compares the closed form solver with the previous one
+// and with a double precision eigen decomposition of the same Weingarten matrix
+// Errors are relative, but never to less than 1e-3 of the largest curvature of the model: flat regions only carry rounding noise
+CurvatureSolverCheck check_CurvatureSolver(const std::string& model, const std::vector<BezierSurface>& bsurfaces, unsigned int grid)
+{
+	struct Reference { BezierSurfaceSample sample; double k1, k2; glm::dvec3 direction1; };
+	std::vector<Reference> references;
+	references.reserve(bsurfaces.size() * (grid + 1) * (grid + 1));
+	double modelScale = 0.0;
+	for (const auto& bsurface : bsurfaces)
+		for (unsigned int iu = 0; iu <= grid; iu++)
+			for (unsigned int iv = 0; iv <= grid; iv++)
+			{
+				const auto sample = eval_BezierSurface(bsurface, (float)iu / grid, (float)iv / grid);
+				// degenerate points (collapsed edges of the models) have no tangent plane
+				if (!(glm::length(glm::cross(sample.tangent, sample.bitangent)) > 1e-6f))
+					continue;
+				// double precision reference
+				const glm::dvec3 Su(sample.tangent), Sv(sample.bitangent), n(sample.normal);
+				const double E = glm::dot(Su, Su), F = glm::dot(Su, Sv), G = glm::dot(Sv, Sv);
+				const double L = glm::dot(n, glm::dvec3(sample.uu)), M = glm::dot(n, glm::dvec3(sample.uv)), N = glm::dot(n, glm::dvec3(sample.vv));
+				const double det = glm::dot(glm::cross(Su, Sv), glm::cross(Su, Sv));
+				const double a = (G * L - F * M) / det, b = (G * M - F * N) / det, c = (E * M - F * L) / det, d = (E * N - F * M) / det;
+				const double H = 0.5 * (a + d), root = std::sqrt(std::max(0.25 * (a - d) * (a - d) + b * c, 0.0));
+				const double k1 = H + root;
+				const glm::dvec2 e = std::abs(b) + std::abs(k1 - a) >= std::abs(k1 - d) + std::abs(c) ? glm::dvec2(b, k1 - a) : glm::dvec2(k1 - d, c);
+				const glm::dvec3 direction = e.x * Su + e.y * Sv;
+				references.push_back({ sample, k1, H - root, glm::length(direction) > 0.0 ? glm::normalize(direction) : glm::dvec3(0.0) });
+				modelScale = std::max({ modelScale, std::abs(k1), std::abs(H - root) });
+			}
+
+	CurvatureSolverCheck check;
+	check.model = model;
+	check.samples = references.size();
+	const double floor = std::max(1e-3 * modelScale, 1e-30);
+	auto relative = [&](double x, double reference) { return std::abs(x - reference) / std::max(std::abs(reference), floor); };
+	for (const auto& r : references)
+	{
+		const auto k = calc_SurfaceCurvature(r.sample);
+		const auto legacy = calc_SurfaceCurvatureLegacy(r.sample);
+		const double K = r.k1 * r.k2;
+		check.maxGaussianError = std::max(check.maxGaussianError, std::abs(legacy.gaussianCurvature - K) / std::max(std::abs(K), floor * floor));
+		check.maxCurvatureError = std::max({ check.maxCurvatureError, relative(k.k1, r.k1), relative(k.k2, r.k2) });
+		if (std::max(relative(std::max(legacy.k1, legacy.k2), r.k1), relative(std::min(legacy.k1, legacy.k2), r.k2)) > 1e-3)
+			check.legacyCurvatureMismatches++;
+		// principal directions are only defined away from umbilic points
+		if (r.k1 - r.k2 > 1e-2 * modelScale)
+		{
+			const double cosine = std::min(1.0, std::abs(glm::dot(r.direction1, glm::dvec3(k.principalDirection1))));
+			check.maxDirectionError = std::max(check.maxDirectionError, std::acos(cosine));
+		}
+	}
+	return check;
+}
+
+NPR_FP_CONTRACT_OFF_END
@@ -0,0 +1,560 @@
+/*
+Bernstein basis and de Casteljau kernels for bicubic Bezier Surfaces
+- basis tables (cubic Bernstein polynomials and their first two derivatives) for fixed sets of parameters, e.g. uniform grids
+- batched evaluation of positions, first and second derivatives and normals for many (u, v) pairs or for a grid of tables,
+  in SoA layout and vectorized across the samples with simd_float (AVX2 or SSE2, see utils/simd.h)
+- de Casteljau subdivision of curves and of a patch into 4 sub-patches
+- users: ray picking and collision (subdivision down to nearly flat sub-patches refined by Newton iterations on the surface)
+  and export of the tessellated patches
+Control point (i, j) of the shaders (i follows u, j follows v) is bsurface[j][i], as in eval_BezierSurface
+*/
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/bezier_surface.h>
+#include <utils/bezier_curvature.h>
+#include <utils/simd.h>
+
+// Cubic Bernstein basis functions and their derivatives at a set of parameters, one array for each function (SoA)
+struct BezierBasisTable {
+	std::vector<float> params;
+	std::vector<float> b[4], db[4], ddb[4];
+
+	std::size_t size() const noexcept { return params.size(); }
+};
+
+// Quantities computed by the batched evaluators
+enum BezierEvalFlags : unsigned int {
+	BEZIER_EVAL_POSITION = 1,
+	BEZIER_EVAL_FIRST_DERIVATIVES = 2,
+	BEZIER_EVAL_SECOND_DERIVATIVES = 4,
+	BEZIER_EVAL_NORMALS = 8,
+	BEZIER_EVAL_ALL = 15
+};
+
+// Samples of a patch in SoA layout: x, y and z of every quantity in separate arrays (only the requested ones are filled)
+struct BezierSurfaceSamples {
+	std::size_t count = 0;
+	std::vector<float> position[3];
+	std::vector<float> tangent[3];		// dS/du
+	std::vector<float> bitangent[3];	// dS/dv
+	std::vector<float> uu[3], uv[3], vv[3];
+	std::vector<float> normal[3];
+
+	static glm::vec3 get(const std::vector<float> (&q)[3], std::size_t i) noexcept { return glm::vec3(q[0][i], q[1][i], q[2][i]); }
+};
+
+// Closest intersection of a ray with a set of patches
+struct BezierRayHit {
+	bool hit = false;
+	std::size_t patch = 0;
+	float u = 0.0f, v = 0.0f;
+	// along the (not necessarily unit) ray direction
+	float distance = std::numeric_limits<float>::infinity();
+	glm::vec3 position = glm::vec3(0.0f);
+};
+
+// Evaluated samples per second of the single sample evaluator and of the batched ones, subdivided patches per second
+struct BezierMathBenchmark {
+	const char* simdName = simd_float::name;
+	int simdWidth = simd_float::width;
+	std::size_t samples = 0;
+	double scalarSamplesPerSecond = 0.0;
+	double batchSamplesPerSecond = 0.0;
+	double gridSamplesPerSecond = 0.0;
+	double subdivisionsPerSecond = 0.0;
+	// largest distance between the positions of the batched evaluators and eval_BezierSurface, relative to the model size
+	double maxPositionError = 0.0;
+};
+
+//Methods definition
+BezierBasisTable gen_BezierBasisTable(const std::vector<float>& params);
+BezierBasisTable gen_BezierBasisTable(unsigned int level);
+void eval_BezierSurfaceBatch(const BezierSurface& bsurface, const float* u, const float* v, std::size_t count, unsigned int flags, BezierSurfaceSamples& out);
+void eval_BezierSurfaceGrid(const BezierSurface& bsurface, const BezierBasisTable& uTable, const BezierBasisTable& vTable, unsigned int flags, BezierSurfaceSamples& out);
+void subdivide_BezierCurve(const glm::vec3 p[4], float t, glm::vec3 left[4], glm::vec3 right[4]) noexcept;
+std::array<BezierSurface, 4> subdivide_BezierSurface(const BezierSurface& bsurface, float u = 0.5f, float v = 0.5f) noexcept;
+BezierRayHit intersect_BezierSurface(const BezierSurface& bsurface, const glm::vec3& origin, const glm::vec3& direction, unsigned int depth = 8);
+BezierRayHit pick_BezierSurfaces(const std::vector<BezierSurface>& bsurfaces, const glm::vec3& origin, const glm::vec3& direction, unsigned int depth = 8);
+bool write_BezierSurfacesOBJ(const std::string& path, const std::vector<BezierSurface>& bsurfaces, unsigned int level, const glm::mat4& modelMatrix = glm::mat4(1.0f));
+BezierMathBenchmark bench_BezierMath(const std::vector<BezierSurface>& bsurfaces, unsigned int level = 16);
+
+//Methods implementation
+// no floating point contraction: the scalar references and the vectorized kernels round the same way (see utils/simd.h)
+NPR_FP_CONTRACT_OFF_BEGIN
+// Same weights of the shader and of eval_BezierSurface
+BezierBasisTable gen_BezierBasisTable(const std::vector<float>& params)
+{
+	BezierBasisTable table;
+	table.params = params;
+	for (int k = 0; k != 4; k++)
+	{
+		table.b[k].resize(params.size());
+		table.db[k].resize(params.size());
+		table.ddb[k].resize(params.size());
+	}
+	for (std::size_t i = 0; i != params.size(); i++)
+	{
+		const float t = params[i];
+		const float b[4] = { (1 - t) * (1 - t) * (1 - t), 3 * t * (1 - t) * (1 - t), 3 * t * t * (1 - t), t * t * t };
+		const float db[4] = { -3 * (1 - t) * (1 - t), 3 * (1 - t) * (1 - t) - 6 * t * (1 - t), 6 * t * (1 - t) - 3 * t * t, 3 * t * t };
+		const float ddb[4] = { 6 * (1 - t), -6 * (1 - t) - (6 * (1 - t) - 6 * t), 6 * (1 - t) - 6 * t - 6 * t, 6 * t };
+		for (int k = 0; k != 4; k++)
+		{
+			table.b[k][i] = b[k];
+			table.db[k][i] = db[k];
+			table.ddb[k][i] = ddb[k];
+		}
+	}
+	return table;
+}
+
+// level + 1 parameters, uniform in [0, 1]
+BezierBasisTable gen_BezierBasisTable(unsigned int level)
+{
+	level = std::max(1u, level);
+	std::vector<float> params(level + 1);
+	for (unsigned int i = 0; i <= level; i++)
+		params[i] = (float)i / level;
+	return gen_BezierBasisTable(params);
+}
+
+namespace bezier_math_detail
+{
+	inline void resizeSamples(BezierSurfaceSamples& out, std::size_t count, unsigned int flags)
+	{
+		out.count = count;
+		auto resize = [count](std::vector<float> (&q)[3], bool used) { for (auto& c : q) c.resize(used ? count : 0); };
+		resize(out.position, flags & BEZIER_EVAL_POSITION);
+		resize(out.tangent, flags & BEZIER_EVAL_FIRST_DERIVATIVES);
+		resize(out.bitangent, flags & BEZIER_EVAL_FIRST_DERIVATIVES);
+		resize(out.uu, flags & BEZIER_EVAL_SECOND_DERIVATIVES);
+		resize(out.uv, flags & BEZIER_EVAL_SECOND_DERIVATIVES);
+		resize(out.vv, flags & BEZIER_EVAL_SECOND_DERIVATIVES);
+		resize(out.normal, flags & BEZIER_EVAL_NORMALS);
+	}
+
+	template <typename V>
+	inline void store3(std::vector<float> (&q)[3], std::size_t i, const V& x, const V& y, const V& z)
+	{
+		x.store(q[0].data() + i);
+		y.store(q[1].data() + i);
+		z.store(q[2].data() + i);
+	}
+
+	// Weighted sums of the 4 curves (x, y, z of each one), the curves are the same for all the lanes or one for each lane
+	template <typename V, typename C>
+	inline void combine(const V w[4], const C (&c)[4][3], V& x, V& y, V& z)
+	{
+		x = w[0] * c[0][0] + w[1] * c[1][0] + w[2] * c[2][0] + w[3] * c[3][0];
+		y = w[0] * c[0][1] + w[1] * c[1][1] + w[2] * c[2][1] + w[3] * c[3][1];
+		z = w[0] * c[0][2] + w[1] * c[1][2] + w[2] * c[2][2] + w[3] * c[3][2];
+	}
+
+	// Derivatives and normal of the lanes from the u weights and the v curves (c, dc, ddc) of the 4 columns
+	template <typename V, typename C>
+	inline void evalLanes(const V bu[4], const V dbu[4], const V ddbu[4], const C (&c)[4][3], const C (&dc)[4][3], const C (&ddc)[4][3],
+		unsigned int flags, std::size_t i, BezierSurfaceSamples& out)
+	{
+		V x, y, z;
+		if (flags & BEZIER_EVAL_POSITION)
+		{
+			combine(bu, c, x, y, z);
+			store3(out.position, i, x, y, z);
+		}
+		if (flags & (BEZIER_EVAL_FIRST_DERIVATIVES | BEZIER_EVAL_NORMALS))
+		{
+			V tx, ty, tz, bx, by, bz;
+			combine(dbu, c, tx, ty, tz);
+			combine(bu, dc, bx, by, bz);
+			if (flags & BEZIER_EVAL_FIRST_DERIVATIVES)
+			{
+				store3(out.tangent, i, tx, ty, tz);
+				store3(out.bitangent, i, bx, by, bz);
+			}
+			if (flags & BEZIER_EVAL_NORMALS)
+			{
+				// as glm::normalize(glm::cross(tangent, bitangent))
+				const V nx = ty * bz - by * tz, ny = tz * bx - bz * tx, nz = tx * by - bx * ty;
+				const V inverseLength = V(1.0f) / sqrt(nx * nx + ny * ny + nz * nz);
+				store3(out.normal, i, nx * inverseLength, ny * inverseLength, nz * inverseLength);
+			}
+		}
+		if (flags & BEZIER_EVAL_SECOND_DERIVATIVES)
+		{
+			combine(ddbu, c, x, y, z);
+			store3(out.uu, i, x, y, z);
+			combine(dbu, dc, x, y, z);
+			store3(out.uv, i, x, y, z);
+			combine(bu, ddc, x, y, z);
+			store3(out.vv, i, x, y, z);
+		}
+	}
+
+	// Samples [i, i + V::width) of eval_BezierSurfaceBatch: every lane has its own v curves
+	template <typename V>
+	inline void evalBatch(const BezierSurface& s, const float* u, const float* v, unsigned int flags, std::size_t i, BezierSurfaceSamples& out)
+	{
+		const V one(1.0f), three(3.0f), six(6.0f);
+		const V uu = V::load(u + i), vv = V::load(v + i);
+		const V mu = one - uu, mv = one - vv;
+		const V bu[4] = { mu * mu * mu, three * uu * mu * mu, three * uu * uu * mu, uu * uu * uu };
+		const V dbu[4] = { -three * mu * mu, three * mu * mu - six * uu * mu, six * uu * mu - three * uu * uu, three * uu * uu };
+		const V ddbu[4] = { six * mu, -six * mu - (six * mu - six * uu), six * mu - six * uu - six * uu, six * uu };
+		const V bv[4] = { mv * mv * mv, three * vv * mv * mv, three * vv * vv * mv, vv * vv * vv };
+		const V dbv[4] = { -three * mv * mv, three * mv * mv - six * vv * mv, six * vv * mv - three * vv * vv, three * vv * vv };
+		const V ddbv[4] = { six * mv, -six * mv - (six * mv - six * vv), six * mv - six * vv - six * vv, six * vv };
+		V c[4][3], dc[4][3], ddc[4][3];
+		for (int col = 0; col != 4; col++)
+			for (int k = 0; k != 3; k++)
+			{
+				const V p0(s[0][col][k]), p1(s[1][col][k]), p2(s[2][col][k]), p3(s[3][col][k]);
+				c[col][k] = bv[0] * p0 + bv[1] * p1 + bv[2] * p2 + bv[3] * p3;
+				dc[col][k] = dbv[0] * p0 + dbv[1] * p1 + dbv[2] * p2 + dbv[3] * p3;
+				ddc[col][k] = ddbv[0] * p0 + ddbv[1] * p1 + ddbv[2] * p2 + ddbv[3] * p3;
+			}
+		evalLanes(bu, dbu, ddbu, c, dc, ddc, flags, i, out);
+	}
+
+	// Samples [iu, iu + V::width) of the row of eval_BezierSurfaceGrid: the v curves are shared by the row
+	template <typename V>
+	inline void evalGridRow(const BezierBasisTable& uTable, std::size_t iu, const V (&c)[4][3], const V (&dc)[4][3], const V (&ddc)[4][3],
+		unsigned int flags, std::size_t i, BezierSurfaceSamples& out)
+	{
+		V bu[4], dbu[4], ddbu[4];
+		for (int k = 0; k != 4; k++)
+		{
+			bu[k] = V::load(uTable.b[k].data() + iu);
+			dbu[k] = V::load(uTable.db[k].data() + iu);
+			ddbu[k] = V::load(uTable.ddb[k].data() + iu);
+		}
+		evalLanes(bu, dbu, ddbu, c, dc, ddc, flags, i, out);
+	}
+
+	// Ray and axis aligned box of the control points (they contain the patch): entry distance, or infinity if missed
+	inline float rayBox(const BezierSurface& s, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance)
+	{
+		glm::vec3 lo = s[0][0], hi = lo;
+		for (const auto& row : s)
+			for (const auto& point : row)
+			{
+				lo = glm::min(lo, point);
+				hi = glm::max(hi, point);
+			}
+		const glm::vec3 t0 = (lo - origin) * inverseDirection, t1 = (hi - origin) * inverseDirection;
+		const glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+		const float entry = std::max({ tNear.x, tNear.y, tNear.z, 0.0f });
+		const float exit = std::min({ tFar.x, tFar.y, tFar.z, maxDistance });
+		return entry <= exit ? entry : std::numeric_limits<float>::infinity();
+	}
+}
+
+void eval_BezierSurfaceBatch(const BezierSurface& bsurface, const float* u, const float* v, std::size_t count, unsigned int flags, BezierSurfaceSamples& out)
+{
+	using namespace bezier_math_detail;
+	resizeSamples(out, count, flags);
+	std::size_t i = 0;
+	for (; i + simd_float::width <= count; i += simd_float::width)
+		evalBatch<simd_float>(bsurface, u, v, flags, i, out);
+	for (; i != count; i++)
+		evalBatch<scalar_float>(bsurface, u, v, flags, i, out);
+}
+
+// Sample (iu, iv) at iv * uTable.size() + iu
+void eval_BezierSurfaceGrid(const BezierSurface& bsurface, const BezierBasisTable& uTable, const BezierBasisTable& vTable, unsigned int flags, BezierSurfaceSamples& out)
+{
+	using namespace bezier_math_detail;
+	const std::size_t nu = uTable.size(), nv = vTable.size();
+	resizeSamples(out, nu * nv, flags);
+	for (std::size_t iv = 0; iv != nv; iv++)
+	{
+		// v curves of the 4 columns, broadcast to the lanes
+		simd_float c[4][3], dc[4][3], ddc[4][3];
+		scalar_float cs[4][3], dcs[4][3], ddcs[4][3];
+		for (int col = 0; col != 4; col++)
+			for (int k = 0; k != 3; k++)
+			{
+				float sum = 0.0f, dsum = 0.0f, ddsum = 0.0f;
+				for (int j = 0; j != 4; j++)
+				{
+					sum += vTable.b[j][iv] * bsurface[j][col][k];
+					dsum += vTable.db[j][iv] * bsurface[j][col][k];
+					ddsum += vTable.ddb[j][iv] * bsurface[j][col][k];
+				}
+				c[col][k] = sum;
+				dc[col][k] = dsum;
+				ddc[col][k] = ddsum;
+				cs[col][k] = sum;
+				dcs[col][k] = dsum;
+				ddcs[col][k] = ddsum;
+			}
+		std::size_t iu = 0;
+		for (; iu + simd_float::width <= nu; iu += simd_float::width)
+			evalGridRow<simd_float>(uTable, iu, c, dc, ddc, flags, iv * nu + iu, out);
+		for (; iu != nu; iu++)
+			evalGridRow<scalar_float>(uTable, iu, cs, dcs, ddcs, flags, iv * nu + iu, out);
+	}
+}
+
+// de Casteljau: the control points of the curve on [0, t] and on [t, 1]
+void subdivide_BezierCurve(const glm::vec3 p[4], float t, glm::vec3 left[4], glm::vec3 right[4]) noexcept
+{
+	const glm::vec3 p01 = glm::mix(p[0], p[1], t), p12 = glm::mix(p[1], p[2], t), p23 = glm::mix(p[2], p[3], t);
+	const glm::vec3 p012 = glm::mix(p01, p12, t), p123 = glm::mix(p12, p23, t);
+	const glm::vec3 middle = glm::mix(p012, p123, t);
+	left[0] = p[0]; left[1] = p01; left[2] = p012; left[3] = middle;
+	right[0] = middle; right[1] = p123; right[2] = p23; right[3] = p[3];
+}
+
+// Sub-patches on [0, u] x [0, v], [u, 1] x [0, v], [0, u] x [v, 1] and [u, 1] x [v, 1]:
+// the rows (along u) are split first, then the columns of both halves
+std::array<BezierSurface, 4> subdivide_BezierSurface(const BezierSurface& bsurface, float u, float v) noexcept
+{
+	BezierSurface halves[2];
+	for (int j = 0; j != 4; j++)
+		subdivide_BezierCurve(bsurface[j].data(), u, halves[0][j].data(), halves[1][j].data());
+	std::array<BezierSurface, 4> parts;
+	for (int h = 0; h != 2; h++)
+		for (int i = 0; i != 4; i++)
+		{
+			const glm::vec3 column[4] = { halves[h][0][i], halves[h][1][i], halves[h][2][i], halves[h][3][i] };
+			glm::vec3 low[4], high[4];
+			subdivide_BezierCurve(column, v, low, high);
+			for (int j = 0; j != 4; j++)
+			{
+				parts[h][j][i] = low[j];
+				parts[2 + h][j][i] = high[j];
+			}
+		}
+	return parts;
+}
+
+// The patch is subdivided (nearest boxes first) down to 'depth' levels, the sub-patches are intersected as the two triangles
+// of their corners and the hit is refined with Newton iterations on S(u, v) = origin + t direction
+BezierRayHit intersect_BezierSurface(const BezierSurface& bsurface, const glm::vec3& origin, const glm::vec3& direction, unsigned int depth)
+{
+	using bezier_math_detail::rayBox;
+	struct Node { BezierSurface patch; float u0, v0, size; unsigned int depth; };
+	const glm::vec3 inverseDirection = 1.0f / direction;
+	BezierRayHit best;
+	std::vector<Node> stack;
+	if (rayBox(bsurface, origin, inverseDirection, best.distance) < best.distance)
+		stack.push_back({ bsurface, 0.0f, 0.0f, 1.0f, 0 });
+	while (!stack.empty())
+	{
+		Node node = stack.back();
+		stack.pop_back();
+		if (rayBox(node.patch, origin, inverseDirection, best.distance) >= best.distance)
+			continue;
+		if (node.depth < depth)
+		{
+			const auto parts = subdivide_BezierSurface(node.patch);
+			const float half = 0.5f * node.size;
+			float entries[4];
+			int order[4] = { 0, 1, 2, 3 };
+			for (int k = 0; k != 4; k++)
+				entries[k] = rayBox(parts[k], origin, inverseDirection, best.distance);
+			// the nearest box is pushed last, so it is visited first
+			std::sort(order, order + 4, [&](int a, int b) { return entries[a] > entries[b]; });
+			for (int k : order)
+				if (entries[k] < best.distance)
+					stack.push_back({ parts[k], node.u0 + (k & 1) * half, node.v0 + (k >> 1) * half, half, node.depth + 1 });
+			continue;
+		}
+		// corners (u, v) = (0, 0), (1, 0), (1, 1), (0, 1) of the sub-patch
+		const glm::vec3 corners[4] = { node.patch[0][0], node.patch[0][3], node.patch[3][3], node.patch[3][0] };
+		const glm::vec2 cornerUV[4] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+		for (int tri = 0; tri != 2; tri++)
+		{
+			const int a = 0, b = 1 + tri, c = 2 + tri;
+			// Moller-Trumbore
+			const glm::vec3 e1 = corners[b] - corners[a], e2 = corners[c] - corners[a];
+			const glm::vec3 pv = glm::cross(direction, e2);
+			const float det = glm::dot(e1, pv);
+			if (std::abs(det) < 1e-20f)
+				continue;
+			const glm::vec3 tv = origin - corners[a];
+			const float s1 = glm::dot(tv, pv) / det;
+			const glm::vec3 qv = glm::cross(tv, e1);
+			const float s2 = glm::dot(direction, qv) / det;
+			const float t = glm::dot(e2, qv) / det;
+			if (s1 < -1e-4f || s2 < -1e-4f || s1 + s2 > 1.0f + 1e-4f || t < 0.0f || t >= best.distance)
+				continue;
+			const glm::vec2 local = cornerUV[a] + s1 * (cornerUV[b] - cornerUV[a]) + s2 * (cornerUV[c] - cornerUV[a]);
+			best.hit = true;
+			best.u = node.u0 + node.size * local.x;
+			best.v = node.v0 + node.size * local.y;
+			best.distance = t;
+		}
+	}
+	if (!best.hit)
+		return best;
+
+	// Newton iterations on F(u, v, t) = S(u, v) - origin - t direction, J = [Su Sv -direction]
+	float u = best.u, v = best.v, t = best.distance;
+	for (int iteration = 0; iteration != 4; iteration++)
+	{
+		const auto sample = eval_BezierSurface(bsurface, u, v);
+		const glm::mat3 J(sample.tangent, sample.bitangent, -direction);
+		if (std::abs(glm::determinant(J)) < 1e-20f)
+			break;
+		const glm::vec3 step = glm::inverse(J) * (sample.position - origin - t * direction);
+		u -= step.x;
+		v -= step.y;
+		t -= step.z;
+	}
+	// the refinement is kept only if it converged inside the patch
+	if (u >= -1e-4f && u <= 1.0f + 1e-4f && v >= -1e-4f && v <= 1.0f + 1e-4f && t >= 0.0f && std::isfinite(t))
+	{
+		best.u = glm::clamp(u, 0.0f, 1.0f);
+		best.v = glm::clamp(v, 0.0f, 1.0f);
+		best.distance = t;
+	}
+	best.position = eval_BezierSurface(bsurface, best.u, best.v).position;
+	return best;
+}
+
+// Patches whose control point box is farther than the closest hit found so far are skipped
+BezierRayHit pick_BezierSurfaces(const std::vector<BezierSurface>& bsurfaces, const glm::vec3& origin, const glm::vec3& direction, unsigned int depth)
+{
+	const glm::vec3 inverseDirection = 1.0f / direction;
+	BezierRayHit best;
+	for (std::size_t i = 0; i != bsurfaces.size(); i++)
+	{
+		if (bezier_math_detail::rayBox(bsurfaces[i], origin, inverseDirection, best.distance) >= best.distance)
+			continue;
+		BezierRayHit hit = intersect_BezierSurface(bsurfaces[i], origin, direction, depth);
+		if (hit.hit && hit.distance < best.distance)
+		{
+			best = hit;
+			best.patch = i;
+		}
+	}
+	return best;
+}
+
+// Wavefront OBJ of the patches tessellated on a (level + 1) x (level + 1) grid, with normals (every patch has its own vertices)
+bool write_BezierSurfacesOBJ(const std::string& path, const std::vector<BezierSurface>& bsurfaces, unsigned int level, const glm::mat4& modelMatrix)
+{
+	std::ofstream out(path, std::ios::trunc);
+	if (!out)
+		return false;
+	const BezierBasisTable table = gen_BezierBasisTable(level);
+	const std::size_t side = table.size();
+	const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelMatrix)));
+	BezierSurfaceSamples samples;
+	out << "# " << bsurfaces.size() << " Bezier patches, " << side << " x " << side << " vertices each\n";
+	std::size_t first = 1;
+	for (const auto& bsurface : bsurfaces)
+	{
+		eval_BezierSurfaceGrid(bsurface, table, table, BEZIER_EVAL_POSITION | BEZIER_EVAL_NORMALS, samples);
+		for (std::size_t i = 0; i != samples.count; i++)
+		{
+			const glm::vec3 p = glm::vec3(modelMatrix * glm::vec4(BezierSurfaceSamples::get(samples.position, i), 1.0f));
+			out << "v " << p.x << " " << p.y << " " << p.z << "\n";
+		}
+		for (std::size_t i = 0; i != samples.count; i++)
+		{
+			glm::vec3 n = normalMatrix * BezierSurfaceSamples::get(samples.normal, i);
+			// degenerate points (collapsed edges) have no normal
+			n = glm::length(n) > 0.0f ? glm::normalize(n) : glm::vec3(0.0f, 1.0f, 0.0f);
+			out << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+		}
+		for (std::size_t iv = 0; iv + 1 != side; iv++)
+			for (std::size_t iu = 0; iu + 1 != side; iu++)
+			{
+				const std::size_t a = first + iv * side + iu, b = a + 1, c = a + side + 1, d = a + side;
+				out << "f " << a << "//" << a << " " << b << "//" << b << " " << c << "//" << c << "\n";
+				out << "f " << a << "//" << a << " " << c << "//" << c << " " << d << "//" << d << "\n";
+			}
+		first += samples.count;
+	}
+	return (bool)out;
+}
+
+// Same (level + 1)^2 samples of every patch with eval_BezierSurface, with the batched evaluator and with the grid evaluator
+// (positions, derivatives and normals), then a subdivision of every patch in 4
+BezierMathBenchmark bench_BezierMath(const std::vector<BezierSurface>& bsurfaces, unsigned int level)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto seconds = [](clock::time_point start) { return std::max(std::chrono::duration<double>(clock::now() - start).count(), 1e-9); };
+	const BezierBasisTable table = gen_BezierBasisTable(level);
+	const std::size_t side = table.size();
+	std::vector<float> us(side * side), vs(side * side);
+	for (std::size_t iv = 0; iv != side; iv++)
+		for (std::size_t iu = 0; iu != side; iu++)
+		{
+			us[iv * side + iu] = table.params[iu];
+			vs[iv * side + iu] = table.params[iv];
+		}
+
+	BezierMathBenchmark result;
+	result.samples = bsurfaces.size() * side * side;
+	std::vector<glm::vec3> reference;
+	reference.reserve(result.samples);
+	float checksum = 0.0f;
+	auto start = clock::now();
+	for (const auto& bsurface : bsurfaces)
+		for (std::size_t i = 0; i != side * side; i++)
+		{
+			const auto sample = eval_BezierSurface(bsurface, us[i], vs[i]);
+			reference.push_back(sample.position);
+			checksum += sample.normal.x + sample.uu.x + sample.uv.x + sample.vv.x;
+		}
+	result.scalarSamplesPerSecond = result.samples / seconds(start);
+
+	double modelSize = 1e-30, error = 0.0;
+	BezierSurfaceSamples samples;
+	auto compare = [&](std::size_t patch) {
+		for (std::size_t i = 0; i != samples.count; i++)
+		{
+			const glm::vec3& r = reference[patch * side * side + i];
+			modelSize = std::max(modelSize, (double)glm::length(r));
+			error = std::max(error, (double)glm::length(BezierSurfaceSamples::get(samples.position, i) - r));
+		}
+	};
+	start = clock::now();
+	for (const auto& bsurface : bsurfaces)
+	{
+		eval_BezierSurfaceBatch(bsurface, us.data(), vs.data(), us.size(), BEZIER_EVAL_ALL, samples);
+		checksum += samples.normal[0][0];
+	}
+	result.batchSamplesPerSecond = result.samples / seconds(start);
+	// the positions are compared outside of the timed loops
+	for (std::size_t patch = 0; patch != bsurfaces.size(); patch++)
+	{
+		eval_BezierSurfaceBatch(bsurfaces[patch], us.data(), vs.data(), us.size(), BEZIER_EVAL_POSITION, samples);
+		compare(patch);
+	}
+	start = clock::now();
+	for (const auto& bsurface : bsurfaces)
+	{
+		eval_BezierSurfaceGrid(bsurface, table, table, BEZIER_EVAL_ALL, samples);
+		checksum += samples.normal[0][0];
+	}
+	result.gridSamplesPerSecond = result.samples / seconds(start);
+	for (std::size_t patch = 0; patch != bsurfaces.size(); patch++)
+	{
+		eval_BezierSurfaceGrid(bsurfaces[patch], table, table, BEZIER_EVAL_POSITION, samples);
+		compare(patch);
+	}
+	result.maxPositionError = error / modelSize;
+
+	start = clock::now();
+	for (const auto& bsurface : bsurfaces)
+		checksum += subdivide_BezierSurface(bsurface)[3][0][0].x;
+	result.subdivisionsPerSecond = bsurfaces.size() / seconds(start);
+	// keeps the evaluations of the timed loops alive
+	if (checksum == 12345.0f)
+		result.samples++;
+	return result;
+}
+
+NPR_FP_CONTRACT_OFF_END
@@ -18,8 +18,8 @@ typedef std::array<int, 2> ControlVertexIndex;
 
 //Methods definition
 glm::vec3 eval_BezierCurve(const glm::vec3 &p0, const glm::vec3& p1, const glm::vec3& p2, const glm::vec3& p3, float t) noexcept;
-BezierSurface gen_BezierSurfaceMask(float outer_h, float inner_h) noexcept;
-glm::vec3 calc_rand_uv(unsigned int i, unsigned int j, float h);
+BezierSurface gen_BezierSurfaceMask(float outer_h, float inner_h, std::uint64_t key) noexcept;
+glm::vec3 calc_rand_uv(unsigned int i, unsigned int j, float h, std::uint64_t key) noexcept;
 ControlVertexIndex get_BSurfaceCVI(int e_i, int edge_offset, int i) noexcept;
 
 //Methods implementation
@@ -32,32 +32,33 @@ glm::vec3 eval_BezierCurve(const glm::vec3& p0, const glm::vec3& p1, const glm::
 	return p0 * b0 + p1 * b1 + p2 * b2 + p3 * b3;
 }
 
-glm::vec3 calc_rand_uv(unsigned int i, unsigned int j, float h)
+// key identifies the patch (see calc_rand_key), the control point (i, j) selects the two counters
+glm::vec3 calc_rand_uv(unsigned int i, unsigned int j, float h, std::uint64_t key) noexcept
 {
 	constexpr float div = 0.25;
 	float u_min = (float)j * div;
 	float u_max = ((float)j + 1.0f) * div;
 	float v_min = (float)i * div;
 	float v_max = ((float)i + 1.0f) * div;
-	static RNG_float rng;
-	return { rng(u_min, u_max), rng(v_min, v_max), h };
+	const std::uint32_t counter = 2 * (4 * i + j);
+	return { rand_float(key, counter, u_min, u_max), rand_float(key, counter + 1, v_min, v_max), h };
 }
 
-BezierSurface gen_BezierSurfaceMask(float outer_h, float inner_h) noexcept
+BezierSurface gen_BezierSurfaceMask(float outer_h, float inner_h, std::uint64_t key) noexcept
 {
 	BezierSurface mask;
 	for (unsigned int i = 0; i != 4; i++)
 		for (unsigned int j = 0; j != 4; j++)
 		{
 			if (i == 0 || i == 3)
-				mask[i][j] = calc_rand_uv(i, j, outer_h);
+				mask[i][j] = calc_rand_uv(i, j, outer_h, key);
 
 			if (i == 1 || i == 2)
 			{
 				if (j == 0 || j == 3)
-					mask[i][j] = calc_rand_uv(i, j, outer_h);
+					mask[i][j] = calc_rand_uv(i, j, outer_h, key);
 				else
-					mask[i][j] = calc_rand_uv(i, j, inner_h);
+					mask[i][j] = calc_rand_uv(i, j, inner_h, key);
 			}
 		}
 	return mask;
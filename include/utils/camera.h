@@ -112,6 +112,18 @@ public:
         this->updateCameraVectors();
     }
 
+    //////////////////////////////////////////
+    // it places the camera in position, looking at target (Yaw and Pitch are derived from the view direction)
+    void LookAt(glm::vec3 position, glm::vec3 target)
+    {
+        this->Position = position;
+        glm::vec3 direction = glm::normalize(target - position);
+        this->Pitch = glm::degrees(asin(glm::clamp(direction.y, -1.0f, 1.0f)));
+        this->Yaw = glm::degrees(atan2(direction.z, direction.x));
+        // the camera reference system is updated using the new camera rotations
+        this->updateCameraVectors();
+    }
+
 private:
     //////////////////////////////////////////
     // it updates the camera reference system
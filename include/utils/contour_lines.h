@@ -0,0 +1,507 @@
+/*
+Object space contours and suggestive contours
+- the patches are tessellated once (CPU tessellator, view independent terms only), the view dependent terms are
+  computed in object space from the camera position: n.(c - p) for the contours and the radial curvature kr of the
+  view vector projected in the tangent plane for the suggestive contours
+- the zero sets are extracted on the triangles of the uv grid of every patch (two triangles for each cell, no ambiguous
+  cases); suggestive contours keep only the parts where the derivative of kr along w (DwKr) is positive on front faces
+- the segments are chained into polylines through the grid edges they cross: the edges of stitched patch borders have
+  the same end points in both patches, so the lines continue across the borders
+- incremental: a patch is extracted again only when the camera moved, in object space, by more than a tolerance relative
+  to its distance from the patch
+*/
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/bezier_surface.h>
+#include <utils/cpu_tessellator.h>
+#include <utils/rand_float.hpp>
+#include <utils/thread_pool.h>
+
+// A chained line in object space: closed lines repeat their first point at the end
+struct ContourPolyline {
+	NPRLineClass type = NPR_CONTOUR_LINE;
+	bool closed = false;
+	std::vector<glm::vec3> points;
+};
+
+struct ContourExtractionSettings {
+	bool contours = true;
+	bool suggestiveContours = true;
+	// a patch is extracted again when the camera moved by more than viewTolerance times its distance from the patch
+	float viewTolerance = 0.01f;
+	// suggestive contours where DwKr is larger than this (DeCarlo et al. use a small positive threshold to remove noise)
+	float minRadialDerivative = 0.0f;
+};
+
+// Work of the last update
+struct ContourExtractionStats {
+	std::size_t patches = 0;
+	std::size_t extractedPatches = 0;
+	std::size_t segments = 0;
+	std::size_t polylines = 0;
+	std::size_t points = 0;
+	double extractMs = 0.0;
+	double chainMs = 0.0;
+};
+
+// Segment of a zero set inside a triangle of the grid: every end point lies on a grid edge, identified by a key
+// of the positions of its end points (0 for the ends clipped inside the triangle, that are not shared)
+struct LineSegment {
+	glm::vec3 points[2];
+	std::uint64_t keys[2];
+};
+
+//Methods definition
+std::vector<ContourPolyline> chain_LineSegments(const std::vector<LineSegment>& segments, NPRLineClass type, float weldDistance = 0.0f);
+bool write_ContourPolylinesOBJ(const std::string& path, const std::vector<ContourPolyline>& polylines, const glm::mat4& modelMatrix = glm::mat4(1.0f));
+
+/////////////////// CONTOUR EXTRACTOR class ///////////////////////
+class ContourExtractor
+{
+public:
+	ContourExtractionSettings settings;
+
+	// Tessellates the patches (level + 1 samples on each side), every patch will be extracted at the next update
+	void setPatches(const std::vector<BezierSurface>& bsurfaces, unsigned int level, ThreadPool* pool = nullptr)
+	{
+		tessellate_BezierPatches(bsurfaces, level, TessellationView(), tessellation, pool);
+		patchLines.assign(bsurfaces.size(), PatchLines());
+		bounds.resize(bsurfaces.size());
+		for (std::size_t i = 0; i != bsurfaces.size(); i++)
+		{
+			// sphere around the bounding box of the control points (it contains the patch)
+			glm::vec3 lo = bsurfaces[i][0][0], hi = lo;
+			for (const auto& row : bsurfaces[i])
+				for (const auto& point : row)
+				{
+					lo = glm::min(lo, point);
+					hi = glm::max(hi, point);
+				}
+			bounds[i] = glm::vec4(0.5f * (lo + hi), 0.5f * glm::length(hi - lo));
+		}
+		// a fraction of the average length of the grid edges
+		double edgeLength = 0.0;
+		for (std::size_t i = 0; i != bsurfaces.size(); i++)
+			edgeLength += glm::length(bsurfaces[i][0][3] - bsurfaces[i][0][0]) + glm::length(bsurfaces[i][3][0] - bsurfaces[i][0][0]);
+		weldDistance = bsurfaces.empty() ? 0.0f : (float)(0.25 * edgeLength / (2.0 * bsurfaces.size() * tessellation.level));
+		polylines.clear();
+	}
+
+	// Forces the extraction of every patch (e.g. after a change of the settings)
+	void invalidate() { for (auto& lines : patchLines) lines.valid = false; }
+
+	// Extracts the patches whose view changed beyond the tolerance and chains all the segments again.
+	// Returns true if the polylines changed
+	bool update(const glm::mat4& modelMatrix, const glm::vec3& cameraWorldPosition, ThreadPool* pool = nullptr)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		const glm::vec3 camera = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(cameraWorldPosition, 1.0f));
+		std::vector<std::size_t> dirty;
+		for (std::size_t i = 0; i != patchLines.size(); i++)
+		{
+			const PatchLines& lines = patchLines[i];
+			const float distance = std::max(glm::length(camera - glm::vec3(bounds[i])) - bounds[i].w, 1e-6f);
+			if (!lines.valid || glm::length(camera - lines.camera) > settings.viewTolerance * distance)
+				dirty.push_back(i);
+		}
+		auto extract = [&](std::size_t begin, std::size_t end) {
+			std::vector<float> scratch;
+			for (std::size_t d = begin; d != end; d++)
+				extractPatch(dirty[d], camera, scratch);
+		};
+		if (pool)
+			pool->parallel_for(dirty.size(), 16, extract);
+		else
+			extract(0, dirty.size());
+		auto middle = std::chrono::high_resolution_clock::now();
+
+		stats.patches = patchLines.size();
+		stats.extractedPatches = dirty.size();
+		if (!dirty.empty())
+		{
+			std::vector<LineSegment> contours, suggestiveContours;
+			for (const auto& lines : patchLines)
+			{
+				contours.insert(contours.end(), lines.contours.begin(), lines.contours.end());
+				suggestiveContours.insert(suggestiveContours.end(), lines.suggestiveContours.begin(), lines.suggestiveContours.end());
+			}
+			polylines = chain_LineSegments(contours, NPR_CONTOUR_LINE, weldDistance);
+			auto suggestive = chain_LineSegments(suggestiveContours, NPR_SUGGESTIVE_CONTOUR_LINE, weldDistance);
+			polylines.insert(polylines.end(), std::make_move_iterator(suggestive.begin()), std::make_move_iterator(suggestive.end()));
+			stats.segments = contours.size() + suggestiveContours.size();
+			stats.polylines = polylines.size();
+			stats.points = 0;
+			for (const auto& polyline : polylines)
+				stats.points += polyline.points.size();
+		}
+		auto end = std::chrono::high_resolution_clock::now();
+		stats.extractMs = std::chrono::duration<double, std::milli>(middle - start).count();
+		stats.chainMs = std::chrono::duration<double, std::milli>(end - middle).count();
+		return !dirty.empty();
+	}
+
+	const std::vector<ContourPolyline>& lines() const noexcept { return polylines; }
+	const ContourExtractionStats& lastStats() const noexcept { return stats; }
+
+private:
+
+	struct PatchLines {
+		bool valid = false;
+		// camera position (object space) of the last extraction
+		glm::vec3 camera = glm::vec3(0.0f);
+		std::vector<LineSegment> contours;
+		std::vector<LineSegment> suggestiveContours;
+	};
+
+	// view dependent values of every sample of a patch (scratch buffer of the extracting thread)
+	enum { CONTOUR_VALUE, NORMAL_DOT_VIEW, RADIAL_CURVATURE, W_U, W_V, RADIAL_DERIVATIVE, VIEW_VALUES };
+
+	static std::uint64_t edgeKey(const glm::vec3& a, const glm::vec3& b)
+	{
+		auto pointKey = [](const glm::vec3& p) {
+			std::uint32_t bits[3];
+			std::memcpy(bits, &p, sizeof(bits));
+			return mix_SplitMix64(mix_SplitMix64(mix_SplitMix64(bits[0]) ^ bits[1]) ^ bits[2]);
+		};
+		const std::uint64_t ka = pointKey(a), kb = pointKey(b);
+		// same key for both orientations of the edge, never 0
+		return mix_SplitMix64(std::min(ka, kb) ^ mix_SplitMix64(std::max(ka, kb))) | 1u;
+	}
+
+	void extractPatch(std::size_t patch, const glm::vec3& camera, std::vector<float>& scratch)
+	{
+		const auto& t = tessellation;
+		const unsigned int level = t.level, side = level + 1;
+		const std::size_t count = t.samplesPerPatch();
+		scratch.resize(count * VIEW_VALUES);
+		float* values[VIEW_VALUES];
+		for (int k = 0; k != VIEW_VALUES; k++)
+			values[k] = scratch.data() + k * count;
+		std::vector<glm::vec3> positions(count);
+
+		auto vec3Field = [&](TessellationField x, std::size_t s) { return glm::vec3(t.fields[x][s], t.fields[x + 1][s], t.fields[x + 2][s]); };
+		for (unsigned int iv = 0; iv <= level; iv++)
+			for (unsigned int iu = 0; iu <= level; iu++)
+			{
+				const std::size_t s = t.index(patch, iu, iv), k = (std::size_t)iv * side + iu;
+				positions[k] = vec3Field(TESS_POSITION_X, s);
+				const glm::vec3 n = vec3Field(TESS_NORMAL_X, s), Su = vec3Field(TESS_TANGENT_X, s), Sv = vec3Field(TESS_BITANGENT_X, s);
+				const float E = t.fields[TESS_E][s], F = t.fields[TESS_F][s], G = t.fields[TESS_G][s];
+				const float L = t.fields[TESS_L][s], M = t.fields[TESS_M][s], N = t.fields[TESS_N][s];
+				const glm::vec3 toCamera = camera - positions[k];
+				const glm::vec3 view = glm::normalize(toCamera);
+				// w, the view vector projected in the tangent plane, in the (Su, Sv) basis: I [a b]^T = [w.Su w.Sv]^T
+				const glm::vec3 w = view - glm::dot(view, n) * n;
+				const float wu = glm::dot(w, Su), wv = glm::dot(w, Sv), det = E * G - F * F;
+				const float a = (G * wu - F * wv) / det, b = (E * wv - F * wu) / det;
+				values[CONTOUR_VALUE][k] = glm::dot(n, toCamera);
+				values[NORMAL_DOT_VIEW][k] = glm::dot(n, view);
+				// kr = II(w, w) / I(w, w)
+				values[RADIAL_CURVATURE][k] = (L * a * a + 2.0f * M * a * b + N * b * b) / (E * a * a + 2.0f * F * a * b + G * b * b);
+				values[W_U][k] = a;
+				values[W_V][k] = b;
+			}
+		// DwKr = a dkr/du + b dkr/dv (central differences, one sided on the borders)
+		for (unsigned int iv = 0; iv <= level; iv++)
+			for (unsigned int iu = 0; iu <= level; iu++)
+			{
+				const unsigned int u0 = iu > 0 ? iu - 1 : iu, u1 = iu < level ? iu + 1 : iu;
+				const unsigned int v0 = iv > 0 ? iv - 1 : iv, v1 = iv < level ? iv + 1 : iv;
+				const float* kr = values[RADIAL_CURVATURE];
+				const float dkdu = (kr[iv * side + u1] - kr[iv * side + u0]) * level / (u1 - u0);
+				const float dkdv = (kr[v1 * side + iu] - kr[v0 * side + iu]) * level / (v1 - v0);
+				const std::size_t k = (std::size_t)iv * side + iu;
+				values[RADIAL_DERIVATIVE][k] = values[W_U][k] * dkdu + values[W_V][k] * dkdv;
+			}
+
+		PatchLines& lines = patchLines[patch];
+		lines.contours.clear();
+		lines.suggestiveContours.clear();
+		auto triangle = [&](std::size_t i0, std::size_t i1, std::size_t i2) {
+			const std::size_t ids[3] = { i0, i1, i2 };
+			if (settings.contours)
+				zeroSet(ids, positions, values, CONTOUR_VALUE, false, lines.contours);
+			if (settings.suggestiveContours)
+				zeroSet(ids, positions, values, RADIAL_CURVATURE, true, lines.suggestiveContours);
+		};
+		for (unsigned int iv = 0; iv != level; iv++)
+			for (unsigned int iu = 0; iu != level; iu++)
+			{
+				const std::size_t a = (std::size_t)iv * side + iu, b = a + 1, c = a + side + 1, d = a + side;
+				triangle(a, b, c);
+				triangle(a, c, d);
+			}
+		lines.camera = camera;
+		lines.valid = true;
+	}
+
+	// Segment of the zero set of values[field] in a triangle (if its sign changes on two edges). Suggestive contours are
+	// kept on front faces only, and clipped to the part where DwKr > minRadialDerivative (linear along the segment)
+	void zeroSet(const std::size_t ids[3], const std::vector<glm::vec3>& positions, float* const values[VIEW_VALUES], int field,
+		bool suggestive, std::vector<LineSegment>& out) const
+	{
+		const float* f = values[field];
+		for (int k = 0; k != 3; k++)
+			if (std::isnan(f[ids[k]]))
+				return;
+		LineSegment segment;
+		float derivative[2], normalDotView[2];
+		int found = 0;
+		for (int e = 0; e != 3; e++)
+		{
+			const std::size_t i0 = ids[e], i1 = ids[(e + 1) % 3];
+			if ((f[i0] >= 0.0f) == (f[i1] >= 0.0f))
+				continue;
+			const float t = f[i0] / (f[i0] - f[i1]);
+			segment.points[found] = positions[i0] + t * (positions[i1] - positions[i0]);
+			segment.keys[found] = edgeKey(positions[i0], positions[i1]);
+			derivative[found] = values[RADIAL_DERIVATIVE][i0] + t * (values[RADIAL_DERIVATIVE][i1] - values[RADIAL_DERIVATIVE][i0]);
+			normalDotView[found] = values[NORMAL_DOT_VIEW][i0] + t * (values[NORMAL_DOT_VIEW][i1] - values[NORMAL_DOT_VIEW][i0]);
+			found++;
+		}
+		if (found != 2)
+			return;
+		if (suggestive)
+		{
+			if (!(normalDotView[0] > 0.0f && normalDotView[1] > 0.0f))
+				return;
+			const float d0 = derivative[0] - settings.minRadialDerivative, d1 = derivative[1] - settings.minRadialDerivative;
+			if (!(d0 > 0.0f) && !(d1 > 0.0f))
+				return;
+			if (!(d0 > 0.0f) || !(d1 > 0.0f))
+			{
+				// the end with DwKr below the threshold moves to the crossing, it is no longer on a grid edge
+				const int inside = d0 > 0.0f ? 1 : 0;
+				const float t = d0 / (d0 - d1);
+				segment.points[inside] = segment.points[0] + t * (segment.points[1] - segment.points[0]);
+				segment.keys[inside] = 0;
+			}
+		}
+		out.push_back(segment);
+	}
+
+	TessellatedPatches tessellation;
+	// bounding sphere (center, radius) of every patch
+	std::vector<glm::vec4> bounds;
+	std::vector<PatchLines> patchLines;
+	// distance within which the open ends of the segments are welded
+	float weldDistance = 0.0f;
+	std::vector<ContourPolyline> polylines;
+	ContourExtractionStats stats;
+};
+
+/////////////////// CONTOUR LINE MESH class ///////////////////////
+// GPU copy of the polylines, drawn as line strips (one multi draw call for each type of line)
+class ContourLineMesh
+{
+public:
+	ContourLineMesh()
+	{
+		glGenVertexArrays(1, &this->VAO);
+		glGenBuffers(1, &this->VBO);
+		glBindVertexArray(this->VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (GLvoid*)0);
+		glBindVertexArray(0);
+	}
+
+	ContourLineMesh(const ContourLineMesh&) = delete;
+	ContourLineMesh& operator=(const ContourLineMesh&) = delete;
+
+	void upload(const std::vector<ContourPolyline>& polylines)
+	{
+		std::vector<glm::vec3> points;
+		for (auto& range : ranges)
+		{
+			range.first.clear();
+			range.count.clear();
+		}
+		for (NPRLineClass type : { NPR_CONTOUR_LINE, NPR_SUGGESTIVE_CONTOUR_LINE })
+			for (const auto& polyline : polylines)
+				if (polyline.type == type)
+				{
+					ranges[type - NPR_CONTOUR_LINE].first.push_back((GLint)points.size());
+					ranges[type - NPR_CONTOUR_LINE].count.push_back((GLsizei)polyline.points.size());
+					points.insert(points.end(), polyline.points.begin(), polyline.points.end());
+				}
+		glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+		glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(glm::vec3), points.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void Draw(NPRLineClass type) const
+	{
+		const auto& range = ranges[type - NPR_CONTOUR_LINE];
+		if (range.first.empty())
+			return;
+		glBindVertexArray(this->VAO);
+		glMultiDrawArrays(GL_LINE_STRIP, range.first.data(), range.count.data(), (GLsizei)range.first.size());
+		glBindVertexArray(0);
+	}
+
+	// We delete the buffers when application closes
+	void Delete()
+	{
+		glDeleteVertexArrays(1, &this->VAO);
+		glDeleteBuffers(1, &this->VBO);
+	}
+
+private:
+	struct Range { std::vector<GLint> first; std::vector<GLsizei> count; };
+	// contours, suggestive contours
+	Range ranges[2];
+	GLuint VAO = 0, VBO = 0;
+};
+
+//Methods implementation
+// Segments sharing an edge key are linked end to end (edges shared by more than two segments are left open).
+// The ends still open on a grid edge are then welded to the closest open end within weldDistance: borders of patches with
+// opposite parametrizations (or collapsed into a pole) do not have bit identical samples.
+// Every chain is finally walked from one of its open ends (or from any segment for closed lines)
+std::vector<ContourPolyline> chain_LineSegments(const std::vector<LineSegment>& segments, NPRLineClass type, float weldDistance)
+{
+	// end e of segment s is 2 * s + e, link holds the end of the next segment (or -1)
+	std::vector<std::int64_t> link(2 * segments.size(), -1);
+	std::unordered_map<std::uint64_t, std::int64_t> openEnds;
+	openEnds.reserve(segments.size());
+	for (std::size_t s = 0; s != segments.size(); s++)
+		for (int e = 0; e != 2; e++)
+		{
+			const std::uint64_t key = segments[s].keys[e];
+			if (key == 0)
+				continue;
+			const std::int64_t end = (std::int64_t)(2 * s + e);
+			auto found = openEnds.find(key);
+			if (found == openEnds.end())
+				openEnds.emplace(key, end);
+			else if (found->second >= 0)
+			{
+				link[end] = found->second;
+				link[found->second] = end;
+				found->second = -1;
+			}
+		}
+
+	if (weldDistance > 0.0f)
+	{
+		auto cellOf = [weldDistance](const glm::vec3& p) { return glm::ivec3(glm::floor(p / weldDistance)); };
+		auto cellKey = [](const glm::ivec3& c) {
+			return mix_SplitMix64(mix_SplitMix64(mix_SplitMix64((std::uint32_t)c.x) ^ (std::uint32_t)c.y) ^ (std::uint32_t)c.z);
+		};
+		std::unordered_multimap<std::uint64_t, std::int64_t> cells;
+		std::vector<std::int64_t> open;
+		for (std::size_t end = 0; end != link.size(); end++)
+			if (link[end] < 0 && segments[end / 2].keys[end & 1] != 0)
+			{
+				open.push_back((std::int64_t)end);
+				cells.emplace(cellKey(cellOf(segments[end / 2].points[end & 1])), (std::int64_t)end);
+			}
+		for (std::int64_t end : open)
+		{
+			if (link[end] >= 0)
+				continue;
+			const glm::vec3& p = segments[end / 2].points[end & 1];
+			const glm::ivec3 cell = cellOf(p);
+			std::int64_t closest = -1;
+			float closestDistance = weldDistance;
+			for (int dz = -1; dz <= 1; dz++)
+				for (int dy = -1; dy <= 1; dy++)
+					for (int dx = -1; dx <= 1; dx++)
+					{
+						auto range = cells.equal_range(cellKey(cell + glm::ivec3(dx, dy, dz)));
+						for (auto it = range.first; it != range.second; ++it)
+						{
+							const std::int64_t other = it->second;
+							if (other / 2 == end / 2 || link[other] >= 0)
+								continue;
+							const float distance = glm::length(segments[other / 2].points[other & 1] - p);
+							if (distance <= closestDistance)
+							{
+								closest = other;
+								closestDistance = distance;
+							}
+						}
+					}
+			if (closest >= 0)
+			{
+				link[end] = closest;
+				link[closest] = end;
+			}
+		}
+	}
+
+	std::vector<ContourPolyline> polylines;
+	std::vector<bool> visited(segments.size(), false);
+	auto walk = [&](std::size_t first, int entry) {
+		ContourPolyline polyline;
+		polyline.type = type;
+		polyline.points.push_back(segments[first].points[entry]);
+		std::int64_t end = (std::int64_t)(2 * first + entry);
+		while (true)
+		{
+			const std::size_t s = (std::size_t)(end / 2);
+			visited[s] = true;
+			const std::int64_t exit = end ^ 1;
+			polyline.points.push_back(segments[s].points[exit & 1]);
+			end = link[exit];
+			if (end < 0)
+				break;
+			if (visited[(std::size_t)(end / 2)])
+			{
+				polyline.closed = true;
+				break;
+			}
+		}
+		polylines.push_back(std::move(polyline));
+	};
+	// open chains first, from their free ends
+	for (std::size_t s = 0; s != segments.size(); s++)
+		for (int e = 0; e != 2; e++)
+			if (!visited[s] && link[2 * s + e] < 0)
+				walk(s, e);
+	// what is left are closed loops
+	for (std::size_t s = 0; s != segments.size(); s++)
+		if (!visited[s])
+			walk(s, 0);
+	return polylines;
+}
+
+// Wavefront OBJ with a line element for every polyline, in world space (contours and suggestive contours in two groups)
+bool write_ContourPolylinesOBJ(const std::string& path, const std::vector<ContourPolyline>& polylines, const glm::mat4& modelMatrix)
+{
+	std::ofstream out(path, std::ios::trunc);
+	if (!out)
+		return false;
+	out << "# object space contours: " << polylines.size() << " polylines\n";
+	std::size_t vertex = 1;
+	for (NPRLineClass type : { NPR_CONTOUR_LINE, NPR_SUGGESTIVE_CONTOUR_LINE })
+	{
+		out << "g " << (type == NPR_CONTOUR_LINE ? "contours" : "suggestive_contours") << "\n";
+		for (const auto& polyline : polylines)
+		{
+			if (polyline.type != type)
+				continue;
+			for (const auto& point : polyline.points)
+			{
+				const glm::vec3 p = glm::vec3(modelMatrix * glm::vec4(point, 1.0f));
+				out << "v " << p.x << " " << p.y << " " << p.z << "\n";
+			}
+			out << "l";
+			for (std::size_t i = 0; i != polyline.points.size(); i++)
+				out << " " << vertex + i;
+			out << "\n";
+			vertex += polyline.points.size();
+		}
+	}
+	return (bool)out;
+}
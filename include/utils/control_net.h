@@ -0,0 +1,117 @@
+/*
+Indexed control net of a set of Bezier Surfaces
+- stitched patches share their boundary control points, so we store every unique control point once
+  and describe each patch with the 16 indices of its control points (used as GL_PATCHES index buffer)
+*/
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <utils/bezier_surface.h>
+
+// Unique control points + 16 indices (row major, same order as BezierSurface) for each patch
+struct ControlNet
+{
+	std::vector<glm::vec3> points;
+	std::vector<GLuint> indices;
+
+	std::size_t patchCount() const noexcept { return indices.size() / 16; }
+
+	// Control point (i, j) of a patch: shared points are stored once, so a single write updates every patch using it
+	glm::vec3& patchPoint(std::size_t patch, unsigned int i, unsigned int j) { return points[indices[16 * patch + 4 * i + j]]; }
+	const glm::vec3& patchPoint(std::size_t patch, unsigned int i, unsigned int j) const { return points[indices[16 * patch + 4 * i + j]]; }
+
+	BezierSurface patch(std::size_t patch) const
+	{
+		BezierSurface bsurface;
+		for (unsigned int i = 0; i != 4; i++)
+			for (unsigned int j = 0; j != 4; j++)
+				bsurface[i][j] = patchPoint(patch, i, j);
+		return bsurface;
+	}
+};
+
+//Methods definition
+ControlNet index_BezierSurfaces(const std::vector<BezierSurface>& bsurfaces);
+ControlNet index_TerrainGrid(unsigned int l, unsigned int w, const std::vector<BezierSurface>& bsurfaces);
+std::size_t calc_TerrainGridPointCount(unsigned int l, unsigned int w) noexcept;
+void fill_TerrainGrid(unsigned int l, unsigned int w, const BezierSurface* bsurfaces, glm::vec3* points, GLuint* indices, unsigned int rowBegin = 0, unsigned int rowEnd = ~0u) noexcept;
+
+// Hash and equality on the exact bits of the point: only identical control points are merged
+struct vec3BitsHash
+{
+	std::size_t operator()(const glm::vec3& v) const noexcept
+	{
+		std::uint32_t b[3];
+		std::memcpy(b, &v, sizeof(b));
+		std::size_t h = b[0];
+		h = h * 0x9E3779B1u ^ b[1];
+		h = h * 0x9E3779B1u ^ b[2];
+		return h;
+	}
+
+	bool operator()(const glm::vec3& a, const glm::vec3& b) const noexcept
+	{
+		return std::memcmp(&a, &b, sizeof(glm::vec3)) == 0;
+	}
+};
+
+//Methods implementation
+// Generic deduplication (loaded models): control points with the same bits are merged
+ControlNet index_BezierSurfaces(const std::vector<BezierSurface>& bsurfaces)
+{
+	ControlNet net;
+	net.indices.reserve(16 * bsurfaces.size());
+	std::unordered_map<glm::vec3, GLuint, vec3BitsHash, vec3BitsHash> unique;
+	unique.reserve(16 * bsurfaces.size());
+	for (const auto& bsurface : bsurfaces)
+		for (const auto& row : bsurface)
+			for (const auto& vertex : row)
+			{
+				auto it = unique.try_emplace(vertex, (GLuint)net.points.size());
+				if (it.second)
+					net.points.push_back(vertex);
+				net.indices.push_back(it.first->second);
+			}
+	return net;
+}
+
+// Stitched terrain of l x w patches (see stitch_BezierSurfaces): patch (r, c) control point (i, j)
+// lives at (3r + i, 3c + j) of a global (3l + 1) x (3w + 1) grid, since stitched edges are bit identical
+ControlNet index_TerrainGrid(unsigned int l, unsigned int w, const std::vector<BezierSurface>& bsurfaces)
+{
+	if (l * w != bsurfaces.size())
+		return index_BezierSurfaces(bsurfaces);
+
+	ControlNet net;
+	net.points.resize(calc_TerrainGridPointCount(l, w));
+	net.indices.resize(16 * bsurfaces.size());
+	fill_TerrainGrid(l, w, bsurfaces.data(), net.points.data(), net.indices.data());
+	return net;
+}
+
+std::size_t calc_TerrainGridPointCount(unsigned int l, unsigned int w) noexcept
+{
+	return (std::size_t)(3 * l + 1) * (3 * w + 1);
+}
+
+// Writes the grid points and the 16 indices of the patches of the rows [rowBegin, rowEnd) in the given arrays (e.g. mapped GPU buffers):
+// points and indices are the arrays of the whole grid, rows can be filled in any order
+void fill_TerrainGrid(unsigned int l, unsigned int w, const BezierSurface* bsurfaces, glm::vec3* points, GLuint* indices, unsigned int rowBegin, unsigned int rowEnd) noexcept
+{
+	const unsigned int gridWidth = 3 * w + 1;
+	rowEnd = std::min(rowEnd, l);
+	indices += (std::size_t)16 * w * rowBegin;
+	for (unsigned int r = rowBegin; r < rowEnd; r++)
+		for (unsigned int c = 0; c != w; c++)
+		{
+			const auto& bsurface = bsurfaces[r * w + c];
+			for (unsigned int i = 0; i != 4; i++)
+				for (unsigned int j = 0; j != 4; j++)
+				{
+					GLuint index = (3 * r + i) * gridWidth + (3 * c + j);
+					points[index] = bsurface[i][j];
+					*indices++ = index;
+				}
+		}
+}
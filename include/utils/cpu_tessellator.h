@@ -0,0 +1,451 @@
+/*
+CPU tessellator (reference of terrainBezierTessellation_tes.glsl and of the contour test of the fragment shader)
+- evaluates every patch on a (level + 1) x (level + 1) uv grid: position, first derivatives, normal, first and second
+  fundamental forms, principal curvatures, n.v, radial curvature (normalCurvatureInDirectionW) and window position,
+  with the same formulas, spaces and operation order of the evaluation shader
+- the patches are evaluated side by side in the lanes of simd_float (utils/simd.h); the same kernel on scalar_float is
+  the reference of the vectorized one
+- the classifier marks the samples the fragment shader draws as contours and suggestive contours: the screen space
+  derivatives of the shader (dFdx, dFdy) are replaced by finite differences on the uv grid mapped to the window
+*/
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/bezier_surface.h>
+#include <utils/bezier_curvature.h>
+#include <utils/simd.h>
+#include <utils/thread_pool.h>
+
+// Transformations of the evaluation shader (modelMatrix, normalMatrix and the camera block)
+struct TessellationView {
+	glm::mat4 modelMatrix = glm::mat4(1.0f);
+	glm::mat3 normalMatrix = glm::mat3(1.0f);
+	glm::mat4 viewMatrix = glm::mat4(1.0f);
+	glm::mat4 projectionMatrix = glm::mat4(1.0f);
+	glm::vec2 viewportResolution = glm::vec2(1.0f);
+};
+
+// Values computed for every sample (same names of the shader)
+enum TessellationField {
+	TESS_POSITION_X, TESS_POSITION_Y, TESS_POSITION_Z,
+	TESS_TANGENT_X, TESS_TANGENT_Y, TESS_TANGENT_Z,
+	TESS_BITANGENT_X, TESS_BITANGENT_Y, TESS_BITANGENT_Z,
+	TESS_NORMAL_X, TESS_NORMAL_Y, TESS_NORMAL_Z,
+	// first and second fundamental forms
+	TESS_E, TESS_F, TESS_G, TESS_L, TESS_M, TESS_N,
+	// principal curvatures (k1 >= k2)
+	TESS_K1, TESS_K2,
+	// normalDotViewValue and normalCurvatureInDirectionW
+	TESS_NORMAL_DOT_VIEW, TESS_RADIAL_CURVATURE,
+	// x and y of viewVectorProjectedInTangentPlane (the direction of the derivative of the radial curvature)
+	TESS_VIEW_PROJECTED_X, TESS_VIEW_PROJECTED_Y,
+	// window coordinates in pixels (origin in the bottom left corner, as gl_FragCoord)
+	TESS_WINDOW_X, TESS_WINDOW_Y,
+	TESS_FIELD_COUNT
+};
+
+// Samples of a set of patches, one array for each field. The patches are interleaved by groups of 'lanes'
+// (the width of the kernel that evaluated them): the samples of a group are stored lane by lane
+struct TessellatedPatches {
+	unsigned int level = 0;
+	unsigned int lanes = 1;
+	std::size_t patches = 0;
+	std::vector<float> fields[TESS_FIELD_COUNT];
+
+	std::size_t samplesPerPatch() const noexcept { return (std::size_t)(level + 1) * (level + 1); }
+	std::size_t samples() const noexcept { return patches * samplesPerPatch(); }
+	// Sample (iu, iv) of a patch, u = iu / level and v = iv / level
+	std::size_t index(std::size_t patch, unsigned int iu, unsigned int iv) const noexcept
+	{
+		return ((patch / lanes) * samplesPerPatch() + (std::size_t)iv * (level + 1) + iu) * lanes + patch % lanes;
+	}
+	float at(TessellationField field, std::size_t patch, unsigned int iu, unsigned int iv) const noexcept
+	{
+		return fields[field][index(patch, iu, iv)];
+	}
+};
+
+// Parameters of the contour test of the fragment shader (see the NPRStyleBlock)
+struct NPRLineSettings {
+	float contourLimit = 0.1f;
+	float directionalDerivativeLimit = 12.0f;
+	bool enableContours = true;
+	bool enableSuggestiveContours = true;
+};
+
+enum NPRLineClass : std::uint8_t { NPR_NO_LINE = 0, NPR_CONTOUR_LINE = 1, NPR_SUGGESTIVE_CONTOUR_LINE = 2 };
+
+// Class of every sample (same layout of the TessellatedPatches) and number of samples of each class
+struct NPRLineClassification {
+	std::vector<std::uint8_t> classes;
+	std::size_t contourSamples = 0;
+	std::size_t suggestiveContourSamples = 0;
+};
+
+// Agreement of the tessellator with the single sample reference and of the vectorized kernel with the scalar one
+struct CPUTessellatorCheck {
+	std::size_t samples = 0;
+	// largest error of position and normal against eval_BezierSurface, relative to the size of the model
+	double maxPositionError = 0.0;
+	double maxNormalError = 0.0;
+	// largest error of k1 and k2 against calc_SurfaceCurvature, relative to the largest curvature of the model
+	double maxCurvatureError = 0.0;
+	// samples where a field of the vectorized kernel differs from the scalar one by more than 1e-5 of the largest value of the field
+	std::size_t simdMismatches = 0;
+	// samples classified differently from the scalar kernel output
+	std::size_t classMismatches = 0;
+};
+
+// Throughput of the tessellator (samples per second) and lines found from the given view
+struct CPUTessellatorBenchmark {
+	const char* simdName = simd_float::name;
+	int simdWidth = simd_float::width;
+	unsigned int threads = 1;
+	std::size_t patches = 0;
+	std::size_t samples = 0;
+	double scalarSamplesPerSecond = 0.0;
+	double simdSamplesPerSecond = 0.0;
+	double threadedSamplesPerSecond = 0.0;
+	double classifierSamplesPerSecond = 0.0;
+	double contourRatio = 0.0;
+	double suggestiveContourRatio = 0.0;
+};
+
+//Methods definition
+template <typename V = simd_float>
+void tessellate_BezierPatches(const std::vector<BezierSurface>& bsurfaces, unsigned int level, const TessellationView& view, TessellatedPatches& out, ThreadPool* pool = nullptr);
+NPRLineClassification classify_NPRLines(const TessellatedPatches& tessellation, const NPRLineSettings& settings);
+CPUTessellatorCheck check_CPUTessellator(const std::vector<BezierSurface>& bsurfaces, unsigned int level, const TessellationView& view, const NPRLineSettings& settings);
+CPUTessellatorBenchmark bench_CPUTessellator(const std::vector<BezierSurface>& bsurfaces, unsigned int level, const TessellationView& view, const NPRLineSettings& settings, ThreadPool& pool, std::size_t maxSamples = 1 << 21);
+
+//Methods implementation
+// no floating point contraction: the scalar references and the vectorized kernels round the same way (see utils/simd.h)
+NPR_FP_CONTRACT_OFF_BEGIN
+namespace tessellator_detail
+{
+	template <typename V>
+	struct Vec3 { V x, y, z; };
+
+	template <typename V> inline Vec3<V> operator+(const Vec3<V>& a, const Vec3<V>& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+	template <typename V> inline Vec3<V> operator-(const Vec3<V>& a, const Vec3<V>& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+	template <typename V> inline Vec3<V> operator*(V s, const Vec3<V>& a) { return { s * a.x, s * a.y, s * a.z }; }
+	template <typename V> inline V dot(const Vec3<V>& a, const Vec3<V>& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+	template <typename V> inline Vec3<V> cross(const Vec3<V>& a, const Vec3<V>& b)
+	{
+		return { a.y * b.z - b.y * a.z, a.z * b.x - b.z * a.x, a.x * b.y - b.x * a.y };
+	}
+	// as glm::normalize: x * inversesqrt(dot(x, x))
+	template <typename V> inline Vec3<V> normalize(const Vec3<V>& a) { return (V(1.0f) / sqrt(dot(a, a))) * a; }
+	template <typename V> inline Vec3<V> transform(const glm::mat3& m, const Vec3<V>& a)
+	{
+		return { V(m[0][0]) * a.x + V(m[1][0]) * a.y + V(m[2][0]) * a.z,
+				 V(m[0][1]) * a.x + V(m[1][1]) * a.y + V(m[2][1]) * a.z,
+				 V(m[0][2]) * a.x + V(m[1][2]) * a.y + V(m[2][2]) * a.z };
+	}
+	// transpose(m) * a
+	template <typename V> inline Vec3<V> transformTransposed(const glm::mat3& m, const Vec3<V>& a)
+	{
+		return { V(m[0][0]) * a.x + V(m[0][1]) * a.y + V(m[0][2]) * a.z,
+				 V(m[1][0]) * a.x + V(m[1][1]) * a.y + V(m[1][2]) * a.z,
+				 V(m[2][0]) * a.x + V(m[2][1]) * a.y + V(m[2][2]) * a.z };
+	}
+	// row r of m * (a, 1)
+	template <typename V> inline V transformRow(const glm::mat4& m, int r, const Vec3<V>& a)
+	{
+		return V(m[0][r]) * a.x + V(m[1][r]) * a.y + V(m[2][r]) * a.z + V(m[3][r]);
+	}
+
+	// Evaluates the group of patches [first, first + V::width) (the last patch fills the lanes past the end)
+	template <typename V>
+	void tessellateGroup(const std::vector<BezierSurface>& bsurfaces, std::size_t first, const TessellationView& view,
+		const glm::mat4& modelView, const glm::mat4& modelViewProjection, TessellatedPatches& out)
+	{
+		constexpr int W = V::width;
+		const unsigned int level = out.level;
+		// control point (i, j) of the shader is bsurface[j][i]: P[i][j] holds it for all the lanes
+		Vec3<V> P[4][4];
+		for (unsigned int i = 0; i != 4; i++)
+			for (unsigned int j = 0; j != 4; j++)
+			{
+				float x[W], y[W], z[W];
+				for (int l = 0; l != W; l++)
+				{
+					const glm::vec3& p = bsurfaces[std::min(first + l, bsurfaces.size() - 1)][j][i];
+					x[l] = p.x;
+					y[l] = p.y;
+					z[l] = p.z;
+				}
+				P[i][j] = { V::load(x), V::load(y), V::load(z) };
+			}
+
+		float* fields[TESS_FIELD_COUNT];
+		for (int f = 0; f != TESS_FIELD_COUNT; f++)
+			fields[f] = out.fields[f].data() + (first / W) * out.samplesPerPatch() * W;
+
+		for (unsigned int iv = 0; iv <= level; iv++)
+		{
+			const float v = (float)iv / level;
+			const float bv[4] = { (1 - v) * (1 - v) * (1 - v), 3 * v * (1 - v) * (1 - v), 3 * v * v * (1 - v), v * v * v };
+			const float dbv[4] = { -3 * (1 - v) * (1 - v), 3 * (1 - v) * (1 - v) - 6 * v * (1 - v), 6 * v * (1 - v) - 3 * v * v, 3 * v * v };
+			const float ddbv[4] = { 6 * (1 - v), -6 * (1 - v) - (6 * (1 - v) - 6 * v), 6 * (1 - v) - 6 * v - 6 * v, 6 * v };
+			// curves along v of the columns, and their derivatives: shared by the whole row of samples
+			Vec3<V> c[4], dc[4], ddc[4];
+			for (unsigned int i = 0; i != 4; i++)
+			{
+				c[i] = V(bv[0]) * P[i][0] + V(bv[1]) * P[i][1] + V(bv[2]) * P[i][2] + V(bv[3]) * P[i][3];
+				dc[i] = V(dbv[0]) * P[i][0] + V(dbv[1]) * P[i][1] + V(dbv[2]) * P[i][2] + V(dbv[3]) * P[i][3];
+				ddc[i] = V(ddbv[0]) * P[i][0] + V(ddbv[1]) * P[i][1] + V(ddbv[2]) * P[i][2] + V(ddbv[3]) * P[i][3];
+			}
+			for (unsigned int iu = 0; iu <= level; iu++)
+			{
+				const float u = (float)iu / level;
+				const V bu[4] = { (1 - u) * (1 - u) * (1 - u), 3 * u * (1 - u) * (1 - u), 3 * u * u * (1 - u), u * u * u };
+				const V dbu[4] = { -3 * (1 - u) * (1 - u), 3 * (1 - u) * (1 - u) - 6 * u * (1 - u), 6 * u * (1 - u) - 3 * u * u, 3 * u * u };
+				const V ddbu[4] = { 6 * (1 - u), -6 * (1 - u) - (6 * (1 - u) - 6 * u), 6 * (1 - u) - 6 * u - 6 * u, 6 * u };
+
+				const Vec3<V> position = bu[0] * c[0] + bu[1] * c[1] + bu[2] * c[2] + bu[3] * c[3];
+				const Vec3<V> tangent = dbu[0] * c[0] + dbu[1] * c[1] + dbu[2] * c[2] + dbu[3] * c[3];
+				const Vec3<V> bitangent = bu[0] * dc[0] + bu[1] * dc[1] + bu[2] * dc[2] + bu[3] * dc[3];
+				const Vec3<V> uu = ddbu[0] * c[0] + ddbu[1] * c[1] + ddbu[2] * c[2] + ddbu[3] * c[3];
+				const Vec3<V> uv = dbu[0] * dc[0] + dbu[1] * dc[1] + dbu[2] * dc[2] + dbu[3] * dc[3];
+				const Vec3<V> vv = bu[0] * ddc[0] + bu[1] * ddc[1] + bu[2] * ddc[2] + bu[3] * ddc[3];
+				const Vec3<V> normal = normalize(cross(tangent, bitangent));
+
+				// fundamental forms
+				const V E = dot(tangent, tangent), F = dot(tangent, bitangent), G = dot(bitangent, bitangent);
+				const V L = dot(normal, uu), M = dot(normal, uv), N = dot(normal, vv);
+
+				// closed form principal curvatures (computeCurvature, calc_SurfaceCurvature)
+				const V p = sqrt(E);
+				const Vec3<V> t1 = (V(1.0f) / p) * tangent;
+				const Vec3<V> t2 = cross(normal, t1);
+				const V q = dot(bitangent, t1), r = dot(bitangent, t2);
+				const V alpha = q / p;
+				const V s11 = L / (p * p);
+				const V s12 = (M - alpha * L) / (p * r);
+				const V s22 = (N - alpha * (V(2.0f) * M - alpha * L)) / (r * r);
+				const V meanCurvature = V(0.5f) * (s11 + s22);
+				const V halfGap = V(0.5f) * (s11 - s22);
+				const V root = sqrt(halfGap * halfGap + s12 * s12);
+				const V k1 = meanCurvature + root, k2 = meanCurvature - root;
+				// first principal direction: the longer of (s12, k1 - s11) and (k1 - s22, s12), t1 at the umbilic points
+				const V row0x = s12, row0y = k1 - s11, row1x = k1 - s22, row1y = s12;
+				const auto fromRow0 = row0x * row0x + row0y * row0y >= row1x * row1x + row1y * row1y;
+				const V e1x = select(fromRow0, row0x, row1x), e1y = select(fromRow0, row0y, row1y);
+				const V e1Length = sqrt(e1x * e1x + e1y * e1y);
+				const Vec3<V> e1 = e1x * t1 + e1y * t2;
+				const auto notUmbilic = e1Length > V(0.0f);
+				const Vec3<V> d1 = { select(notUmbilic, e1.x / e1Length, t1.x), select(notUmbilic, e1.y / e1Length, t1.y),
+					select(notUmbilic, e1.z / e1Length, t1.z) };
+
+				// view dependent terms, in view space: n.v and w, the view vector projected in the tangent plane
+				const Vec3<V> mvPosition = { transformRow(modelView, 0, position), transformRow(modelView, 1, position), transformRow(modelView, 2, position) };
+				const Vec3<V> vectorToCamera = normalize(Vec3<V>{ -mvPosition.x, -mvPosition.y, -mvPosition.z });
+				const Vec3<V> Nv = normalize(transform(view.normalMatrix, normal));
+				const V normalDotView = dot(Nv, vectorToCamera);
+				const Vec3<V> projected = vectorToCamera - dot(vectorToCamera, Nv) * Nv;
+				// Euler formula of the shader, k2 + (k1 - k2) cos^2 with w back in object space (transpose(normalMatrix)) and d1 d1^T w
+				// as principalDirections * objectW, then scaled to view space units by |w object| / |w view|
+				const Vec3<V> objectW = transformTransposed(view.normalMatrix, projected);
+				const Vec3<V> directionsW = { d1.x * d1.x * objectW.x + d1.x * d1.y * objectW.y + d1.x * d1.z * objectW.z,
+					d1.y * d1.x * objectW.x + d1.y * d1.y * objectW.y + d1.y * d1.z * objectW.z,
+					d1.z * d1.x * objectW.x + d1.z * d1.y * objectW.y + d1.z * d1.z * objectW.z };
+				const V cosTheta2 = dot(objectW, directionsW) / dot(objectW, objectW);
+				const V radialCurvature = (k2 + (k1 - k2) * cosTheta2) * sqrt(dot(objectW, objectW)) / sqrt(dot(projected, projected));
+
+				const V clipX = transformRow(modelViewProjection, 0, position), clipY = transformRow(modelViewProjection, 1, position);
+				const V clipW = transformRow(modelViewProjection, 3, position);
+
+				const V values[TESS_FIELD_COUNT] = {
+					position.x, position.y, position.z, tangent.x, tangent.y, tangent.z, bitangent.x, bitangent.y, bitangent.z,
+					normal.x, normal.y, normal.z, E, F, G, L, M, N, k1, k2,
+					max(normalDotView, V(0.0f)), radialCurvature, projected.x, projected.y,
+					(clipX / clipW * V(0.5f) + V(0.5f)) * V(view.viewportResolution.x),
+					(clipY / clipW * V(0.5f) + V(0.5f)) * V(view.viewportResolution.y)
+				};
+				const std::size_t offset = ((std::size_t)iv * (level + 1) + iu) * W;
+				for (int f = 0; f != TESS_FIELD_COUNT; f++)
+					values[f].store(fields[f] + offset);
+			}
+		}
+	}
+
+	// NaN (degenerate points) equal to NaN, otherwise within the tolerance
+	inline bool sameValue(float a, float b, float tolerance) noexcept
+	{
+		if (std::isnan(a) || std::isnan(b))
+			return std::isnan(a) && std::isnan(b);
+		return std::abs(a - b) <= tolerance;
+	}
+}
+
+// The groups of patches are independent: with a pool they are evaluated in parallel
+template <typename V>
+void tessellate_BezierPatches(const std::vector<BezierSurface>& bsurfaces, unsigned int level, const TessellationView& view, TessellatedPatches& out, ThreadPool* pool)
+{
+	level = std::max(1u, level);
+	out.level = level;
+	out.lanes = V::width;
+	out.patches = bsurfaces.size();
+	const std::size_t groups = (bsurfaces.size() + V::width - 1) / V::width;
+	for (auto& field : out.fields)
+		field.resize(groups * V::width * out.samplesPerPatch());
+	if (groups == 0)
+		return;
+
+	const glm::mat4 modelView = view.viewMatrix * view.modelMatrix;
+	const glm::mat4 modelViewProjection = view.projectionMatrix * view.viewMatrix * view.modelMatrix;
+	auto evaluate = [&](std::size_t begin, std::size_t end) {
+		for (std::size_t g = begin; g != end; g++)
+			tessellator_detail::tessellateGroup<V>(bsurfaces, g * V::width, view, modelView, modelViewProjection, out);
+	};
+	if (pool)
+		pool->parallel_for(groups, 8, evaluate);
+	else
+		evaluate(0, groups);
+}
+
+// Contours where normalDotView^2 < contourLimit, otherwise suggestive contours where |kr| < dd (the shader accepts -dd <= kr < dd)
+// and DwKr > 0. DwKr = w.x * dkr/dx + w.y * dkr/dy as in the shader: the window derivatives come from the uv derivatives
+// (central differences, one sided on the borders) through the inverse of the Jacobian of the window position
+NPRLineClassification classify_NPRLines(const TessellatedPatches& tessellation, const NPRLineSettings& settings)
+{
+	const auto& t = tessellation;
+	const unsigned int level = t.level;
+	const float dd = settings.directionalDerivativeLimit * 0.0001f;
+	NPRLineClassification result;
+	result.classes.assign(t.fields[0].size(), NPR_NO_LINE);
+	for (std::size_t patch = 0; patch != t.patches; patch++)
+		for (unsigned int iv = 0; iv <= level; iv++)
+			for (unsigned int iu = 0; iu <= level; iu++)
+			{
+				const std::size_t s = t.index(patch, iu, iv);
+				const float normalDotView = t.fields[TESS_NORMAL_DOT_VIEW][s];
+				if (settings.enableContours && normalDotView * normalDotView < settings.contourLimit)
+				{
+					result.classes[s] = NPR_CONTOUR_LINE;
+					result.contourSamples++;
+					continue;
+				}
+				const float kr = t.fields[TESS_RADIAL_CURVATURE][s];
+				if (!settings.enableSuggestiveContours || !(kr >= -dd && kr < dd))
+					continue;
+
+				const std::size_t u0 = t.index(patch, iu > 0 ? iu - 1 : iu, iv), u1 = t.index(patch, iu < level ? iu + 1 : iu, iv);
+				const std::size_t v0 = t.index(patch, iu, iv > 0 ? iv - 1 : iv), v1 = t.index(patch, iu, iv < level ? iv + 1 : iv);
+				const float* kField = t.fields[TESS_RADIAL_CURVATURE].data();
+				const float* xField = t.fields[TESS_WINDOW_X].data();
+				const float* yField = t.fields[TESS_WINDOW_Y].data();
+				// the grid steps are the same for kr and the window position: they cancel out
+				const float dkdu = kField[u1] - kField[u0], dkdv = kField[v1] - kField[v0];
+				const float dxdu = xField[u1] - xField[u0], dxdv = xField[v1] - xField[v0];
+				const float dydu = yField[u1] - yField[u0], dydv = yField[v1] - yField[v0];
+				const float det = dxdu * dydv - dxdv * dydu;
+				if (!(std::abs(det) > 0.0f))
+					continue;
+				const float dkdx = (dkdu * dydv - dkdv * dydu) / det;
+				const float dkdy = (dxdu * dkdv - dxdv * dkdu) / det;
+				const float DwKr = t.fields[TESS_VIEW_PROJECTED_X][s] * dkdx + t.fields[TESS_VIEW_PROJECTED_Y][s] * dkdy;
+				if (DwKr > 0.0f)
+				{
+					result.classes[s] = NPR_SUGGESTIVE_CONTOUR_LINE;
+					result.suggestiveContourSamples++;
+				}
+			}
+	return result;
+}
+
+// The scalar kernel is compared with eval_BezierSurface and calc_SurfaceCurvature (points without a tangent plane are skipped),
+// then the vectorized kernel and its classification with the scalar ones
+CPUTessellatorCheck check_CPUTessellator(const std::vector<BezierSurface>& bsurfaces, unsigned int level, const TessellationView& view, const NPRLineSettings& settings)
+{
+	using tessellator_detail::sameValue;
+	CPUTessellatorCheck check;
+	TessellatedPatches scalar, simd;
+	tessellate_BezierPatches<scalar_float>(bsurfaces, level, view, scalar);
+	tessellate_BezierPatches<simd_float>(bsurfaces, level, view, simd);
+	level = scalar.level;
+	check.samples = scalar.samples();
+
+	double modelSize = 0.0, modelCurvature = 0.0;
+	float fieldScale[TESS_FIELD_COUNT] = {};
+	for (int f = 0; f != TESS_FIELD_COUNT; f++)
+		for (float value : scalar.fields[f])
+			if (std::isfinite(value))
+				fieldScale[f] = std::max(fieldScale[f], std::abs(value));
+	for (std::size_t patch = 0; patch != bsurfaces.size(); patch++)
+		for (unsigned int iv = 0; iv <= level; iv++)
+			for (unsigned int iu = 0; iu <= level; iu++)
+			{
+				const auto sample = eval_BezierSurface(bsurfaces[patch], (float)iu / level, (float)iv / level);
+				modelSize = std::max(modelSize, (double)glm::length(sample.position));
+				if (!(glm::length(glm::cross(sample.tangent, sample.bitangent)) > 1e-6f))
+					continue;
+				const auto curvature = calc_SurfaceCurvature(sample);
+				modelCurvature = std::max({ modelCurvature, (double)std::abs(curvature.k1), (double)std::abs(curvature.k2) });
+				const glm::vec3 position(scalar.at(TESS_POSITION_X, patch, iu, iv), scalar.at(TESS_POSITION_Y, patch, iu, iv), scalar.at(TESS_POSITION_Z, patch, iu, iv));
+				const glm::vec3 normal(scalar.at(TESS_NORMAL_X, patch, iu, iv), scalar.at(TESS_NORMAL_Y, patch, iu, iv), scalar.at(TESS_NORMAL_Z, patch, iu, iv));
+				check.maxPositionError = std::max(check.maxPositionError, (double)glm::length(position - sample.position));
+				check.maxNormalError = std::max(check.maxNormalError, (double)glm::length(normal - sample.normal));
+				check.maxCurvatureError = std::max({ check.maxCurvatureError,
+					(double)std::abs(scalar.at(TESS_K1, patch, iu, iv) - curvature.k1), (double)std::abs(scalar.at(TESS_K2, patch, iu, iv) - curvature.k2) });
+			}
+	check.maxPositionError /= std::max(modelSize, 1e-30);
+	check.maxCurvatureError /= std::max(modelCurvature, 1e-30);
+
+	const auto scalarClasses = classify_NPRLines(scalar, settings);
+	const auto simdClasses = classify_NPRLines(simd, settings);
+	for (std::size_t patch = 0; patch != bsurfaces.size(); patch++)
+		for (unsigned int iv = 0; iv <= level; iv++)
+			for (unsigned int iu = 0; iu <= level; iu++)
+			{
+				const std::size_t a = scalar.index(patch, iu, iv), b = simd.index(patch, iu, iv);
+				bool same = true;
+				for (int f = 0; f != TESS_FIELD_COUNT; f++)
+					same = same && sameValue(scalar.fields[f][a], simd.fields[f][b], 1e-5f * fieldScale[f]);
+				check.simdMismatches += !same;
+				check.classMismatches += scalarClasses.classes[a] != simdClasses.classes[b];
+			}
+	return check;
+}
+
+// Scalar and vectorized kernel on the calling thread, vectorized kernel on the pool, then the classifier.
+// Large models are cut to maxSamples samples (the first patches), so the output stays within a few hundred MB
+CPUTessellatorBenchmark bench_CPUTessellator(const std::vector<BezierSurface>& bsurfaces, unsigned int level, const TessellationView& view, const NPRLineSettings& settings, ThreadPool& pool, std::size_t maxSamples)
+{
+	using clock = std::chrono::high_resolution_clock;
+	auto seconds = [](clock::time_point start) { return std::max(std::chrono::duration<double>(clock::now() - start).count(), 1e-9); };
+	level = std::max(1u, level);
+	const std::size_t patches = std::min(bsurfaces.size(), std::max<std::size_t>(1, maxSamples / ((std::size_t)(level + 1) * (level + 1))));
+	const std::vector<BezierSurface> selected(bsurfaces.begin(), bsurfaces.begin() + patches);
+
+	CPUTessellatorBenchmark result;
+	result.threads = pool.size();
+	result.patches = patches;
+	TessellatedPatches tessellation;
+	auto start = clock::now();
+	tessellate_BezierPatches<scalar_float>(selected, level, view, tessellation);
+	result.samples = tessellation.samples();
+	result.scalarSamplesPerSecond = result.samples / seconds(start);
+	start = clock::now();
+	tessellate_BezierPatches<simd_float>(selected, level, view, tessellation);
+	result.simdSamplesPerSecond = result.samples / seconds(start);
+	start = clock::now();
+	tessellate_BezierPatches<simd_float>(selected, level, view, tessellation, &pool);
+	result.threadedSamplesPerSecond = result.samples / seconds(start);
+	start = clock::now();
+	const auto lines = classify_NPRLines(tessellation, settings);
+	result.classifierSamplesPerSecond = result.samples / seconds(start);
+	if (result.samples)
+	{
+		result.contourRatio = (double)lines.contourSamples / result.samples;
+		result.suggestiveContourRatio = (double)lines.suggestiveContourSamples / result.samples;
+	}
+	return result;
+}
+
+NPR_FP_CONTRACT_OFF_END
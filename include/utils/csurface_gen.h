@@ -4,32 +4,27 @@ CSurfaces subdivision method into step values
 #pragma once
 #include <utils/csurface.hpp>
 
-std::vector<CSurface> subdiv_CSurface(const CSurface& c, unsigned int w, unsigned int l)
+// Cell (i, j) of the w x l subdivision of c (row i along v, column j along u): same corners as subdiv_CSurface, computed on its own
+CSurface calc_CSurfaceCell(const CSurface& c, unsigned int w, unsigned int l, unsigned int i, unsigned int j)
 {
 	float w_div = 1.0f / (float)w;
 	float l_div = 1.0f / (float)l;
 
+	auto v = (float)i * l_div;
+	auto v_delta = v + l_div;
+	auto u = (float)j * w_div;
+	auto u_delta = u + w_div;
+	return CSurface(c.p(u, v), c.p(u_delta, v), c.p(u_delta, v_delta), c.p(u, v_delta));
+}
+
+std::vector<CSurface> subdiv_CSurface(const CSurface& c, unsigned int w, unsigned int l)
+{
 	std::vector<CSurface> s;
 	s.reserve(w * l);
 
-	for (auto i = 0; i < l; i++)
-	{
-		auto v = (float)i * l_div;
-		auto v_delta = v + l_div;
-
-		for (auto j = 0; j < w; j++)
-		{
-			auto u = (float)j * w_div;
-			auto u_delta = u + w_div;
-			s.emplace_back(c.p(u, v), c.p(u_delta, v), c.p(u_delta, v_delta), c.p(u, v_delta));
-		}
-	}
+	for (auto i = 0u; i < l; i++)
+		for (auto j = 0u; j < w; j++)
+			s.push_back(calc_CSurfaceCell(c, w, l, i, j));
 
 	return s;
 }
-
-
-
-
-
-
@@ -0,0 +1,341 @@
+/*
+Curvature cache
+- the view independent differential geometry of every patch is sampled once on a fixed uv grid (resolution x resolution samples):
+  normal, principal curvatures (k1 >= k2) and first principal direction d1, with the solver of the evaluation shader (calc_SurfaceCurvature)
+- the samples are stored in a texture array of 3 RGBA16F layers, as an atlas with a square tile for each patch (patch i in the tile
+  (i % tilesPerRow, i / tilesPerRow)): layer 0 normal and k1, layer 1 k2 and d1 d1^T (xx, xy, xz), layer 2 d1 d1^T (yy, yz, zz)
+- the evaluation shader reads the tile of its patch with bilinear filtering: the direction is stored as d1 d1^T,
+  which does not change sign with d1, so neighbouring samples with opposite d1 are filtered correctly
+- the shader then only computes the view dependent terms: n.v, the view vector projected in the tangent plane (w) and the radial
+  curvature from the Euler formula, kr = k1 cos^2(theta) + k2 sin^2(theta) = k2 + (k1 - k2) (w.d1)^2 / (w.w)
+- the patch is found from its index in the draw: the cache draws its own copy of the patches without indices (16 control points
+  each), the vertex shader gives gl_VertexID / 16 to the evaluation shader. gl_PrimitiveID would not do: the Mesa software
+  renderers (llvmpipe, softpipe) restart it every 64 patches
+- the texture and the patch buffer are created by build(): release() must be called before the GL context is destroyed
+*/
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/bezier_surface.h>
+#include <utils/bezier_curvature.h>
+#include <utils/terrain_mesh.h>
+#include <utils/thread_pool.h>
+
+// samples along u and v of each patch
+constexpr unsigned int CURVATURE_CACHE_RESOLUTION = 9;
+constexpr unsigned int CURVATURE_CACHE_LAYERS = 3;
+// a point has no tangent plane when |dS/du x dS/dv| is below this fraction of the square of the size of its patch
+constexpr float CURVATURE_CACHE_DEGENERATE = 1e-4f;
+// steps (in u and v) towards the center of the patch where the samples without a tangent plane take their limit normal
+constexpr float CURVATURE_CACHE_INSET[2] = { 1e-2f, 5e-2f };
+
+// Values of the samples of a set of patches, laid out as the layers of the texture array
+struct CurvatureCacheImage {
+	unsigned int resolution = 0;
+	unsigned int tilesPerRow = 0;
+	unsigned int width = 0, height = 0;
+	// CURVATURE_CACHE_LAYERS layers of width x height RGBA texels
+	std::vector<float> texels;
+
+	// first float of the texel (x, y) of a layer
+	std::size_t index(unsigned int layer, unsigned int x, unsigned int y) const noexcept
+	{
+		return (((std::size_t)layer * height + y) * width + x) * 4;
+	}
+};
+
+// View independent geometry interpolated at (u, v) of a patch, as the shader reads it
+struct CachedCurvature {
+	glm::vec3 normal = glm::vec3(0.0f);
+	float k1 = 0.0f;
+	float k2 = 0.0f;
+	// d1 d1^T
+	glm::mat3 principalDirections = glm::mat3(0.0f);
+};
+
+// Radial curvature of the cache against the one computed at the same point from the surface (object space)
+struct CurvatureCacheCheck {
+	std::size_t patches = 0;
+	std::size_t samples = 0;
+	// largest error at the samples of the grid and between them (bilinear filtering), relative to the largest curvature of the model
+	double maxGridError = 0.0;
+	double maxInterpolatedError = 0.0;
+	// average error between the samples, relative to the largest curvature
+	double averageInterpolatedError = 0.0;
+	// largest angle (radians) between the interpolated normal and the exact one
+	double maxNormalError = 0.0;
+};
+
+//Methods definition
+float calc_PatchSize(const BezierSurface& bsurface) noexcept;
+bool has_TangentPlane(const BezierSurfaceSample& sample, float patchSize) noexcept;
+CurvatureCacheImage gen_CurvatureCacheImage(const std::vector<BezierSurface>& bsurfaces, unsigned int resolution, unsigned int maxTextureSize, ThreadPool* pool = nullptr);
+CachedCurvature calc_CachedCurvature(const CurvatureCacheImage& image, std::size_t patch, float u, float v) noexcept;
+float calc_EulerRadialCurvature(const CachedCurvature& curvature, const glm::vec3& w) noexcept;
+CurvatureCacheCheck check_CurvatureCache(const std::vector<BezierSurface>& bsurfaces, unsigned int resolution = CURVATURE_CACHE_RESOLUTION, std::size_t maxPatches = 2048);
+
+//Methods implementation
+// Diagonal of the box of the control points
+float calc_PatchSize(const BezierSurface& bsurface) noexcept
+{
+	glm::vec3 lo = bsurface[0][0], hi = bsurface[0][0];
+	for (const auto& row : bsurface)
+		for (const auto& p : row)
+		{
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+	return glm::length(hi - lo);
+}
+
+// Relative test: on the collapsed edges of the models the cross product is rounding noise (down to 1e-9), not a normal
+bool has_TangentPlane(const BezierSurfaceSample& sample, float patchSize) noexcept
+{
+	return glm::length(glm::cross(sample.tangent, sample.bitangent)) > CURVATURE_CACHE_DEGENERATE * patchSize * patchSize;
+}
+
+// Samples (iu, iv) of the patch i are the texels (tile.x * resolution + iu, tile.y * resolution + iv). Points without a tangent plane
+// (collapsed edges and corners) take the normal of a point just inside the patch, their limit, and a null curvature: the curvature
+// diverges there, and the filtering of NaN would spread it to the whole tile. An empty image if the atlas exceeds maxTextureSize
+CurvatureCacheImage gen_CurvatureCacheImage(const std::vector<BezierSurface>& bsurfaces, unsigned int resolution, unsigned int maxTextureSize, ThreadPool* pool)
+{
+	CurvatureCacheImage image;
+	resolution = std::max(2u, resolution);
+	const unsigned int maxTiles = maxTextureSize / resolution;
+	const std::size_t columns = std::min<std::size_t>(maxTiles, (std::size_t)std::ceil(std::sqrt((double)bsurfaces.size())));
+	if (bsurfaces.empty() || columns == 0 || (bsurfaces.size() + columns - 1) / columns > maxTiles)
+		return image;
+	image.resolution = resolution;
+	image.tilesPerRow = (unsigned int)columns;
+	image.width = image.tilesPerRow * resolution;
+	image.height = (unsigned int)((bsurfaces.size() + columns - 1) / columns) * resolution;
+	image.texels.assign((std::size_t)CURVATURE_CACHE_LAYERS * image.width * image.height * 4, 0.0f);
+
+	auto sample = [&](std::size_t begin, std::size_t end) {
+		for (std::size_t patch = begin; patch != end; patch++)
+		{
+			const unsigned int x0 = (unsigned int)(patch % columns) * resolution, y0 = (unsigned int)(patch / columns) * resolution;
+			const float size = calc_PatchSize(bsurfaces[patch]);
+			for (unsigned int iv = 0; iv != resolution; iv++)
+				for (unsigned int iu = 0; iu != resolution; iu++)
+				{
+					const float u = (float)iu / (resolution - 1), v = (float)iv / (resolution - 1);
+					const BezierSurfaceSample s = eval_BezierSurface(bsurfaces[patch], u, v);
+					glm::vec3 normal = s.normal;
+					SurfaceCurvature curvature;
+					if (has_TangentPlane(s, size))
+						curvature = calc_SurfaceCurvature(s);
+					else
+					{
+						normal = glm::vec3(0.0f);
+						for (float inset : CURVATURE_CACHE_INSET)
+						{
+							const BezierSurfaceSample inside = eval_BezierSurface(bsurfaces[patch], std::clamp(u, inset, 1.0f - inset), std::clamp(v, inset, 1.0f - inset));
+							if (has_TangentPlane(inside, size))
+							{
+								normal = inside.normal;
+								break;
+							}
+						}
+					}
+					const glm::vec3 d = curvature.principalDirection1;
+					float* t0 = &image.texels[image.index(0, x0 + iu, y0 + iv)];
+					float* t1 = &image.texels[image.index(1, x0 + iu, y0 + iv)];
+					float* t2 = &image.texels[image.index(2, x0 + iu, y0 + iv)];
+					const float values[12] = { normal.x, normal.y, normal.z, curvature.k1, curvature.k2, d.x * d.x, d.x * d.y, d.x * d.z,
+						d.y * d.y, d.y * d.z, d.z * d.z, 0.0f };
+					for (int c = 0; c != 4; c++)
+					{
+						t0[c] = std::isfinite(values[c]) ? values[c] : 0.0f;
+						t1[c] = std::isfinite(values[4 + c]) ? values[4 + c] : 0.0f;
+						t2[c] = std::isfinite(values[8 + c]) ? values[8 + c] : 0.0f;
+					}
+				}
+		}
+	};
+	if (pool)
+		pool->parallel_for(bsurfaces.size(), 64, sample);
+	else
+		sample(0, bsurfaces.size());
+	return image;
+}
+
+// Bilinear filtering of the tile of the patch, as the sampler of the shader (texel centers on the samples of the grid)
+CachedCurvature calc_CachedCurvature(const CurvatureCacheImage& image, std::size_t patch, float u, float v) noexcept
+{
+	const unsigned int r = image.resolution;
+	const float x = std::clamp(u, 0.0f, 1.0f) * (r - 1), y = std::clamp(v, 0.0f, 1.0f) * (r - 1);
+	const unsigned int ix = std::min((unsigned int)x, r - 2), iy = std::min((unsigned int)y, r - 2);
+	const float fx = x - ix, fy = y - iy;
+	const unsigned int x0 = (unsigned int)(patch % image.tilesPerRow) * r + ix, y0 = (unsigned int)(patch / image.tilesPerRow) * r + iy;
+	float values[CURVATURE_CACHE_LAYERS * 4];
+	for (unsigned int layer = 0; layer != CURVATURE_CACHE_LAYERS; layer++)
+		for (unsigned int c = 0; c != 4; c++)
+		{
+			const float a = image.texels[image.index(layer, x0, y0) + c], b = image.texels[image.index(layer, x0 + 1, y0) + c];
+			const float d = image.texels[image.index(layer, x0, y0 + 1) + c], e = image.texels[image.index(layer, x0 + 1, y0 + 1) + c];
+			values[layer * 4 + c] = (a + (b - a) * fx) + ((d + (e - d) * fx) - (a + (b - a) * fx)) * fy;
+		}
+	CachedCurvature result;
+	result.normal = glm::vec3(values[0], values[1], values[2]);
+	if (glm::length(result.normal) > 0.0f)
+		result.normal = glm::normalize(result.normal);
+	result.k1 = values[3];
+	result.k2 = values[4];
+	result.principalDirections = glm::mat3(values[5], values[6], values[7], values[6], values[8], values[9], values[7], values[9], values[10]);
+	return result;
+}
+
+// Euler formula for a tangent direction w (need not be unit): cos^2(theta) = w^T d1 d1^T w / w^T w
+float calc_EulerRadialCurvature(const CachedCurvature& curvature, const glm::vec3& w) noexcept
+{
+	const float cos2 = glm::dot(w, curvature.principalDirections * w) / glm::dot(w, w);
+	return curvature.k2 + (curvature.k1 - curvature.k2) * cos2;
+}
+
+// At the samples of the cache and halfway between them (up to maxPatches patches, evenly spaced in the model) the radial curvature of
+// the cache for the directions of the tangents and their bisectors is compared with II(w, w) / I(w, w) of the surface
+CurvatureCacheCheck check_CurvatureCache(const std::vector<BezierSurface>& bsurfaces, unsigned int resolution, std::size_t maxPatches)
+{
+	CurvatureCacheCheck check;
+	const CurvatureCacheImage image = gen_CurvatureCacheImage(bsurfaces, resolution, 1u << 30);
+	if (image.texels.empty())
+		return check;
+	const std::size_t patchStep = std::max<std::size_t>(1, bsurfaces.size() / std::max<std::size_t>(1, maxPatches));
+	const unsigned int r = image.resolution;
+	double maxCurvature = 0.0, interpolatedSum = 0.0;
+	std::size_t interpolatedSamples = 0;
+	for (std::size_t patch = 0; patch < bsurfaces.size(); patch += patchStep)
+	{
+		check.patches++;
+		const float size = calc_PatchSize(bsurfaces[patch]);
+		// steps of half a cell: the even ones are on the samples of the grid
+		for (unsigned int iv = 0; iv <= 2 * r - 2; iv++)
+			for (unsigned int iu = 0; iu <= 2 * r - 2; iu++)
+			{
+				const float u = (float)iu / (2 * r - 2), v = (float)iv / (2 * r - 2);
+				const BezierSurfaceSample s = eval_BezierSurface(bsurfaces[patch], u, v);
+				if (!has_TangentPlane(s, size))
+					continue;
+				const CachedCurvature cached = calc_CachedCurvature(image, patch, u, v);
+				const bool onGrid = iu % 2 == 0 && iv % 2 == 0;
+				const float E = glm::dot(s.tangent, s.tangent), F = glm::dot(s.tangent, s.bitangent), G = glm::dot(s.bitangent, s.bitangent);
+				const float L = glm::dot(s.normal, s.uu), M = glm::dot(s.normal, s.uv), N = glm::dot(s.normal, s.vv);
+				const SurfaceCurvature exact = calc_SurfaceCurvature(s);
+				maxCurvature = std::max({ maxCurvature, (double)std::abs(exact.k1), (double)std::abs(exact.k2) });
+				check.maxNormalError = std::max(check.maxNormalError, (double)std::acos(std::clamp(glm::dot(cached.normal, s.normal), -1.0f, 1.0f)));
+				// w = a dS/du + b dS/dv
+				const float directions[4][2] = { { 1.0f, 0.0f }, { 0.0f, 1.0f }, { 1.0f, 1.0f }, { 1.0f, -1.0f } };
+				for (const auto& ab : directions)
+				{
+					const float a = ab[0], b = ab[1];
+					const float kr = (L * a * a + 2.0f * M * a * b + N * b * b) / (E * a * a + 2.0f * F * a * b + G * b * b);
+					const double error = std::abs(calc_EulerRadialCurvature(cached, a * s.tangent + b * s.bitangent) - kr);
+					if (onGrid)
+						check.maxGridError = std::max(check.maxGridError, error);
+					else
+					{
+						check.maxInterpolatedError = std::max(check.maxInterpolatedError, error);
+						interpolatedSum += error;
+						interpolatedSamples++;
+					}
+				}
+				check.samples++;
+			}
+	}
+	maxCurvature = std::max(maxCurvature, 1e-30);
+	check.maxGridError /= maxCurvature;
+	check.maxInterpolatedError /= maxCurvature;
+	check.averageInterpolatedError = interpolatedSamples ? interpolatedSum / interpolatedSamples / maxCurvature : 0.0;
+	return check;
+}
+
+/////////////////// CURVATURE CACHE class ///////////////////////
+class CurvatureCache
+{
+public:
+
+	CurvatureCache() = default;
+
+	CurvatureCache(const CurvatureCache&) = delete;
+	CurvatureCache& operator=(const CurvatureCache&) = delete;
+
+	// Samples the patches and uploads them with the patches to draw (the previous cache is dropped): false if the atlas does not fit
+	// in a texture
+	bool build(const std::vector<BezierSurface>& bsurfaces, ThreadPool* pool = nullptr)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		GLint maxTextureSize = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+		CurvatureCacheImage image = gen_CurvatureCacheImage(bsurfaces, CURVATURE_CACHE_RESOLUTION, (unsigned int)maxTextureSize, pool);
+		patchCount = bsurfaces.size();
+		tiles = image.tilesPerRow;
+		bytes = 0;
+		if (image.texels.empty())
+		{
+			release();
+			return false;
+		}
+		if (!texture)
+			glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		// half floats: the values are interpolated by the sampler, 16 bits are enough for normals and curvatures
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA16F, image.width, image.height, CURVATURE_CACHE_LAYERS, 0, GL_RGBA, GL_FLOAT, image.texels.data());
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		mesh = std::make_unique<TerrainMesh>(bsurfaces);
+		bytes = (std::size_t)image.width * image.height * CURVATURE_CACHE_LAYERS * 4 * sizeof(std::uint16_t) + mesh->gpuBytes();
+		buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+		return true;
+	}
+
+	void bind(GLuint unit) const
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	// Draws the patches in the order of the tiles, without indices (the shaders find the tile of a patch from gl_VertexID)
+	void Draw() const
+	{
+		if (mesh)
+			mesh->Draw();
+	}
+
+	// Deletes the texture and the patch buffer (the GL context must be alive)
+	void release()
+	{
+		if (texture)
+			glDeleteTextures(1, &texture);
+		texture = 0;
+		mesh.reset();
+		bytes = 0;
+	}
+
+	bool isReady() const noexcept { return texture != 0 && mesh != nullptr; }
+
+	// tiles in a row of the atlas (the shader finds the tile of a patch from its index)
+	unsigned int tilesPerRow() const noexcept { return tiles; }
+	unsigned int resolution() const noexcept { return CURVATURE_CACHE_RESOLUTION; }
+	std::size_t patches() const noexcept { return patchCount; }
+	std::size_t gpuBytes() const noexcept { return bytes; }
+	double buildTime() const noexcept { return buildMs; }
+
+private:
+
+	GLuint texture = 0;
+	std::unique_ptr<TerrainMesh> mesh;
+	unsigned int tiles = 0;
+	std::size_t patchCount = 0;
+	std::size_t bytes = 0;
+	double buildMs = 0.0;
+};
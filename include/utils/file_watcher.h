@@ -0,0 +1,140 @@
+/*
+File watcher
+- a background thread watches a set of files and collects the ones modified on disk
+- on Linux the directories of the files are watched with inotify (editors often save by writing a new file and renaming it),
+  elsewhere the modification times are polled
+- the changes are taken by the GL thread (e.g. between two frames), that is the only one that rebuilds the shaders
+*/
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/////////////////// FILE WATCHER class ///////////////////////
+class FileWatcher
+{
+public:
+
+    explicit FileWatcher(const std::vector<std::string>& files) : files(files)
+    {
+        worker = std::thread(&FileWatcher::run, this);
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    ~FileWatcher()
+    {
+        stop = true;
+        worker.join();
+    }
+
+    // Files modified since the last call, each one reported once (paths as given to the constructor)
+    std::vector<std::string> takeChangedFiles()
+    {
+        std::lock_guard<std::mutex> lock(changedMutex);
+        std::vector<std::string> taken;
+        taken.swap(changed);
+        return taken;
+    }
+
+private:
+
+    // the watcher thread checks the stop request at least this often
+    static constexpr int POLL_INTERVAL_MS = 100;
+
+    void run()
+    {
+#ifdef __linux__
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd >= 0)
+        {
+            watchInotify(fd);
+            close(fd);
+            return;
+        }
+#endif
+        watchModificationTimes();
+    }
+
+    void publish(const std::string& file)
+    {
+        std::lock_guard<std::mutex> lock(changedMutex);
+        if (std::find(changed.begin(), changed.end(), file) == changed.end())
+            changed.push_back(file);
+    }
+
+#ifdef __linux__
+    void watchInotify(int fd)
+    {
+        // one watch for each directory, the events of the other files of the directory are ignored
+        std::unordered_map<int, std::filesystem::path> directories;
+        for (const auto& file : files)
+        {
+            std::filesystem::path directory = std::filesystem::path(file).parent_path();
+            int wd = inotify_add_watch(fd, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+            if (wd >= 0)
+                directories[wd] = directory;
+        }
+        alignas(inotify_event) char buffer[4096];
+        pollfd descriptor{ fd, POLLIN, 0 };
+        while (!stop)
+        {
+            if (poll(&descriptor, 1, POLL_INTERVAL_MS) <= 0)
+                continue;
+            ssize_t length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+                for (char* event = buffer; event < buffer + length; event += sizeof(inotify_event) + ((inotify_event*)event)->len)
+                {
+                    const inotify_event* e = (const inotify_event*)event;
+                    if (e->len == 0 || !directories.count(e->wd))
+                        continue;
+                    const std::filesystem::path path = directories[e->wd] / e->name;
+                    for (const auto& file : files)
+                        if (std::filesystem::path(file).lexically_normal() == path.lexically_normal())
+                            publish(file);
+                }
+        }
+    }
+#endif
+
+    void watchModificationTimes()
+    {
+        std::vector<std::filesystem::file_time_type> times(files.size());
+        std::error_code error;
+        for (std::size_t i = 0; i != files.size(); i++)
+            times[i] = std::filesystem::last_write_time(files[i], error);
+        while (!stop)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(POLL_INTERVAL_MS));
+            for (std::size_t i = 0; i != files.size(); i++)
+            {
+                // a file being replaced may be missing for a moment: it is checked again at the next poll
+                auto time = std::filesystem::last_write_time(files[i], error);
+                if (!error && time != times[i])
+                {
+                    times[i] = time;
+                    publish(files[i]);
+                }
+            }
+        }
+    }
+
+    const std::vector<std::string> files;
+    std::mutex changedMutex;
+    std::vector<std::string> changed;
+    std::atomic<bool> stop{ false };
+    // declared last: started when the other members are initialized
+    std::thread worker;
+};
@@ -0,0 +1,117 @@
+/*
+GPU timer
+- GL_TIME_ELAPSED queries in a small ring: the result of a query is read a few frames after it was issued, when the GPU
+  is done with it, so the measure never stalls the pipeline (flush waits for the pending ones, e.g. at the end of a benchmark)
+- the queries are created at the first use: the timer can be declared before the GL context, release() must be called before
+  the context is destroyed
+*/
+#pragma once
+#include <vector>
+
+/////////////////// GPU TIMER class ///////////////////////
+class GpuTimer
+{
+public:
+
+    explicit GpuTimer(unsigned int ringSize = 4) : slots(ringSize > 1 ? ringSize : 2) {}
+
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    // Starts the measure of the commands issued until end() (begin/end pairs cannot be nested)
+    void begin()
+    {
+        if (slots[0].query == 0)
+            for (auto& slot : slots)
+                glGenQueries(1, &slot.query);
+        collect();
+        // the ring is full: the oldest result is waited for
+        if (slots[next].pending)
+            read(slots[next]);
+        glBeginQuery(GL_TIME_ELAPSED, slots[next].query);
+    }
+
+    void end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        slots[next].pending = true;
+        slots[next].counted = true;
+        next = (next + 1) % slots.size();
+    }
+
+    // Reads the results already available (called by begin)
+    void collect()
+    {
+        for (auto& slot : slots)
+        {
+            if (!slot.pending)
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(slot.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+                read(slot);
+        }
+    }
+
+    // Waits for every pending result
+    void flush()
+    {
+        for (auto& slot : slots)
+            if (slot.pending)
+                read(slot);
+    }
+
+    // Restarts the sums: the results of the queries still pending are dropped
+    void reset() noexcept
+    {
+        for (auto& slot : slots)
+            slot.counted = false;
+        samples = 0;
+        totalMs = 0.0;
+    }
+
+    // Deletes the queries (the GL context must be alive)
+    void release()
+    {
+        for (auto& slot : slots)
+        {
+            if (slot.query)
+                glDeleteQueries(1, &slot.query);
+            slot = Slot();
+        }
+        next = 0;
+    }
+
+    // last result read, number of results and their sum since the last reset (in milliseconds)
+    double lastMs = 0.0;
+    unsigned int samples = 0;
+    double totalMs = 0.0;
+
+    double averageMs() const noexcept { return samples ? totalMs / samples : 0.0; }
+
+private:
+
+    struct Slot
+    {
+        GLuint query = 0;
+        bool pending = false;
+        // false if the timer was reset after the query was issued
+        bool counted = false;
+    };
+
+    std::vector<Slot> slots;
+    std::size_t next = 0;
+
+    void read(Slot& slot)
+    {
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(slot.query, GL_QUERY_RESULT, &nanoseconds);
+        slot.pending = false;
+        lastMs = nanoseconds * 1e-6;
+        if (slot.counted)
+        {
+            samples++;
+            totalMs += lastMs;
+        }
+    }
+};
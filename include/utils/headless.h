@@ -0,0 +1,345 @@
+/*
+Headless rendering
+- frames rendered in an offscreen frame buffer (any resolution, independent from the window) along a camera path
+- pixels read back asynchronously in a ring of pixel buffer objects: glReadPixels only queues the copy, the pixels of a
+  frame are mapped a few frames later, when the GPU is done with them
+- PNG files encoded and written by background threads, so rendering never waits for the disk
+*/
+#pragma once
+#include <utils/png_writer.h>
+#include <utils/thread_pool.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+// Options of the headless mode, from the command line (see parse_HeadlessSettings)
+struct HeadlessSettings {
+    bool enabled = false;
+    GLuint width = 1920;
+    GLuint height = 1080;
+    // frames of the turntable (a camera path file gives its own number of frames)
+    GLuint frames = 36;
+    // "turntable" (a full turn around the model) or a file with a camera key for each line
+    std::string cameraPath = "turntable";
+    // "terrain" or the path of a .bez/.bbez model
+    std::string model = "terrain";
+    GLuint style = 0;
+    std::string outputDirectory = "frames";
+    // "native", "egl" or "osmesa" (the last one is a software context: no GPU nor display server is needed
+    // when GLFW is built with its OSMesa backend)
+    std::string contextApi = "native";
+    // frames queued for the PNG writers at most, rendering waits beyond it
+    GLuint maxQueuedFrames = 8;
+    // runs the ownership check of the terrain GPU buffers (see check_TerrainBuffers) instead of rendering
+    bool checkBuffers = false;
+};
+
+// Camera position and target of a frame
+struct CameraKey {
+    glm::vec3 position;
+    glm::vec3 target;
+};
+
+//Methods definition
+bool parse_HeadlessSettings(int argc, char* argv[], HeadlessSettings& settings);
+std::vector<CameraKey> read_CameraPath(const std::string& path);
+std::vector<CameraKey> gen_TurntablePath(const glm::vec3& position, const glm::vec3& target, unsigned int frames);
+std::vector<CameraKey> gen_FlyThroughPath(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& modelMatrix, unsigned int frames);
+
+//Methods implementation
+// --headless [--size WxH] [--frames N] [--camera-path turntable|file] [--model terrain|file.bez] [--style i]
+//            [--output directory] [--context native|egl|osmesa] [--check-buffers]
+// returns false on malformed options
+bool parse_HeadlessSettings(int argc, char* argv[], HeadlessSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string option = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (option == "--headless")
+            settings.enabled = true;
+        else if (option == "--check-buffers")
+            settings.enabled = settings.checkBuffers = true;
+        else if (option == "--size" && hasValue)
+        {
+            if (std::sscanf(argv[++i], "%ux%u", &settings.width, &settings.height) != 2 || settings.width == 0 || settings.height == 0)
+                return false;
+        }
+        else if (option == "--frames" && hasValue)
+            settings.frames = (GLuint)std::max(1, std::atoi(argv[++i]));
+        else if (option == "--camera-path" && hasValue)
+            settings.cameraPath = argv[++i];
+        else if (option == "--model" && hasValue)
+            settings.model = argv[++i];
+        else if (option == "--style" && hasValue)
+            settings.style = (GLuint)std::max(0, std::atoi(argv[++i]));
+        else if (option == "--output" && hasValue)
+            settings.outputDirectory = argv[++i];
+        else if (option == "--context" && hasValue)
+        {
+            settings.contextApi = argv[++i];
+            if (settings.contextApi != "native" && settings.contextApi != "egl" && settings.contextApi != "osmesa")
+                return false;
+        }
+    }
+    return true;
+}
+
+// One key for each line: "px py pz tx ty tz" (world space), empty lines and lines starting with # are skipped
+std::vector<CameraKey> read_CameraPath(const std::string& path)
+{
+    std::vector<CameraKey> keys;
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream values(line);
+        CameraKey key;
+        if (values >> key.position.x >> key.position.y >> key.position.z >> key.target.x >> key.target.y >> key.target.z)
+            keys.push_back(key);
+    }
+    return keys;
+}
+
+// The camera turns around the vertical axis through target, at the height and distance of position
+std::vector<CameraKey> gen_TurntablePath(const glm::vec3& position, const glm::vec3& target, unsigned int frames)
+{
+    std::vector<CameraKey> keys(frames);
+    const glm::vec3 offset = position - target;
+    for (unsigned int i = 0; i != frames; i++)
+    {
+        const float angle = glm::two_pi<float>() * i / frames;
+        const float c = std::cos(angle), s = std::sin(angle);
+        keys[i].position = target + glm::vec3(c * offset.x + s * offset.z, offset.y, -s * offset.x + c * offset.z);
+        keys[i].target = target;
+    }
+    return keys;
+}
+
+// Low flight over a terrain (bounds in object space, keys in world space): across its length along a wide S, a bit above the highest
+// point, looking ahead and slightly down, so near and far patches are both in view
+std::vector<CameraKey> gen_FlyThroughPath(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::mat4& modelMatrix, unsigned int frames)
+{
+    std::vector<CameraKey> keys(frames);
+    const glm::vec3 size = boundsMax - boundsMin;
+    const float extent = std::max(size.x, size.z);
+    auto point = [&](float t) {
+        return glm::vec3(boundsMin.x + size.x * (0.1f + 0.8f * t), boundsMax.y + 0.05f * extent,
+            0.5f * (boundsMin.z + boundsMax.z) + 0.3f * size.z * std::sin(glm::two_pi<float>() * t));
+    };
+    for (unsigned int i = 0; i != frames; i++)
+    {
+        const float t = frames > 1 ? (float)i / (frames - 1) : 0.0f;
+        const glm::vec3 position = point(t);
+        const glm::vec3 ahead = point(t + 0.05f) - position;
+        const glm::vec3 target = position + ahead + glm::vec3(0.0f, -0.4f * glm::length(ahead), 0.0f);
+        keys[i].position = glm::vec3(modelMatrix * glm::vec4(position, 1.0f));
+        keys[i].target = glm::vec3(modelMatrix * glm::vec4(target, 1.0f));
+    }
+    return keys;
+}
+
+
+/////////////////// OFFSCREEN TARGET class ///////////////////////
+// Frame buffer with a RGBA8 color and a 24 bit depth render buffer
+class OffscreenTarget
+{
+public:
+    GLuint width, height;
+
+    OffscreenTarget(GLuint width, GLuint height) : width(width), height(height)
+    {
+        glGenRenderbuffers(1, &this->colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glGenRenderbuffers(1, &this->depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glGenFramebuffers(1, &this->FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthBuffer);
+        complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    OffscreenTarget(const OffscreenTarget&) = delete;
+    OffscreenTarget& operator=(const OffscreenTarget&) = delete;
+
+    ~OffscreenTarget()
+    {
+        glDeleteFramebuffers(1, &this->FBO);
+        glDeleteRenderbuffers(1, &this->colorBuffer);
+        glDeleteRenderbuffers(1, &this->depthBuffer);
+    }
+
+    bool isComplete() const noexcept { return complete; }
+
+    // The next draw calls render in the target (and it is the source of FrameDumper::capture)
+    void Bind() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, this->FBO);
+        glViewport(0, 0, width, height);
+    }
+
+private:
+    GLuint FBO = 0, colorBuffer = 0, depthBuffer = 0;
+    bool complete = false;
+};
+
+
+/////////////////// FRAME DUMPER class ///////////////////////
+// Asynchronous readback of the bound frame buffer in PNG files (directory/frame_00000.png, ...)
+class FrameDumper
+{
+public:
+    // Time the GL thread spent waiting: for the GPU to finish a frame (mapping its buffer) or for the writers (full queue)
+    double readbackWaitMs = 0.0;
+    double writerWaitMs = 0.0;
+    std::size_t capturedFrames = 0;
+
+    FrameDumper(GLuint width, GLuint height, const std::string& directory, GLuint maxQueuedFrames = 8,
+                unsigned int writers = std::max(1u, std::thread::hardware_concurrency() / 2))
+        : width(width), height(height), directory(directory), maxQueuedFrames(std::max(1u, maxQueuedFrames)), writerPool(writers + 1)
+    {
+        std::error_code error;
+        std::filesystem::create_directories(directory, error);
+        slots.resize(RING_SIZE);
+        for (auto& slot : slots)
+        {
+            glGenBuffers(1, &slot.PBO);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PBO);
+            glBufferData(GL_PIXEL_PACK_BUFFER, frameBytes(), nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    FrameDumper(const FrameDumper&) = delete;
+    FrameDumper& operator=(const FrameDumper&) = delete;
+
+    // The frames still in flight are written before the buffers are released
+    ~FrameDumper()
+    {
+        finish();
+        for (auto& slot : slots)
+            glDeleteBuffers(1, &slot.PBO);
+    }
+
+    // Queues the copy of the bound read frame buffer in the next buffer of the ring. The buffer is reused after
+    // RING_SIZE frames: its previous frame is mapped and handed to the writers only then
+    void capture(std::size_t frame)
+    {
+        Slot& slot = slots[capturedFrames % RING_SIZE];
+        if (slot.busy)
+            collect(slot);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PBO);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.frame = frame;
+        slot.busy = true;
+        capturedFrames++;
+    }
+
+    // Collects the frames in flight (oldest first) and waits for the writers
+    void finish()
+    {
+        for (std::size_t i = 0; i != RING_SIZE; i++)
+        {
+            Slot& slot = slots[(capturedFrames + i) % RING_SIZE];
+            if (slot.busy)
+                collect(slot);
+        }
+        std::unique_lock<std::mutex> lock(writeMutex);
+        written.wait(lock, [this] { return queuedFrames == 0; });
+    }
+
+    std::size_t writtenFrames() const { std::lock_guard<std::mutex> lock(writeMutex); return writtenCount; }
+    std::size_t failedFrames() const { std::lock_guard<std::mutex> lock(writeMutex); return failedCount; }
+    // average time spent by a writer thread to encode and write a frame
+    double averageWriteMs() const { std::lock_guard<std::mutex> lock(writeMutex); return writtenCount + failedCount ? totalWriteMs / (writtenCount + failedCount) : 0.0; }
+
+private:
+    // frames in flight on the GPU: the pixels of frame n are mapped while frame n + RING_SIZE is rendered
+    static constexpr std::size_t RING_SIZE = 3;
+
+    using Clock = std::chrono::high_resolution_clock;
+
+    struct Slot
+    {
+        GLuint PBO = 0;
+        GLsync fence = nullptr;
+        std::size_t frame = 0;
+        bool busy = false;
+    };
+
+    std::size_t frameBytes() const noexcept { return 4 * (std::size_t)width * height; }
+
+    void collect(Slot& slot)
+    {
+        auto start = Clock::now();
+        glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(10) * 1000 * 1000 * 1000);
+        glDeleteSync(slot.fence);
+        std::vector<unsigned char> pixels(frameBytes());
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PBO);
+        if (const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameBytes(), GL_MAP_READ_BIT))
+        {
+            std::memcpy(pixels.data(), mapped, frameBytes());
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.busy = false;
+        readbackWaitMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        // the queue of the writers is bounded, so that a slow disk cannot fill the memory
+        start = Clock::now();
+        {
+            std::unique_lock<std::mutex> lock(writeMutex);
+            written.wait(lock, [this] { return queuedFrames < maxQueuedFrames; });
+            queuedFrames++;
+        }
+        writerWaitMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        char name[32];
+        std::snprintf(name, sizeof(name), "frame_%05zu.png", slot.frame);
+        const std::string path = (std::filesystem::path(directory) / name).string();
+        writerPool.submit([this, path, pixels = std::move(pixels)]() {
+            auto writeStart = Clock::now();
+            const bool ok = write_PNG(path, pixels.data(), width, height);
+            const double ms = std::chrono::duration<double, std::milli>(Clock::now() - writeStart).count();
+            std::lock_guard<std::mutex> lock(writeMutex);
+            (ok ? writtenCount : failedCount)++;
+            totalWriteMs += ms;
+            queuedFrames--;
+            written.notify_all();
+        });
+    }
+
+    const GLuint width, height;
+    const std::string directory;
+    const std::size_t maxQueuedFrames;
+    std::vector<Slot> slots;
+    mutable std::mutex writeMutex;
+    std::condition_variable written;
+    std::size_t queuedFrames = 0;
+    std::size_t writtenCount = 0;
+    std::size_t failedCount = 0;
+    double totalWriteMs = 0.0;
+    // declared last: destroyed first, so the writers are joined while the members they use are still alive
+    ThreadPool writerPool;
+};
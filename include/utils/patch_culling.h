@@ -0,0 +1,135 @@
+/*
+Patch culling
+- CPU mirror of the culling test of terrainBezierTessellation_tcs.glsl (frustum test of the control points convex hull
+  and back facing test of the normal cone of the derivative nets), used to measure how many patches the GPU discards
+*/
+#pragma once
+#include <cmath>
+#include <vector>
+#include <glm/glm.hpp>
+#include <utils/bezier_surface.h>
+
+// Same extra aperture of the normal cone used by the control shader (the cone is exact, the margin only covers rounding)
+constexpr float PATCH_NORMAL_CONE_MARGIN = 0.01f;
+
+enum PatchCullResult {
+    PATCH_VISIBLE,
+    PATCH_OUTSIDE_FRUSTUM,
+    PATCH_BACK_FACING
+};
+
+// Culled patches accumulated over one or more views
+struct PatchCullingStats {
+    std::size_t views = 0;
+    std::size_t patches = 0;
+    std::size_t outsideFrustum = 0;
+    std::size_t backFacing = 0;
+
+    double culledRatio() const noexcept { return patches ? (double)(outsideFrustum + backFacing) / patches : 0.0; }
+};
+
+//Methods definition
+bool is_PatchOutsideFrustum(const BezierSurface& bsurface, const glm::mat4& modelViewProjection) noexcept;
+bool is_PatchBackFacing(const BezierSurface& bsurface, const glm::mat4& modelMatrix, const glm::vec3& cameraWorldPosition) noexcept;
+PatchCullResult cull_BezierPatch(const BezierSurface& bsurface, const glm::mat4& modelMatrix, const glm::mat4& viewProjection, const glm::vec3& cameraWorldPosition) noexcept;
+void calc_PatchCulling(const std::vector<BezierSurface>& bsurfaces, const glm::mat4& modelMatrix, const glm::mat4& viewProjection, const glm::vec3& cameraWorldPosition, PatchCullingStats& stats) noexcept;
+
+//Methods implementation
+// The patch lies in the convex hull of its control points: it is outside the frustum if all of them are outside the same clip plane
+bool is_PatchOutsideFrustum(const BezierSurface& bsurface, const glm::mat4& modelViewProjection) noexcept
+{
+	glm::vec4 clip[16];
+	for (unsigned int i = 0; i != 4; i++)
+		for (unsigned int j = 0; j != 4; j++)
+			clip[4 * i + j] = modelViewProjection * glm::vec4(bsurface[i][j], 1.0f);
+	for (int axis = 0; axis != 3; axis++)
+	{
+		bool allBelow = true, allAbove = true;
+		for (const auto& p : clip)
+		{
+			allBelow = allBelow && p[axis] < -p.w;
+			allAbove = allAbove && p[axis] > p.w;
+		}
+		if (allBelow || allAbove)
+			return true;
+	}
+	return false;
+}
+
+// Normal cone of the patch against the view directions towards its bounding sphere. The normal dS/du x dS/dv is a combination
+// with non negative weights of the cross products of the control vectors of the two derivative nets (hodographs), so the cone
+// of those 144 products holds every normal of the patch, also where an edge collapses to a point
+bool is_PatchBackFacing(const BezierSurface& bsurface, const glm::mat4& modelMatrix, const glm::vec3& cameraWorldPosition) noexcept
+{
+	// world control point (i, j) of the shader (i follows u, j follows v) is bsurface[j][i]
+	glm::vec3 world[4][4];
+	glm::vec3 centre(0.0f);
+	for (unsigned int i = 0; i != 4; i++)
+		for (unsigned int j = 0; j != 4; j++)
+		{
+			world[i][j] = glm::vec3(modelMatrix * glm::vec4(bsurface[j][i], 1.0f));
+			centre += world[i][j] / 16.0f;
+		}
+	float radius = 0.0f;
+	for (const auto& column : world)
+		for (const auto& p : column)
+			radius = std::max(radius, glm::distance(p, centre));
+
+	// control vectors of dS/du (3 x 4) and dS/dv (4 x 3), without the constant factor 3
+	glm::vec3 du[12], dv[12];
+	for (unsigned int i = 0; i != 3; i++)
+		for (unsigned int j = 0; j != 4; j++)
+		{
+			du[4 * i + j] = world[i + 1][j] - world[i][j];
+			dv[4 * i + j] = world[j][i + 1] - world[j][i];
+		}
+	// axis: sum of the unit products (null products do not contribute to the normal), then aperture in a second pass
+	glm::vec3 axis(0.0f);
+	for (const auto& a : du)
+		for (const auto& b : dv)
+		{
+			glm::vec3 n = glm::cross(a, b);
+			if (glm::length(n) > 0.0f)
+				axis += glm::normalize(n);
+		}
+	if (glm::length(axis) == 0.0f)
+		return false;
+	axis = glm::normalize(axis);
+	float coneCos = 1.0f;
+	for (const auto& a : du)
+		for (const auto& b : dv)
+		{
+			glm::vec3 n = glm::cross(a, b);
+			if (glm::length(n) > 0.0f)
+				coneCos = std::min(coneCos, glm::dot(axis, glm::normalize(n)));
+		}
+	const float coneAngle = std::acos(glm::clamp(coneCos, -1.0f, 1.0f)) + PATCH_NORMAL_CONE_MARGIN;
+	const glm::vec3 toCamera = cameraWorldPosition - centre;
+	const float cameraDistance = glm::length(toCamera);
+	if (cameraDistance <= radius)
+		return false;
+	const float viewAngle = std::acos(glm::clamp(glm::dot(axis, toCamera / cameraDistance), -1.0f, 1.0f));
+	return viewAngle > 1.5707963f + coneAngle + std::asin(radius / cameraDistance);
+}
+
+PatchCullResult cull_BezierPatch(const BezierSurface& bsurface, const glm::mat4& modelMatrix, const glm::mat4& viewProjection, const glm::vec3& cameraWorldPosition) noexcept
+{
+	if (is_PatchOutsideFrustum(bsurface, viewProjection * modelMatrix))
+		return PATCH_OUTSIDE_FRUSTUM;
+	if (is_PatchBackFacing(bsurface, modelMatrix, cameraWorldPosition))
+		return PATCH_BACK_FACING;
+	return PATCH_VISIBLE;
+}
+
+// Adds the patches culled from one view to stats
+void calc_PatchCulling(const std::vector<BezierSurface>& bsurfaces, const glm::mat4& modelMatrix, const glm::mat4& viewProjection, const glm::vec3& cameraWorldPosition, PatchCullingStats& stats) noexcept
+{
+	stats.views++;
+	stats.patches += bsurfaces.size();
+	for (const auto& bsurface : bsurfaces)
+	{
+		auto result = cull_BezierPatch(bsurface, modelMatrix, viewProjection, cameraWorldPosition);
+		stats.outsideFrustum += result == PATCH_OUTSIDE_FRUSTUM;
+		stats.backFacing += result == PATCH_BACK_FACING;
+	}
+}
@@ -0,0 +1,67 @@
+/*
+Patch store
+- one contiguous buffer with every patch of a terrain (or model): 16 control points per patch, patch after patch,
+  in the order of BezierSurface, that is also the layout of the GL_PATCHES vertex buffer
+- it is the only CPU copy of the patches: the masks are generated in it, the surfaces are evaluated and stitched in place,
+  and the GPU buffers are filled straight from it
+- a generated terrain keeps its l x w grid, so the borders shared by adjacent patches are indexed without searching them
+*/
+#pragma once
+#include <vector>
+#include <utils/bezier_surface.h>
+
+static_assert(sizeof(BezierSurface) == 16 * sizeof(glm::vec3), "BezierSurface must be 16 packed control points");
+
+/////////////////// PATCH STORE class ///////////////////////
+class PatchStore
+{
+public:
+
+    PatchStore() = default;
+
+    // takes the patches read from a file (no grid)
+    explicit PatchStore(std::vector<BezierSurface>&& bsurfaces) noexcept : bsurfaces(std::move(bsurfaces)) {}
+
+    // l x w patches in a single allocation, the content is written by the caller (e.g. gen_Terrain)
+    void reset(unsigned int l, unsigned int w)
+    {
+        bsurfaces.resize((std::size_t)l * w);
+        bsurfaces.shrink_to_fit();
+        gridLength = l;
+        gridWidth = w;
+    }
+
+    void clear() noexcept
+    {
+        bsurfaces = std::vector<BezierSurface>();
+        gridLength = gridWidth = 0;
+    }
+
+    std::size_t size() const noexcept { return bsurfaces.size(); }
+    bool empty() const noexcept { return bsurfaces.empty(); }
+
+    BezierSurface& operator[](std::size_t patch) noexcept { return bsurfaces[patch]; }
+    const BezierSurface& operator[](std::size_t patch) const noexcept { return bsurfaces[patch]; }
+    BezierSurface* data() noexcept { return bsurfaces.data(); }
+    const BezierSurface* data() const noexcept { return bsurfaces.data(); }
+
+    // every control point, 16 for each patch (ready for glBufferData)
+    const glm::vec3* points() const noexcept { return bsurfaces.empty() ? nullptr : &bsurfaces[0][0][0]; }
+    std::size_t pointCount() const noexcept { return 16 * bsurfaces.size(); }
+
+    // the patches seen as the vector used by the rest of the utils (no copy)
+    const std::vector<BezierSurface>& surfaces() const noexcept { return bsurfaces; }
+    std::vector<BezierSurface>& surfaces() noexcept { return bsurfaces; }
+
+    // patches grid of a generated terrain (0 x 0 for models read from file)
+    bool isGrid() const noexcept { return gridLength && (std::size_t)gridLength * gridWidth == bsurfaces.size(); }
+    unsigned int length() const noexcept { return gridLength; }
+    unsigned int width() const noexcept { return gridWidth; }
+
+    // CPU memory held by the store
+    std::size_t bytes() const noexcept { return bsurfaces.capacity() * sizeof(BezierSurface); }
+
+private:
+    std::vector<BezierSurface> bsurfaces;
+    unsigned int gridLength = 0, gridWidth = 0;
+};
@@ -0,0 +1,243 @@
+/*
+PNG writer
+- 8 bit RGB PNG files from the RGBA pixels read back from the frame buffer (bottom row first, as glReadPixels returns them)
+- every row is filtered (none, sub or up, the one with the smallest sum of residuals) and compressed with a single
+  deflate block of fixed Huffman codes and LZ77 matches: no dependencies, and the flat regions of the NPR styles
+  compress well
+*/
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//Methods definition
+bool write_PNG(const std::string& path, const unsigned char* rgba, unsigned int width, unsigned int height, bool bottomUp = true);
+std::vector<unsigned char> compress_Zlib(const std::vector<unsigned char>& data);
+std::uint32_t calc_CRC32(const unsigned char* data, std::size_t size, std::uint32_t crc = 0) noexcept;
+
+//Methods implementation
+std::uint32_t calc_CRC32(const unsigned char* data, std::size_t size, std::uint32_t crc) noexcept
+{
+	static const auto table = [] {
+		std::array<std::uint32_t, 256> t{};
+		for (std::uint32_t n = 0; n != 256; n++)
+		{
+			std::uint32_t c = n;
+			for (int k = 0; k != 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			t[n] = c;
+		}
+		return t;
+	}();
+	crc = ~crc;
+	for (std::size_t i = 0; i != size; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+namespace png_detail
+{
+	// Deflate bit stream: bits are packed from the least significant one, Huffman codes from their most significant bit
+	struct BitWriter
+	{
+		std::vector<unsigned char>& out;
+		std::uint32_t buffer = 0;
+		int count = 0;
+
+		void putBits(std::uint32_t bits, int length)
+		{
+			buffer |= bits << count;
+			count += length;
+			while (count >= 8)
+			{
+				out.push_back((unsigned char)buffer);
+				buffer >>= 8;
+				count -= 8;
+			}
+		}
+
+		void putCode(std::uint32_t code, int length)
+		{
+			std::uint32_t reversed = 0;
+			for (int i = 0; i != length; i++)
+				reversed |= ((code >> i) & 1u) << (length - 1 - i);
+			putBits(reversed, length);
+		}
+
+		void flush()
+		{
+			if (count > 0)
+				out.push_back((unsigned char)buffer);
+			buffer = 0;
+			count = 0;
+		}
+	};
+
+	// Fixed Huffman code of a literal/length symbol
+	inline void putLiteral(BitWriter& bits, unsigned int symbol)
+	{
+		if (symbol < 144)
+			bits.putCode(0x30 + symbol, 8);
+		else if (symbol < 256)
+			bits.putCode(0x190 + symbol - 144, 9);
+		else if (symbol < 280)
+			bits.putCode(symbol - 256, 7);
+		else
+			bits.putCode(0xC0 + symbol - 280, 8);
+	}
+
+	const unsigned short lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	const unsigned char lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	const unsigned short distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	const unsigned char distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	inline void putMatch(BitWriter& bits, unsigned int length, unsigned int distance)
+	{
+		int code = 28;
+		while (lengthBase[code] > length)
+			code--;
+		putLiteral(bits, 257 + code);
+		bits.putBits(length - lengthBase[code], lengthExtra[code]);
+		code = 29;
+		while (distanceBase[code] > distance)
+			code--;
+		bits.putCode(code, 5);
+		bits.putBits(distance - distanceBase[code], distanceExtra[code]);
+	}
+
+	inline void putBigEndian(std::vector<unsigned char>& out, std::uint32_t value)
+	{
+		out.push_back((unsigned char)(value >> 24));
+		out.push_back((unsigned char)(value >> 16));
+		out.push_back((unsigned char)(value >> 8));
+		out.push_back((unsigned char)value);
+	}
+
+	inline void putChunk(std::vector<unsigned char>& file, const char type[4], const std::vector<unsigned char>& data)
+	{
+		putBigEndian(file, (std::uint32_t)data.size());
+		const std::size_t start = file.size();
+		file.insert(file.end(), type, type + 4);
+		file.insert(file.end(), data.begin(), data.end());
+		putBigEndian(file, calc_CRC32(file.data() + start, file.size() - start));
+	}
+}
+
+// zlib stream of data: a single final deflate block with fixed Huffman codes, matches found with a hash of the next 3 bytes
+std::vector<unsigned char> compress_Zlib(const std::vector<unsigned char>& data)
+{
+	using namespace png_detail;
+	constexpr std::size_t WINDOW = 32768, MIN_MATCH = 3, MAX_MATCH = 258, HASH_BITS = 15;
+	std::vector<unsigned char> out = { 0x78, 0x01 };
+	out.reserve(data.size() / 4 + 64);
+	BitWriter bits{ out };
+	// final block, fixed Huffman codes
+	bits.putBits(1, 1);
+	bits.putBits(1, 2);
+
+	std::vector<std::int64_t> head(std::size_t(1) << HASH_BITS, -1);
+	auto hash = [&data](std::size_t i) {
+		return ((std::uint32_t)data[i] << 10 ^ (std::uint32_t)data[i + 1] << 5 ^ data[i + 2]) & ((1u << HASH_BITS) - 1);
+	};
+	std::size_t i = 0;
+	const std::size_t n = data.size();
+	while (i < n)
+	{
+		std::size_t length = 0, distance = 0;
+		if (i + MIN_MATCH <= n)
+		{
+			const std::uint32_t h = hash(i);
+			const std::int64_t candidate = head[h];
+			head[h] = (std::int64_t)i;
+			if (candidate >= 0 && i - (std::size_t)candidate <= WINDOW)
+			{
+				const std::size_t limit = std::min(MAX_MATCH, n - i);
+				while (length < limit && data[(std::size_t)candidate + length] == data[i + length])
+					length++;
+				distance = i - (std::size_t)candidate;
+			}
+		}
+		if (length >= MIN_MATCH)
+		{
+			putMatch(bits, (unsigned int)length, (unsigned int)distance);
+			// the positions inside the match are added to the hash table too
+			for (std::size_t k = i + 1; k != i + length && k + MIN_MATCH <= n; k++)
+				head[hash(k)] = (std::int64_t)k;
+			i += length;
+		}
+		else
+			putLiteral(bits, data[i++]);
+	}
+	putLiteral(bits, 256);
+	bits.flush();
+
+	// Adler-32 of the uncompressed data
+	std::uint32_t a = 1, b = 0;
+	for (std::size_t k = 0; k < n;)
+	{
+		// sums reduced every 5552 bytes, the longest run that cannot overflow
+		const std::size_t end = std::min(n, k + 5552);
+		for (; k != end; k++)
+		{
+			a += data[k];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	putBigEndian(out, (b << 16) | a);
+	return out;
+}
+
+bool write_PNG(const std::string& path, const unsigned char* rgba, unsigned int width, unsigned int height, bool bottomUp)
+{
+	using namespace png_detail;
+	const std::size_t rowSize = 3 * (std::size_t)width;
+	// filtered rows: filter type byte followed by the RGB residuals
+	std::vector<unsigned char> filtered;
+	filtered.reserve((rowSize + 1) * height);
+	std::vector<unsigned char> previous(rowSize, 0), current(rowSize), residuals[3];
+	for (auto& r : residuals)
+		r.resize(rowSize);
+	for (unsigned int y = 0; y != height; y++)
+	{
+		const unsigned char* row = rgba + 4 * (std::size_t)width * (bottomUp ? height - 1 - y : y);
+		for (unsigned int x = 0; x != width; x++)
+			for (int c = 0; c != 3; c++)
+				current[3 * x + c] = row[4 * x + c];
+		// none, sub and up filters: the one with the smallest sum of absolute (signed) residuals is kept
+		unsigned long cost[3] = { 0, 0, 0 };
+		for (std::size_t k = 0; k != rowSize; k++)
+		{
+			residuals[0][k] = current[k];
+			residuals[1][k] = (unsigned char)(current[k] - (k >= 3 ? current[k - 3] : 0));
+			residuals[2][k] = (unsigned char)(current[k] - previous[k]);
+			for (int f = 0; f != 3; f++)
+				cost[f] += (unsigned long)std::abs((int)(signed char)residuals[f][k]);
+		}
+		int best = 0;
+		for (int f = 1; f != 3; f++)
+			if (cost[f] < cost[best])
+				best = f;
+		filtered.push_back((unsigned char)best);
+		filtered.insert(filtered.end(), residuals[best].begin(), residuals[best].end());
+		previous.swap(current);
+	}
+
+	std::vector<unsigned char> file = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	std::vector<unsigned char> header;
+	putBigEndian(header, width);
+	putBigEndian(header, height);
+	// 8 bits per channel, RGB, deflate, adaptive filtering, no interlace
+	header.insert(header.end(), { 8, 2, 0, 0, 0 });
+	putChunk(file, "IHDR", header);
+	putChunk(file, "IDAT", compress_Zlib(filtered));
+	putChunk(file, "IEND", {});
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	return (bool)out.write((const char*)file.data(), (std::streamsize)file.size());
+}
@@ -4,6 +4,7 @@ Random Float  Util Class and Methods
 #pragma once
 #include <random>
 #include <ctime>
+#include <cstdint>
 
 class RNG_float {
 public:
@@ -12,4 +13,31 @@ public:
 	std::uniform_real_distribution<float> dist(min, max); return dist(rng); }
 private:
 	std::mt19937 rng;
-};
\ No newline at end of file
+};
+
+/*
+Counter-based (stateless) random floats
+- the value only depends on a key and a counter (SplitMix64 mixing), so there is no state to share between threads
+- the same (seed, patch, control point) always gives the same value on any machine and thread count
+*/
+// SplitMix64 finalizer: bijective mixing of 64 bits
+constexpr std::uint64_t mix_SplitMix64(std::uint64_t x) noexcept
+{
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+// Key of a terrain patch, computed once and then combined with the counter of each draw
+constexpr std::uint64_t calc_rand_key(std::uint32_t seed, std::uint32_t i, std::uint32_t j) noexcept
+{
+	return mix_SplitMix64(mix_SplitMix64(((std::uint64_t)seed << 32) | i) ^ j);
+}
+
+// Uniform float between min and max from (key, counter): 24 random bits, exactly representable as float
+constexpr float rand_float(std::uint64_t key, std::uint32_t counter, float min, float max) noexcept
+{
+	const float unit = (float)(mix_SplitMix64(key ^ ((std::uint64_t)counter << 32)) >> 40) * (1.0f / 16777216.0f);
+	return min + (max - min) * unit;
+}
@@ -1,6 +1,12 @@
 /*
 Shader class
 - loading Shader source code, Shader Program creation
+- uniform locations resolved once after linking, set through typed setters keyed by hashed names (see hash_UniformName)
+- linked programs are saved as program binaries (glGetProgramBinary) in SHADER_CACHE_DIRECTORY and loaded on the
+  next launches instead of compiling the sources; the cache is keyed by the sources and the driver, any failure falls back
+  to the compilation
+- Reload() rebuilds the program from its files (hot reload), keeping the current program if the new one does not link
+- the varyings captured by transform feedback (if any) are declared before linking, interleaved in a single buffer
 */
 
 #pragma once
@@ -12,19 +18,61 @@ using namespace std;
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <initializer_list>
+#include <unordered_map>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// FNV-1a hash of a uniform name, evaluated at compile time for the names known by the application
+constexpr std::uint32_t hash_UniformName(const char* name) noexcept
+{
+    std::uint32_t hash = 2166136261u;
+    for (; *name != '\0'; name++)
+        hash = (hash ^ (std::uint32_t)(unsigned char)*name) * 16777619u;
+    return hash;
+}
+
+// Directory of the program binaries (relative to the working directory, as the shader paths)
+constexpr const char* SHADER_CACHE_DIRECTORY = "ShaderCache/";
+
+// Time spent creating a Shader Program (milliseconds), and whether it was loaded from the program binary cache
+struct ShaderLoadTimings {
+    double readMs = 0.0;
+    double compileMs = 0.0;
+    double linkMs = 0.0;
+    // glProgramBinary of the cached program, in place of compile and link
+    double cacheLoadMs = 0.0;
+    bool cacheHit = false;
+
+    double totalMs() const noexcept { return readMs + compileMs + linkMs + cacheLoadMs; }
+};
 
 /////////////////// SHADER class ///////////////////////
 class Shader
 {
 public:
     GLuint Program;
+    ShaderLoadTimings timings;
+    // false if the program did not compile or link
+    bool linked = false;
+    // programs are compiled from the sources when false (e.g. to measure the compilation time)
+    inline static bool useProgramCache = true;
 
     //////////////////////////////////////////
 
     //constructor
     Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
     {
+        sourcePaths = { vertexPath, fragmentPath };
         // Step 1: we retrieve shaders source code from provided filepaths
+        auto start = std::chrono::high_resolution_clock::now();
         string vertexCode;
         string fragmentCode;
         ifstream vShaderFile;
@@ -53,12 +101,19 @@ public:
         {
             cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
         }
+        timings.readMs = elapsedMs(start);
+
+        // a program linked from the same sources by the same driver is loaded from the cache
+        std::string cachePath = programCachePath({ &vertexCode, &fragmentCode });
+        if (loadProgramBinary(cachePath))
+            return;
 
         // Convert strings to char pointers
         const GLchar* vShaderCode = vertexCode.c_str();
         const GLchar * fShaderCode = fragmentCode.c_str();
 
         // Step 2: we compile the shaders
+        start = std::chrono::high_resolution_clock::now();
         GLuint vertex, fragment;
 
         // Vertex Shader
@@ -74,14 +129,20 @@ public:
         glCompileShader(fragment);
         // check compilation errors
         checkCompileErrors(fragment, "FRAGMENT");
+        timings.compileMs = elapsedMs(start);
 
         // Step 3: Shader Program creation
+        start = std::chrono::high_resolution_clock::now();
         this->Program = glCreateProgram();
         glAttachShader(this->Program, vertex);
         glAttachShader(this->Program, fragment);
+        glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(this->Program);
         // check linking errors
-        checkCompileErrors(this->Program, "PROGRAM");
+        linked = checkCompileErrors(this->Program, "PROGRAM");
+        timings.linkMs = elapsedMs(start);
+        cacheUniformLocations();
+        saveProgramBinary(cachePath);
 
         // Step 4: we delete the shaders because they are linked to the Shader Program, and we do not need them anymore
         glDeleteShader(vertex);
@@ -89,10 +150,17 @@ public:
     }
 
     // ------------------------------------------------------------------------
+    // defines (e.g. "#define NAME\n") are added to every stage, to compile a variant of the same sources
+    // feedbackVaryings are the outputs of the last vertex processing stage captured by transform feedback
     Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath,
-           const char* tessControlPath = nullptr, const char* tessEvalPath = nullptr)
+           const char* tessControlPath = nullptr, const char* tessEvalPath = nullptr, const std::string& defines = "",
+           const std::vector<std::string>& feedbackVaryings = {})
     {
+        sourcePaths = { vertexPath, fragmentPath, geometryPath ? geometryPath : "", tessControlPath ? tessControlPath : "", tessEvalPath ? tessEvalPath : "" };
+        sourceDefines = defines;
+        sourceFeedbackVaryings = feedbackVaryings;
         // 1. retrieve the vertex/fragment source code from filePath
+        auto start = std::chrono::high_resolution_clock::now();
         std::string vertexCode;
         std::string fragmentCode;
         std::string geometryCode;
@@ -152,9 +220,23 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        vertexCode = addDefines(vertexCode, defines);
+        fragmentCode = addDefines(fragmentCode, defines);
+        geometryCode = addDefines(geometryCode, defines);
+        tessControlCode = addDefines(tessControlCode, defines);
+        tessEvalCode = addDefines(tessEvalCode, defines);
+        timings.readMs = elapsedMs(start);
+        // a program linked from the same sources (defines and captured varyings) by the same driver is loaded from the cache
+        std::string varyingNames;
+        for (const auto& name : feedbackVaryings)
+            varyingNames += name + '\n';
+        std::string cachePath = programCachePath({ &vertexCode, &fragmentCode, &geometryCode, &tessControlCode, &tessEvalCode, &varyingNames });
+        if (loadProgramBinary(cachePath))
+            return;
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
+        start = std::chrono::high_resolution_clock::now();
         unsigned int vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -195,7 +277,9 @@ public:
             glCompileShader(tessEval);
             checkCompileErrors(tessEval, "TESS_EVALUATION");
         }
+        timings.compileMs = elapsedMs(start);
         // shader Program
+        start = std::chrono::high_resolution_clock::now();
         this->Program = glCreateProgram();
         glAttachShader(this->Program , vertex);
         glAttachShader(this->Program , fragment);
@@ -205,13 +289,28 @@ public:
             glAttachShader(this->Program, tessControl);
         if(tessEvalPath != nullptr)
             glAttachShader(this->Program, tessEval);
+        if (!feedbackVaryings.empty())
+        {
+            std::vector<const char*> names;
+            for (const auto& name : feedbackVaryings)
+                names.push_back(name.c_str());
+            glTransformFeedbackVaryings(this->Program, (GLsizei)names.size(), names.data(), GL_INTERLEAVED_ATTRIBS);
+        }
+        glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(this->Program);
-        checkCompileErrors(this->Program, "PROGRAM");
+        linked = checkCompileErrors(this->Program, "PROGRAM");
+        timings.linkMs = elapsedMs(start);
+        cacheUniformLocations();
+        saveProgramBinary(cachePath);
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
         if(geometryPath != nullptr)
             glDeleteShader(geometry);
+        if(tessControlPath != nullptr)
+            glDeleteShader(tessControl);
+        if(tessEvalPath != nullptr)
+            glDeleteShader(tessEval);
 
     }
 
@@ -223,11 +322,221 @@ public:
     // We delete the Shader Program when application closes
     void Delete() { glDeleteProgram(this->Program); }
 
+    // Location of an active uniform (-1 if the program does not use it: the setters then do nothing, as glUniform does)
+    GLint getUniformLocation(std::uint32_t nameHash) const
+    {
+        auto it = uniformLocations.find(nameHash);
+        return it != uniformLocations.end() ? it->second : -1;
+    }
+
+    // Typed setters: the program has to be in use
+    void setInt(std::uint32_t nameHash, GLint value) const { glUniform1i(getUniformLocation(nameHash), value); }
+    void setFloat(std::uint32_t nameHash, GLfloat value) const { glUniform1f(getUniformLocation(nameHash), value); }
+    void setVec2(std::uint32_t nameHash, const glm::vec2& value) const { glUniform2fv(getUniformLocation(nameHash), 1, glm::value_ptr(value)); }
+    void setVec3(std::uint32_t nameHash, const glm::vec3& value) const { glUniform3fv(getUniformLocation(nameHash), 1, glm::value_ptr(value)); }
+    void setMat3(std::uint32_t nameHash, const glm::mat3& value) const { glUniformMatrix3fv(getUniformLocation(nameHash), 1, GL_FALSE, glm::value_ptr(value)); }
+    void setMat4(std::uint32_t nameHash, const glm::mat4& value) const { glUniformMatrix4fv(getUniformLocation(nameHash), 1, GL_FALSE, glm::value_ptr(value)); }
+
+    // A uniform block of the program reads the buffer bound to the binding point (no layout(binding) in GLSL 4.10)
+    void bindUniformBlock(const std::string& blockName, GLuint binding)
+    {
+        uniformBlockBindings[blockName] = binding;
+        GLuint index = glGetUniformBlockIndex(this->Program, blockName.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(this->Program, index, binding);
+    }
+
+    // Source files of the stages (empty for the missing stages)
+    const std::vector<std::string>& getSourcePaths() const noexcept { return sourcePaths; }
+
+    // True if one of the source files of the program is in files
+    bool usesFile(const std::vector<std::string>& files) const
+    {
+        for (const auto& source : sourcePaths)
+            for (const auto& file : files)
+                if (!source.empty() && std::filesystem::path(source).lexically_normal() == std::filesystem::path(file).lexically_normal())
+                    return true;
+        return false;
+    }
+
+    // The program is rebuilt from its source files (and defines): it replaces the current one only if it links,
+    // otherwise the last good program is kept. The uniform blocks are bound again, the other uniforms have to be set again
+    bool Reload()
+    {
+        auto path = [this](std::size_t stage) { return stage < sourcePaths.size() && !sourcePaths[stage].empty() ? sourcePaths[stage].c_str() : nullptr; };
+        Shader reloaded(path(0), path(1), path(2), path(3), path(4), sourceDefines, sourceFeedbackVaryings);
+        if (!reloaded.linked)
+        {
+            glDeleteProgram(reloaded.Program);
+            return false;
+        }
+        glDeleteProgram(this->Program);
+        this->Program = reloaded.Program;
+        this->timings = reloaded.timings;
+        this->linked = true;
+        this->uniformLocations = std::move(reloaded.uniformLocations);
+        for (const auto& block : uniformBlockBindings)
+            bindUniformBlock(block.first, block.second);
+        return true;
+    }
+
 private:
+    // Source files of the stages (vertex, fragment, geometry, tessellation control and evaluation), defines and captured varyings, for Reload()
+    std::vector<std::string> sourcePaths;
+    std::string sourceDefines;
+    std::vector<std::string> sourceFeedbackVaryings;
+    // Uniform blocks bound by bindUniformBlock, bound again by Reload()
+    std::unordered_map<std::string, GLuint> uniformBlockBindings;
+    // Locations of the active uniforms outside of the uniform blocks, keyed by the hash of their name
+    std::unordered_map<std::uint32_t, GLint> uniformLocations;
+
     //////////////////////////////////////////
 
+    static double elapsedMs(std::chrono::high_resolution_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Path of the program binary of these sources: FNV-1a hash of the sources of every stage and of the driver strings
+    // (empty if the cache is disabled or the driver has no binary formats)
+    static std::string programCachePath(std::initializer_list<const std::string*> sources)
+    {
+        if (!useProgramCache)
+            return "";
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (formats == 0)
+            return "";
+        std::uint64_t hash = 14695981039346656037ull;
+        auto addBytes = [&hash](const char* data, std::size_t size) {
+            for (std::size_t i = 0; i != size; i++)
+                hash = (hash ^ (std::uint64_t)(unsigned char)data[i]) * 1099511628211ull;
+        };
+        // the stages are separated, so that moving code from one stage to the next changes the key
+        for (const std::string* source : sources)
+            addBytes(source->c_str(), source->size() + 1);
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        {
+            const char* driver = (const char*)glGetString(name);
+            if (driver)
+                addBytes(driver, std::strlen(driver) + 1);
+        }
+        char file[32];
+        std::snprintf(file, sizeof(file), "%016llx.bin", (unsigned long long)hash);
+        return std::string(SHADER_CACHE_DIRECTORY) + file;
+    }
+
+    // Program binary file: magic, binary format, binary size, binary
+    static constexpr char PROGRAM_BINARY_MAGIC[8] = { 'N', 'P', 'R', 'P', 'R', 'O', 'G', '1' };
+
+    // The program is created from its cached binary: false if missing, damaged or refused by the driver
+    // (e.g. after a driver update), the program is then compiled from the sources
+    bool loadProgramBinary(const std::string& path)
+    {
+        if (path.empty())
+            return false;
+        auto start = std::chrono::high_resolution_clock::now();
+        std::ifstream file(path, std::ios::binary);
+        char magic[8];
+        GLenum format = 0;
+        std::uint32_t size = 0;
+        if (!file.read(magic, sizeof(magic)) || std::memcmp(magic, PROGRAM_BINARY_MAGIC, sizeof(magic)) != 0
+            || !file.read((char*)&format, sizeof(format)) || !file.read((char*)&size, sizeof(size)))
+            return false;
+        // the binary must fill the rest of the file exactly (a damaged size would allocate any amount of memory)
+        std::error_code error;
+        const std::uintmax_t fileSize = std::filesystem::file_size(path, error);
+        if (error || size == 0 || fileSize != sizeof(magic) + sizeof(format) + sizeof(size) + (std::uintmax_t)size)
+            return false;
+        std::vector<char> binary(size);
+        if (!file.read(binary.data(), size))
+            return false;
+        this->Program = glCreateProgram();
+        glProgramBinary(this->Program, format, binary.data(), (GLsizei)size);
+        GLint success = 0;
+        glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glDeleteProgram(this->Program);
+            return false;
+        }
+        timings.cacheLoadMs = elapsedMs(start);
+        timings.cacheHit = true;
+        linked = true;
+        cacheUniformLocations();
+        return true;
+    }
+
+    // The linked program is written in the cache (failures only cost the compilation at the next launch)
+    void saveProgramBinary(const std::string& path) const
+    {
+        if (path.empty())
+            return;
+        GLint success = 0, size = 0;
+        glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+        glGetProgramiv(this->Program, GL_PROGRAM_BINARY_LENGTH, &size);
+        if (!success || size <= 0)
+            return;
+        std::vector<char> binary(size);
+        GLenum format = 0;
+        GLsizei length = 0;
+        glGetProgramBinary(this->Program, size, &length, &format, binary.data());
+        std::error_code error;
+        std::filesystem::create_directories(SHADER_CACHE_DIRECTORY, error);
+        // written in a temporary file and renamed, so that an interrupted write never leaves a damaged binary
+        std::string temporaryPath = path + ".tmp";
+        {
+            std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+            std::uint32_t binarySize = (std::uint32_t)length;
+            if (!file.write(PROGRAM_BINARY_MAGIC, sizeof(PROGRAM_BINARY_MAGIC)) || !file.write((const char*)&format, sizeof(format))
+                || !file.write((const char*)&binarySize, sizeof(binarySize)) || !file.write(binary.data(), length))
+                return;
+        }
+        std::filesystem::rename(temporaryPath, path, error);
+    }
+
+    // We query the active uniforms once, after linking: no string lookups are needed while rendering
+    void cacheUniformLocations()
+    {
+        uniformLocations.clear();
+        GLint count = 0;
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORMS, &count);
+        GLchar name[256];
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(this->Program, (GLuint)i, sizeof(name), &length, &size, &type, name);
+            // members of the uniform blocks have no location
+            GLint location = glGetUniformLocation(this->Program, name);
+            if (location < 0)
+                continue;
+            // arrays are reported as "name[0]", they are set by their name
+            std::string uniformName(name, length);
+            if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+                uniformName.resize(uniformName.size() - 3);
+            auto inserted = uniformLocations.emplace(hash_UniformName(uniformName.c_str()), location);
+            if (!inserted.second)
+                std::cout << "ERROR::SHADER::UNIFORM_NAME_HASH_COLLISION: " << uniformName << std::endl;
+        }
+    }
+
+    // The defines are inserted right after the #version directive, that has to be the first statement of the source
+    static std::string addDefines(const std::string& code, const std::string& defines)
+    {
+        if (defines.empty() || code.empty())
+            return code;
+        std::size_t version = code.find("#version");
+        std::size_t lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return defines + code;
+        return code.substr(0, lineEnd + 1) + defines + code.substr(lineEnd + 1);
+    }
+
     // Check compilation and linking errors
-        void checkCompileErrors(GLuint shader, std::string type)
+    // (returns false in case of errors)
+    bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -249,6 +558,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success;
     }
 
 };
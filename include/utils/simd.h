@@ -0,0 +1,164 @@
+/*
+SIMD lanes
+- simd_float: float vector of the widest instruction set enabled at compile time (AVX2: 8 lanes, SSE2: 4 lanes, otherwise 1 lane)
+- scalar_float: the same interface on a single float, reference (and fallback) of the vectorized code
+- only the operations needed by the batched Bezier evaluators: arithmetic, comparisons, select, sqrt, min, max, abs.
+  No fused multiply-add is used, so every lane rounds like the scalar code
+- that holds only without floating point contraction: with FMA enabled (e.g. -mfma) the compiler may fuse a * b + c in some
+  lanes or in the scalar references and not in others. The kernels and their references are compiled between
+  NPR_FP_CONTRACT_OFF_BEGIN and NPR_FP_CONTRACT_OFF_END, which turn contraction off whatever the build flags
+*/
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define NPR_SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NPR_SIMD_SSE2
+#endif
+
+// Code compiled without floating point contraction (a * b + c is never fused), the previous state is restored by the end macro
+#if defined(__clang__)
+#define NPR_FP_CONTRACT_OFF_BEGIN _Pragma("float_control(push)") _Pragma("clang fp contract(off)")
+#define NPR_FP_CONTRACT_OFF_END _Pragma("float_control(pop)")
+#elif defined(__GNUC__)
+#define NPR_FP_CONTRACT_OFF_BEGIN _Pragma("GCC push_options") _Pragma("GCC optimize(\"fp-contract=off\")")
+#define NPR_FP_CONTRACT_OFF_END _Pragma("GCC pop_options")
+#elif defined(_MSC_VER)
+#define NPR_FP_CONTRACT_OFF_BEGIN __pragma(fp_contract(push)) __pragma(fp_contract(off))
+#define NPR_FP_CONTRACT_OFF_END __pragma(fp_contract(pop))
+#else
+#define NPR_FP_CONTRACT_OFF_BEGIN
+#define NPR_FP_CONTRACT_OFF_END
+#endif
+
+/////////////////// SCALAR FLOAT class ///////////////////////
+struct scalar_float
+{
+    static constexpr int width = 1;
+    static constexpr const char* name = "scalar";
+    float v;
+
+    scalar_float() = default;
+    scalar_float(float s) : v(s) {}
+
+    static scalar_float load(const float* p) { return scalar_float(*p); }
+    void store(float* p) const { *p = v; }
+    float lane(int) const { return v; }
+
+    friend scalar_float operator+(scalar_float a, scalar_float b) { return a.v + b.v; }
+    friend scalar_float operator-(scalar_float a, scalar_float b) { return a.v - b.v; }
+    friend scalar_float operator*(scalar_float a, scalar_float b) { return a.v * b.v; }
+    friend scalar_float operator/(scalar_float a, scalar_float b) { return a.v / b.v; }
+    friend scalar_float operator-(scalar_float a) { return -a.v; }
+    scalar_float& operator+=(scalar_float b) { v += b.v; return *this; }
+    scalar_float& operator-=(scalar_float b) { v -= b.v; return *this; }
+    scalar_float& operator*=(scalar_float b) { v *= b.v; return *this; }
+
+    // comparisons give a mask of the lanes where they hold
+    struct mask { bool m; };
+    friend mask operator<(scalar_float a, scalar_float b) { return { a.v < b.v }; }
+    friend mask operator<=(scalar_float a, scalar_float b) { return { a.v <= b.v }; }
+    friend mask operator>(scalar_float a, scalar_float b) { return { a.v > b.v }; }
+    friend mask operator>=(scalar_float a, scalar_float b) { return { a.v >= b.v }; }
+    friend mask operator&(mask a, mask b) { return { a.m && b.m }; }
+    friend mask operator|(mask a, mask b) { return { a.m || b.m }; }
+
+    // a where the mask is set, b elsewhere
+    friend scalar_float select(mask m, scalar_float a, scalar_float b) { return m.m ? a : b; }
+    friend scalar_float sqrt(scalar_float a) { return std::sqrt(a.v); }
+    friend scalar_float min(scalar_float a, scalar_float b) { return b.v < a.v ? b : a; }
+    friend scalar_float max(scalar_float a, scalar_float b) { return a.v < b.v ? b : a; }
+    friend scalar_float abs(scalar_float a) { return std::fabs(a.v); }
+};
+
+
+#if defined(NPR_SIMD_AVX2)
+/////////////////// SIMD FLOAT class (AVX2) ///////////////////////
+struct simd_float
+{
+    static constexpr int width = 8;
+    static constexpr const char* name = "AVX2";
+    __m256 v;
+
+    simd_float() = default;
+    simd_float(__m256 x) : v(x) {}
+    simd_float(float s) : v(_mm256_set1_ps(s)) {}
+
+    static simd_float load(const float* p) { return _mm256_loadu_ps(p); }
+    void store(float* p) const { _mm256_storeu_ps(p, v); }
+    float lane(int i) const { float l[width]; store(l); return l[i]; }
+
+    friend simd_float operator+(simd_float a, simd_float b) { return _mm256_add_ps(a.v, b.v); }
+    friend simd_float operator-(simd_float a, simd_float b) { return _mm256_sub_ps(a.v, b.v); }
+    friend simd_float operator*(simd_float a, simd_float b) { return _mm256_mul_ps(a.v, b.v); }
+    friend simd_float operator/(simd_float a, simd_float b) { return _mm256_div_ps(a.v, b.v); }
+    friend simd_float operator-(simd_float a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+    simd_float& operator+=(simd_float b) { v = _mm256_add_ps(v, b.v); return *this; }
+    simd_float& operator-=(simd_float b) { v = _mm256_sub_ps(v, b.v); return *this; }
+    simd_float& operator*=(simd_float b) { v = _mm256_mul_ps(v, b.v); return *this; }
+
+    struct mask { __m256 m; };
+    friend mask operator<(simd_float a, simd_float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ) }; }
+    friend mask operator<=(simd_float a, simd_float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ) }; }
+    friend mask operator>(simd_float a, simd_float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ) }; }
+    friend mask operator>=(simd_float a, simd_float b) { return { _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ) }; }
+    friend mask operator&(mask a, mask b) { return { _mm256_and_ps(a.m, b.m) }; }
+    friend mask operator|(mask a, mask b) { return { _mm256_or_ps(a.m, b.m) }; }
+
+    friend simd_float select(mask m, simd_float a, simd_float b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+    friend simd_float sqrt(simd_float a) { return _mm256_sqrt_ps(a.v); }
+    // same operand order of the scalar version: b only where it is strictly smaller (greater)
+    friend simd_float min(simd_float a, simd_float b) { return _mm256_min_ps(b.v, a.v); }
+    friend simd_float max(simd_float a, simd_float b) { return _mm256_max_ps(b.v, a.v); }
+    friend simd_float abs(simd_float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+};
+
+#elif defined(NPR_SIMD_SSE2)
+/////////////////// SIMD FLOAT class (SSE2) ///////////////////////
+struct simd_float
+{
+    static constexpr int width = 4;
+    static constexpr const char* name = "SSE2";
+    __m128 v;
+
+    simd_float() = default;
+    simd_float(__m128 x) : v(x) {}
+    simd_float(float s) : v(_mm_set1_ps(s)) {}
+
+    static simd_float load(const float* p) { return _mm_loadu_ps(p); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    float lane(int i) const { float l[width]; store(l); return l[i]; }
+
+    friend simd_float operator+(simd_float a, simd_float b) { return _mm_add_ps(a.v, b.v); }
+    friend simd_float operator-(simd_float a, simd_float b) { return _mm_sub_ps(a.v, b.v); }
+    friend simd_float operator*(simd_float a, simd_float b) { return _mm_mul_ps(a.v, b.v); }
+    friend simd_float operator/(simd_float a, simd_float b) { return _mm_div_ps(a.v, b.v); }
+    friend simd_float operator-(simd_float a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+    simd_float& operator+=(simd_float b) { v = _mm_add_ps(v, b.v); return *this; }
+    simd_float& operator-=(simd_float b) { v = _mm_sub_ps(v, b.v); return *this; }
+    simd_float& operator*=(simd_float b) { v = _mm_mul_ps(v, b.v); return *this; }
+
+    struct mask { __m128 m; };
+    friend mask operator<(simd_float a, simd_float b) { return { _mm_cmplt_ps(a.v, b.v) }; }
+    friend mask operator<=(simd_float a, simd_float b) { return { _mm_cmple_ps(a.v, b.v) }; }
+    friend mask operator>(simd_float a, simd_float b) { return { _mm_cmpgt_ps(a.v, b.v) }; }
+    friend mask operator>=(simd_float a, simd_float b) { return { _mm_cmpge_ps(a.v, b.v) }; }
+    friend mask operator&(mask a, mask b) { return { _mm_and_ps(a.m, b.m) }; }
+    friend mask operator|(mask a, mask b) { return { _mm_or_ps(a.m, b.m) }; }
+
+    // SSE2 has no blend instruction
+    friend simd_float select(mask m, simd_float a, simd_float b) { return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)); }
+    friend simd_float sqrt(simd_float a) { return _mm_sqrt_ps(a.v); }
+    friend simd_float min(simd_float a, simd_float b) { return _mm_min_ps(b.v, a.v); }
+    friend simd_float max(simd_float a, simd_float b) { return _mm_max_ps(b.v, a.v); }
+    friend simd_float abs(simd_float a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+};
+
+#else
+// no vector instruction set: the vectorized code runs one lane at a time
+using simd_float = scalar_float;
+#endif
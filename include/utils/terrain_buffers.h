@@ -0,0 +1,141 @@
+/*
+GPU buffers of the terrain meshes
+- every TerrainMesh takes its vertex array and buffers from a pool and gives them back when it is destroyed, so the patch buffers
+  of a terrain are recycled by the next one (regenerations, one draw call per patch) instead of deleting and creating thousands of GL objects
+- a recycled vertex array keeps its attribute setup and its element buffer binding, only the content of the buffers is specified again.
+  The storage of the buffers is given back to the driver when the set enters the pool, so the pool holds no GPU memory
+- the pool counts the objects it created, deleted and recycled and the ones owned by the meshes: a set given back twice (or never given
+  back) shows up in the counters, see check_TerrainBuffers
+The pool is used by the GL thread only
+*/
+#pragma once
+#include <unordered_set>
+#include <vector>
+
+// Vertex array and buffers of a mesh (EBO is 0 for the meshes that are not indexed)
+struct TerrainBuffers {
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+};
+
+// Counters of the pool (sets of GL objects)
+struct TerrainBufferStats {
+    std::size_t created = 0;
+    std::size_t deleted = 0;
+    // taken from the pool instead of being created
+    std::size_t recycled = 0;
+    // waiting in the pool, and owned by the meshes
+    std::size_t pooled = 0;
+    std::size_t owned = 0;
+    // sets given back twice, or never taken from the pool
+    std::size_t invalidReleases = 0;
+};
+
+
+/////////////////// TERRAIN BUFFER POOL class ///////////////////////
+class TerrainBufferPool
+{
+public:
+
+    // maxPooled sets are kept for each kind (indexed or not), the others are deleted when they are given back
+    explicit TerrainBufferPool(std::size_t maxPooled = 1 << 15) : maxPooled(maxPooled) {}
+
+    TerrainBufferPool(const TerrainBufferPool&) = delete;
+    TerrainBufferPool& operator=(const TerrainBufferPool&) = delete;
+
+    TerrainBuffers acquire(bool indexed)
+    {
+        auto& pool = available[indexed ? 1 : 0];
+        TerrainBuffers buffers;
+        if (!pool.empty())
+        {
+            buffers = pool.back();
+            pool.pop_back();
+            stats.pooled--;
+            stats.recycled++;
+        }
+        else
+        {
+            glGenVertexArrays(1, &buffers.VAO);
+            glGenBuffers(1, &buffers.VBO);
+            if (indexed)
+                glGenBuffers(1, &buffers.EBO);
+            stats.created++;
+        }
+        owned.insert(buffers.VAO);
+        stats.owned = owned.size();
+        return buffers;
+    }
+
+    void release(const TerrainBuffers& buffers)
+    {
+        if (!buffers.VAO)
+            return;
+        if (owned.erase(buffers.VAO) == 0)
+        {
+            stats.invalidReleases++;
+            return;
+        }
+        stats.owned = owned.size();
+        auto& pool = available[buffers.EBO ? 1 : 0];
+        if (pool.size() < maxPooled)
+        {
+            orphan(buffers);
+            pool.push_back(buffers);
+            stats.pooled++;
+        }
+        else
+            destroy(buffers);
+    }
+
+    // Deletes every pooled set (the GL context must be alive), the ones owned by the meshes are not touched
+    void clear()
+    {
+        for (auto& pool : available)
+        {
+            for (const auto& buffers : pool)
+                destroy(buffers);
+            pool.clear();
+            pool.shrink_to_fit();
+        }
+        stats.pooled = 0;
+    }
+
+    const TerrainBufferStats& bufferStats() const noexcept { return stats; }
+
+private:
+    std::size_t maxPooled;
+    // [0] vertex array + VBO, [1] vertex array + VBO + EBO
+    std::vector<TerrainBuffers> available[2];
+    // vertex arrays owned by the meshes
+    std::unordered_set<GLuint> owned;
+    TerrainBufferStats stats;
+
+    // Empties the buffers of a pooled set (bound to the copy target, so that the element buffer of the bound vertex array does not change)
+    void orphan(const TerrainBuffers& buffers)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffers.VBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+        if (buffers.EBO)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffers.EBO);
+            glBufferData(GL_COPY_WRITE_BUFFER, 0, nullptr, GL_STATIC_DRAW);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    void destroy(const TerrainBuffers& buffers)
+    {
+        glDeleteVertexArrays(1, &buffers.VAO);
+        glDeleteBuffers(1, &buffers.VBO);
+        if (buffers.EBO)
+            glDeleteBuffers(1, &buffers.EBO);
+        stats.deleted++;
+    }
+};
+
+// Pool shared by every terrain mesh
+TerrainBufferPool& get_TerrainBufferPool()
+{
+    static TerrainBufferPool pool;
+    return pool;
+}
@@ -4,22 +4,81 @@ Terrain generation (as list of Bezier Surfaces)
 */
 #pragma once
 #include <utils/bezier_surface.h>
+#include <utils/patch_store.h>
+#include <utils/control_net.h>
+#include <utils/alloc_stats.h>
 #include <utils/geometry_util.h>
 #include <utils/csurface.hpp>
 #include <utils/csurface_gen.h>
 #include <utils/PerlinNoise.hpp>
+#include <utils/thread_pool.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
 
 class CSurface;
 
+// Generation throughput measured with a given number of threads
+struct TerrainGenBenchmark {
+	unsigned int threads;
+	double milliseconds;
+	double patchesPerSecond;
+};
+
+// Samples per second of the scalar and batch Perlin noise evaluators
+struct PerlinBenchmark {
+	double scalarSamplesPerSecond = 0.0;
+	double batchSamplesPerSecond = 0.0;
+};
+
+// Progress of a generation running on another thread (see TerrainRegenerator): rows of patches generated so far,
+// the generation gives up between two blocks of rows once cancelled is set
+struct TerrainGenProgress {
+	std::atomic<unsigned int> rowsDone{ 0 };
+	std::atomic<unsigned int> rows{ 0 };
+	std::atomic<bool> cancelled{ false };
+
+	float fraction() const noexcept { return rows ? (float)rowsDone / (float)rows : 0.0f; }
+};
+
+// Heap allocations of the CPU side build of a terrain: separate buffers (masks, subdivided surfaces, patches and the
+// indexed control net copied for the upload) against the patch store (the control net is written in the mapped GPU buffers)
+struct TerrainStorageBenchmark {
+	std::size_t patches = 0;
+	AllocationStats buffers, store;
+	double buffersMs = 0.0, storeMs = 0.0;
+	// both builds give the same control points
+	bool identical = false;
+};
+
 //Methods definition
-void stitch_BezierSurfaces(unsigned int l, unsigned int w, std::vector<BezierSurface>& bsurfaces);
+ThreadPool& get_GenerationPool();
+void stitch_BezierSurfaces(unsigned int l, unsigned int w, std::vector<BezierSurface>& bsurfaces, ThreadPool& pool = get_GenerationPool());
+void stitch_BezierSurfacesLocal(unsigned int l, unsigned int w, std::vector<BezierSurface>& bsurfaces, ThreadPool& pool = get_GenerationPool());
 void stitch_ADJEdges_smooth(BezierSurface &b0, BezierSurface &b1, bool horizontal);					
-std::vector<BezierSurface> gen_Terrain(unsigned int n, std::int32_t seed, std::int32_t octaves, float freq);
-std::vector<BezierSurface> gen_TerrainMasks(unsigned int l, unsigned int w, std::int32_t seed, std::int32_t octaves, float freq);
+void stitch_ADJEdges_smooth(const BezierSurface& s0, const BezierSurface& s1, BezierSurface& b0, BezierSurface& b1, bool horizontal);
+std::vector<BezierSurface> gen_Terrain(unsigned int n, std::int32_t seed, std::int32_t octaves, float freq, ThreadPool& pool = get_GenerationPool());
+bool gen_Terrain(PatchStore& store, unsigned int n, std::int32_t seed, std::int32_t octaves, float freq, ThreadPool& pool = get_GenerationPool(), TerrainGenProgress* progress = nullptr);
+std::vector<BezierSurface> gen_TerrainTile(std::int32_t row0, std::int32_t col0, unsigned int size, unsigned int n, std::int32_t seed, std::int32_t octaves, float freq, ThreadPool& pool = get_GenerationPool());
+CSurface calc_TerrainPatchSurface(std::int32_t row, std::int32_t col, unsigned int n);
+std::vector<BezierSurface> gen_TerrainMasks(unsigned int l, unsigned int w, std::int32_t seed, std::int32_t octaves, float freq, ThreadPool& pool = get_GenerationPool());
+std::vector<BezierSurface> gen_TerrainMasks(unsigned int l, unsigned int w, std::int32_t row0, std::int32_t col0, double fx, double fy, std::int32_t seed, std::int32_t octaves, ThreadPool& pool);
+void gen_TerrainMasks(unsigned int l, unsigned int w, std::int32_t row0, std::int32_t col0, double fx, double fy, std::int32_t seed, std::int32_t octaves, BezierSurface* masks, ThreadPool& pool);
 BezierSurface gen_TerrainSurface(const CSurface& surface, const BezierSurface& mask);
-std::vector<BezierSurface> gen_TerrainSurfaces(const std::vector<CSurface> &l, const std::vector<BezierSurface> &masks);
+std::vector<BezierSurface> gen_TerrainSurfaces(const std::vector<CSurface> &l, const std::vector<BezierSurface> &masks, ThreadPool& pool = get_GenerationPool());
+std::vector<TerrainGenBenchmark> bench_TerrainGeneration(unsigned int n, std::int32_t seed, std::int32_t octaves, float freq);
+TerrainStorageBenchmark bench_TerrainStorage(unsigned int n, std::int32_t seed, std::int32_t octaves, float freq);
+std::uint64_t calc_TerrainFingerprint(const std::vector<BezierSurface>& bsurfaces) noexcept;
+PerlinBenchmark bench_PerlinBatch(std::int32_t octaves = 8, std::size_t samples = 1 << 18);
 
 //Methods implementation
+// Pool shared by all the generation steps (one thread for each hardware thread)
+ThreadPool& get_GenerationPool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
 BezierSurface gen_TerrainSurface(const CSurface& surface, const BezierSurface& mask)
 {
 	BezierSurface bsurface;
@@ -30,92 +89,321 @@ BezierSurface gen_TerrainSurface(const CSurface& surface, const BezierSurface& m
 	return bsurface;
 }
 
-std::vector<BezierSurface> gen_TerrainSurfaces(const std::vector<CSurface>& l, const std::vector<BezierSurface>& masks)
+std::vector<BezierSurface> gen_TerrainSurfaces(const std::vector<CSurface>& l, const std::vector<BezierSurface>& masks, ThreadPool& pool)
 {
-	std::vector<BezierSurface> t_surfaces;
-	t_surfaces.reserve(l.size());
-	for (auto i = 0; i != l.size(); i++)
-		t_surfaces.emplace_back(gen_TerrainSurface(l[i], masks[i]));
-
+	std::vector<BezierSurface> t_surfaces(l.size());
+	// every surface is independent, tiles of patches are evaluated in parallel
+	pool.parallel_for(l.size(), 256, [&](std::size_t begin, std::size_t end) {
+		for (auto i = begin; i != end; i++)
+			t_surfaces[i] = gen_TerrainSurface(l[i], masks[i]);
+	});
 
 	return t_surfaces;
 }
 
 //The real methods where all the generations starts
-std::vector<BezierSurface> gen_Terrain(unsigned int n, std::int32_t seed, std::int32_t octaves, float freq)
+// (one buffer for each step, see the patch store version below for the one used by the terrain model)
+std::vector<BezierSurface> gen_Terrain(unsigned int n, std::int32_t seed, std::int32_t octaves, float freq, ThreadPool& pool)
 {
 	//The space reserved from the generation of the terrain (from -2.0, 0.0, 2.0 to -2.0 0.0 -2.0)
 	auto c = CSurface(glm::vec3(-2.0, 0.0, 2.0), glm::vec3(2.0, 0.0, 2.0), glm::vec3(2.0, 0.0, -2.0), glm::vec3(-2.0, 0.0, -2.0));			// XZ PLANE WITH NORMAL (0.0, 1.0, 0.0)
 	auto s = subdiv_CSurface(c,n,n);
-	auto m = gen_TerrainMasks(n, n, seed, octaves, freq);
-	auto t = gen_TerrainSurfaces(s, m);
-	stitch_BezierSurfaces(n, n, t);
+	auto m = gen_TerrainMasks(n, n, seed, octaves, freq, pool);
+	auto t = gen_TerrainSurfaces(s, m, pool);
+	stitch_BezierSurfaces(n, n, t, pool);
 	return t;
 }
 
-std::vector<BezierSurface> gen_TerrainMasks(unsigned int l, unsigned int w, std::int32_t seed, std::int32_t octaves, float freq)
+// Same terrain of the version above, built in place: the masks are written in the store and every mask is replaced by its surface,
+// so the only allocation is the store itself
+// With a progress, rows are generated in blocks (masks use the global patch coordinates, so the result does not change) and
+// the generation returns false, with an incomplete store, if it is cancelled
+bool gen_Terrain(PatchStore& store, unsigned int n, std::int32_t seed, std::int32_t octaves, float freq, ThreadPool& pool, TerrainGenProgress* progress)
+{
+	auto c = CSurface(glm::vec3(-2.0, 0.0, 2.0), glm::vec3(2.0, 0.0, 2.0), glm::vec3(2.0, 0.0, -2.0), glm::vec3(-2.0, 0.0, -2.0));			// XZ PLANE WITH NORMAL (0.0, 1.0, 0.0)
+	store.reset(n, n);
+	const double fx = (n * 2) / freq;
+	const double fy = (n * 2) / freq;
+	const unsigned int block = progress ? std::max(16u, 4 * pool.size()) : n;
+	if (progress)
+		progress->rows = n + 1;
+	for (unsigned int row0 = 0; row0 < n; row0 += block)
+	{
+		if (progress && progress->cancelled)
+			return false;
+		const unsigned int rows = std::min(block, n - row0);
+		BezierSurface* patches = store.data() + (std::size_t)row0 * n;
+		gen_TerrainMasks(rows, n, (std::int32_t)row0, 0, fx, fy, seed, octaves, patches, pool);
+		pool.parallel_for((std::size_t)rows * n, 256, [&](std::size_t begin, std::size_t end) {
+			for (auto i = begin; i != end; i++)
+				patches[i] = gen_TerrainSurface(calc_CSurfaceCell(c, n, n, row0 + (unsigned int)(i / n), (unsigned int)(i % n)), patches[i]);
+		});
+		if (progress)
+			progress->rowsDone += rows;
+	}
+	if (progress && progress->cancelled)
+		return false;
+	stitch_BezierSurfaces(n, n, store.surfaces(), pool);
+	if (progress)
+		progress->rowsDone++;
+	return true;
+}
+
+// Patch (row, col) of the infinite grid that extends the [-2, 2] terrain of n x n patches (patch (0, 0) is the first one of gen_Terrain)
+// The corners only depend on (row, col, n), so patches shared by the aprons of different tiles are bit identical
+CSurface calc_TerrainPatchSurface(std::int32_t row, std::int32_t col, unsigned int n)
+{
+	const float step = 4.0f / (float)n;
+	const float x0 = -2.0f + step * (float)col, x1 = -2.0f + step * (float)(col + 1);
+	const float z0 = 2.0f - step * (float)row, z1 = 2.0f - step * (float)(row + 1);
+	return CSurface(glm::vec3(x0, 0.0, z0), glm::vec3(x1, 0.0, z0), glm::vec3(x1, 0.0, z1), glm::vec3(x0, 0.0, z1));
+}
+
+// Tile of size x size patches starting at patch (row0, col0) of the infinite terrain with the scale (n, freq) of gen_Terrain
+// The tile is generated with a ring of one extra patch and stitched with stitch_BezierSurfacesLocal: every patch only depends
+// on its 3x3 neighbourhood, so the borders of adjacent tiles match exactly, whatever the order in which they are generated
+std::vector<BezierSurface> gen_TerrainTile(std::int32_t row0, std::int32_t col0, unsigned int size, unsigned int n, std::int32_t seed, std::int32_t octaves, float freq, ThreadPool& pool)
+{
+	const unsigned int apron = size + 2;
+	const double f = (n * 2) / freq;
+	std::vector<CSurface> s;
+	s.reserve(apron * apron);
+	for (unsigned int i = 0; i != apron; i++)
+		for (unsigned int j = 0; j != apron; j++)
+			s.push_back(calc_TerrainPatchSurface(row0 - 1 + (std::int32_t)i, col0 - 1 + (std::int32_t)j, n));
+	auto m = gen_TerrainMasks(apron, apron, row0 - 1, col0 - 1, f, f, seed, octaves, pool);
+	auto t = gen_TerrainSurfaces(s, m, pool);
+	stitch_BezierSurfacesLocal(apron, apron, t, pool);
+
+	std::vector<BezierSurface> tile;
+	tile.reserve(size * size);
+	for (unsigned int i = 1; i != apron - 1; i++)
+		tile.insert(tile.end(), t.begin() + i * apron + 1, t.begin() + (i + 1) * apron - 1);
+	return tile;
+}
+
+// Generates the same terrain with 1, 2, 4, ... up to the hardware threads and measures the patches generated per second
+std::vector<TerrainGenBenchmark> bench_TerrainGeneration(unsigned int n, std::int32_t seed, std::int32_t octaves, float freq)
+{
+	std::vector<TerrainGenBenchmark> results;
+	const unsigned int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned int threads = 1; ; threads = std::min(threads * 2, maxThreads))
+	{
+		ThreadPool pool(threads);
+		PatchStore t;
+		auto start = std::chrono::high_resolution_clock::now();
+		gen_Terrain(t, n, seed, octaves, freq, pool);
+		auto end = std::chrono::high_resolution_clock::now();
+		double ms = std::chrono::duration<double, std::milli>(end - start).count();
+		results.push_back({ threads, ms, t.size() / (ms / 1000.0) });
+		if (threads == maxThreads)
+			break;
+	}
+	return results;
+}
+
+// Builds the same terrain with the separate buffers and with the patch store, counting the heap allocations of each build
+// (the buffers build includes the control net that the store writes directly in the GPU buffers, see TerrainMesh)
+TerrainStorageBenchmark bench_TerrainStorage(unsigned int n, std::int32_t seed, std::int32_t octaves, float freq)
+{
+	TerrainStorageBenchmark result;
+	ThreadPool& pool = get_GenerationPool();
+	std::uint64_t buffersFingerprint;
+	{
+		AllocationScope scope;
+		auto start = std::chrono::high_resolution_clock::now();
+		auto t = gen_Terrain(n, seed, octaves, freq, pool);
+		ControlNet net = index_TerrainGrid(n, n, t);
+		auto end = std::chrono::high_resolution_clock::now();
+		result.buffers = scope.measure();
+		result.buffersMs = std::chrono::duration<double, std::milli>(end - start).count();
+		buffersFingerprint = calc_TerrainFingerprint(t);
+	}
+	{
+		PatchStore store;
+		AllocationScope scope;
+		auto start = std::chrono::high_resolution_clock::now();
+		gen_Terrain(store, n, seed, octaves, freq, pool);
+		auto end = std::chrono::high_resolution_clock::now();
+		result.store = scope.measure();
+		result.storeMs = std::chrono::duration<double, std::milli>(end - start).count();
+		result.patches = store.size();
+		result.identical = calc_TerrainFingerprint(store.surfaces()) == buffersFingerprint;
+	}
+	return result;
+}
+
+std::vector<BezierSurface> gen_TerrainMasks(unsigned int l, unsigned int w, std::int32_t seed, std::int32_t octaves, float freq, ThreadPool& pool)
 {
-	const siv::PerlinNoise perlin(seed);
 	const double fx = (w*2)  / freq;
 	const double fy = (l*2) / freq;
-	std::vector<BezierSurface> masks;
-	for (auto y = 0; y != l * 2; y += 2)
-	{
-		for (auto x = 0; x < w * 2; x += 2)
+	return gen_TerrainMasks(l, w, 0, 0, fx, fy, seed, octaves, pool);
+}
+
+// Masks of the l x w patches starting at patch (row0, col0): noise lattice and random offsets use the global patch coordinates,
+// so a patch gets the same mask in any block it is generated with
+std::vector<BezierSurface> gen_TerrainMasks(unsigned int l, unsigned int w, std::int32_t row0, std::int32_t col0, double fx, double fy, std::int32_t seed, std::int32_t octaves, ThreadPool& pool)
+{
+	std::vector<BezierSurface> masks(l * w);
+	gen_TerrainMasks(l, w, row0, col0, fx, fy, seed, octaves, masks.data(), pool);
+	return masks;
+}
+
+// Masks written in place (masks holds l x w patches)
+void gen_TerrainMasks(unsigned int l, unsigned int w, std::int32_t row0, std::int32_t col0, double fx, double fy, std::int32_t seed, std::int32_t octaves, BezierSurface* masks, ThreadPool& pool)
+{
+	const siv::PerlinNoise perlin((std::uint32_t)seed);
+	// rows of patches are generated in parallel, random offsets are stateless and keyed by (seed, row, column)
+	pool.parallel_for(l, 1, [&](std::size_t rowBegin, std::size_t rowEnd) {
+		// A patch at (x, y) only samples the noise at the 4 lattice points (x|x+1, y|y+1), and those are not shared
+		// with other patches: the 2 lattice rows of a patch row are evaluated once, with the batch noise evaluator
+		// the lattice rows buffers are kept by each thread, instead of being allocated for every tile
+		const unsigned int lw = w * 2;
+		thread_local std::vector<double> xs, ys, noise;
+		xs.resize(2 * lw);
+		ys.resize(2 * lw);
+		noise.resize(2 * lw);
+		for (auto y = (unsigned int)rowBegin * 2; y != rowEnd * 2; y += 2)
 		{
-			auto m = gen_BezierSurfaceMask(0, 0);
-			// gen mask with accumulated perlin noise that will change height of all points
-			m[0][0].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1((x + 1.0) / fx, y / fy, octaves);
-			m[0][1].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1(x / fx, y / fy, octaves);
-			m[0][2].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1((x + 1.0) / fx, y / fy, octaves);
-			m[0][3].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1(x / fx, (y + 1.0) / fy, octaves);
-			m[1][0].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1((x + 1.0) / fx, y / fy, octaves);
-			m[2][0].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1(x / fx, y / fy, octaves);
-			m[3][0].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1((x + 1.0) / fx, y / fy, octaves);
-			m[3][1].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1(x / fx, y / fy, octaves);
-			m[3][2].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1((x + 1.0) / fx, y / fy, octaves);
-			m[3][3].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1(x / fx, y / fy, octaves);
-			m[1][3].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1((x + 1.0) / fx, (y + 1.0) / fy, octaves);
-			m[2][3].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1(x / fx, (y + 1.0) / fy, octaves);
-			m[1][1].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1(x / fx, y / fy, octaves);
-			m[1][2].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1((x + 1.0) / fx, y / fy, octaves);
-			m[2][1].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1(x / fx, (y + 1.0) / fy, octaves);
-			m[2][2].z = 1.3f * perlin.accumulatedOctaveNoise2D_0_1((x + 1.0) / fx, (y + 1.0) / fy, octaves);
-			masks.emplace_back(std::move(m));
+			for (unsigned int k = 0; k != lw; k++)
+			{
+				xs[k] = xs[lw + k] = (2.0 * col0 + k) / fx;
+				ys[k] = (2.0 * row0 + y) / fy;
+				ys[lw + k] = (2.0 * row0 + y + 1.0) / fy;
+			}
+			perlin.accumulatedOctaveNoise2D_0_1(xs.data(), ys.data(), noise.data(), 2 * lw, octaves);
+
+			for (auto x = 0u; x < w * 2; x += 2)
+			{
+				auto m = gen_BezierSurfaceMask(0, 0, calc_rand_key((std::uint32_t)seed, (std::uint32_t)(row0 + (std::int32_t)(y / 2)), (std::uint32_t)(col0 + (std::int32_t)(x / 2))));
+				// noise at (x, y), (x + 1, y), (x, y + 1) and (x + 1, y + 1)
+				const double n00 = noise[x], n10 = noise[x + 1], n01 = noise[lw + x], n11 = noise[lw + x + 1];
+				// gen mask with accumulated perlin noise that will change height of all points
+				m[0][0].z = 1.3f * n10;
+				m[0][1].z = 1.3f * n00;
+				m[0][2].z = 1.3f * n10;
+				m[0][3].z = 1.3f * n01;
+				m[1][0].z = 1.3f * n10;
+				m[2][0].z = 1.3f * n00;
+				m[3][0].z = 1.3f * n10;
+				m[3][1].z = 1.3f * n00;
+				m[3][2].z = 1.3f * n10;
+				m[3][3].z = 1.3f * n00;
+				m[1][3].z = 1.3f * n11;
+				m[2][3].z = 1.3f * n01;
+				m[1][1].z = 1.3f * n00;
+				m[1][2].z = 1.3f * n10;
+				m[2][1].z = 1.3f * n01;
+				m[2][2].z = 1.3f * n11;
+				masks[(y / 2) * w + x / 2] = m;
+			}
 		}
+	});
+}
+
+// Samples per second of the scalar accumulated octave noise against the batch evaluator (same samples)
+PerlinBenchmark bench_PerlinBatch(std::int32_t octaves, std::size_t samples)
+{
+	const siv::PerlinNoise perlin(45u);
+	std::vector<double> xs(samples), ys(samples), out(samples);
+	for (std::size_t i = 0; i != samples; i++)
+	{
+		xs[i] = (i % 512) / 85.0;
+		ys[i] = (i / 512) / 85.0;
 	}
 
-	return masks;
+	auto start = std::chrono::high_resolution_clock::now();
+	for (std::size_t i = 0; i != samples; i++)
+		out[i] = perlin.accumulatedOctaveNoise2D_0_1(xs[i], ys[i], octaves);
+	auto middle = std::chrono::high_resolution_clock::now();
+	perlin.accumulatedOctaveNoise2D_0_1(xs.data(), ys.data(), out.data(), samples, octaves);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	PerlinBenchmark result;
+	result.scalarSamplesPerSecond = samples / std::chrono::duration<double>(middle - start).count();
+	result.batchSamplesPerSecond = samples / std::chrono::duration<double>(end - middle).count();
+	return result;
 }
 
-void stitch_BezierSurfaces(unsigned int l, unsigned int w, std::vector<BezierSurface>& bsurfaces)
+// Hash of the exact bits of every control point: identical terrains (same seed and parameters) have the same fingerprint
+std::uint64_t calc_TerrainFingerprint(const std::vector<BezierSurface>& bsurfaces) noexcept
+{
+	std::uint64_t h = mix_SplitMix64(bsurfaces.size());
+	for (const auto& bsurface : bsurfaces)
+		for (const auto& row : bsurface)
+			for (const auto& vertex : row)
+				for (int c = 0; c != 3; c++)
+				{
+					std::uint32_t bits;
+					std::memcpy(&bits, &vertex[c], sizeof(bits));
+					h = mix_SplitMix64(h ^ bits);
+				}
+	return h;
+}
+
+void stitch_BezierSurfaces(unsigned int l, unsigned int w, std::vector<BezierSurface>& bsurfaces, ThreadPool& pool)
 {
 	if (l * w != bsurfaces.size())
 		return;
 
+	// Conflict-free order: horizontal edges of different rows never touch the same patch,
+	// and neither do vertical edges of different columns, so rows (then columns) run in parallel
+	// while the edges inside a row (column) keep the serial order. The result is the same as the serial stitching.
 
 	// stitch horizontally
-	auto b_i = 0;
-	for (auto j = 0; j != l; j++)
-	{
-		for (auto i = b_i; i != (b_i + w) - 1; i++)
-			stitch_ADJEdges_smooth(bsurfaces[i], bsurfaces[i + 1], true);
-		b_i += w;
-	}
+	pool.parallel_for(l, 1, [&](std::size_t rowBegin, std::size_t rowEnd) {
+		for (auto j = rowBegin; j != rowEnd; j++)
+		{
+			auto b_i = j * w;
+			for (auto i = b_i; i != (b_i + w) - 1; i++)
+				stitch_ADJEdges_smooth(bsurfaces[i], bsurfaces[i + 1], true);
+		}
+	});
 	
 	// stitch vertically
-	b_i = 0;
-	for (auto j = 0; j != l - 1; j++)
-	{
-		for (auto i = b_i; i != b_i + w; i++)
-			stitch_ADJEdges_smooth(bsurfaces[i], bsurfaces[i + w], false);
-		b_i += w;
-	}
-	
+	pool.parallel_for(w, 16, [&](std::size_t colBegin, std::size_t colEnd) {
+		for (auto j = 0u; j + 1 < l; j++)
+		{
+			auto b_i = j * w;
+			for (auto i = b_i + colBegin; i != b_i + colEnd; i++)
+				stitch_ADJEdges_smooth(bsurfaces[i], bsurfaces[i + w], false);
+		}
+	});
 
 }
 
+// Order independent stitching: every edge reads the patches as they were before the horizontal (vertical) pass,
+// so a stitched patch only depends on its 3x3 neighbourhood of unstitched patches (used by the streamed terrain tiles)
+// The result differs slightly from stitch_BezierSurfaces, which reads the edges already stitched in the same row (column)
+void stitch_BezierSurfacesLocal(unsigned int l, unsigned int w, std::vector<BezierSurface>& bsurfaces, ThreadPool& pool)
+{
+	if (l * w != bsurfaces.size() || bsurfaces.empty())
+		return;
+
+	// the edges of a patch write disjoint control points, so every edge of a pass can be stitched in parallel
+	std::vector<BezierSurface> source = bsurfaces;
+	pool.parallel_for(l, 1, [&](std::size_t rowBegin, std::size_t rowEnd) {
+		for (auto j = rowBegin; j != rowEnd; j++)
+			for (auto i = j * w; i + 1 < (j + 1) * w; i++)
+				stitch_ADJEdges_smooth(source[i], source[i + 1], bsurfaces[i], bsurfaces[i + 1], true);
+	});
+
+	source = bsurfaces;
+	pool.parallel_for(l - 1, 1, [&](std::size_t rowBegin, std::size_t rowEnd) {
+		for (auto j = rowBegin; j != rowEnd; j++)
+			for (auto i = j * w; i != (j + 1) * w; i++)
+				stitch_ADJEdges_smooth(source[i], source[i + w], bsurfaces[i], bsurfaces[i + w], false);
+	});
+}
+
 void stitch_ADJEdges_smooth(BezierSurface& b0, BezierSurface& b1, bool horizontal)
+{
+	stitch_ADJEdges_smooth(b0, b1, b0, b1, horizontal);
+}
+
+// Stitches the edge reading the control points of (s0, s1) and writing the ones of (b0, b1): they can be the same patches,
+// every control point is read before it is written
+void stitch_ADJEdges_smooth(const BezierSurface& s0, const BezierSurface& s1, BezierSurface& b0, BezierSurface& b1, bool horizontal)
 {
 	auto b0_ei = 2;
 	auto b1_ei = 0;
@@ -133,10 +421,10 @@ void stitch_ADJEdges_smooth(BezierSurface& b0, BezierSurface& b1, bool horizonta
 		auto p2_vi = get_BSurfaceCVI(b1_ei, 1, i);
 		auto p3_vi = get_BSurfaceCVI(b1_ei, 2, i);
 
-		auto p0 = b0[p0_vi[0]][p0_vi[1]];
-		auto p1 = b0[p1_vi[0]][p1_vi[1]];
-		auto p2 = b1[p2_vi[0]][p2_vi[1]];
-		auto p3 = b1[p3_vi[0]][p3_vi[1]];
+		auto p0 = s0[p0_vi[0]][p0_vi[1]];
+		auto p1 = s0[p1_vi[0]][p1_vi[1]];
+		auto p2 = s1[p2_vi[0]][p2_vi[1]];
+		auto p3 = s1[p3_vi[0]][p3_vi[1]];
 
 
 
@@ -0,0 +1,517 @@
+/*
+Hierarchical level of detail of a generated terrain
+- quadtree of patches over the l x w grid of the terrain: the leaves are the generated patches and every parent is a bicubic fit
+  of its (up to 2 x 2) children, so a node of level k stands for up to 2^k x 2^k patches
+- the border curves of a parent are fitted on the border curves of its children alone (through their ends, inner control points
+  by least squares), the same way for the two nodes sharing it: nodes of the same level have identical borders, as the leaves.
+  Only the 4 inner control points are the least squares fit of the samples of the children
+- every node stores its distance from the generated patches (largest distance from its children on the fit samples, plus the one
+  of the children), the same distance on its borders only and a sphere around the generated patches it covers. The distances are
+  measured on the samples: they are estimates, not strict bounds
+- every frame the tree is walked from the root: a node is drawn when its error, projected on the screen from the nearest point
+  of its sphere, is below the pixel tolerance, otherwise its children are visited, so the far terrain is drawn with a few large patches
+- the patches of all the nodes are uploaded once in a single buffer and the selected ones are drawn with one glMultiDrawArrays
+- requestBuild builds the tree on a background job: the GL thread only uploads it (update), the old tree is drawn until then
+- adjacent nodes of different levels do not share their borders: the gap between them is about the sum of their border errors.
+  The selection keeps twice the border error of a node below the pixel tolerance, so these gaps stay about within the tolerance
+*/
+#pragma once
+#include <utils/patch_store.h>
+#include <utils/terrain_mesh.h>
+#include <utils/thread_pool.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Samples on each side of a child patch for the fit of its parent (and for the measure of the error)
+constexpr unsigned int TERRAIN_LOD_FIT_SAMPLES = 6;
+
+// Node of the quadtree (object space)
+struct TerrainLODNode {
+    // sphere around the generated patches covered by the node
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+    // distance between the patch of the node and the generated patches, on the whole patch and on its borders (0 for the leaves)
+    float error = 0.0f;
+    float borderError = 0.0f;
+    std::uint32_t level = 0;
+    std::uint32_t childCount = 0;
+    std::uint32_t children[4] = { 0, 0, 0, 0 };
+};
+
+// Size of the tree and counters of the last selection
+struct TerrainLODStats {
+    std::size_t nodes = 0;
+    std::size_t leaves = 0;
+    unsigned int levels = 0;
+    float rootError = 0.0f;
+    double buildMs = 0.0;
+    // patches drawn by the last selection (and how many of them are generated patches), CPU time of the traversal
+    std::size_t selectedPatches = 0;
+    std::size_t selectedLeaves = 0;
+    double selectMs = 0.0;
+};
+
+// One pass of the fly-through benchmark (see gen_FlyThroughPath): patches submitted and frame times along the path
+struct FlyThroughStats {
+    unsigned int frames = 0;
+    std::size_t minPatches = 0, maxPatches = 0;
+    double totalPatches = 0.0;
+    // CPU time of the whole frames, GPU time of the terrain draw calls (sums)
+    double frameMs = 0.0;
+    double gpuMs = 0.0;
+
+    void add(std::size_t patches, double ms) noexcept
+    {
+        minPatches = frames ? std::min(minPatches, patches) : patches;
+        maxPatches = std::max(maxPatches, patches);
+        totalPatches += patches;
+        frameMs += ms;
+        frames++;
+    }
+    double averagePatches() const noexcept { return frames ? totalPatches / frames : 0.0; }
+    double averageFrameMs() const noexcept { return frames ? frameMs / frames : 0.0; }
+};
+
+namespace terrain_lod_detail
+{
+    inline void bernstein(double t, double b[4]) noexcept
+    {
+        const double s = 1.0 - t;
+        b[0] = s * s * s;
+        b[1] = 3.0 * t * s * s;
+        b[2] = 3.0 * t * t * s;
+        b[3] = t * t * t;
+    }
+
+    // Least squares cubic with given ends on 'spans' sub-intervals of [0, 1] sampled TERRAIN_LOD_FIT_SAMPLES times each (the first
+    // and the last samples are the ends): Bernstein matrix B (m x 4) and pseudo inverse (B1^T B1)^-1 B1^T (2 x m) of its inner
+    // columns B1, that gives the 2 inner control points from the samples minus the part of the ends
+    struct FitMatrix
+    {
+        unsigned int m = 0;
+        std::vector<double> basis;
+        std::vector<double> innerPseudoInverse;
+    };
+
+    inline FitMatrix gen_FitMatrix(unsigned int spans)
+    {
+        const unsigned int s = TERRAIN_LOD_FIT_SAMPLES;
+        FitMatrix fit;
+        fit.m = spans * s;
+        fit.basis.resize(fit.m * 4);
+        for (unsigned int span = 0; span != spans; span++)
+            for (unsigned int a = 0; a != s; a++)
+                bernstein((span + (double)a / (s - 1)) / spans, &fit.basis[(span * s + a) * 4]);
+        // normal equations of the inner columns, 2 x 2
+        double n00 = 0.0, n01 = 0.0, n11 = 0.0;
+        for (unsigned int k = 0; k != fit.m; k++)
+        {
+            n00 += fit.basis[k * 4 + 1] * fit.basis[k * 4 + 1];
+            n01 += fit.basis[k * 4 + 1] * fit.basis[k * 4 + 2];
+            n11 += fit.basis[k * 4 + 2] * fit.basis[k * 4 + 2];
+        }
+        const double det = n00 * n11 - n01 * n01;
+        fit.innerPseudoInverse.resize(2 * fit.m);
+        for (unsigned int k = 0; k != fit.m; k++)
+        {
+            fit.innerPseudoInverse[k] = (n11 * fit.basis[k * 4 + 1] - n01 * fit.basis[k * 4 + 2]) / det;
+            fit.innerPseudoInverse[fit.m + k] = (n00 * fit.basis[k * 4 + 2] - n01 * fit.basis[k * 4 + 1]) / det;
+        }
+        return fit;
+    }
+
+    // Border curve of a parent from the border curves of its children along it ('spans' cubics, control points in the order of
+    // the border): through the ends of the first and of the last one, inner control points by least squares on their samples.
+    // Only the curves are read, so the two nodes sharing a border compute the same curve
+    inline void fit_BorderCurve(const FitMatrix& fit, const glm::vec3 curves[2][4], unsigned int spans, glm::dvec3 border[4]) noexcept
+    {
+        const unsigned int s = TERRAIN_LOD_FIT_SAMPLES;
+        border[0] = glm::dvec3(curves[0][0]);
+        border[3] = glm::dvec3(curves[spans - 1][3]);
+        border[1] = border[2] = glm::dvec3(0.0);
+        double b[4];
+        for (unsigned int span = 0; span != spans; span++)
+            for (unsigned int a = 0; a != s; a++)
+            {
+                bernstein((double)a / (s - 1), b);
+                glm::dvec3 sample(0.0);
+                for (int i = 0; i != 4; i++)
+                    sample += b[i] * glm::dvec3(curves[span][i]);
+                const unsigned int k = span * s + a;
+                const glm::dvec3 residual = sample - fit.basis[k * 4] * border[0] - fit.basis[k * 4 + 3] * border[3];
+                border[1] += fit.innerPseudoInverse[k] * residual;
+                border[2] += fit.innerPseudoInverse[fit.m + k] * residual;
+            }
+    }
+
+    // Sphere around the control points (the patch lies in their convex hull)
+    inline void calc_PatchSphere(const BezierSurface& bsurface, glm::vec3& center, float& radius) noexcept
+    {
+        glm::vec3 lo = bsurface[0][0], hi = bsurface[0][0];
+        for (const auto& row : bsurface)
+            for (const auto& p : row)
+            {
+                lo = glm::min(lo, p);
+                hi = glm::max(hi, p);
+            }
+        center = 0.5f * (lo + hi);
+        radius = 0.0f;
+        for (const auto& row : bsurface)
+            for (const auto& p : row)
+                radius = std::max(radius, glm::length(p - center));
+    }
+}
+
+
+/////////////////// TERRAIN LOD class ///////////////////////
+class TerrainLOD
+{
+public:
+
+    TerrainLOD() = default;
+
+    TerrainLOD(const TerrainLOD&) = delete;
+    TerrainLOD& operator=(const TerrainLOD&) = delete;
+
+    // Builds the tree of a generated terrain (false if the store has no grid, e.g. a model read from file) and uploads its patches.
+    // fingerprint identifies the terrain (see requestBuild), the job still running is discarded
+    bool build(const PatchStore& store, std::uint64_t fingerprint = 0, ThreadPool& pool = get_GenerationPool())
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        current.reset();
+        mesh.reset();
+        treeFingerprint = fingerprint;
+        if (!buildTree(store, pool))
+            return false;
+        mesh = std::make_unique<TerrainMesh>(nodePatches);
+        stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return true;
+    }
+
+    // Starts building the tree of a terrain on a background job (the store is copied), the tree uploaded so far is kept until update
+    // swaps the new one in. Nothing is started if the tree of the same fingerprint is already uploaded or being built
+    void requestBuild(const PatchStore& store, std::uint64_t fingerprint)
+    {
+        if (current && current->fingerprint == fingerprint)
+            return;
+        current.reset();
+        if (mesh && treeFingerprint == fingerprint)
+            return;
+        auto job = std::make_shared<Job>();
+        job->store = store;
+        job->fingerprint = fingerprint;
+        job->tree = std::make_unique<TerrainLOD>();
+        current = job;
+        if (!jobPool)
+            jobPool = std::make_unique<ThreadPool>(2);
+        jobPool->submit([job]() {
+            auto start = std::chrono::high_resolution_clock::now();
+            job->complete = job->tree->buildTree(job->store, get_GenerationPool());
+            job->tree->stats.buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            job->finished.store(true, std::memory_order_release);
+        });
+    }
+
+    // Called once per frame (GL thread): uploads the tree of the finished job in place of the current one. Returns true on the frame of the swap
+    bool update()
+    {
+        if (!current || !current->finished.load(std::memory_order_acquire))
+            return false;
+        std::shared_ptr<Job> job = std::move(current);
+        if (!job->complete)
+            return false;
+        auto start = std::chrono::high_resolution_clock::now();
+        TerrainLOD& tree = *job->tree;
+        nodes.swap(tree.nodes);
+        nodePatches.swap(tree.nodePatches);
+        lo = tree.lo;
+        hi = tree.hi;
+        stats = tree.stats;
+        treeFingerprint = job->fingerprint;
+        firsts.clear();
+        counts.clear();
+        mesh = std::make_unique<TerrainMesh>(nodePatches);
+        stats.buildMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return true;
+    }
+
+    // Tree only (no GL calls): level 0 is the grid of the store, level k + 1 has ceil(l / 2) x ceil(w / 2) nodes of level k,
+    // the nodes on the last row (column) of an odd level have a single row (column) of children
+    bool buildTree(const PatchStore& store, ThreadPool& pool = get_GenerationPool())
+    {
+        using namespace terrain_lod_detail;
+        nodes.clear();
+        nodePatches.clear();
+        stats = TerrainLODStats();
+        if (!store.isGrid())
+            return false;
+
+        unsigned int l = store.length(), w = store.width();
+        std::size_t total = 0;
+        for (unsigned int ll = l, ww = w; ; ll = (ll + 1) / 2, ww = (ww + 1) / 2)
+        {
+            total += (std::size_t)ll * ww;
+            stats.levels++;
+            if (ll == 1 && ww == 1)
+                break;
+        }
+        nodes.resize(total);
+        nodePatches.resize(total);
+
+        // leaves
+        std::copy(store.data(), store.data() + store.size(), nodePatches.begin());
+        lo = hi = store[0][0][0];
+        for (std::size_t i = 0; i != store.size(); i++)
+        {
+            calc_PatchSphere(store[i], nodes[i].center, nodes[i].radius);
+            for (const auto& row : store[i])
+                for (const auto& p : row)
+                {
+                    lo = glm::min(lo, p);
+                    hi = glm::max(hi, p);
+                }
+        }
+
+        // fit matrices for 1 and 2 children on a side
+        const FitMatrix fits[2] = { gen_FitMatrix(1), gen_FitMatrix(2) };
+        const unsigned int s = TERRAIN_LOD_FIT_SAMPLES;
+        std::size_t childBase = 0, levelBase = store.size();
+        for (std::uint32_t level = 1; level < stats.levels; level++)
+        {
+            const unsigned int pl = (l + 1) / 2, pw = (w + 1) / 2;
+            pool.parallel_for((std::size_t)pl * pw, 16, [&](std::size_t begin, std::size_t end) {
+                // samples of the children (rows follow v, columns follow u) and product with the pseudo inverse along u
+                std::vector<glm::dvec3> samples, half;
+                for (std::size_t id = begin; id != end; id++)
+                {
+                    const unsigned int r = (unsigned int)(id / pw), c = (unsigned int)(id % pw);
+                    const unsigned int rows = std::min(2u, l - 2 * r), cols = std::min(2u, w - 2 * c);
+                    const FitMatrix& fu = fits[cols - 1];
+                    const FitMatrix& fv = fits[rows - 1];
+                    TerrainLODNode& node = nodes[levelBase + id];
+                    node.level = level;
+                    samples.assign((std::size_t)fv.m * fu.m, glm::dvec3(0.0));
+                    float childError = 0.0f;
+                    glm::vec3 clo(std::numeric_limits<float>::max()), chi(-std::numeric_limits<float>::max());
+                    for (unsigned int dr = 0; dr != rows; dr++)
+                        for (unsigned int dc = 0; dc != cols; dc++)
+                        {
+                            const std::uint32_t child = (std::uint32_t)(childBase + (std::size_t)(2 * r + dr) * w + 2 * c + dc);
+                            node.children[node.childCount++] = child;
+                            childError = std::max(childError, nodes[child].error);
+                            clo = glm::min(clo, nodes[child].center - nodes[child].radius);
+                            chi = glm::max(chi, nodes[child].center + nodes[child].radius);
+                            const BezierSurface& bsurface = nodePatches[child];
+                            for (unsigned int a = 0; a != s; a++)
+                                for (unsigned int b = 0; b != s; b++)
+                                {
+                                    // the samples of a child are the ones of a single span: same parameters for the rows and the columns
+                                    const double* bv = &fits[0].basis[a * 4];
+                                    const double* bu = &fits[0].basis[b * 4];
+                                    glm::dvec3 p(0.0);
+                                    for (int j = 0; j != 4; j++)
+                                        for (int i = 0; i != 4; i++)
+                                            p += bv[j] * bu[i] * glm::dvec3(bsurface[j][i]);
+                                    samples[(std::size_t)(dr * s + a) * fu.m + dc * s + b] = p;
+                                }
+                        }
+                    // borders from the curves of the children along them (v = 0, v = 1 follow u, u = 0, u = 1 follow v)
+                    BezierSurface& fitted = nodePatches[levelBase + id];
+                    glm::dvec3 border[4];
+                    glm::vec3 curves[2][4];
+                    for (int side = 0; side != 4; side++)
+                    {
+                        const bool alongU = side < 2;
+                        const unsigned int spans = alongU ? cols : rows;
+                        for (unsigned int span = 0; span != spans; span++)
+                        {
+                            const unsigned int dr = alongU ? (side == 0 ? 0 : rows - 1) : span;
+                            const unsigned int dc = alongU ? span : (side == 2 ? 0 : cols - 1);
+                            const BezierSurface& child = nodePatches[node.children[dr * cols + dc]];
+                            for (int k = 0; k != 4; k++)
+                                curves[span][k] = alongU ? child[side == 0 ? 0 : 3][k] : child[k][side == 2 ? 0 : 3];
+                        }
+                        fit_BorderCurve(alongU ? fu : fv, curves, spans, border);
+                        for (int k = 0; k != 4; k++)
+                        {
+                            if (alongU)
+                                fitted[side == 0 ? 0 : 3][k] = glm::vec3(border[k]);
+                            else
+                                fitted[k][side == 2 ? 0 : 3] = glm::vec3(border[k]);
+                        }
+                    }
+                    // inner control points: least squares on the samples minus the part of the border control points, P = Pv S Pu^T
+                    for (unsigned int A = 0; A != fv.m; A++)
+                        for (unsigned int B = 0; B != fu.m; B++)
+                        {
+                            glm::dvec3 p(0.0);
+                            for (int j = 0; j != 4; j++)
+                                for (int i = 0; i != 4; i++)
+                                    if (j == 0 || j == 3 || i == 0 || i == 3)
+                                        p += fv.basis[A * 4 + j] * fu.basis[B * 4 + i] * glm::dvec3(fitted[j][i]);
+                            samples[(std::size_t)A * fu.m + B] -= p;
+                        }
+                    half.assign((std::size_t)fv.m * 2, glm::dvec3(0.0));
+                    for (unsigned int A = 0; A != fv.m; A++)
+                        for (int i = 0; i != 2; i++)
+                            for (unsigned int B = 0; B != fu.m; B++)
+                                half[A * 2 + i] += fu.innerPseudoInverse[i * fu.m + B] * samples[(std::size_t)A * fu.m + B];
+                    for (int j = 0; j != 2; j++)
+                        for (int i = 0; i != 2; i++)
+                        {
+                            glm::dvec3 p(0.0);
+                            for (unsigned int A = 0; A != fv.m; A++)
+                                p += fv.innerPseudoInverse[j * fv.m + A] * half[A * 2 + i];
+                            fitted[j + 1][i + 1] = glm::vec3(p);
+                        }
+                    // error on the samples (the residuals of the border control points are added back), plus the one of the children
+                    double fitError = 0.0, borderFitError = 0.0;
+                    for (unsigned int A = 0; A != fv.m; A++)
+                        for (unsigned int B = 0; B != fu.m; B++)
+                        {
+                            glm::dvec3 p(0.0);
+                            for (int j = 1; j != 3; j++)
+                                for (int i = 1; i != 3; i++)
+                                    p += fv.basis[A * 4 + j] * fu.basis[B * 4 + i] * glm::dvec3(fitted[j][i]);
+                            const double distance = glm::length(p - samples[(std::size_t)A * fu.m + B]);
+                            fitError = std::max(fitError, distance);
+                            if (A == 0 || A == fv.m - 1 || B == 0 || B == fu.m - 1)
+                                borderFitError = std::max(borderFitError, distance);
+                        }
+                    float childBorderError = 0.0f;
+                    for (std::uint32_t k = 0; k != node.childCount; k++)
+                        childBorderError = std::max(childBorderError, nodes[node.children[k]].borderError);
+                    node.borderError = (float)borderFitError + childBorderError;
+                    node.error = (float)fitError + childError;
+                    // sphere around the spheres of the children
+                    node.center = 0.5f * (clo + chi);
+                    for (std::uint32_t k = 0; k != node.childCount; k++)
+                        node.radius = std::max(node.radius, glm::length(nodes[node.children[k]].center - node.center) + nodes[node.children[k]].radius);
+                }
+            });
+            childBase = levelBase;
+            levelBase += (std::size_t)pl * pw;
+            l = pl;
+            w = pw;
+        }
+        stats.nodes = nodes.size();
+        stats.leaves = store.size();
+        stats.rootError = nodes.back().error;
+        return true;
+    }
+
+    // Gives back the GPU buffers (the GL context must be alive), the running job is waited for
+    void clear()
+    {
+        jobPool.reset();
+        current.reset();
+        treeFingerprint = 0;
+        mesh.reset();
+        nodes.clear();
+        nodePatches.clear();
+        firsts.clear();
+        counts.clear();
+        stats = TerrainLODStats();
+    }
+
+    bool isReady() const noexcept { return mesh != nullptr; }
+    bool isBuilding() const noexcept { return current != nullptr; }
+    // terrain of the uploaded tree
+    std::uint64_t fingerprint() const noexcept { return treeFingerprint; }
+
+    // Chooses the patches to draw from the camera: the error of a node (at least twice its border error), seen from the nearest
+    // point of its sphere, is compared with pixelTolerance (projection and viewport height give the pixels of a unit at unit distance). Returns the number of patches
+    std::size_t select(const glm::mat4& modelMatrix, const glm::vec3& cameraWorldPosition, const glm::mat4& projection, float viewportHeight, float pixelTolerance)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        firsts.clear();
+        counts.clear();
+        stats.selectedLeaves = 0;
+        if (!nodes.empty())
+        {
+            // the terrain matrix scales uniformly, so the ratio between error and distance is the same in object space
+            const glm::vec3 camera = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(cameraWorldPosition, 1.0f));
+            const float pixelsPerUnit = 0.5f * viewportHeight * projection[1][1];
+            const float tolerance = std::max(pixelTolerance, 1e-3f);
+            stack.clear();
+            stack.push_back((std::uint32_t)nodes.size() - 1);
+            while (!stack.empty())
+            {
+                const std::uint32_t id = stack.back();
+                stack.pop_back();
+                const TerrainLODNode& node = nodes[id];
+                const float distance = glm::length(camera - node.center) - node.radius;
+                // twice the border error: the gap with a neighbour of another level is about the sum of their border errors
+                const float error = std::max(node.error, 2.0f * node.borderError);
+                if (node.childCount && (distance <= 0.0f || error * pixelsPerUnit > tolerance * distance))
+                {
+                    for (std::uint32_t k = 0; k != node.childCount; k++)
+                        stack.push_back(node.children[k]);
+                    continue;
+                }
+                firsts.push_back((GLint)(16 * id));
+                counts.push_back(16);
+                if (!node.childCount)
+                    stats.selectedLeaves++;
+            }
+        }
+        stats.selectedPatches = firsts.size();
+        stats.selectMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return stats.selectedPatches;
+    }
+
+    // Draws the patches of the last selection with a single call
+    void Draw() const
+    {
+        if (!mesh || firsts.empty())
+            return;
+        glBindVertexArray(mesh->VAO);
+        glMultiDrawArrays(GL_PATCHES, firsts.data(), counts.data(), (GLsizei)firsts.size());
+        glBindVertexArray(0);
+    }
+
+    const std::vector<TerrainLODNode>& treeNodes() const noexcept { return nodes; }
+    // patch of each node (same order of the nodes)
+    const std::vector<BezierSurface>& patches() const noexcept { return nodePatches; }
+    const TerrainLODStats& lodStats() const noexcept { return stats; }
+    // bounds of the control points of the generated patches
+    glm::vec3 boundsMin() const noexcept { return lo; }
+    glm::vec3 boundsMax() const noexcept { return hi; }
+    std::size_t gpuBytes() const noexcept { return mesh ? mesh->gpuBytes() : 0; }
+
+private:
+
+    // Shared by the background job and the GL thread: a discarded job keeps it alive until it returns
+    struct Job
+    {
+        PatchStore store;
+        std::uint64_t fingerprint = 0;
+        // tree only, without the GPU buffers
+        std::unique_ptr<TerrainLOD> tree;
+        bool complete = false;
+        std::atomic<bool> finished{ false };
+    };
+
+    // level after level from the leaves, the root is the last node
+    std::vector<TerrainLODNode> nodes;
+    std::vector<BezierSurface> nodePatches;
+    std::unique_ptr<TerrainMesh> mesh;
+    glm::vec3 lo = glm::vec3(0.0f), hi = glm::vec3(0.0f);
+    TerrainLODStats stats;
+    // reused by every selection
+    std::vector<std::uint32_t> stack;
+    std::vector<GLint> firsts;
+    std::vector<GLsizei> counts;
+    std::uint64_t treeFingerprint = 0;
+    std::shared_ptr<Job> current;
+    // a single background thread (the tree itself is built on the generation pool), created by the first request
+    // declared last: destroyed first, so the worker is joined while the members it uses are still alive
+    std::unique_ptr<ThreadPool> jobPool;
+};
@@ -1,39 +1,129 @@
 /*
 Bezier Surfaces Mesh class
 - Extension of the classic mesh class that supports terrain generation and Bezier Surfaces defined meshes
+- A TerrainMesh can hold a single patch or a batch of patches packed in one contiguous VBO (16 control points each)
+- or an indexed control net (unique control points + 16 indices per patch in an EBO)
+- patches are uploaded straight from their CPU storage (m_vertices is only filled by the constructors that take ownership of the data)
+- move-only, like Mesh: the GL objects come from the terrain buffer pool and go back to it when the mesh is destroyed
 */
 #pragma once
+#include <iostream>
 #include <utils/bezier_surface.h>
+#include <utils/control_net.h>
+#include <utils/patch_store.h>
+#include <utils/terrain_buffers.h>
 
 
 class TerrainMesh {
     public:
 
         std::vector<glm::vec3> m_vertices;
-        GLuint VAO, VBO;
+        // indices of the control points of each patch (empty if the mesh is not indexed)
+        std::vector<GLuint> m_indices;
+        GLuint VAO = 0, VBO = 0, EBO = 0;
+        // number of 16 control points patches stored in the VBO
+        GLuint patchCount = 0;
+        // control points and indices uploaded on the GPU
+        std::size_t pointCount = 0, indexCount = 0;
 
+        // the 16 control points of a patch are contiguous (see PatchStore), so they are uploaded without a copy
         TerrainMesh(const BezierSurface &bsurface)
         {
-            m_vertices.reserve(16);
-            for (const auto& row : bsurface){
-                for (const auto& vertex : row){
-                    m_vertices.push_back(glm::vec3(vertex));
-                }
+            patchCount = 1;
+
+            setupMesh(&bsurface[0][0], 16, nullptr, 0);
+        }
+
+        // Batched patch buffer: all the patches are packed one after the other in a single VBO,
+        // so the whole set can be drawn with a single glDrawArrays(GL_PATCHES, 0, 16 * N)
+        TerrainMesh(const std::vector<BezierSurface> &bsurfaces)
+        {
+            patchCount = (GLuint)bsurfaces.size();
+
+            setupMesh(bsurfaces.empty() ? nullptr : &bsurfaces[0][0][0], 16 * bsurfaces.size(), nullptr, 0);
+        }
+
+        // Patches of a store: a terrain grid is uploaded as indexed control net, written directly in the mapped GPU buffers
+        // (no CPU side control net), any other set of patches as batched patch buffer
+        TerrainMesh(const PatchStore &store)
+        {
+            patchCount = (GLuint)store.size();
+
+            if (store.isGrid())
+            {
+                mapGridMesh(store.length(), store.width());
+                uploadRows(store, 0, store.length());
+                finishUpload();
             }
+            else
+                setupMesh(store.points(), store.pointCount(), nullptr, 0);
+        }
+
+        // Staged upload of a terrain grid of l x w patches: the buffers are created and stay mapped, uploadRows fills some rows
+        // of patches at a time (e.g. a slice every frame) and the mesh can be drawn after finishUpload
+        TerrainMesh(unsigned int l, unsigned int w)
+        {
+            patchCount = l * w;
+
+            mapGridMesh(l, w);
+        }
+
+        // Indexed control net: shared control points are uploaded once and patches are assembled through the EBO
+        // This constructor empties the source control net
+        TerrainMesh(ControlNet &net)
+            : m_vertices(std::move(net.points)), m_indices(std::move(net.indices))
+        {
+            patchCount = (GLuint)(m_indices.size() / 16);
 
             setupMesh();
         }
 
-        TerrainMesh(std::vector<glm::vec3> &new_m_vertices)
+        // Indexed control net read straight from memory (e.g. a mapped .bbez file): the data are uploaded
+        // without any CPU side copy, so m_vertices and m_indices stay empty
+        TerrainMesh(const glm::vec3* points, std::size_t numPoints, const GLuint* indices, std::size_t numIndices)
         {
-            m_vertices.clear(); 
-            std::copy(std::begin(new_m_vertices), std::end(new_m_vertices), std::begin(m_vertices));
+            patchCount = (GLuint)(numIndices / 16);
+
+            setupMesh(points, numPoints, indices, numIndices);
+        }
+
+        // TerrainMesh is move-only: a copy would give the same GL objects back to the pool twice
+        TerrainMesh(const TerrainMesh&) = delete;
+        TerrainMesh& operator=(const TerrainMesh&) = delete;
+
+        // Move constructor: the source no longer owns GPU resources (VAO = 0) and its vectors are empty
+        TerrainMesh(TerrainMesh&& move) noexcept
+            : m_vertices(std::move(move.m_vertices)), m_indices(std::move(move.m_indices)),
+            VAO(move.VAO), VBO(move.VBO), EBO(move.EBO), patchCount(move.patchCount), pointCount(move.pointCount), indexCount(move.indexCount),
+            mappedPoints(move.mappedPoints), mappedIndices(move.mappedIndices)
+        {
+            move.releaseOwnership();
+        }
+
+        // Move assignment: the GPU resources of this instance go back to the pool first
+        TerrainMesh& operator=(TerrainMesh&& move) noexcept
+        {
+            if (this == &move)
+                return *this;
+            freeGPUresources();
+            m_vertices = std::move(move.m_vertices);
+            m_indices = std::move(move.m_indices);
+            VAO = move.VAO;
+            VBO = move.VBO;
+            EBO = move.EBO;
+            patchCount = move.patchCount;
+            pointCount = move.pointCount;
+            indexCount = move.indexCount;
+            mappedPoints = move.mappedPoints;
+            mappedIndices = move.mappedIndices;
+            move.releaseOwnership();
+            return *this;
         }
 
         // destructor
         ~TerrainMesh() noexcept
         {
-            // calls the function which will delete (if needed) the GPU resources
+            // calls the function which will give back (if needed) the GPU resources
             freeGPUresources();
         }
         
@@ -42,35 +132,118 @@ class TerrainMesh {
         {
             // draw mesh
             glBindVertexArray(VAO);
-            glDrawArrays(GL_PATCHES, 0, 16);
+            if (EBO)
+                glDrawElements(GL_PATCHES, 16 * patchCount, GL_UNSIGNED_INT, 0);
+            else
+                glDrawArrays(GL_PATCHES, 0, 16 * patchCount);
             glBindVertexArray(0);
         }   
 
+        // Writes the control points and indices of the patch rows [rowBegin, rowEnd) of the store in the mapped buffers
+        bool uploadRows(const PatchStore& store, unsigned int rowBegin, unsigned int rowEnd) noexcept
+        {
+            if (!mappedPoints || !mappedIndices || (std::size_t)store.length() * store.width() != patchCount)
+                return false;
+            fill_TerrainGrid(store.length(), store.width(), store.data(), mappedPoints, mappedIndices, rowBegin, rowEnd);
+            return true;
+        }
+
+        // Unmaps the buffers of a staged upload: false if the upload failed (the content of the buffers is undefined)
+        bool finishUpload()
+        {
+            bool valid = mappedPoints && mappedIndices;
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            if (mappedPoints)
+                valid = glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE && valid;
+            if (mappedIndices)
+                valid = glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER) == GL_TRUE && valid;
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            mappedPoints = nullptr;
+            mappedIndices = nullptr;
+            if (!valid)
+                std::cout << "ERROR::TERRAIN_MESH::UPLOAD_FAILED" << std::endl;
+            return valid;
+        }
+
+        bool isUploading() const noexcept { return mappedPoints || mappedIndices; }
+
+        // GPU memory used by the control points (and indices) of the mesh
+        std::size_t gpuBytes() const noexcept
+        {
+            return pointCount * sizeof(glm::vec3) + indexCount * sizeof(GLuint);
+        }
+
     private:
 
+        // buffers of a staged upload, mapped until finishUpload
+        glm::vec3* mappedPoints = nullptr;
+        GLuint* mappedIndices = nullptr;
         
         void setupMesh()
         {
-            // create buffers/arrays
-            glGenVertexArrays(1, &VAO);
-            glGenBuffers(1, &VBO);
+            setupMesh(m_vertices.data(), m_vertices.size(), m_indices.data(), m_indices.size());
+        }
+
+        void setupMesh(const glm::vec3* points, std::size_t numPoints, const GLuint* indices, std::size_t numIndices)
+        {
+            pointCount = numPoints;
+            indexCount = numIndices;
+            // buffers/arrays from the pool (created if none is available)
+            const TerrainBuffers buffers = get_TerrainBufferPool().acquire(numIndices != 0);
+            VAO = buffers.VAO;
+            VBO = buffers.VBO;
+            EBO = buffers.EBO;
             glBindVertexArray(VAO);
             // load data into vertex buffers
             glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            glBufferData(GL_ARRAY_BUFFER, m_vertices.size() * sizeof(glm::vec3), &m_vertices[0], GL_STATIC_DRAW);
+            glBufferData(GL_ARRAY_BUFFER, numPoints * sizeof(glm::vec3), points, GL_STATIC_DRAW);
+            if (numIndices)
+            {
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * sizeof(GLuint), indices, GL_STATIC_DRAW);
+            }
             glEnableVertexAttribArray(0);
             glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
             glBindVertexArray(0);
         }
 
+        // Grid buffers of l x w patches, created and mapped for writing (the control net is written in place, see fill_TerrainGrid)
+        void mapGridMesh(unsigned int l, unsigned int w)
+        {
+            pointCount = calc_TerrainGridPointCount(l, w);
+            indexCount = (std::size_t)16 * l * w;
+            setupMesh(nullptr, pointCount, nullptr, indexCount);
+            // the element buffer binding is part of the VAO
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            mappedPoints = static_cast<glm::vec3*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, pointCount * sizeof(glm::vec3), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+            mappedIndices = static_cast<GLuint*>(glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, indexCount * sizeof(GLuint), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+            if (!mappedPoints || !mappedIndices)
+                std::cout << "ERROR::TERRAIN_MESH::CANNOT_MAP_BUFFERS" << std::endl;
+            glBindVertexArray(0);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+
+        void releaseOwnership() noexcept
+        {
+            VAO = VBO = EBO = 0;
+            mappedPoints = nullptr;
+            mappedIndices = nullptr;
+        }
+
         void freeGPUresources()
         {
             // If VAO is 0, this instance of Mesh has been through a move, and no longer owns GPU resources,
-            // so there's no need for deleting.
+            // so there's nothing to give back.
             if (VAO)
             {
-                glDeleteVertexArrays(1, &this->VAO);
-                glDeleteBuffers(1, &this->VBO);
+                // a staged upload that never finished (e.g. a cancelled regeneration): the buffers are unmapped before they are recycled
+                if (isUploading())
+                    finishUpload();
+                get_TerrainBufferPool().release({ VAO, VBO, EBO });
+                releaseOwnership();
             }
         }
 
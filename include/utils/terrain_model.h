@@ -9,8 +9,25 @@ using namespace std;
 #include <utils/terrain_mesh.h>
 #include <utils/terrain_gen.h>
 #include <utils/bezier_surface.h>
+#include <utils/control_net.h>
+#include <utils/patch_store.h>
+#include <utils/alloc_stats.h>
+#include <utils/bez_io.h>
 #include <sstream>
 #include <string>
+#include <algorithm>
+#include <chrono>
+
+// Per-frame submission counters of the terrain
+struct TerrainDrawStats {
+    GLuint drawCalls = 0;
+    GLuint patches = 0;
+    // control points and GPU memory of the terrain buffers
+    std::size_t controlPoints = 0;
+    std::size_t gpuBytes = 0;
+    // CPU time spent submitting the draw calls (in milliseconds)
+    double submitTimeMs = 0.0;
+};
 
 
 /////////////////// MODEL class ///////////////////////
@@ -23,84 +40,306 @@ public:
     /////////////////////////////////////////
     
     //Bezier Surfaces Model created from generation with all the utils classes (Perlin Noise, Terrain Generation, ecc.)
-    TerrainModel(unsigned int n, std::int32_t seed, std::int32_t octaves, float freq)
+    TerrainModel(unsigned int n, std::int32_t seed, std::int32_t octaves, float freq, bool batched = true)
+        : batched(batched)
     {
-        vector<BezierSurface> terrain_surfaces = gen_Terrain(n, seed, octaves, freq);
-        std::vector<TerrainMesh> tmesh;
-	    tmesh.reserve(terrain_surfaces.size());
-        for (const auto& bsurface : terrain_surfaces)
-		    tmesh.emplace_back(bsurface);
-        meshes = std::move(tmesh);
-        
+        AllocationScope scope;
+        auto start = std::chrono::high_resolution_clock::now();
+        gen_Terrain(store, n, seed, octaves, freq);
+        auto end = std::chrono::high_resolution_clock::now();
+        generationMs = std::chrono::duration<double, std::milli>(end - start).count();
+        fingerprintValue = calc_TerrainFingerprint(store.surfaces());
+        setupMeshes();
+        allocations = scope.measure();
     }
 
-    //Bezier Surfaces Model created from reading it in memory
-    TerrainModel(string path)
+    //Bezier Surfaces Model created from reading it in memory (.bez text format or .bbez binary format)
+    TerrainModel(string path, bool batched = true)
+        : batched(batched)
+    {
+        AllocationScope scope;
+        if (path.size() > 5 && path.compare(path.size() - 5, 5, ".bbez") == 0)
+        {
+            // the file stays mapped, the control points are uploaded straight from the mapping
+            binaryFile = MappedFile(path);
+            binaryView = view_BezBinary(binaryFile);
+            if (!binaryView.valid())
+                std::cout << "ERROR::TERRAIN_MODEL::INVALID_BINARY_MODEL " << path << std::endl;
+        }
+        else
+            store = PatchStore(read_BezText(path));
+        setupMeshes();
+        allocations = scope.measure();
+    }
+
+    //Bezier Surfaces Model of patches generated elsewhere (e.g. by a background job, see TerrainRegenerator): no GPU buffer is created here,
+    //the patches are uploaded a slice at a time by uploadStep and the model can be drawn once the upload is complete
+    TerrainModel(PatchStore&& generated, std::uint64_t fingerprint, double generationMs, bool batched = true)
+        : store(std::move(generated)), batched(batched), generationMs(generationMs), fingerprintValue(fingerprint), uploading(true)
     {
-        vector<BezierSurface> surfaces = readModel(path);
-        std::vector<TerrainMesh> tmesh;
-	    tmesh.reserve(surfaces.size());
-        for (const auto& bsurface : surfaces)
-		    tmesh.emplace_back(bsurface);
-        meshes = std::move(tmesh);
-        
     }
 
     TerrainModel(){
     }
 
+    // TerrainModel is move-only, like its meshes: a moved model hands its GPU buffers over, an assigned one gives its old buffers back to the pool
+    TerrainModel(const TerrainModel&) = delete;
+    TerrainModel& operator=(const TerrainModel&) = delete;
+    TerrainModel(TerrainModel&&) = default;
+    TerrainModel& operator=(TerrainModel&&) = default;
+
+    // Switch between one draw call per patch and the single batched indexed control net (the meshes are rebuilt)
+    void setBatched(bool isBatched)
+    {
+        if (isBatched == batched)
+            return;
+        batched = isBatched;
+        if (uploading)
+        {
+            // a staged upload restarts in the new mode
+            meshes.clear();
+            uploadedPatches = 0;
+            return;
+        }
+        setupMeshes();
+    }
+
+    bool isBatched() const noexcept { return batched; }
+
+    // Staged upload: uploads about patchBudget more patches (one draw call per patch creates a VAO and a VBO for each patch,
+    // so only patchBudget / 16 of them), true once every patch is on the GPU
+    bool uploadStep(std::size_t patchBudget)
+    {
+        if (!uploading)
+            return true;
+        if (batched && store.isGrid())
+        {
+            // the grid buffers stay mapped until the last rows are written
+            if (meshes.empty())
+                meshes.emplace_back(store.length(), store.width());
+            const unsigned int rowBegin = (unsigned int)(uploadedPatches / store.width());
+            const unsigned int rowEnd = std::min(store.length(), rowBegin + (unsigned int)std::max<std::size_t>(1, patchBudget / store.width()));
+            meshes.front().uploadRows(store, rowBegin, rowEnd);
+            uploadedPatches = (std::size_t)rowEnd * store.width();
+            if (uploadedPatches == store.size())
+                meshes.front().finishUpload();
+        }
+        else if (batched)
+        {
+            setupMeshes();
+            uploadedPatches = store.size();
+        }
+        else
+        {
+            meshes.reserve(store.size());
+            const std::size_t end = std::min(store.size(), uploadedPatches + std::max<std::size_t>(1, patchBudget / 16));
+            for (; uploadedPatches != end; uploadedPatches++)
+                meshes.emplace_back(store[uploadedPatches]);
+        }
+        if (uploadedPatches == store.size())
+        {
+            uploading = false;
+            updateMeshStats();
+        }
+        return !uploading;
+    }
+
+    // Fraction of the patches of a staged upload already on the GPU
+    float uploadProgress() const noexcept { return uploading && !store.empty() ? (float)uploadedPatches / (float)store.size() : 1.0f; }
+    // CPU time of the last terrain generation (0 for models read from file)
+    double generationTime() const noexcept { return generationMs; }
+
+    // Hash of the generated patches: the generation is deterministic, so same parameters give the same fingerprint
+    std::uint64_t fingerprint() const noexcept { return fingerprintValue; }
+
+    // Heap allocations made while the model was built (generation or reading, and GPU upload)
+    const AllocationStats& buildAllocations() const noexcept { return allocations; }
+
+    // Changes every time the GPU buffers of the model are rebuilt: anything derived from them (e.g. a vertex cache) is stale
+    std::uint64_t revision() const noexcept { return revisionValue; }
+
+    // CPU memory of the patches
+    std::size_t patchBytes() const noexcept { return store.bytes(); }
+
+    // Patches with the grid of a generated terrain (empty for a mapped .bbez model until patches() is called)
+    const PatchStore& patchStore() const noexcept { return store; }
+
+    // CPU side patches of the model (a mapped .bbez model is expanded on the first call)
+    const vector<BezierSurface>& patches()
+    {
+        if (store.empty() && binaryView.valid())
+            store = PatchStore(read_BezBinary(binaryView));
+        return store.surfaces();
+    }
 
     //////////////////////////////////////////
 
     // model rendering: calls rendering methods of each instance of Mesh class in the vector
     void Draw()
     {
+        auto start = std::chrono::high_resolution_clock::now();
         for (const auto& Mesh : meshes)
 			Mesh.Draw();
-            
+        auto end = std::chrono::high_resolution_clock::now();
+        // CPU side cost of the submission of the terrain (driver calls only, GPU time is not included)
+        stats.drawCalls = (GLuint)meshes.size();
+        stats.patches = 0;
+        for (const auto& Mesh : meshes)
+            stats.patches += Mesh.patchCount;
+        stats.submitTimeMs = std::chrono::duration<double, std::milli>(end - start).count();
     }
 
+    const TerrainDrawStats& drawStats() const noexcept { return stats; }
+
     //////////////////////////////////////////
 
 
 private:
 
-    vector<BezierSurface> readModel(string path)
+    // CPU side copy of the patches (with the grid of a generated terrain), used to rebuild the GPU buffers when the draw mode changes
+    PatchStore store;
+    // mapped .bbez model (the patches are expanded in the store only if they are needed on the CPU or drawn one by one)
+    MappedFile binaryFile;
+    BinaryPatchView binaryView;
+    bool batched = true;
+    TerrainDrawStats stats;
+    AllocationStats allocations;
+    double generationMs = 0.0;
+    std::uint64_t fingerprintValue = 0;
+    std::uint64_t revisionValue = 0;
+    // staged upload in progress (see uploadStep)
+    bool uploading = false;
+    std::size_t uploadedPatches = 0;
+
+    // GPU buffers creation: one single indexed control net with every patch (batched) or one mesh for each patch
+    void setupMeshes()
     {
-        vector<BezierSurface> surfaces;
-        std::ifstream infile(path);
-        std::string line;
-        int count = 0;
-        BezierSurface bs;
-        while (std::getline(infile, line))
+        std::vector<TerrainMesh> tmesh;
+        if (!batched && store.empty() && binaryView.valid())
+            store = PatchStore(read_BezBinary(binaryView));
+        if (batched && binaryView.valid())
         {
-            std::istringstream iss(line);
-            //First line and every 4 lines (empty), skip
-            if(count == 0 || count == 5){
-                if(count == 5){
-                    surfaces.push_back(bs);
-                }
-                count=1;
-                continue;
+            // zero-copy upload of the indexed control net stored in the file
+            if (binaryView.header->patchCount)
+                tmesh.emplace_back(binaryView.points, binaryView.header->pointCount, binaryView.indices, (std::size_t)binaryView.header->patchCount * 16);
+        }
+        else if (batched && store.isGrid())
+        {
+            // stitched terrain borders are shared by construction: the control net is written straight in the GPU buffers
+            tmesh.emplace_back(store);
+        }
+        else if (batched)
+        {
+            if (!store.empty())
+            {
+                // loaded models are deduplicated by value
+                ControlNet net = index_BezierSurfaces(store.surfaces());
+                tmesh.emplace_back(net);
             }
-            //Process 4 control points
-            float p1_x, p1_y, p1_z;
-            float p2_x, p2_y, p2_z;
-            float p3_x, p3_y, p3_z;
-            float p4_x, p4_y, p4_z;
-            if (!(iss >> p1_x >> p1_y >> p1_z
-                      >> p2_x >> p2_y >> p2_z
-                      >> p3_x >> p3_y >> p3_z
-                      >> p4_x >> p4_y >> p4_z)) { break; } // error
-
-            ControlVertices app;
-            app[0] = glm::vec3(p1_x,p1_y,p1_z);
-            app[1] = glm::vec3(p2_x,p2_y,p2_z);
-            app[2] = glm::vec3(p3_x,p3_y,p3_z);
-            app[3] = glm::vec3(p4_x,p4_y,p4_z);
-            bs[count-1] = app;
-            count++;
         }
-        return surfaces;
+        else
+        {
+            tmesh.reserve(store.size());
+            for (const auto& bsurface : store.surfaces())
+                tmesh.emplace_back(bsurface);
+        }
+        meshes = std::move(tmesh);
+        updateMeshStats();
+    }
+
+    void updateMeshStats()
+    {
+        // shared by every model: two models never have the same revision (their buffers may be recycled ones)
+        static std::uint64_t revisions = 0;
+        revisionValue = ++revisions;
+        stats.controlPoints = 0;
+        stats.gpuBytes = 0;
+        for (const auto& Mesh : meshes)
+        {
+            stats.controlPoints += Mesh.pointCount;
+            stats.gpuBytes += Mesh.gpuBytes();
+        }
     }
 };
+
+
+// Result of check_TerrainBuffers (sets of GL objects: vertex array + buffers of a mesh)
+struct TerrainBufferCheck {
+    bool passed = false;
+    std::size_t patches = 0;
+    // still owned after every mesh of the check was destroyed, and given back twice
+    std::size_t leaked = 0;
+    std::size_t invalidReleases = 0;
+    // meshes whose objects are not (or no longer) GL objects
+    std::size_t invalidMeshes = 0;
+    // sets created by the first build, and created / recycled by the following regenerations
+    std::size_t firstBuildCreated = 0;
+    std::size_t regenerationCreated = 0;
+    std::size_t regenerationRecycled = 0;
+    GLenum glError = GL_NO_ERROR;
+};
+
+//Methods definition
+TerrainBufferCheck check_TerrainBuffers(unsigned int n = 24);
+
+//Methods implementation
+// Ownership of the terrain GPU buffers (needs a GL context, see --check-buffers in headless.h): meshes moved by the growth of a vector,
+// moved and assigned meshes and models, regenerations in one draw call per patch mode and a staged upload dropped half way.
+// Every set must go back to the pool exactly once, and regenerations after the first one must only recycle sets
+TerrainBufferCheck check_TerrainBuffers(unsigned int n)
+{
+    TerrainBufferCheck check;
+    TerrainBufferPool& pool = get_TerrainBufferPool();
+    while (glGetError() != GL_NO_ERROR)
+        ;
+    auto countInvalid = [&](const std::vector<TerrainMesh>& meshes) {
+        for (const auto& mesh : meshes)
+            if (!glIsVertexArray(mesh.VAO) || !glIsBuffer(mesh.VBO) || (mesh.EBO && !glIsBuffer(mesh.EBO)))
+                check.invalidMeshes++;
+    };
+    const TerrainBufferStats start = pool.bufferStats();
+    {
+        // no reserve: every reallocation moves the meshes
+        PatchStore store;
+        gen_Terrain(store, n, 45, 8, 3.0f);
+        check.patches = store.size();
+        std::vector<TerrainMesh> meshes;
+        for (std::size_t i = 0; i != store.size(); i++)
+            meshes.emplace_back(store[i]);
+        countInvalid(meshes);
+        // move construction and move assignment (the assigned mesh gives its buffers back)
+        TerrainMesh moved = std::move(meshes.back());
+        meshes.pop_back();
+        meshes.front() = std::move(moved);
+        countInvalid(meshes);
+    }
+    const TerrainBufferStats firstBuild = pool.bufferStats();
+    check.firstBuildCreated = firstBuild.created - start.created;
+    {
+        // the first regeneration creates a second terrain worth of sets (old and new models are alive together), the next ones recycle them
+        TerrainModel model(n, 46, 8, 3.0f, false);
+        model = TerrainModel(n, 47, 8, 3.0f, false);
+        const TerrainBufferStats steady = pool.bufferStats();
+        for (std::int32_t seed = 48; seed != 51; seed++)
+            model = TerrainModel(n, seed, 8, 3.0f, false);
+        TerrainModel movedModel(std::move(model));
+        countInvalid(movedModel.meshes);
+        const TerrainBufferStats regenerated = pool.bufferStats();
+        check.regenerationCreated = regenerated.created - steady.created;
+        check.regenerationRecycled = regenerated.recycled - steady.recycled;
+
+        // indexed grid, then a staged upload destroyed while its buffers are still mapped
+        movedModel.setBatched(true);
+        countInvalid(movedModel.meshes);
+        PatchStore staged;
+        gen_Terrain(staged, n, 51, 8, 3.0f);
+        TerrainModel stagedModel(std::move(staged), 0, 0.0, true);
+        stagedModel.uploadStep(n);
+    }
+    const TerrainBufferStats end = pool.bufferStats();
+    check.leaked = end.owned - start.owned;
+    check.invalidReleases = end.invalidReleases - start.invalidReleases;
+    check.glError = glGetError();
+    check.passed = check.leaked == 0 && check.invalidReleases == 0 && check.invalidMeshes == 0 && check.regenerationCreated == 0 && check.glError == GL_NO_ERROR;
+    return check;
+}
@@ -0,0 +1,185 @@
+/*
+Background terrain regeneration
+- the patches of a new terrain are generated by a background job (on the generation pool) while the render loop keeps drawing the old terrain
+- the GL thread uploads the new patches a slice per frame, in buffers that stay mapped for the whole upload (see TerrainModel::uploadStep),
+  and swaps the new model in only when it is complete
+- a new request (or cancel) discards the job still running: its generation stops at the next block of rows
+*/
+#pragma once
+#include <utils/terrain_gen.h>
+#include <utils/terrain_model.h>
+#include <utils/thread_pool.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+// Parameters of a generated terrain (see gen_Terrain)
+struct TerrainGenSettings {
+    unsigned int n = 100;
+    std::int32_t seed = 45;
+    std::int32_t octaves = 8;
+    float freq = 3.0f;
+
+    bool operator==(const TerrainGenSettings& other) const noexcept
+    {
+        return n == other.n && seed == other.seed && octaves == other.octaves && freq == other.freq;
+    }
+    bool operator!=(const TerrainGenSettings& other) const noexcept { return !(*this == other); }
+};
+
+enum TerrainRegenStage {
+    REGEN_IDLE,
+    REGEN_GENERATING,
+    REGEN_UPLOADING
+};
+
+// Timings of the last regeneration
+struct TerrainRegenStats {
+    // generation on the background job, upload on the GL thread (sum and longest frame)
+    double generationMs = 0.0;
+    double uploadMs = 0.0;
+    double maxFrameUploadMs = 0.0;
+    unsigned int uploadFrames = 0;
+    unsigned int completedJobs = 0;
+    unsigned int cancelledJobs = 0;
+};
+
+
+/////////////////// TERRAIN REGENERATOR class ///////////////////////
+class TerrainRegenerator
+{
+public:
+
+    // patchesPerFrame is the upload budget of a frame
+    explicit TerrainRegenerator(std::size_t patchesPerFrame = 2500)
+        : patchesPerFrame(patchesPerFrame), jobPool(2)
+    {
+    }
+
+    TerrainRegenerator(const TerrainRegenerator&) = delete;
+    TerrainRegenerator& operator=(const TerrainRegenerator&) = delete;
+
+    ~TerrainRegenerator()
+    {
+        // the pool (last member) waits for the running job, that stops at its next block of rows
+        cancel();
+    }
+
+    // Starts the generation of a new terrain, the job still running (or the model still uploading) is discarded
+    void request(const TerrainGenSettings& settings, bool batched)
+    {
+        cancel();
+        jobSettings = settings;
+        jobBatched = batched;
+        auto job = std::make_shared<Job>();
+        current = job;
+        stage = REGEN_GENERATING;
+        jobPool.submit([job, settings]() {
+            auto start = Clock::now();
+            PatchStore store;
+            if (!job->progress.cancelled && gen_Terrain(store, settings.n, settings.seed, settings.octaves, settings.freq, get_GenerationPool(), &job->progress))
+            {
+                job->fingerprint = calc_TerrainFingerprint(store.surfaces());
+                job->generationMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+                job->store = std::move(store);
+                job->complete = true;
+            }
+            job->finished.store(true, std::memory_order_release);
+        });
+    }
+
+    // Drops the current job (or staged model), the terrain drawn does not change
+    void cancel()
+    {
+        if (stage == REGEN_IDLE)
+            return;
+        if (current)
+            current->progress.cancelled = true;
+        current.reset();
+        staged.reset();
+        stage = REGEN_IDLE;
+        stats.cancelledJobs++;
+    }
+
+    // Called once per frame (GL thread): takes the generated patches, uploads a slice of them and, when the upload is complete,
+    // moves the new terrain into model (the old one is released). Returns true on the frame of the swap
+    bool update(TerrainModel& model)
+    {
+        if (stage == REGEN_GENERATING && current->finished.load(std::memory_order_acquire))
+        {
+            if (!current->complete)
+            {
+                cancel();
+                return false;
+            }
+            stats.generationMs = current->generationMs;
+            stats.uploadMs = stats.maxFrameUploadMs = 0.0;
+            stats.uploadFrames = 0;
+            staged = std::make_unique<TerrainModel>(std::move(current->store), current->fingerprint, current->generationMs, jobBatched);
+            current.reset();
+            stage = REGEN_UPLOADING;
+        }
+        if (stage != REGEN_UPLOADING)
+            return false;
+
+        auto start = Clock::now();
+        const bool uploaded = staged->uploadStep(patchesPerFrame);
+        const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        stats.uploadMs += ms;
+        stats.maxFrameUploadMs = std::max(stats.maxFrameUploadMs, ms);
+        stats.uploadFrames++;
+        if (!uploaded)
+            return false;
+        model = std::move(*staged);
+        staged.reset();
+        stage = REGEN_IDLE;
+        stats.completedJobs++;
+        return true;
+    }
+
+    TerrainRegenStage currentStage() const noexcept { return stage; }
+    bool isBusy() const noexcept { return stage != REGEN_IDLE; }
+
+    // Progress of the current stage (rows generated, patches uploaded)
+    float progress() const noexcept
+    {
+        if (stage == REGEN_GENERATING)
+            return current->progress.fraction();
+        if (stage == REGEN_UPLOADING)
+            return staged->uploadProgress();
+        return 0.0f;
+    }
+
+    // Parameters of the terrain being generated (or uploaded)
+    const TerrainGenSettings& settings() const noexcept { return jobSettings; }
+
+    const TerrainRegenStats& regenStats() const noexcept { return stats; }
+
+private:
+
+    using Clock = std::chrono::high_resolution_clock;
+
+    // Shared by the background job and the GL thread: a cancelled job keeps it alive until it returns
+    struct Job
+    {
+        TerrainGenProgress progress;
+        PatchStore store;
+        std::uint64_t fingerprint = 0;
+        double generationMs = 0.0;
+        bool complete = false;
+        std::atomic<bool> finished{ false };
+    };
+
+    std::size_t patchesPerFrame;
+    TerrainGenSettings jobSettings;
+    bool jobBatched = true;
+    TerrainRegenStage stage = REGEN_IDLE;
+    TerrainRegenStats stats;
+    std::shared_ptr<Job> current;
+    // generated terrain, uploading on the GPU
+    std::unique_ptr<TerrainModel> staged;
+    // a single background thread (the generation itself runs on the generation pool)
+    // declared last: destroyed first, so the worker is joined while the members it uses are still alive
+    ThreadPool jobPool;
+};
@@ -0,0 +1,286 @@
+/*
+Streamed terrain tiles
+- infinite terrain split in square tiles of stitched Bezier patches, generated around the camera on background threads
+- every tile is generated together with the ring of patches around it (see gen_TerrainTile), so its borders match
+  the ones of the tiles already resident without touching them
+- tiles far from (or behind) the camera are evicted to keep the GPU buffers under a fixed memory budget
+*/
+#pragma once
+#include <utils/terrain_gen.h>
+#include <utils/terrain_mesh.h>
+#include <utils/control_net.h>
+#include <utils/thread_pool.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Parameters of the streamed terrain (the scale of the patches and of the noise is the one of gen_Terrain(n, ...))
+struct TerrainTileSettings {
+    unsigned int n = 100;
+    std::int32_t seed = 45;
+    std::int32_t octaves = 8;
+    float freq = 3.0f;
+    // patches on each side of a tile
+    unsigned int tilePatches = 16;
+    // tiles kept around the camera tile (in each direction)
+    unsigned int viewRadius = 4;
+    // GPU memory allowed to the resident tiles
+    std::size_t memoryBudgetBytes = 32u << 20;
+    // tiles uploaded on the GPU at most in a single frame
+    unsigned int uploadsPerFrame = 4;
+};
+
+// State of the streamed terrain, refreshed by update() and Draw()
+struct TerrainTileStats {
+    std::size_t residentTiles = 0;
+    std::size_t pendingTiles = 0;
+    std::size_t generatedTiles = 0;
+    std::size_t evictedTiles = 0;
+    // time spent by a worker thread generating a tile (last and average)
+    double lastGenerationMs = 0.0;
+    double averageGenerationMs = 0.0;
+    // time from the request of a tile to its upload on the GPU (queue + generation + upload)
+    double lastLatencyMs = 0.0;
+    // GPU memory of the resident tiles and the budget they are kept under
+    std::size_t gpuBytes = 0;
+    std::size_t budgetBytes = 0;
+    GLuint drawCalls = 0;
+    GLuint patches = 0;
+};
+
+
+/////////////////// TERRAIN TILE MANAGER class ///////////////////////
+class TerrainTileManager
+{
+public:
+
+    // workers is the number of background threads generating tiles
+    explicit TerrainTileManager(const TerrainTileSettings& settings, unsigned int workers = std::max(1u, std::thread::hardware_concurrency() / 2))
+        : settings(settings), workerPool(workers + 1)
+    {
+    }
+
+    TerrainTileManager(const TerrainTileManager&) = delete;
+    TerrainTileManager& operator=(const TerrainTileManager&) = delete;
+
+    ~TerrainTileManager()
+    {
+        // queued jobs are skipped, the pool (last member) waits for the running ones before the rest is destroyed
+        epoch++;
+    }
+
+    // New terrain parameters: every resident tile is dropped and the jobs still running are discarded
+    void reset(const TerrainTileSettings& newSettings)
+    {
+        settings = newSettings;
+        epoch++;
+        tiles.clear();
+        pending.clear();
+        std::lock_guard<std::mutex> lock(readyMutex);
+        ready.clear();
+    }
+
+    const TerrainTileSettings& getSettings() const noexcept { return settings; }
+
+    // Called once per frame (GL thread): uploads the tiles generated in the meantime, evicts the tiles out of range
+    // and requests the missing ones. cameraPosition and cameraFront are in the terrain model space
+    void update(const glm::vec3& cameraPosition, const glm::vec3& cameraFront)
+    {
+        const std::int32_t P = (std::int32_t)settings.tilePatches;
+        const float step = 4.0f / (float)settings.n;
+        // tile of the camera (rows grow towards -z, columns towards +x, as in gen_Terrain)
+        const std::int32_t cameraRow = floorDiv((std::int32_t)std::floor((2.0f - cameraPosition.z) / step), P);
+        const std::int32_t cameraCol = floorDiv((std::int32_t)std::floor((cameraPosition.x + 2.0f) / step), P);
+        const glm::vec2 camera(cameraPosition.x, cameraPosition.z);
+        glm::vec2 front(cameraFront.x, cameraFront.z);
+        front = glm::length(front) > 0.0f ? glm::normalize(front) : glm::vec2(0.0f);
+
+        // distance in tiles, doubled for the tiles behind the camera: they are the last requested and the first evicted
+        auto priority = [&](std::int32_t row, std::int32_t col) {
+            const float size = step * P;
+            const glm::vec2 centre(-2.0f + size * (col + 0.5f), 2.0f - size * (row + 0.5f));
+            const glm::vec2 toTile = (centre - camera) / size;
+            const float distance = glm::length(toTile);
+            return glm::dot(toTile, front) < -0.5f ? 2.0f * distance : distance;
+        };
+
+        const std::size_t maxTiles = std::max<std::size_t>(1, settings.memoryBudgetBytes / tileBytes());
+
+        // 1. uploads (a few per frame, the others wait for the next frames)
+        std::vector<ReadyTile> completed;
+        {
+            std::lock_guard<std::mutex> lock(readyMutex);
+            const std::size_t count = std::min<std::size_t>(ready.size(), settings.uploadsPerFrame);
+            completed.assign(std::make_move_iterator(ready.begin()), std::make_move_iterator(ready.begin() + count));
+            ready.erase(ready.begin(), ready.begin() + count);
+        }
+        for (auto& tile : completed)
+        {
+            pending.erase(tile.key);
+            stats.generatedTiles++;
+            stats.lastGenerationMs = tile.generationMs;
+            totalGenerationMs += tile.generationMs;
+            stats.averageGenerationMs = totalGenerationMs / stats.generatedTiles;
+            // a tile that went out of range while it was generated is not uploaded
+            if (chebyshev(tile.row - cameraRow, tile.col - cameraCol) > (std::int32_t)settings.viewRadius + 1)
+                continue;
+            // the control net is uploaded as it is, the CPU side data are released
+            ControlNet net = index_TerrainGrid(settings.tilePatches, settings.tilePatches, tile.patches);
+            Tile resident;
+            resident.row = tile.row;
+            resident.col = tile.col;
+            resident.mesh = std::make_unique<TerrainMesh>(net.points.data(), net.points.size(), net.indices.data(), net.indices.size());
+            tiles[tile.key] = std::move(resident);
+            stats.lastLatencyMs = std::chrono::duration<double, std::milli>(Clock::now() - tile.requested).count();
+        }
+
+        // 2. evictions: tiles out of range, then the lowest priority ones while over budget
+        for (auto it = tiles.begin(); it != tiles.end();)
+        {
+            if (chebyshev(it->second.row - cameraRow, it->second.col - cameraCol) > (std::int32_t)settings.viewRadius + 1)
+            {
+                it = tiles.erase(it);
+                stats.evictedTiles++;
+            }
+            else
+                ++it;
+        }
+        if (tiles.size() > maxTiles)
+        {
+            std::vector<std::pair<float, std::uint64_t>> order;
+            order.reserve(tiles.size());
+            for (const auto& tile : tiles)
+                order.emplace_back(priority(tile.second.row, tile.second.col), tile.first);
+            std::sort(order.begin(), order.end());
+            for (std::size_t i = maxTiles; i != order.size(); i++)
+            {
+                tiles.erase(order[i].second);
+                stats.evictedTiles++;
+            }
+        }
+
+        // 3. requests: missing tiles in range, nearest (and in front of the camera) first, within the budget
+        std::vector<std::pair<float, std::uint64_t>> wanted;
+        const std::int32_t R = (std::int32_t)settings.viewRadius;
+        for (std::int32_t row = cameraRow - R; row <= cameraRow + R; row++)
+            for (std::int32_t col = cameraCol - R; col <= cameraCol + R; col++)
+                wanted.emplace_back(priority(row, col), tileKey(row, col));
+        std::sort(wanted.begin(), wanted.end());
+        if (wanted.size() > maxTiles)
+            wanted.resize(maxTiles);
+        const std::size_t maxPending = 2 * (workerPool.size() - 1) + 2;
+        for (const auto& tile : wanted)
+        {
+            if (pending.size() >= maxPending)
+                break;
+            if (tiles.count(tile.second) || pending.count(tile.second))
+                continue;
+            request(tile.second);
+        }
+
+        stats.residentTiles = tiles.size();
+        stats.pendingTiles = pending.size();
+        stats.budgetBytes = settings.memoryBudgetBytes;
+        stats.gpuBytes = 0;
+        for (const auto& tile : tiles)
+            stats.gpuBytes += tile.second.mesh->gpuBytes();
+    }
+
+    // Draws every resident tile (one draw call each)
+    void Draw()
+    {
+        stats.drawCalls = 0;
+        stats.patches = 0;
+        for (const auto& tile : tiles)
+        {
+            tile.second.mesh->Draw();
+            stats.drawCalls++;
+            stats.patches += tile.second.mesh->patchCount;
+        }
+    }
+
+    const TerrainTileStats& tileStats() const noexcept { return stats; }
+
+    // GPU memory of a tile: (3P + 1)^2 unique control points and 16 indices per patch
+    std::size_t tileBytes() const noexcept
+    {
+        const std::size_t side = 3 * settings.tilePatches + 1;
+        return side * side * sizeof(glm::vec3) + 16 * settings.tilePatches * settings.tilePatches * sizeof(GLuint);
+    }
+
+private:
+
+    using Clock = std::chrono::high_resolution_clock;
+
+    struct Tile
+    {
+        std::int32_t row = 0, col = 0;
+        std::unique_ptr<TerrainMesh> mesh;
+    };
+
+    // Tile generated by a worker, waiting to be uploaded by the GL thread
+    struct ReadyTile
+    {
+        std::uint64_t key;
+        std::int32_t row, col;
+        std::vector<BezierSurface> patches;
+        double generationMs;
+        Clock::time_point requested;
+    };
+
+    static std::uint64_t tileKey(std::int32_t row, std::int32_t col) noexcept
+    {
+        return ((std::uint64_t)(std::uint32_t)row << 32) | (std::uint32_t)col;
+    }
+
+    static std::int32_t floorDiv(std::int32_t a, std::int32_t b) noexcept
+    {
+        return a / b - ((a % b != 0) && ((a < 0) != (b < 0)));
+    }
+
+    static std::int32_t chebyshev(std::int32_t dr, std::int32_t dc) noexcept
+    {
+        return std::max(std::abs(dr), std::abs(dc));
+    }
+
+    void request(std::uint64_t key)
+    {
+        const auto row = (std::int32_t)(std::uint32_t)(key >> 32);
+        const auto col = (std::int32_t)(std::uint32_t)key;
+        pending[key] = Clock::now();
+        const unsigned int jobEpoch = epoch;
+        const TerrainTileSettings jobSettings = settings;
+        const Clock::time_point requested = pending[key];
+        workerPool.submit([this, key, row, col, jobEpoch, jobSettings, requested]() {
+            if (jobEpoch != epoch)
+                return;
+            // the tile is generated on this worker only: parallel_for on a pool of size 1 runs inline
+            ThreadPool inlinePool(1);
+            auto start = Clock::now();
+            const std::int32_t P = (std::int32_t)jobSettings.tilePatches;
+            auto patches = gen_TerrainTile(row * P, col * P, jobSettings.tilePatches, jobSettings.n, jobSettings.seed, jobSettings.octaves, jobSettings.freq, inlinePool);
+            double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+            std::lock_guard<std::mutex> lock(readyMutex);
+            if (jobEpoch == epoch)
+                ready.push_back({ key, row, col, std::move(patches), ms, requested });
+        });
+    }
+
+    TerrainTileSettings settings;
+    TerrainTileStats stats;
+    double totalGenerationMs = 0.0;
+    std::unordered_map<std::uint64_t, Tile> tiles;
+    // tiles requested and not uploaded yet, with their request time
+    std::unordered_map<std::uint64_t, Clock::time_point> pending;
+    std::mutex readyMutex;
+    std::vector<ReadyTile> ready;
+    // jobs of a previous epoch (before a reset) are discarded
+    std::atomic<unsigned int> epoch{ 0 };
+    // declared last: destroyed first, so the workers are joined while the members they use are still alive
+    ThreadPool workerPool;
+};
@@ -0,0 +1,124 @@
+/*
+Thread Pool class
+- fixed set of worker threads used to split CPU work (e.g. terrain generation) in tiles
+- parallel_for blocks until every tile has been processed, the calling thread works too
+- submit queues a background job on the worker threads and returns immediately
+*/
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+
+	// threads is the total number of threads working on a parallel_for (the caller included)
+	explicit ThreadPool(unsigned int threads = std::max(1u, std::thread::hardware_concurrency()))
+	{
+		threads = std::max(1u, threads);
+		for (unsigned int i = 1; i < threads; i++)
+			workers.emplace_back([this] { workerLoop(); });
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wakeUp.notify_all();
+		for (auto& worker : workers)
+			worker.join();
+	}
+
+	unsigned int size() const noexcept { return (unsigned int)workers.size() + 1; }
+
+	// Calls fn(begin, end) on tiles of at most grain elements covering [0, count)
+	// Tiles are independent, so the result does not depend on the number of threads
+	template <class F>
+	void parallel_for(std::size_t count, std::size_t grain, F&& fn)
+	{
+		if (count == 0)
+			return;
+		grain = std::max<std::size_t>(1, grain);
+		const std::size_t tiles = (count + grain - 1) / grain;
+
+		std::atomic<std::size_t> nextTile{ 0 };
+		auto runTiles = [&]() {
+			for (std::size_t t = nextTile++; t < tiles; t = nextTile++)
+				fn(t * grain, std::min(count, (t + 1) * grain));
+		};
+
+		// no need to wake up the workers for a single tile
+		const std::size_t helpers = std::min<std::size_t>(workers.size(), tiles - 1);
+		std::size_t pending = helpers;
+		std::mutex doneMutex;
+		std::condition_variable done;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (std::size_t i = 0; i != helpers; i++)
+				jobs.push([&]() {
+					runTiles();
+					std::lock_guard<std::mutex> doneLock(doneMutex);
+					if (--pending == 0)
+						done.notify_one();
+				});
+		}
+		wakeUp.notify_all();
+
+		runTiles();
+		std::unique_lock<std::mutex> doneLock(doneMutex);
+		done.wait(doneLock, [&] { return pending == 0; });
+	}
+
+	// Queues fn on the worker threads without waiting for it (a pool of size 1 has no workers and runs fn inline)
+	// Jobs still queued when the pool is destroyed are run before the workers exit
+	void submit(std::function<void()> fn)
+	{
+		if (workers.empty())
+		{
+			fn();
+			return;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			jobs.push(std::move(fn));
+		}
+		wakeUp.notify_one();
+	}
+
+private:
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	std::mutex mutex;
+	std::condition_variable wakeUp;
+	bool stopping = false;
+
+	void workerLoop()
+	{
+		for (;;)
+		{
+			std::function<void()> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeUp.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping && jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop();
+			}
+			job();
+		}
+	}
+};
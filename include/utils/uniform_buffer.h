@@ -0,0 +1,90 @@
+/*
+Uniform buffers
+- std140 uniform blocks shared by the shader programs (camera and NPR style parameters)
+- the buffer keeps a copy of the last uploaded block and is re-uploaded only when a value actually changes
+*/
+#pragma once
+#include <cstring>
+#include <glm/glm.hpp>
+
+// Binding points of the uniform blocks (every program binds its blocks to these, see Shader::bindUniformBlock)
+constexpr GLuint CAMERA_BLOCK_BINDING = 0;
+constexpr GLuint NPR_STYLE_BLOCK_BINDING = 1;
+
+// std140 layout of CameraBlock: view dependent values, shared by the terrain programs and the skybox
+struct CameraBlock {
+    glm::mat4 viewMatrix = glm::mat4(1.0f);
+    glm::mat4 projectionMatrix = glm::mat4(1.0f);
+    // camera position in world space (w unused)
+    glm::vec4 cameraWorldPosition = glm::vec4(0.0f);
+    // viewport size in pixels
+    glm::vec2 viewportResolution = glm::vec2(0.0f);
+    glm::vec2 padding = glm::vec2(0.0f);
+};
+static_assert(sizeof(CameraBlock) == 160, "CameraBlock does not match the std140 layout");
+
+// std140 layout of NPRStyleBlock: every vec3 is followed by a scalar that fills its 16 bytes, bools are 4 bytes
+struct NPRStyleBlock {
+    glm::vec3 warmColor = glm::vec3(0.0f);
+    GLfloat contourLimit = 0.0f;
+    glm::vec3 coldColor = glm::vec3(0.0f);
+    GLfloat directionalDerivativeLimit = 0.0f;
+    glm::vec3 strokeColor = glm::vec3(0.0f);
+    GLfloat tessellationTriangleSize = 0.0f;
+    GLint shadingType = 0;
+    GLint celShadingSize = 0;
+    GLint shininessFactor = 0;
+    GLint curvatureDebugView = 0;
+    GLint enableContours = 0;
+    GLint enableSuggestiveContours = 0;
+    GLint enablePatchCulling = 0;
+    GLfloat curvatureDebugScale = 0.0f;
+};
+static_assert(sizeof(NPRStyleBlock) == 80, "NPRStyleBlock does not match the std140 layout");
+
+
+/////////////////// UNIFORM BUFFER class ///////////////////////
+template <typename Block>
+class UniformBuffer
+{
+public:
+    // Number of update() calls and of the ones that actually uploaded the block
+    std::size_t updates = 0;
+    std::size_t uploads = 0;
+
+    // The buffer stays bound to the binding point for the whole application
+    explicit UniformBuffer(GLuint binding) : binding(binding)
+    {
+        glGenBuffers(1, &this->UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, binding, this->UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    // Uploads the block if it differs from the last uploaded one, returns true if it was uploaded
+    bool update(const Block& block)
+    {
+        updates++;
+        if (uploaded && std::memcmp(&block, &lastBlock, sizeof(Block)) == 0)
+            return false;
+        glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &block);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        lastBlock = block;
+        uploaded = true;
+        uploads++;
+        return true;
+    }
+
+    GLuint getBinding() const noexcept { return binding; }
+
+    // We delete the buffer when application closes
+    void Delete() { glDeleteBuffers(1, &this->UBO); }
+
+private:
+    GLuint UBO = 0;
+    GLuint binding;
+    bool uploaded = false;
+    Block lastBlock;
+};
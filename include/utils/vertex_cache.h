@@ -0,0 +1,277 @@
+/*
+Terrain vertex cache
+- the triangles generated by the tessellation of the terrain (position in clip space and the varyings of the fragment shader)
+  are captured with transform feedback while the terrain is drawn, and drawn again as plain triangles (glDrawTransformFeedback)
+  as long as the inputs of the tessellation do not change: patches, tessellation levels, camera, model and light
+- the inputs are summed up in a key (VertexCacheKey): the triangles are captured again once a new key stays the same for two
+  frames in a row, so a moving camera draws the terrain without paying the capture at every frame
+- the captured triangles are counted by a query read at the next frames (never stalling the pipeline): if they did not fit
+  in the buffer, it grows and the triangles are captured again
+- the GL objects are created at the first use: the cache can be declared before the GL context, release() must be called before
+  the context is destroyed
+*/
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+#include <algorithm>
+#include <utils/gpu_timer.h>
+
+// A varying captured for each vertex: name in the capturing program and number of floats
+struct VertexCacheAttribute
+{
+    std::string name;
+    GLint components;
+};
+
+// What to do with the terrain at this frame
+enum VertexCacheAction { VERTEX_CACHE_HIT, VERTEX_CACHE_CAPTURE, VERTEX_CACHE_SKIP };
+
+// FNV-1a hash of the inputs of the captured draw (the bytes of trivially copyable values, e.g. matrices and uniform blocks)
+struct VertexCacheKey
+{
+    std::uint64_t value = 14695981039346656037ull;
+
+    template <typename T>
+    VertexCacheKey& add(const T& data) noexcept
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "only plain values can be hashed");
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&data);
+        for (std::size_t i = 0; i != sizeof(T); i++)
+        {
+            value ^= bytes[i];
+            value *= 1099511628211ull;
+        }
+        return *this;
+    }
+};
+
+/////////////////// TERRAIN VERTEX CACHE class ///////////////////////
+class TerrainVertexCache
+{
+public:
+
+    // first size of the buffer, and the largest one (beyond it the view is drawn without the cache)
+    static constexpr std::size_t initialBytes = 8u << 20;
+    static constexpr std::size_t maxBytes = 512u << 20;
+
+    TerrainVertexCache() = default;
+
+    TerrainVertexCache(const TerrainVertexCache&) = delete;
+    TerrainVertexCache& operator=(const TerrainVertexCache&) = delete;
+
+    // frames drawn from the cache, frames that tessellated the terrain (captures included) and captures
+    std::size_t hits = 0, misses = 0, captures = 0;
+    // captures that did not fit in the buffer
+    std::size_t overflows = 0;
+    // GPU time of the terrain in the frames drawn from the cache and in the frames that captured it
+    GpuTimer hitTimer, captureTimer;
+
+    // Varyings of the capturing program, in the order they were declared at link time (an empty layout disables the cache):
+    // a new layout drops the captured triangles
+    void setLayout(const std::vector<VertexCacheAttribute>& attributes)
+    {
+        bool same = attributes.size() == layout.size();
+        for (std::size_t i = 0; same && i != attributes.size(); i++)
+            same = attributes[i].name == layout[i].name && attributes[i].components == layout[i].components;
+        if (same)
+            return;
+        layout = attributes;
+        stride = 0;
+        for (const auto& attribute : layout)
+            stride += attribute.components * sizeof(GLfloat);
+        layoutChanged = true;
+        invalidate();
+    }
+
+    // Chooses between the captured triangles, a new capture (call beginCapture/endCapture around the draw) and a plain draw
+    VertexCacheAction prepare(std::uint64_t key)
+    {
+        checkCapture();
+        const bool stable = key == previousKey;
+        previousKey = key;
+        if (layout.empty() || key == tooLargeKey)
+        {
+            misses++;
+            return VERTEX_CACHE_SKIP;
+        }
+        if (captured && key == capturedKey)
+        {
+            // the size of the capture is not known yet: the terrain is drawn again
+            if (checkPending)
+            {
+                misses++;
+                return VERTEX_CACHE_SKIP;
+            }
+            hits++;
+            return VERTEX_CACHE_HIT;
+        }
+        // the view changed since the last frame: it is captured only if it stays
+        misses++;
+        return stable ? VERTEX_CACHE_CAPTURE : VERTEX_CACHE_SKIP;
+    }
+
+    // The primitives drawn until endCapture (triangles, with the varyings of the layout) are written in the cache
+    void beginCapture(std::uint64_t key)
+    {
+        if (!feedback)
+        {
+            glGenTransformFeedbacks(1, &feedback);
+            glGenBuffers(1, &buffer);
+            glGenVertexArrays(1, &VAO);
+            glGenQueries(1, &generatedQuery);
+            glGenQueries(1, &writtenQuery);
+        }
+        if (bufferBytes < requiredBytes)
+        {
+            bufferBytes = requiredBytes;
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, bufferBytes, nullptr, GL_STATIC_COPY);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        if (layoutChanged)
+            setupVertexArray();
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, feedback);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer);
+        glBeginQuery(GL_PRIMITIVES_GENERATED, generatedQuery);
+        glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, writtenQuery);
+        glBeginTransformFeedback(GL_TRIANGLES);
+        capturedKey = key;
+    }
+
+    void endCapture()
+    {
+        glEndTransformFeedback();
+        glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+        glEndQuery(GL_PRIMITIVES_GENERATED);
+        glBindTransformFeedback(GL_TRANSFORM_FEEDBACK, 0);
+        captured = true;
+        checkPending = true;
+        captures++;
+    }
+
+    // Draws the captured triangles (with a program that reads the layout as vertex attributes, in the same order)
+    void Draw() const
+    {
+        glBindVertexArray(VAO);
+        glDrawTransformFeedback(GL_TRIANGLES, feedback);
+        glBindVertexArray(0);
+    }
+
+    // The captured triangles are dropped (e.g. the capturing program was rebuilt)
+    void invalidate() noexcept
+    {
+        captured = false;
+        tooLargeKey = 0;
+    }
+
+    // Restarts the counters and the timers
+    void resetStats() noexcept
+    {
+        hits = misses = captures = overflows = 0;
+        hitTimer.reset();
+        captureTimer.reset();
+    }
+
+    // Deletes the GL objects (the GL context must be alive)
+    void release()
+    {
+        if (feedback)
+        {
+            glDeleteTransformFeedbacks(1, &feedback);
+            glDeleteBuffers(1, &buffer);
+            glDeleteVertexArrays(1, &VAO);
+            glDeleteQueries(1, &generatedQuery);
+            glDeleteQueries(1, &writtenQuery);
+        }
+        feedback = buffer = VAO = generatedQuery = writtenQuery = 0;
+        bufferBytes = 0;
+        enabledAttributes = 0;
+        layoutChanged = true;
+        captured = checkPending = false;
+        hitTimer.release();
+        captureTimer.release();
+    }
+
+    double hitRate() const noexcept { return hits + misses ? (double)hits / (hits + misses) : 0.0; }
+
+    // GPU time saved by the frames drawn from the cache, estimated against the average of plainTimer: the frames that tessellated
+    // the terrain without capturing it (a capture costs more than the frames the cache replaces)
+    double savedMs(const GpuTimer& plainTimer) const noexcept
+    {
+        if (!hitTimer.samples || !plainTimer.samples)
+            return 0.0;
+        return hits * std::max(0.0, plainTimer.averageMs() - hitTimer.averageMs());
+    }
+
+    // triangles of the last capture (known a few frames after it) and GPU memory of the buffer
+    std::size_t capturedTriangles() const noexcept { return triangles; }
+    std::size_t gpuBytes() const noexcept { return bufferBytes; }
+
+private:
+
+    std::vector<VertexCacheAttribute> layout;
+    std::size_t stride = 0;
+    bool layoutChanged = true;
+    GLuint enabledAttributes = 0;
+    GLuint feedback = 0, buffer = 0, VAO = 0;
+    GLuint generatedQuery = 0, writtenQuery = 0;
+    std::size_t bufferBytes = 0, requiredBytes = initialBytes;
+    std::size_t triangles = 0;
+    bool captured = false;
+    // the queries of the last capture were not read yet
+    bool checkPending = false;
+    std::uint64_t capturedKey = 0;
+    // key of the last frame
+    std::uint64_t previousKey = 0;
+    // view whose triangles do not fit in the largest buffer
+    std::uint64_t tooLargeKey = 0;
+
+    // Reads the queries of the last capture when they are available: the cache is dropped if the triangles did not fit
+    void checkCapture()
+    {
+        if (!checkPending)
+            return;
+        GLint available = 0;
+        glGetQueryObjectiv(generatedQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        GLuint generated = 0, written = 0;
+        glGetQueryObjectuiv(generatedQuery, GL_QUERY_RESULT, &generated);
+        glGetQueryObjectuiv(writtenQuery, GL_QUERY_RESULT, &written);
+        checkPending = false;
+        triangles = written;
+        if (written >= generated)
+            return;
+        // the buffer grows with some margin for the next views, and the triangles are captured again
+        overflows++;
+        captured = false;
+        std::size_t needed = (std::size_t)generated * 3 * stride;
+        if (needed > maxBytes)
+            tooLargeKey = capturedKey;
+        else
+            requiredBytes = std::min(maxBytes, std::max(bufferBytes * 2, needed + needed / 4));
+    }
+
+    // the varyings are interleaved in the buffer: attribute i is read from location i
+    void setupVertexArray()
+    {
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        std::size_t offset = 0;
+        for (GLuint i = 0; i != layout.size(); i++)
+        {
+            glEnableVertexAttribArray(i);
+            glVertexAttribPointer(i, layout[i].components, GL_FLOAT, GL_FALSE, (GLsizei)stride, (void*)offset);
+            offset += layout[i].components * sizeof(GLfloat);
+        }
+        // locations of a longer layout used before
+        for (GLuint i = (GLuint)layout.size(); i < enabledAttributes; i++)
+            glDisableVertexAttribArray(i);
+        enabledAttributes = (GLuint)layout.size();
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        layoutChanged = false;
+    }
+};
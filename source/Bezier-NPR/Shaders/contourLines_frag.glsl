@@ -0,0 +1,10 @@
+#version 410 core
+
+out vec4 colorFrag;
+
+uniform vec3 lineColor;
+
+void main()
+{
+    colorFrag = vec4(lineColor, 1.0);
+}
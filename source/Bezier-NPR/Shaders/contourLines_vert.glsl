@@ -0,0 +1,24 @@
+#version 410 core
+
+// Object space contours and suggestive contours extracted on the CPU (utils/contour_lines.h), drawn as line strips
+layout (location = 0) in vec3 position;
+
+uniform mat4 modelMatrix;
+// Camera parameters, shared by all the programs (CameraBlock in utils/uniform_buffer.h)
+layout (std140) uniform CameraBlock {
+    mat4 viewMatrix;
+    mat4 projectionMatrix;
+    // camera position in world space (w unused)
+    vec4 cameraWorldPosition;
+    // viewport size in pixels
+    vec2 viewportResolution;
+};
+
+// The lines lie on the surface: they are moved slightly towards the camera to win the depth test against it
+const float depthOffset = 0.0005;
+
+void main()
+{
+    gl_Position = projectionMatrix * viewMatrix * modelMatrix * vec4(position, 1.0);
+    gl_Position.z -= depthOffset * gl_Position.w;
+}
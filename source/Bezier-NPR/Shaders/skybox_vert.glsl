@@ -36,10 +36,15 @@ layout (location = 0) in vec3 position;
 // texture coordinates for the environment map sampling (we use 3 coordinates because we are sampling in 3 dimensions)
 out vec3 interp_UVW;
 
-// view matrix
-uniform mat4 viewMatrix;
-// Projection matrix
-uniform mat4 projectionMatrix;
+// Camera parameters, shared by all the programs (CameraBlock in utils/uniform_buffer.h)
+layout (std140) uniform CameraBlock {
+    mat4 viewMatrix;
+    mat4 projectionMatrix;
+    // camera position in world space (w unused)
+    vec4 cameraWorldPosition;
+    // viewport size in pixels
+    vec2 viewportResolution;
+};
 
 void main()
 {
@@ -47,7 +52,9 @@ void main()
 		interp_UVW = position;
 
 		// we apply the transformations to the vertex
-    vec4 pos = projectionMatrix * viewMatrix * vec4(position, 1.0);
+    // to have the background fixed during camera movements, we remove the translations from the view matrix
+		// (we consider only its top-left 3x3 submatrix)
+    vec4 pos = projectionMatrix * mat4(mat3(viewMatrix)) * vec4(position, 1.0);
 		// we want to set the Z coordinate of the projected vertex at the maximum depth (i.e., we want Z to be equal to 1.0 after the projection divide)
 		// -> we set Z equal to W (because in the projection divide, after clipping, all the components will be divided by W).
 		// This means that, during the depth test, the fragments of the environment map will have maximum depth (see comments in the code of the main application)
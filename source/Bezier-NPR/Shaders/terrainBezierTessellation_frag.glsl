@@ -3,11 +3,15 @@
 // output shader Color
 out vec4 out_Color;
 
-// Inputs from Tessellation Evaluation Shader
+// Inputs from Tessellation Evaluation Shader (only the ones of the render mode of this variant, see the NPR_* defines)
+#ifdef NPR_CONTOURS
 in float normalDotViewValue;
+#endif
 
-// Structure to pass data to Tessellation Evaluation Shader
+#ifdef NPR_SUGGESTIVE_CONTOURS
+// Structure to pass data from Tessellation Evaluation Shader (same members as the one of the evaluation shader)
 in CURVATURE_INFO{
+#ifdef NPR_CURVATURE_DEBUG
     vec2 uvCoordinatesInBezierPatch;
     mat2 firstFundamentalFormMatrix;
     mat2 secondFundamentalFormMatrix;
@@ -17,11 +21,13 @@ in CURVATURE_INFO{
     float gaussianCurvature;
     vec3 principalDirection1;
     vec3 principalDirection2;
-    vec3 viewVectorProjectedInTangentPlane;
     mat3 TBN;
     vec2 w;
+#endif
+    vec3 viewVectorProjectedInTangentPlane;
     float normalCurvatureInDirectionW;
 } curvature_informations;
+#endif
 
 // Normal in view coordinates
 in vec3 viewNormal;
@@ -30,20 +36,31 @@ in vec3 viewLightDirection;
 // Vector to Camera in view coordinate
 in vec3 vectorToCamera;
 
-// Uniforms from user
-uniform float contourLimit;
-uniform float directionalDerivativeLimit;
-// Colors to achieve desired style
-uniform vec3 warmColor;
-uniform vec3 coldColor;
-uniform vec3 strokeColor;
-// Numbers of levels for cel Shading
-uniform int celShadingSize;
-uniform int shininessFactor;
-// settings from UI
-uniform int shadingType;
-uniform bool enableContours;
-uniform bool enableSuggestiveContours;
+// Style parameters from the UI, re-uploaded only when they change (NPRStyleBlock in utils/uniform_buffer.h)
+layout (std140) uniform NPRStyleBlock {
+    // Colors to achieve desired style, each one followed by a parameter to fill the std140 slot
+    vec3 warmColor;
+    float contourLimit;
+    vec3 coldColor;
+    float directionalDerivativeLimit;
+    vec3 strokeColor;
+    // Desired length (in pixels) of the edges of the generated triangles
+    float tessellationTriangleSize;
+    // 0 - Cel Shading , 1 - Gooch Shading, 2 - Uniform color
+    int shadingType;
+    // Numbers of levels for cel Shading
+    int celShadingSize;
+    int shininessFactor;
+    // Quantity shown by the curvature debug variant (0: none, 1: mean curvature, 2: Gaussian curvature,
+    // 3: first principal direction, 4: radial curvature)
+    int curvatureDebugView;
+    bool enableContours;
+    bool enableSuggestiveContours;
+    // Patches outside the view frustum or entirely back facing are discarded before tessellation
+    bool enablePatchCulling;
+    // curvature mapped to half saturation by the curvature debug view
+    float curvatureDebugScale;
+};
 
 
 ////////////////////////////////////////////////////////////////////
@@ -107,10 +124,12 @@ vec3 GoochShading(){
   return vec3(kFinal + vec3(1) * specular);
 }
 
+#ifdef NPR_CONTOURS
 vec3 Contours()
 {
   vec3 color = vec3(1.0, 1.0, 1.0);
   float cLimitCalculated = (pow(normalDotViewValue, 2.0));
+#ifdef NPR_SUGGESTIVE_CONTOURS
   float dd = directionalDerivativeLimit * 0.0001;
   // Derivate of normal Curvature in direction W, DwKr
   // It is approximated as composition of dFdx and dFdy
@@ -118,11 +137,13 @@ vec3 Contours()
   float derivateNormalCurvatureInDirectionW = 
       curvature_informations.viewVectorProjectedInTangentPlane.x * dFdx(curvature_informations.normalCurvatureInDirectionW) 
     + curvature_informations.viewVectorProjectedInTangentPlane.y * dFdy(curvature_informations.normalCurvatureInDirectionW);
+#endif
   // Contours are those points where N dot V = 0
   // contourLimits is used to stretch the definition interval so that contours are those 
   // points where 0 <= N dot V <= contourLimits
   if(enableContours && cLimitCalculated<contourLimit)
     color = strokeColor;
+#ifdef NPR_SUGGESTIVE_CONTOURS
   // Suggestive Contours are those points where Kr = 0 and DwKr > 0
   // directionalDerivateLimit (dd) is used to stretch the definition interval so
   // that Suggestive Contours are those points where -dd <= Kr <= dd && DwKr > 0
@@ -132,8 +153,30 @@ vec3 Contours()
     && derivateNormalCurvatureInDirectionW>0 ){
       color = mix(vec3(1.0), strokeColor, 0.75);
   }
+#endif
   return color;
 }
+#endif
+
+#ifdef NPR_CURVATURE_DEBUG
+// Signed value in [-inf, inf] to a blue (negative), white (zero), red (positive) scale
+vec3 SignedColorMap(float value, float scale)
+{
+  float t = value / (abs(value) + scale);
+  return t < 0.0 ? mix(vec3(1.0), vec3(0.1, 0.3, 1.0), -t) : mix(vec3(1.0), vec3(1.0, 0.2, 0.1), t);
+}
+
+vec3 CurvatureDebugColor()
+{
+  if (curvatureDebugView == 1)
+    return SignedColorMap(curvature_informations.meanCurvature, curvatureDebugScale);
+  if (curvatureDebugView == 2)
+    return SignedColorMap(curvature_informations.gaussianCurvature, curvatureDebugScale * curvatureDebugScale);
+  if (curvatureDebugView == 3)
+    return abs(normalize(curvature_informations.principalDirection1));
+  return SignedColorMap(curvature_informations.normalCurvatureInDirectionW, curvatureDebugScale);
+}
+#endif
 
 //////////////////////////////////////////
 // main
@@ -151,9 +194,16 @@ void main(void)
       color = warmColor;
     }
 
+#ifdef NPR_CONTOURS
     if (enableContours || enableSuggestiveContours){
           color *= Contours();
     }
+#endif
+#ifdef NPR_CURVATURE_DEBUG
+    if (curvatureDebugView != 0){
+          color = CurvatureDebugColor();
+    }
+#endif
 
     //Final Fragment Color
     out_Color = vec4(color, 1.0);
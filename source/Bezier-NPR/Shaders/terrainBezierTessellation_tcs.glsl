@@ -2,40 +2,166 @@
 // Define the number of Control Points in the output patch
 layout (vertices = 16) out;
 
-// Necessary Matrices to calculate distance from camera
+// Index of the patch from the vertex shader, passed to the evaluation shader
+in int controlPointPatch[];
+patch out int patchIndex;
+
+// Model matrix of the terrain
 uniform mat4 modelMatrix;
-uniform mat4 viewMatrix;
-
-float getTessellationLevelBasedOnCameraDistance(vec4 currentPointPosition){
-    // Tessellation Parameters
-    int minTessLevel = 2;       int maxTessLevel = 8;
-    float maxDepthToConsider = 1000.0;    float minDepthToConsider = 100.0;
-    // Position in camera Coordinates
-    vec4 positionV = viewMatrix * modelMatrix * currentPointPosition;
-    // Tessellation level based on distance from camera
-    // "Distance" from camera scaled between 0 and 1
-    float currScaledDepth = clamp( (abs(positionV.z) - minDepthToConsider) / (maxDepthToConsider - minDepthToConsider),0.0, 1.0 );
-    // Interpolate between min/max tess levels
-    float tessLevel = mix(maxTessLevel, minTessLevel, currScaledDepth);
-    return tessLevel;
+// Camera parameters, shared by all the programs (CameraBlock in utils/uniform_buffer.h)
+layout (std140) uniform CameraBlock {
+    mat4 viewMatrix;
+    mat4 projectionMatrix;
+    // camera position in world space (w unused)
+    vec4 cameraWorldPosition;
+    // viewport size in pixels
+    vec2 viewportResolution;
+};
+
+// Style parameters from the UI, re-uploaded only when they change (NPRStyleBlock in utils/uniform_buffer.h)
+layout (std140) uniform NPRStyleBlock {
+    // Colors to achieve desired style, each one followed by a parameter to fill the std140 slot
+    vec3 warmColor;
+    float contourLimit;
+    vec3 coldColor;
+    float directionalDerivativeLimit;
+    vec3 strokeColor;
+    // Desired length (in pixels) of the edges of the generated triangles
+    float tessellationTriangleSize;
+    // 0 - Cel Shading , 1 - Gooch Shading, 2 - Uniform color
+    int shadingType;
+    // Numbers of levels for cel Shading
+    int celShadingSize;
+    int shininessFactor;
+    // Quantity shown by the curvature debug variant (0: none, 1: mean curvature, 2: Gaussian curvature,
+    // 3: first principal direction, 4: radial curvature)
+    int curvatureDebugView;
+    bool enableContours;
+    bool enableSuggestiveContours;
+    // Patches outside the view frustum or entirely back facing are discarded before tessellation
+    bool enablePatchCulling;
+    // curvature mapped to half saturation by the curvature debug view
+    float curvatureDebugScale;
+};
+
+// Tessellation Parameters
+const float minTessLevel = 1.0;
+const float maxTessLevel = 64.0;
+// Extra aperture of the normal cone: the cone holds every normal of the patch, the margin only covers rounding
+const float normalConeMargin = 0.01;
+
+// Control point in screen coordinates (pixels)
+vec2 projectOnScreen(vec4 controlPoint){
+    vec4 clipPosition = projectionMatrix * viewMatrix * modelMatrix * controlPoint;
+    // points behind the camera are clamped on the near plane side, so that the edge length stays finite
+    clipPosition.w = max(clipPosition.w, 0.0001);
+    return (clipPosition.xy / clipPosition.w * 0.5 + 0.5) * viewportResolution;
 }
 
-void main()
-{
-    vec4 currentPointPosition = gl_in[gl_InvocationID].gl_Position;
-    float tessLevel = getTessellationLevelBasedOnCameraDistance(currentPointPosition);
-    // For quads we have 4 tessellation Outer levels and 2 Tessellation inner levels.
-    // We set them all to the calculated tessellation level based on the distance from camera.
-    gl_TessLevelOuter[0] = tessLevel;
-    gl_TessLevelOuter[1] = tessLevel;
-    gl_TessLevelOuter[2] = tessLevel;
-    gl_TessLevelOuter[3] = tessLevel;
-    gl_TessLevelInner[0] = tessLevel;
-    gl_TessLevelInner[1] = tessLevel;
-    // We also pass the position to the Tessellation Evaluation Shader
-    gl_out[gl_InvocationID].gl_Position = currentPointPosition;
+// Tessellation level of a boundary curve from the screen space length of its control polygon (an upper bound of the curve length)
+// The two end segments are added first: the sum is the same whichever patch walks the shared edge, and in whichever direction,
+// so both patches sharing an edge get exactly the same level and no crack can open between them
+float getTessellationLevelOfEdge(int i0, int i1, int i2, int i3){
+    vec2 s0 = projectOnScreen(gl_in[i0].gl_Position);
+    vec2 s1 = projectOnScreen(gl_in[i1].gl_Position);
+    vec2 s2 = projectOnScreen(gl_in[i2].gl_Position);
+    vec2 s3 = projectOnScreen(gl_in[i3].gl_Position);
+    float screenLength = (distance(s0, s1) + distance(s2, s3)) + distance(s1, s2);
+    return clamp(screenLength / tessellationTriangleSize, minTessLevel, maxTessLevel);
+}
 
+// The patch lies in the convex hull of its control points: it is outside the frustum if all of them are outside the same clip plane
+bool isOutsideFrustum(){
+    vec4 clipPositions[16];
+    for (int i = 0; i < 16; i++)
+        clipPositions[i] = projectionMatrix * viewMatrix * modelMatrix * gl_in[i].gl_Position;
+    for (int axis = 0; axis < 3; axis++){
+        bool allBelow = true;       bool allAbove = true;
+        for (int i = 0; i < 16; i++){
+            allBelow = allBelow && clipPositions[i][axis] < -clipPositions[i].w;
+            allAbove = allAbove && clipPositions[i][axis] > clipPositions[i].w;
+        }
+        if (allBelow || allAbove)
+            return true;
+    }
+    return false;
 }
 
+// Normal cone of the patch (axis and aperture) against the cone of view directions towards the bounding sphere of the patch:
+// the patch is back facing if no normal of the cone can see the camera from any point of the sphere.
+// The normal dS/du x dS/dv is a combination with non negative weights of the cross products of the control vectors of the two
+// derivative nets, so the cone of those products holds every normal of the patch, also where an edge collapses to a point
+bool isBackFacing(){
+    vec3 worldPositions[16];
+    vec3 centre = vec3(0.0);
+    for (int i = 0; i < 16; i++){
+        worldPositions[i] = (modelMatrix * gl_in[i].gl_Position).xyz;
+        centre += worldPositions[i] / 16.0;
+    }
+    float radius = 0.0;
+    for (int i = 0; i < 16; i++)
+        radius = max(radius, distance(worldPositions[i], centre));
+    // Control vectors of dS/du (3 x 4) and dS/dv (4 x 3), without the constant factor 3 (control point (i, j) is gl_in[i + 4 * j])
+    vec3 du[12];
+    vec3 dv[12];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 4; j++){
+            du[4 * i + j] = worldPositions[(i + 1) + 4 * j] - worldPositions[i + 4 * j];
+            dv[4 * i + j] = worldPositions[j + 4 * (i + 1)] - worldPositions[j + 4 * i];
+        }
+    // Axis: sum of the unit products (null products do not contribute to the normal), then aperture in a second pass
+    vec3 axis = vec3(0.0);
+    for (int a = 0; a < 12; a++)
+        for (int b = 0; b < 12; b++){
+            vec3 n = cross(du[a], dv[b]);
+            if (length(n) > 0.0)
+                axis += normalize(n);
+        }
+    if (length(axis) == 0.0)
+        return false;
+    axis = normalize(axis);
+    float coneCos = 1.0;
+    for (int a = 0; a < 12; a++)
+        for (int b = 0; b < 12; b++){
+            vec3 n = cross(du[a], dv[b]);
+            if (length(n) > 0.0)
+                coneCos = min(coneCos, dot(axis, normalize(n)));
+        }
+    float coneAngle = acos(clamp(coneCos, -1.0, 1.0)) + normalConeMargin;
+    vec3 toCamera = cameraWorldPosition.xyz - centre;
+    float cameraDistance = length(toCamera);
+    if (cameraDistance <= radius)
+        return false;
+    float viewAngle = acos(clamp(dot(axis, toCamera / cameraDistance), -1.0, 1.0));
+    return viewAngle > 1.5707963 + coneAngle + asin(radius / cameraDistance);
+}
 
+void main()
+{
+    // We also pass the position to the Tessellation Evaluation Shader
+    gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
 
+    // The levels are per patch: a single invocation writes them, so they do not depend on the invocations order
+    if (gl_InvocationID == 0){
+        patchIndex = controlPointPatch[0];
+        // A patch with an outer level equal to 0 is discarded and never reaches the evaluation shader
+        if (enablePatchCulling && (isOutsideFrustum() || isBackFacing())){
+            gl_TessLevelOuter[0] = 0.0;
+            gl_TessLevelOuter[1] = 0.0;
+            gl_TessLevelOuter[2] = 0.0;
+            gl_TessLevelOuter[3] = 0.0;
+            gl_TessLevelInner[0] = 0.0;
+            gl_TessLevelInner[1] = 0.0;
+            return;
+        }
+        // Control point (i, j) is gl_in[i + 4 * j], i follows u and j follows v (see the evaluation shader)
+        // For quads: outer 0 is the edge u = 0, outer 1 is v = 0, outer 2 is u = 1, outer 3 is v = 1
+        gl_TessLevelOuter[0] = getTessellationLevelOfEdge(0, 4, 8, 12);
+        gl_TessLevelOuter[1] = getTessellationLevelOfEdge(0, 1, 2, 3);
+        gl_TessLevelOuter[2] = getTessellationLevelOfEdge(3, 7, 11, 15);
+        gl_TessLevelOuter[3] = getTessellationLevelOfEdge(12, 13, 14, 15);
+        // Inner levels follow the longest of the two edges in the same direction
+        gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);
+        gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);
+    }
+}
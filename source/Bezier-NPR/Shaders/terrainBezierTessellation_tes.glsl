@@ -3,7 +3,11 @@
 // Define the type of input patch, a grid of 16 control points
 layout(quads, equal_spacing, ccw) in;
 
+// The program is compiled in a variant for each render mode (see the NPR_* defines added by the application):
+// every variant only writes the varyings its fragment shader reads
+#ifdef NPR_CONTOURS
 out float normalDotViewValue;
+#endif
 // Normal in view coordinates
 out vec3 viewNormal;
 // Light direction in view coordinates
@@ -11,8 +15,12 @@ out vec3 viewLightDirection;
 // Vector to Camera in view coordinate
 out vec3 vectorToCamera;
 
-// Structure to pass data to Tessellation Evaluation Shader
+#ifdef NPR_SUGGESTIVE_CONTOURS
+// Structure to pass data to the Fragment Shader
+// Suggestive contours only need the radial curvature and the projected view vector (a single vec4 slot),
+// the whole differential geometry of the surface is passed only by the curvature debug variant
 out CURVATURE_INFO{
+#ifdef NPR_CURVATURE_DEBUG
     vec2 uvCoordinatesInBezierPatch;
     mat2 firstFundamentalFormMatrix;
     mat2 secondFundamentalFormMatrix;
@@ -22,82 +30,83 @@ out CURVATURE_INFO{
     float gaussianCurvature;
     vec3 principalDirection1;
     vec3 principalDirection2;
-    vec3 viewVectorProjectedInTangentPlane;
     mat3 TBN;
     vec2 w;
+#endif
+    vec3 viewVectorProjectedInTangentPlane;
     float normalCurvatureInDirectionW;
 } curvature_informations;
+#endif
 
 
 
 uniform mat3 normalMatrix;
 uniform mat4 modelMatrix;
-uniform mat4 viewMatrix;
-uniform mat4 projectionMatrix;
+// Camera parameters, shared by all the programs (CameraBlock in utils/uniform_buffer.h)
+layout (std140) uniform CameraBlock {
+    mat4 viewMatrix;
+    mat4 projectionMatrix;
+    // camera position in world space (w unused)
+    vec4 cameraWorldPosition;
+    // viewport size in pixels
+    vec2 viewportResolution;
+};
 // Point Light Position in world Space
 uniform vec3 pointLightWorldPosition;
-
-
-vec2 calculateCurvaturePairFromFirstSecondFormMatrix(mat2 firstFundamentalFormMatrix, mat2 secondFundamentalFormMatrix){
-    // Inverse of the first Fundamental Form Matrix
-    mat2 firstTraspose = inverse(firstFundamentalFormMatrix); 
-    // 2x2 multiplication matrix between second form and inverse of first form
-    mat2 resultingMultiplicationMatrix = secondFundamentalFormMatrix * firstTraspose;
-    // Curvature Values
-    float k1 = 0;       float k2 = 0;
-    // EigenValues Calculation of 2x2 result matrix (application of simple matrix algebra to find eigenvalues)
-    if (resultingMultiplicationMatrix[1][0] == 0 ){
-        k1 = resultingMultiplicationMatrix[0][0];
-        k2 = resultingMultiplicationMatrix[1][1];
-    }
-    else if (resultingMultiplicationMatrix[0][0] == 0 ){
-        k1 = resultingMultiplicationMatrix[0][1];
-        k2 = resultingMultiplicationMatrix[1][0];
-    }
-    else{
-        k1 = resultingMultiplicationMatrix[0][0];
-        k2 = resultingMultiplicationMatrix[1][1] 
-           - resultingMultiplicationMatrix[1][0]/resultingMultiplicationMatrix[0][0] 
-           * resultingMultiplicationMatrix[0][1];
-    }
-
-    vec2 curvatureValues = vec2(k1,k2);
-    return curvatureValues;
-}
-
-// Inverse Power Iteration method to estimate eigenvector from eigenvalue
-vec2 estimateEigenVector(mat2 matrix, float eigenValue){
-    int count = 0;
-    vec2 v = vec2(1.0, 0.0);
-    vec2 prevVector = v;
-    mat2 identityMatrix = mat2(1,0,0,1);
-
-    while (count < 10)
-	{
-		// Store a copy of the current working vector to use for computing delta.
-		prevVector = v;
-		// Compute the next value of v.
-		mat2 tempMatrix = matrix - (eigenValue * identityMatrix);
-		tempMatrix = mat2(tempMatrix[1][1], -tempMatrix[0][1], -tempMatrix[1][0], tempMatrix[0][0] );
-		v = tempMatrix * v;
-		v = normalize(v);
-		// Increment iteration count.
-		count++;
-
-	}
-    return v;
-}
-
-vec3 calculateCurvaturePairFromFirstSecondFormMatrix(mat2 firstFundamentalFormMatrix, mat2 secondFundamentalFormMatrix, float eigenValue, vec3 tangentVector, vec3 bitangentVector){
-    // Inverse of the first Fundamental Form Matrix
-    mat2 firstTraspose = inverse(firstFundamentalFormMatrix); 
-    // 2x2 multiplication matrix between second form and inverse of first form
-    mat2 resultingMultiplicationMatrix = secondFundamentalFormMatrix * firstTraspose;
-    // EigenVector (principal curvature direction) in tangent Space
-    vec2 eigenVector = estimateEigenVector(resultingMultiplicationMatrix, eigenValue);
-    // EigenVector (principal curvature direction) in 3D Space
-    vec3 resultingEigenVector = eigenVector.x * normalize(tangentVector) + eigenVector.y * normalize(bitangentVector);
-    return resultingEigenVector;
+// View independent geometry sampled once for every patch (utils/curvature_cache.h), read instead of the derivatives of the patch
+// when the patches are drawn without indices in their order (CurvatureCache::Draw, patchIndex is the patch). Layer 0: normal and k1, layer 1: k2 and
+// d1 d1^T (xx, xy, xz), layer 2: d1 d1^T (yy, yz, zz), with d1 the first principal direction
+uniform bool curvatureCacheEnabled;
+uniform sampler2DArray curvatureCache;
+uniform int curvatureCacheTilesPerRow;
+uniform int curvatureCacheResolution;
+// Index of the patch in a draw without indices (from gl_VertexID, which every renderer numbers the same way, unlike gl_PrimitiveID)
+patch in int patchIndex;
+
+
+// Principal curvatures, mean and Gaussian curvature and principal directions of the surface at a point
+struct Curvature{
+    float k1;
+    float k2;
+    float meanCurvature;
+    float gaussianCurvature;
+    vec3 principalDirection1;
+    vec3 principalDirection2;
+};
+
+// Closed form curvature solver (CPU reference: calc_SurfaceCurvature in utils/bezier_curvature.h)
+// The Weingarten map is built once in the orthonormal tangent frame (t1 = Su / |Su|, t2 = N x t1), where it is symmetric:
+// with Su = p t1 and Sv = q t1 + r t2 it is S = J^-T II J^-1, J = [p q; 0 r]. Its 2x2 eigenproblem is solved analytically,
+// the second principal direction is orthogonal to the first one in the tangent plane
+Curvature computeCurvature(vec3 tangentVector, vec3 bitangentVector, vec3 normalVector, float L, float M, float N){
+    float p = length(tangentVector);
+    vec3 t1 = tangentVector / p;
+    vec3 t2 = cross(normalVector, t1);
+    float q = dot(bitangentVector, t1);
+    float r = dot(bitangentVector, t2);
+    float alpha = q / p;
+    // Symmetric Weingarten matrix [s11 s12; s12 s22]
+    float s11 = L / (p * p);
+    float s12 = (M - alpha * L) / (p * r);
+    float s22 = (N - alpha * (2.0 * M - alpha * L)) / (r * r);
+
+    Curvature curvature;
+    curvature.meanCurvature = 0.5 * (s11 + s22);
+    curvature.gaussianCurvature = s11 * s22 - s12 * s12;
+    float halfGap = 0.5 * (s11 - s22);
+    float root = sqrt(halfGap * halfGap + s12 * s12);
+    curvature.k1 = curvature.meanCurvature + root;
+    curvature.k2 = curvature.meanCurvature - root;
+
+    // (s12, k1 - s11) and (k1 - s22, s12) both solve (S - k1 I) x = 0: the longer one is the better conditioned
+    vec2 fromRow0 = vec2(s12, curvature.k1 - s11);
+    vec2 fromRow1 = vec2(curvature.k1 - s22, s12);
+    vec2 e1 = dot(fromRow0, fromRow0) >= dot(fromRow1, fromRow1) ? fromRow0 : fromRow1;
+    float e1Length = length(e1);
+    // umbilic points: every direction is principal
+    curvature.principalDirection1 = e1Length > 0.0 ? (e1.x * t1 + e1.y * t2) / e1Length : t1;
+    curvature.principalDirection2 = cross(normalVector, curvature.principalDirection1);
+    return curvature;
 }
 
 
@@ -129,7 +138,6 @@ void main()
     // We get the U,V coords
     float u = gl_TessCoord.x;
     float v = gl_TessCoord.y;
-    curvature_informations.uvCoordinatesInBezierPatch = vec2(u, v);
 
     // U - weights for bezier surface                           // V - weights for bezier surface
     float bu0 = (1-u) * (1-u) * (1-u);                          float bv0 = (1-v) * (1-v) * (1-v);
@@ -155,94 +163,144 @@ void main()
                         + bu2 * ( bv0*p20 + bv1*p21 + bv2*p22 + bv3*p23 )
                         + bu3 * ( bv0*p30 + bv1*p31 + bv2*p32 + bv3*p33 );
 
-    // Calculation of tangent/bitangent vectors in the bezier patch using derivate weights and control points
-    vec3 tangentVector = (dbu0 * ( bv0*p00 + bv1*p01 + bv2*p02 + bv3*p03 )
-                       + dbu1 * ( bv0*p10 + bv1*p11 + bv2*p12 + bv3*p13 )
-                       + dbu2 * ( bv0*p20 + bv1*p21 + bv2*p22 + bv3*p23 )
-                       + dbu3 * ( bv0*p30 + bv1*p31 + bv2*p32 + bv3*p33 )).xyz;
-
-    vec3 bitangentVector = (bu0 * ( dbv0*p00 + dbv1*p01 + dbv2*p02 + dbv3*p03 )
-                         + bu1 * ( dbv0*p10 + dbv1*p11 + dbv2*p12 + dbv3*p13 )
-                         + bu2 * ( dbv0*p20 + dbv1*p21 + dbv2*p22 + dbv3*p23 )
-                         + bu3 * ( dbv0*p30 + dbv1*p31 + dbv2*p32 + dbv3*p33 )).xyz;
-
-    // Computation of Normal vector (cross product + normalization of tangent vectors)
-    vec3 normalVector = normalize(cross( tangentVector.xyz, bitangentVector.xyz ));
-
-    // Computation of partial derivatives for second fundamental form Matrix
-    vec3 secondPartialDerivativeUU = (ddbu0 * ( bv0*p00 + bv1*p01 + bv2*p02 + bv3*p03 )
-                                   + ddbu1 * ( bv0*p10 + bv1*p11 + bv2*p12 + bv3*p13 )
-                                   + ddbu2 * ( bv0*p20 + bv1*p21 + bv2*p22 + bv3*p23 )
-                                   + ddbu3 * ( bv0*p30 + bv1*p31 + bv2*p32 + bv3*p33 )).xyz;
-
-    vec3 secondPartialDerivativeUV = (dbu0 * ( dbv0*p00 + dbv1*p01 + dbv2*p02 + dbv3*p03 )
-                                   + dbu1 * ( dbv0*p10 + dbv1*p11 + dbv2*p12 + dbv3*p13 )
-                                   + dbu2 * ( dbv0*p20 + dbv1*p21 + dbv2*p22 + dbv3*p23 )
-                                   + dbu3 * ( dbv0*p30 + dbv1*p31 + dbv2*p32 + dbv3*p33 )).xyz;
-
-    vec3 secondPartialDerivativeVV = (bu0 * ( ddbv0*p00 + ddbv1*p01 + ddbv2*p02 + ddbv3*p03 )
-                                   + bu1 * ( ddbv0*p10 + ddbv1*p11 + ddbv2*p12 + ddbv3*p13 )
-                                   + bu2 * ( ddbv0*p20 + ddbv1*p21 + ddbv2*p22 + ddbv3*p23 )
-                                   + bu3 * ( ddbv0*p30 + ddbv1*p31 + ddbv2*p32 + ddbv3*p33 )).xyz;
-    
-    // First Fundamental Form Matrix
-    float E = dot( tangentVector,tangentVector );
-    float F = dot( tangentVector,bitangentVector );
-    float G = dot( bitangentVector,bitangentVector );
-    curvature_informations.firstFundamentalFormMatrix = mat2(E, F, F, G);
-
-    // Second Fundamental Form Matrix
-    float L = dot(normalVector,secondPartialDerivativeUU);
-    float M = dot(normalVector,secondPartialDerivativeUV);
-    float N = dot(normalVector,secondPartialDerivativeVV);
-    curvature_informations.secondFundamentalFormMatrix = mat2(L, M, M, N);
-
-    // Calculation of principal curvatures, k1 and k2, values given First and Second Fundamental Form Matrices
-    vec2 curvatureValues = calculateCurvaturePairFromFirstSecondFormMatrix(curvature_informations.firstFundamentalFormMatrix, curvature_informations.secondFundamentalFormMatrix);
-    curvature_informations.k1 = curvatureValues.x;       curvature_informations.k2 = curvatureValues.y;
-    // Calculation of Mean and Gaussian Curvature based on principal curvatures, k1 and k2, previously calculated
-
-    // Mean Curvature Computation        { Can be also computed directly as: ( E*N - 2*F*M + G*L ) / ( 2*( E*G - F*F ) ) }
-    curvature_informations.meanCurvature = curvature_informations.k1 + curvature_informations.k2 / 2;
-
-    // Gaussian Curvature Computation    { Can be also computed directly as: ( L*N - M*M ) / ( E*G - F*F ) }
-    curvature_informations.gaussianCurvature = curvature_informations.k1 * curvature_informations.k2;
-
-    // Calculation of principal curvatures, pdir1 and pdir2, directions in 3D space, given EigenValue, Tangent vector, Bitangent vector, First and Second Fundamental Form Matrices
-    curvature_informations.principalDirection1 = calculateCurvaturePairFromFirstSecondFormMatrix(curvature_informations.firstFundamentalFormMatrix, curvature_informations.secondFundamentalFormMatrix, curvature_informations.k1, tangentVector, bitangentVector);
-    curvature_informations.principalDirection2 = calculateCurvaturePairFromFirstSecondFormMatrix(curvature_informations.firstFundamentalFormMatrix, curvature_informations.secondFundamentalFormMatrix, curvature_informations.k2, tangentVector, bitangentVector);
+    // View independent geometry of the point: from the curvature cache (not in the curvature debug variant, that shows the exact values)
+    // or from the derivatives of the patch
+    vec3 normalVector;
+#ifdef NPR_SUGGESTIVE_CONTOURS
+    float k1, k2;
+    // d1 d1^T, with d1 the first principal direction in object space
+    mat3 principalDirections;
+#endif
+#ifdef NPR_CURVATURE_DEBUG
+    vec3 tangentVector, bitangentVector;
+    mat2 firstFundamentalFormMatrix, secondFundamentalFormMatrix;
+    Curvature curvature;
+#endif
+#ifndef NPR_CURVATURE_DEBUG
+    if (curvatureCacheEnabled)
+    {
+        // the samples of the tile of the patch are at the texel centers: the sampler interpolates them bilinearly
+        vec2 tile = vec2(patchIndex % curvatureCacheTilesPerRow, patchIndex / curvatureCacheTilesPerRow);
+        vec2 texel = tile * float(curvatureCacheResolution) + 0.5 + vec2(u, v) * float(curvatureCacheResolution - 1);
+        vec2 coordinates = texel / vec2(textureSize(curvatureCache, 0).xy);
+        vec4 normalAndK1 = texture(curvatureCache, vec3(coordinates, 0.0));
+        normalVector = normalize(normalAndK1.xyz);
+#ifdef NPR_SUGGESTIVE_CONTOURS
+        vec4 k2AndDirections = texture(curvatureCache, vec3(coordinates, 1.0));
+        vec4 directions = texture(curvatureCache, vec3(coordinates, 2.0));
+        k1 = normalAndK1.w;
+        k2 = k2AndDirections.x;
+        principalDirections = mat3(k2AndDirections.yzw, vec3(k2AndDirections.z, directions.xy), vec3(k2AndDirections.w, directions.yz));
+#endif
+    }
+    else
+#endif
+    {
+#ifndef NPR_CURVATURE_DEBUG
+        vec3 tangentVector, bitangentVector;
+#endif
+        // Calculation of tangent/bitangent vectors in the bezier patch using derivate weights and control points
+        tangentVector = (dbu0 * ( bv0*p00 + bv1*p01 + bv2*p02 + bv3*p03 )
+                      + dbu1 * ( bv0*p10 + bv1*p11 + bv2*p12 + bv3*p13 )
+                      + dbu2 * ( bv0*p20 + bv1*p21 + bv2*p22 + bv3*p23 )
+                      + dbu3 * ( bv0*p30 + bv1*p31 + bv2*p32 + bv3*p33 )).xyz;
+
+        bitangentVector = (bu0 * ( dbv0*p00 + dbv1*p01 + dbv2*p02 + dbv3*p03 )
+                        + bu1 * ( dbv0*p10 + dbv1*p11 + dbv2*p12 + dbv3*p13 )
+                        + bu2 * ( dbv0*p20 + dbv1*p21 + dbv2*p22 + dbv3*p23 )
+                        + bu3 * ( dbv0*p30 + dbv1*p31 + dbv2*p32 + dbv3*p33 )).xyz;
+
+        // Computation of Normal vector (cross product + normalization of tangent vectors)
+        normalVector = normalize(cross( tangentVector.xyz, bitangentVector.xyz ));
+
+        // Computation of partial derivatives for second fundamental form Matrix
+        vec3 secondPartialDerivativeUU = (ddbu0 * ( bv0*p00 + bv1*p01 + bv2*p02 + bv3*p03 )
+                                       + ddbu1 * ( bv0*p10 + bv1*p11 + bv2*p12 + bv3*p13 )
+                                       + ddbu2 * ( bv0*p20 + bv1*p21 + bv2*p22 + bv3*p23 )
+                                       + ddbu3 * ( bv0*p30 + bv1*p31 + bv2*p32 + bv3*p33 )).xyz;
+
+        vec3 secondPartialDerivativeUV = (dbu0 * ( dbv0*p00 + dbv1*p01 + dbv2*p02 + dbv3*p03 )
+                                       + dbu1 * ( dbv0*p10 + dbv1*p11 + dbv2*p12 + dbv3*p13 )
+                                       + dbu2 * ( dbv0*p20 + dbv1*p21 + dbv2*p22 + dbv3*p23 )
+                                       + dbu3 * ( dbv0*p30 + dbv1*p31 + dbv2*p32 + dbv3*p33 )).xyz;
+
+        vec3 secondPartialDerivativeVV = (bu0 * ( ddbv0*p00 + ddbv1*p01 + ddbv2*p02 + ddbv3*p03 )
+                                       + bu1 * ( ddbv0*p10 + ddbv1*p11 + ddbv2*p12 + ddbv3*p13 )
+                                       + bu2 * ( ddbv0*p20 + ddbv1*p21 + ddbv2*p22 + ddbv3*p23 )
+                                       + bu3 * ( ddbv0*p30 + ddbv1*p31 + ddbv2*p32 + ddbv3*p33 )).xyz;
+
+        // First Fundamental Form Matrix
+        float E = dot( tangentVector,tangentVector );
+        float F = dot( tangentVector,bitangentVector );
+        float G = dot( bitangentVector,bitangentVector );
+
+        // Second Fundamental Form Matrix
+        float L = dot(normalVector,secondPartialDerivativeUU);
+        float M = dot(normalVector,secondPartialDerivativeUV);
+        float N = dot(normalVector,secondPartialDerivativeVV);
+#ifdef NPR_SUGGESTIVE_CONTOURS
+        // Principal curvatures, mean and Gaussian curvature and principal directions, computed once and without iterations
+#ifndef NPR_CURVATURE_DEBUG
+        Curvature curvature;
+#endif
+        curvature = computeCurvature(tangentVector, bitangentVector, normalVector, L, M, N);
+        k1 = curvature.k1;
+        k2 = curvature.k2;
+        principalDirections = outerProduct(curvature.principalDirection1, curvature.principalDirection1);
+#endif
+#ifdef NPR_CURVATURE_DEBUG
+        firstFundamentalFormMatrix = mat2(E, F, F, G);
+        secondFundamentalFormMatrix = mat2(L, M, M, N);
+#endif
+    }
 
+    // View dependent terms
     vec4 mvPosition = viewMatrix * modelMatrix * vertexPosition;
     // Calculation of vector to camera
 	vectorToCamera = normalize(-mvPosition.xyz);
+    viewNormal = normalize(normalMatrix * normalVector);
 
-    //normalVector è il versore normale del piano tangente
-    //So if you have a vector A and a plane with normal N, the vector that is resulted by projecting A on the plane will be B = A - (A.dot.N)N
-    curvature_informations.viewVectorProjectedInTangentPlane = vectorToCamera - normalVector * dot(vectorToCamera, normalVector);
-    //Now I need w to be expressed in tangent coordinate system
-    curvature_informations.TBN = ComputeTangentBitangentNormalMatrix(tangentVector, bitangentVector, normalVector);
-    //  view Vector Projected in Tangent Plane expressed in Tangent Coordinate System
-    curvature_informations.w = (curvature_informations.TBN * curvature_informations.viewVectorProjectedInTangentPlane).xy;
-
-    // Inverse of the first Fundamental Form Matrix
-    mat2 firstTraspose = inverse(curvature_informations.firstFundamentalFormMatrix); 
-    // 2x2 multiplication matrix between second form and inverse of first form
-    mat2 weingartenMatrix = curvature_informations.secondFundamentalFormMatrix * firstTraspose;
-
-    //The normal curvature of a surface S at a point p measures its curvature in a specific direction x in the tangent plane
-    curvature_informations.normalCurvatureInDirectionW = ( dot(( curvature_informations.secondFundamentalFormMatrix * curvature_informations.w ), curvature_informations.w)/dot(curvature_informations.w,curvature_informations.w) );
-
-	// compute ndotv
-	normalDotViewValue = max(dot(normalVector,vectorToCamera), 0.0);
+#ifdef NPR_SUGGESTIVE_CONTOURS
+    // So if you have a vector A and a plane with normal N, the vector that is resulted by projecting A on the plane will be B = A - (A.dot.N)N
+    // (the view vector and the normal in view space)
+    vec3 viewVectorProjectedInTangentPlane = vectorToCamera - viewNormal * dot(vectorToCamera, viewNormal);
+    // The normal curvature of a surface S at a point p measures its curvature in a specific direction x in the tangent plane:
+    // Euler formula kr = k1 cos^2(theta) + k2 sin^2(theta), with theta the angle between w and the first principal direction.
+    // w goes back to object space, where the curvatures are (transpose(normalMatrix) is the inverse of the model view matrix),
+    // and the ratio of the lengths gives the curvature in view space units (the model matrix is a rotation and a uniform scale)
+    vec3 objectW = transpose(normalMatrix) * viewVectorProjectedInTangentPlane;
+    float cosTheta2 = dot(objectW, principalDirections * objectW) / dot(objectW, objectW);
+    curvature_informations.normalCurvatureInDirectionW = (k2 + (k1 - k2) * cosTheta2) * length(objectW) / length(viewVectorProjectedInTangentPlane);
+    curvature_informations.viewVectorProjectedInTangentPlane = viewVectorProjectedInTangentPlane;
+#endif
+
+#ifdef NPR_CURVATURE_DEBUG
+    // view vector projected in tangent plane expressed in the tangent coordinate system
+    mat3 TBN = ComputeTangentBitangentNormalMatrix(tangentVector, bitangentVector, normalVector);
+    vec2 w = (TBN * viewVectorProjectedInTangentPlane).xy;
+    curvature_informations.uvCoordinatesInBezierPatch = vec2(u, v);
+    curvature_informations.firstFundamentalFormMatrix = firstFundamentalFormMatrix;
+    curvature_informations.secondFundamentalFormMatrix = secondFundamentalFormMatrix;
+    curvature_informations.k1 = curvature.k1;
+    curvature_informations.k2 = curvature.k2;
+    curvature_informations.meanCurvature = curvature.meanCurvature;
+    curvature_informations.gaussianCurvature = curvature.gaussianCurvature;
+    curvature_informations.principalDirection1 = curvature.principalDirection1;
+    curvature_informations.principalDirection2 = curvature.principalDirection2;
+    curvature_informations.TBN = TBN;
+    curvature_informations.w = w;
+#endif
+
+#ifdef NPR_CONTOURS
+    // both in view space, as the normal of the suggestive contours
+	normalDotViewValue = max(dot(viewNormal,vectorToCamera), 0.0);
+#endif
 
     // Light position in view coordinates
     vec4 lightPos = viewMatrix  * vec4(pointLightWorldPosition, 1.0);
     // Light vector in view coordinates
     viewLightDirection = lightPos.xyz - mvPosition.xyz;
 
-    viewNormal = normalize(normalMatrix * normalVector);
-
     //passing position to fragment Shader
     gl_Position = projectionMatrix * viewMatrix * modelMatrix * vertexPosition;
 }
-
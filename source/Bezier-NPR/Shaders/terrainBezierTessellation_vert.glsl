@@ -1,10 +1,13 @@
 #version 410 core
 
 layout (location = 0) in vec3 position;
+// Index of the patch when the patches are drawn without indices, 16 control points each (read by the curvature cache)
+out int controlPointPatch;
 
 void main()
 {
     //Simple passing Vertex Position to Tessellation Control Shader
     gl_Position = vec4(position, 1.0);
+    controlPointPatch = gl_VertexID / 16;
 
 }
\ No newline at end of file
@@ -0,0 +1,46 @@
+#version 410 core
+
+// Triangles of the terrain captured with transform feedback (utils/vertex_cache.h), drawn again without tessellation:
+// the vertices already hold the clip space position and the outputs of the evaluation shader of the same variant,
+// in the order of the captured varyings
+layout (location = 0) in vec4 clipPosition;
+layout (location = 1) in vec3 cachedViewNormal;
+layout (location = 2) in vec3 cachedViewLightDirection;
+layout (location = 3) in vec3 cachedVectorToCamera;
+#ifdef NPR_CONTOURS
+layout (location = 4) in float cachedNormalDotViewValue;
+#endif
+#ifdef NPR_SUGGESTIVE_CONTOURS
+layout (location = 5) in vec3 cachedViewVectorProjectedInTangentPlane;
+layout (location = 6) in float cachedNormalCurvatureInDirectionW;
+#endif
+
+// Same outputs of the evaluation shader (the curvature debug variant is never cached)
+#ifdef NPR_CONTOURS
+out float normalDotViewValue;
+#endif
+out vec3 viewNormal;
+out vec3 viewLightDirection;
+out vec3 vectorToCamera;
+
+#ifdef NPR_SUGGESTIVE_CONTOURS
+out CURVATURE_INFO{
+    vec3 viewVectorProjectedInTangentPlane;
+    float normalCurvatureInDirectionW;
+} curvature_informations;
+#endif
+
+void main()
+{
+    gl_Position = clipPosition;
+    viewNormal = cachedViewNormal;
+    viewLightDirection = cachedViewLightDirection;
+    vectorToCamera = cachedVectorToCamera;
+#ifdef NPR_CONTOURS
+    normalDotViewValue = cachedNormalDotViewValue;
+#endif
+#ifdef NPR_SUGGESTIVE_CONTOURS
+    curvature_informations.viewVectorProjectedInTangentPlane = cachedViewVectorProjectedInTangentPlane;
+    curvature_informations.normalCurvatureInDirectionW = cachedNormalCurvatureInDirectionW;
+#endif
+}
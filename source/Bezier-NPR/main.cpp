@@ -39,8 +39,22 @@ Universita' degli Studi di Milano
 
 // classes developed during lab lectures to manage shaders and to load models
 #include <utils/shader.h>
+#include <utils/uniform_buffer.h>
+#include <utils/file_watcher.h>
+#include <utils/headless.h>
 #include <utils/model.h>
 #include <utils/terrain_model.h>
+#include <utils/terrain_tiles.h>
+#include <utils/patch_culling.h>
+#include <utils/bezier_curvature.h>
+#include <utils/cpu_tessellator.h>
+#include <utils/contour_lines.h>
+#include <utils/bezier_math.h>
+#include <utils/terrain_regen.h>
+#include <utils/terrain_lod.h>
+#include <utils/gpu_timer.h>
+#include <utils/vertex_cache.h>
+#include <utils/curvature_cache.h>
 #include <utils/camera.h>
 
 // we load the GLM classes used in the application
@@ -55,6 +69,7 @@ GLfloat viewportResolution[] = {(GLfloat)screenWidth, (GLfloat)screenHeight};
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
 void apply_camera_movements();
 void LoadTextureCubeSide(string path, string side_image, GLuint side_name);
 GLint LoadTextureCube(string path);
@@ -73,6 +88,12 @@ bool keys[1024];
 GLfloat lastX, lastY;
 // when rendering the first frame, we do not have a "previous state" for the mouse, so we need to manage this situation
 bool firstMouse = true;
+// a left click outside of the UI picks the terrain under the cursor (position in window coordinates)
+bool pickRequested = false;
+double pickX, pickY;
+string pickStatus;
+// the camera is kept above the terrain surface
+bool terrainCollision = false;
 // parameters for time calculation (for animations)
 GLfloat deltaTime = 0.0f;
 GLfloat lastFrame = 0.0f;
@@ -107,6 +128,33 @@ GLuint numPatches = 100;
 GLuint generationSeed = 45;
 GLuint consideredOctaves = 8;
 GLfloat consideredFrequency = 3.0;
+// results of the last generation benchmark (patches/second against thread count)
+std::vector<TerrainGenBenchmark> generationBenchmark;
+// results of the last storage benchmark (allocations of separate buffers against the patch store)
+TerrainStorageBenchmark storageBenchmark;
+// results of the last noise benchmark (scalar against batch Perlin evaluation, 8 octaves)
+PerlinBenchmark noiseBenchmark;
+// results of the last model loading benchmark (.bez text against .bbez binary)
+std::vector<BezLoadBenchmark> loadingBenchmark;
+const string BenchmarkModels[] = { "teapot", "shuttle", "gumbo", "bunny" };
+// results of the last check of the closed form curvature solver on the sample models
+std::vector<CurvatureSolverCheck> curvatureCheck;
+// results of the last benchmark of the Bernstein and de Casteljau kernels on the current model
+BezierMathBenchmark bezierMathBenchmark;
+string meshExportStatus;
+// CPU reference of the evaluation shader and of the contour test: check and throughput from the current view
+CPUTessellatorCheck tessellatorCheck;
+CPUTessellatorBenchmark tessellatorBenchmark;
+GLuint tessellatorLevel = 16;
+// View independent geometry of the patches (normal, principal curvatures and directions) sampled once for each model and read by the
+// evaluation shader, which only computes the view dependent terms (the cache draws its own copy of the patches of the model). Off by
+// default, and never used in headless mode
+bool curvatureCacheEnabled = false;
+CurvatureCache curvatureCache;
+std::uint64_t curvatureCacheRevision = 0;
+const GLuint CURVATURE_CACHE_TEXTURE_UNIT = 3;
+bool CurvatureCacheActive();
+CurvatureCacheCheck curvatureCacheCheck;
 
 // Uniforms to pass to shaders
 //User UI parameters
@@ -120,14 +168,115 @@ GLuint celShadingSize = 15;
 GLuint shadingType = 0;
 bool enableContours = true;
 bool enableSuggestiveContours = true;
+// Quantity of the surface shown instead of the style: 0 - none, 1 - mean curvature, 2 - Gaussian curvature,
+// 3 - first principal direction, 4 - radial curvature (curvature mapped to half saturation)
+GLint curvatureDebugView = 0;
+GLfloat curvatureDebugScale = 1.0f;
+// The terrain program is compiled in a variant for each render mode: every variant only interpolates
+// the varyings its fragment shader reads (the full curvature block only in the debug variant)
+enum NPRVariant { NPR_VARIANT_SHADING, NPR_VARIANT_CONTOURS, NPR_VARIANT_SUGGESTIVE_CONTOURS, NPR_VARIANT_CURVATURE_DEBUG, NPR_VARIANT_COUNT };
+const string NPRVariantDefines[NPR_VARIANT_COUNT] =
+    {
+        "",
+        "#define NPR_CONTOURS\n",
+        "#define NPR_CONTOURS\n#define NPR_SUGGESTIVE_CONTOURS\n",
+        "#define NPR_CONTOURS\n#define NPR_SUGGESTIVE_CONTOURS\n#define NPR_CURVATURE_DEBUG\n"
+    };
+NPRVariant CurrentNPRVariant();
+// Outputs of the evaluation shader of each variant captured by the vertex cache (the curvature debug variant is never cached)
+const std::vector<VertexCacheAttribute> NPRVariantCachedVaryings[NPR_VARIANT_COUNT] =
+    {
+        { {"gl_Position", 4}, {"viewNormal", 3}, {"viewLightDirection", 3}, {"vectorToCamera", 3} },
+        { {"gl_Position", 4}, {"viewNormal", 3}, {"viewLightDirection", 3}, {"vectorToCamera", 3}, {"normalDotViewValue", 1} },
+        { {"gl_Position", 4}, {"viewNormal", 3}, {"viewLightDirection", 3}, {"vectorToCamera", 3}, {"normalDotViewValue", 1},
+          {"CURVATURE_INFO.viewVectorProjectedInTangentPlane", 3}, {"CURVATURE_INFO.normalCurvatureInDirectionW", 1} },
+        {}
+    };
+// Uniforms outside of the uniform blocks, set through the locations cached by the Shader class
+namespace UniformNames
+{
+    constexpr std::uint32_t modelMatrix = hash_UniformName("modelMatrix");
+    constexpr std::uint32_t normalMatrix = hash_UniformName("normalMatrix");
+    constexpr std::uint32_t pointLightWorldPosition = hash_UniformName("pointLightWorldPosition");
+    constexpr std::uint32_t backgroundColor = hash_UniformName("backgroundColor");
+    constexpr std::uint32_t skyboxCube = hash_UniformName("skyboxCube");
+    constexpr std::uint32_t lineColor = hash_UniformName("lineColor");
+    constexpr std::uint32_t curvatureCacheEnabled = hash_UniformName("curvatureCacheEnabled");
+    constexpr std::uint32_t curvatureCache = hash_UniformName("curvatureCache");
+    constexpr std::uint32_t curvatureCacheTilesPerRow = hash_UniformName("curvatureCacheTilesPerRow");
+    constexpr std::uint32_t curvatureCacheResolution = hash_UniformName("curvatureCacheResolution");
+}
+NPRStyleBlock CurrentStyleBlock();
+// time spent creating the shader programs at startup (summed over all the programs) and programs loaded from the binary cache
+ShaderLoadTimings shaderStartupTimings;
+GLuint shaderPrograms = 0;
+GLuint shaderCacheHits = 0;
+void AddShaderStartupTimings(const Shader& shader);
+// shader files edited while the application runs are rebuilt between two frames
+bool shaderHotReload = true;
+string shaderReloadStatus;
 // Contour and Suggestive Contour limit parameters 
 GLfloat contourLimit = 0.1;
 //Directional derivative of Radial Curvature Limit
 GLfloat directionalDerivativeLimit = 12;
+// Target length in pixels of the edges of the tessellated triangles (the tessellation levels follow the projected patch edges)
+GLfloat tessellationTriangleSize = 10.0f;
+// patches outside the frustum or back facing are discarded by the tessellation control shader
+bool enablePatchCulling = true;
+// culled patches measured on the CPU along the turntable path of the current model
+PatchCullingStats cullingMeasure;
+// Contours and suggestive contours extracted in object space on the CPU and drawn as lines (instead of the per pixel test)
+bool objectSpaceLines = false;
+ContourExtractor contourExtractor;
+GLuint contourLinesLevel = 8;
+// revision of the model the extractor was set up with (the storage of a new model may be the recycled one of the previous model)
+std::uint64_t contourLinesRevision = 0;
+GLuint contourLinesSourceLevel = 0;
+string contourLinesStatus;
+bool ObjectSpaceLinesActive();
+glm::mat4 calc_TerrainModelMatrix(GLfloat orientation);
 
 //Stores the Model to be displayed and changed dynamically during run-time
 TerrainModel terrainModel;
 bool showingTerrain = true;
+// all the patches in a single buffer drawn with one draw call (otherwise one draw call for each patch)
+bool batchedPatches = true;
+// infinite terrain streamed in tiles around the camera (instead of the single generated terrain)
+bool streamingTerrain = false;
+std::unique_ptr<TerrainTileManager> terrainTiles;
+GLuint tileViewRadius = 4;
+GLuint tileMemoryBudgetMB = 32;
+TerrainTileSettings CurrentTileSettings();
+// background regeneration of the terrain (created at the first request): the current model is drawn until the new one is uploaded
+std::unique_ptr<TerrainRegenerator> terrainRegenerator;
+// the camera goes back to its start position when the regenerated terrain is swapped in
+bool regenerationResetsCamera = false;
+TerrainGenSettings CurrentGenSettings();
+void RequestTerrainRegeneration();
+// Hierarchical level of detail of the generated terrain (built for each new terrain while it is enabled): the nodes of the tree are
+// chosen every frame so that their error on the screen stays below the tolerance (in pixels)
+bool terrainLODEnabled = false;
+GLfloat terrainLODTolerance = 2.0f;
+TerrainLOD terrainLOD;
+bool TerrainLODActive();
+// GPU time of the terrain draw calls
+GpuTimer terrainTimer;
+// Tessellated triangles of the terrain captured when the view does not change, and drawn again without tessellation
+// (not for the tiles, the curvature debug view, the spinning model, the fly-through and headless rendering)
+bool vertexCacheEnabled = true;
+TerrainVertexCache terrainVertexCache;
+bool VertexCacheActive();
+// Fly-through benchmark: the same low flight over the terrain with the generated patches (pass 0) and with the LOD (pass 1)
+std::vector<CameraKey> flyThroughPath;
+int flyThroughPass = -1;
+std::size_t flyThroughFrame = 0;
+GLboolean flyThroughSpinning = GL_FALSE;
+FlyThroughStats flyThroughResults[2];
+// patches drawn in the last frame of the benchmark, recorded with its duration at the start of the next frame
+std::size_t flyThroughDrawnPatches = 0;
+bool flyThroughDrawn = false;
+void StartFlyThrough();
+void UpdateFlyThrough();
 
 //Styles we can switch in UI
 typedef void (*PreloadedStyleFunction) ();
@@ -149,8 +298,34 @@ GLuint styleIndex = 0;
 int switchTabs = 0;
 
 /////////////////// MAIN function ///////////////////////
-int main()
+int main(int argc, char* argv[])
 {
+  // Offline conversion of a .bez text model in the .bbez binary format: --convert input.bez output.bbez
+  if (argc == 4 && string(argv[1]) == "--convert")
+  {
+      bool converted = convert_BezToBinary(argv[2], argv[3]);
+      std::cout << (converted ? "Converted " : "Failed to convert ") << argv[2] << " -> " << argv[3] << std::endl;
+      return converted ? 0 : -1;
+  }
+  // The shader programs are compiled from the sources, ignoring the program binary cache: --no-shader-cache
+  for (int arg = 1; arg < argc; arg++)
+      if (string(argv[arg]) == "--no-shader-cache")
+          Shader::useProgramCache = false;
+  // Batch rendering of PNG frames along a camera path, without window and UI: --headless [options] (see utils/headless.h)
+  HeadlessSettings headless;
+  if (!parse_HeadlessSettings(argc, argv, headless))
+  {
+      std::cout << "Invalid headless options" << std::endl;
+      return -1;
+  }
+  if (headless.enabled)
+  {
+      // the frames are rendered in an offscreen frame buffer of the requested size
+      screenWidth = headless.width;
+      screenHeight = headless.height;
+      viewportResolution[0] = (GLfloat)screenWidth;
+      viewportResolution[1] = (GLfloat)screenHeight;
+  }
   // Initialization of OpenGL context using GLFW
   glfwInit();
   // We set OpenGL specifications required for this application
@@ -160,8 +335,18 @@ int main()
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
   // we set if the window is resizable
   glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+  // in headless mode the window only owns the context: it is small and never shown
+  if (headless.enabled)
+  {
+      glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+      if (headless.contextApi == "egl")
+          glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API);
+      else if (headless.contextApi == "osmesa")
+          glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+  }
   // we create the application's window
-    GLFWwindow* window = glfwCreateWindow(screenWidth, screenHeight, "Non Photorealistic Rendering - Thesis", nullptr, nullptr);
+    GLFWwindow* window = headless.enabled ? glfwCreateWindow(64, 64, "Non Photorealistic Rendering - Thesis", nullptr, nullptr)
+                                          : glfwCreateWindow(screenWidth, screenHeight, "Non Photorealistic Rendering - Thesis", nullptr, nullptr);
     if (!window)
     {
         std::cout << "Failed to create GLFW window" << std::endl;
@@ -172,6 +357,7 @@ int main()
     // we put in relation the window and the callbacks
     glfwSetKeyCallback(window, key_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
     // we disable the mouse cursor
     //glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     // GLAD tries to load the context set by GLFW
@@ -194,13 +380,64 @@ int main()
     
     /////////////////// SHADER PROGRAMS ///////////////////////
     Shader skybox_shader = Shader("Shaders/skybox_vert.glsl", "Shaders/skybox_frag.glsl");
-    Shader illumination_shader = Shader("Shaders/terrainBezierTessellation_vert.glsl", "Shaders/terrainBezierTessellation_frag.glsl",nullptr,"Shaders/terrainBezierTessellation_tcs.glsl","Shaders/terrainBezierTessellation_tes.glsl");
+    Shader contour_lines_shader = Shader("Shaders/contourLines_vert.glsl", "Shaders/contourLines_frag.glsl");
+    // one terrain program for each render mode, the one of the current mode is used at every frame
+    // (linked with the varyings captured by the vertex cache), and the program that draws the captured triangles of each cached variant
+    std::vector<Shader> illumination_shaders;
+    std::vector<Shader> vertex_cache_shaders;
+    for (int variant = 0; variant != NPR_VARIANT_COUNT; variant++)
+    {
+        std::vector<std::string> varyings;
+        for (const auto& attribute : NPRVariantCachedVaryings[variant])
+            varyings.push_back(attribute.name);
+        illumination_shaders.push_back(Shader("Shaders/terrainBezierTessellation_vert.glsl", "Shaders/terrainBezierTessellation_frag.glsl",nullptr,"Shaders/terrainBezierTessellation_tcs.glsl","Shaders/terrainBezierTessellation_tes.glsl", NPRVariantDefines[variant], varyings));
+        if (!varyings.empty())
+            vertex_cache_shaders.push_back(Shader("Shaders/terrainVertexCache_vert.glsl", "Shaders/terrainBezierTessellation_frag.glsl", nullptr, nullptr, nullptr, NPRVariantDefines[variant]));
+    }
+    AddShaderStartupTimings(skybox_shader);
+    AddShaderStartupTimings(contour_lines_shader);
+    for (const auto& illumination_shader : illumination_shaders)
+        AddShaderStartupTimings(illumination_shader);
+    for (const auto& vertex_cache_shader : vertex_cache_shaders)
+        AddShaderStartupTimings(vertex_cache_shader);
+    std::cout << "Shader programs: " << shaderPrograms << " (" << shaderCacheHits << " from the binary cache) in " << shaderStartupTimings.totalMs()
+              << " ms: read " << shaderStartupTimings.readMs << " ms, compile " << shaderStartupTimings.compileMs << " ms, link "
+              << shaderStartupTimings.linkMs << " ms, cache load " << shaderStartupTimings.cacheLoadMs << " ms" << std::endl;
+    // camera and style parameters are shared by all the programs through uniform buffers, uploaded only when they change
+    UniformBuffer<CameraBlock> cameraBuffer(CAMERA_BLOCK_BINDING);
+    UniformBuffer<NPRStyleBlock> styleBuffer(NPR_STYLE_BLOCK_BINDING);
+    // GPU copy of the object space lines
+    ContourLineMesh contourLineMesh;
+    skybox_shader.bindUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING);
+    contour_lines_shader.bindUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING);
+    for (auto& illumination_shader : illumination_shaders)
+    {
+        illumination_shader.bindUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING);
+        illumination_shader.bindUniformBlock("NPRStyleBlock", NPR_STYLE_BLOCK_BINDING);
+    }
+    for (auto& vertex_cache_shader : vertex_cache_shaders)
+        vertex_cache_shader.bindUniformBlock("NPRStyleBlock", NPR_STYLE_BLOCK_BINDING);
+    // the skybox always samples the texture unit 2, the terrain programs read the curvature cache from its own unit
+    skybox_shader.Use();
+    skybox_shader.setInt(UniformNames::skyboxCube, 2);
+    for (auto& illumination_shader : illumination_shaders)
+    {
+        illumination_shader.Use();
+        illumination_shader.setInt(UniformNames::curvatureCache, CURVATURE_CACHE_TEXTURE_UNIT);
+    }
+    // source files of all the programs, watched on a background thread for the hot reload
+    std::vector<std::string> shaderFiles;
+    for (const Shader* shader : { &skybox_shader, &contour_lines_shader, &illumination_shaders.front(), &vertex_cache_shaders.front() })
+        for (const auto& path : shader->getSourcePaths())
+            if (!path.empty())
+                shaderFiles.push_back(path);
+    FileWatcher shaderWatcher(shaderFiles);
     //We apply the first style
     Styles[styleIndex]();
 
     /////////////////// MODELS AND TEXTURES ///////////////////////
     Model cubeModel("../../models/cube.obj");
-    terrainModel = TerrainModel(numPatches, generationSeed, consideredOctaves, consideredFrequency);
+    terrainModel = TerrainModel(numPatches, generationSeed, consideredOctaves, consideredFrequency, batchedPatches);
     GLuint skyboxTexture = LoadTextureCube("Textures/Skyboxes/nprSky/"); 
     // Projection matrix: FOV angle, aspect ratio, near and far planes
     glm::mat4 projection = glm::perspective(45.0f, (float)screenWidth/(float)screenHeight, near, far);
@@ -210,20 +447,71 @@ int main()
     glm::mat4 terrainModelMatrix = glm::mat4(1.0f);
     glm::mat3 terrainNormalMatrix = glm::mat3(1.0f);
 
-    /////////////////// IMGUI SETUP ///////////////////////
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO& io = ImGui::GetIO(); (void)io;
-    ImGui::StyleColorsDark();
-    ImGui_ImplGlfw_InitForOpenGL(window,true);
-    ImGui_ImplOpenGL3_Init("#version 410");
+    /////////////////// HEADLESS SETUP ///////////////////////
+    // model, style and camera path from the command line, frames rendered offscreen and written by background threads
+    std::vector<CameraKey> cameraPath;
+    std::unique_ptr<OffscreenTarget> offscreenTarget;
+    std::unique_ptr<FrameDumper> frameDumper;
+    std::size_t headlessFrame = 0;
+    if (headless.checkBuffers)
+    {
+        // ownership check of the terrain GPU buffers: exit code 0 if no set of GL objects is leaked or given back twice
+        TerrainBufferCheck check = check_TerrainBuffers();
+        std::cout << "Terrain buffers check (" << check.patches << " patches): " << (check.passed ? "passed" : "FAILED") << std::endl
+                  << "  leaked " << check.leaked << ", invalid releases " << check.invalidReleases << ", invalid meshes " << check.invalidMeshes
+                  << ", GL error 0x" << std::hex << check.glError << std::dec << std::endl
+                  << "  created by the first build " << check.firstBuildCreated << ", by the regenerations " << check.regenerationCreated
+                  << " (" << check.regenerationRecycled << " recycled)" << std::endl;
+        terrainModel = TerrainModel();
+        get_TerrainBufferPool().clear();
+        glfwTerminate();
+        return check.passed ? 0 : 1;
+    }
+    if (headless.enabled)
+    {
+        if (headless.model != "terrain")
+        {
+            showingTerrain = false;
+            camera.Position = glm::vec3(0,350,770);
+            terrainModel = TerrainModel(headless.model, batchedPatches);
+        }
+        // every frame of the path has a new camera: the vertex cache would never be drawn. No curvature cache either, so that the
+        // frames do not depend on the renderer
+        vertexCacheEnabled = false;
+        curvatureCacheEnabled = false;
+        styleIndex = std::min<GLuint>(headless.style, (GLuint)(sizeof(Styles) / sizeof(Styles[0])) - 1);
+        Styles[styleIndex]();
+        cameraPath = headless.cameraPath == "turntable" ? gen_TurntablePath(camera.Position, glm::vec3(0.0f), headless.frames) : read_CameraPath(headless.cameraPath);
+        offscreenTarget = std::make_unique<OffscreenTarget>(headless.width, headless.height);
+        if (cameraPath.empty() || !offscreenTarget->isComplete())
+        {
+            std::cout << (cameraPath.empty() ? "Empty camera path: " + headless.cameraPath : "Offscreen frame buffer not supported") << std::endl;
+            offscreenTarget.reset();
+            glfwTerminate();
+            return -1;
+        }
+        frameDumper = std::make_unique<FrameDumper>(headless.width, headless.height, headless.outputDirectory, headless.maxQueuedFrames);
+        std::cout << "Headless rendering of " << cameraPath.size() << " frames (" << headless.width << "x" << headless.height << ") in "
+                  << headless.outputDirectory << std::endl;
+    }
+    else
+    {
+        /////////////////// IMGUI SETUP ///////////////////////
+        IMGUI_CHECKVERSION();
+        ImGui::CreateContext();
+        ImGuiIO& io = ImGui::GetIO(); (void)io;
+        ImGui::StyleColorsDark();
+        ImGui_ImplGlfw_InitForOpenGL(window,true);
+        ImGui_ImplOpenGL3_Init("#version 410");
 
 
-    /////////////////// ICON SETUP ///////////////////////
-    GLFWimage images[1]; 
-    images[0].pixels = stbi_load("Textures/Icon/icon.png", &images[0].width, &images[0].height, 0, 4); //rgba channels 
-    glfwSetWindowIcon(window, 1, images); 
-    stbi_image_free(images[0].pixels);
+        /////////////////// ICON SETUP ///////////////////////
+        GLFWimage images[1]; 
+        images[0].pixels = stbi_load("Textures/Icon/icon.png", &images[0].width, &images[0].height, 0, 4); //rgba channels 
+        glfwSetWindowIcon(window, 1, images); 
+        stbi_image_free(images[0].pixels);
+    }
+    auto headlessStart = std::chrono::high_resolution_clock::now();
 
     /////////////////// RENDERING LOOP ///////////////////////
     while(!glfwWindowShouldClose(window))
@@ -233,18 +521,115 @@ int main()
         GLfloat currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        // the frame of the benchmark drawn last is complete (swap included): it is recorded with its own duration
+        if (flyThroughPass >= 0 && flyThroughDrawn)
+            UpdateFlyThrough();
         // Check is an I/O event is happening
         glfwPollEvents();
+        // Programs with edited source files are rebuilt before the frame (if a new program does not link, the last good one is kept)
+        std::vector<std::string> changedShaderFiles = shaderWatcher.takeChangedFiles();
+        if (shaderHotReload && !changedShaderFiles.empty())
+        {
+            auto reloadStart = std::chrono::high_resolution_clock::now();
+            GLuint reloaded = 0, failed = 0;
+            auto reload = [&](Shader& shader) {
+                if (shader.usesFile(changedShaderFiles))
+                    shader.Reload() ? reloaded++ : failed++;
+            };
+            reload(skybox_shader);
+            reload(contour_lines_shader);
+            for (auto& illumination_shader : illumination_shaders)
+                reload(illumination_shader);
+            for (auto& vertex_cache_shader : vertex_cache_shaders)
+                reload(vertex_cache_shader);
+            // the captured triangles may come from the old terrain programs
+            terrainVertexCache.invalidate();
+            // uniforms set once at startup
+            skybox_shader.Use();
+            skybox_shader.setInt(UniformNames::skyboxCube, 2);
+            for (auto& illumination_shader : illumination_shaders)
+            {
+                illumination_shader.Use();
+                illumination_shader.setInt(UniformNames::curvatureCache, CURVATURE_CACHE_TEXTURE_UNIT);
+            }
+            double reloadMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - reloadStart).count();
+            shaderReloadStatus = std::to_string(reloaded) + " programs reloaded, " + std::to_string(failed) + " kept (errors in the console), "
+                + std::to_string((int)reloadMs) + " ms";
+            std::cout << "Shader hot reload: " << shaderReloadStatus << std::endl;
+        }
         // we apply FPS camera movements
         apply_camera_movements();
+        // Background regeneration: a job for stale parameters is cancelled, the new terrain is uploaded a slice per frame
+        if (terrainRegenerator)
+        {
+            if (terrainRegenerator->isBusy() && terrainRegenerator->settings() != CurrentGenSettings())
+                terrainRegenerator->cancel();
+            if (terrainRegenerator->update(terrainModel))
+            {
+                showingTerrain = true;
+                terrainModel.setBatched(batchedPatches);
+                if (regenerationResetsCamera)
+                    camera.Position = cameraPosition;
+            }
+        }
+        // Collision and picking on the patches of the single terrain or of the loaded model (rays in object space), not on the streamed tiles
+        if (!(showingTerrain && streamingTerrain) && (terrainCollision || pickRequested))
+        {
+            glm::mat4 modelMatrix = calc_TerrainModelMatrix(orientationY);
+            glm::mat4 inverseModelMatrix = glm::inverse(modelMatrix);
+            auto toObject = [&](glm::vec3 p) { return glm::vec3(inverseModelMatrix * glm::vec4(p, 1.0f)); };
+            if (terrainCollision)
+            {
+                // vertical ray from above the camera: the camera is lifted if it is below the surface (plus a small clearance)
+                const glm::vec3 up(0.0f, 1.0f, 0.0f);
+                const glm::vec3 origin = toObject(camera.Position + 2.0f * terrainDimension * up);
+                const BezierRayHit hit = pick_BezierSurfaces(terrainModel.patches(), origin, toObject(camera.Position - 2.0f * terrainDimension * up) - origin, 6);
+                if (hit.hit)
+                {
+                    const float ground = glm::vec3(modelMatrix * glm::vec4(hit.position, 1.0f)).y + 0.01f * terrainDimension;
+                    camera.Position.y = std::max(camera.Position.y, ground);
+                }
+            }
+            if (pickRequested)
+            {
+                int width, height;
+                glfwGetWindowSize(window, &width, &height);
+                const glm::vec2 ndc(2.0f * (float)pickX / width - 1.0f, 1.0f - 2.0f * (float)pickY / height);
+                const glm::mat4 inverseViewProjection = glm::inverse(projection * camera.GetViewMatrix());
+                glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc, -1.0f, 1.0f), farPoint = inverseViewProjection * glm::vec4(ndc, 1.0f, 1.0f);
+                const glm::vec3 origin = toObject(glm::vec3(nearPoint) / nearPoint.w);
+                auto pickStart = std::chrono::high_resolution_clock::now();
+                const BezierRayHit hit = pick_BezierSurfaces(terrainModel.patches(), origin, toObject(glm::vec3(farPoint) / farPoint.w) - origin);
+                double pickMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - pickStart).count();
+                char text[160];
+                if (hit.hit)
+                    std::snprintf(text, sizeof(text), "Picked patch %zu at (u, v) = (%.3f, %.3f) in %.2f ms", hit.patch, hit.u, hit.v, pickMs);
+                else
+                    std::snprintf(text, sizeof(text), "Nothing picked (%.2f ms)", pickMs);
+                pickStatus = text;
+            }
+        }
+        pickRequested = false;
+        // Fly-through benchmark: the camera follows its path
+        if (flyThroughPass >= 0)
+            camera.LookAt(flyThroughPath[flyThroughFrame].position, flyThroughPath[flyThroughFrame].target);
+        // Headless: the camera follows the path and the frame is rendered in the offscreen target
+        if (headless.enabled)
+        {
+            camera.LookAt(cameraPath[headlessFrame].position, cameraPath[headlessFrame].target);
+            offscreenTarget->Bind();
+        }
         // View matrix (=camera): position, view direction, camera "up" vector
         view = camera.GetViewMatrix();
         // we "clear" the frame and z buffer
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
         // GUI Frame
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
+        if (!headless.enabled)
+        {
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+        }
         // we set the rendering mode
         if (wireframe)
             // Draw in wireframe
@@ -256,43 +641,113 @@ int main()
             orientationY+=(deltaTime*spin_speed);
 
         /////////////////// RENDERING OF THE OBJECTS IN THE SCENE ///////////////////////
+        Shader& illumination_shader = illumination_shaders[CurrentNPRVariant()];
         illumination_shader.Use();
         // Terrain Rendering
-        if(showingTerrain){
-            terrainModelMatrix = glm::mat4(1.0f);
-            terrainNormalMatrix = glm::mat3(1.0f);
-            terrainModelMatrix = glm::translate(terrainModelMatrix, glm::vec3(0.0f, 0.0f, 0.0f));
-            terrainModelMatrix = glm::rotate(terrainModelMatrix, glm::radians(orientationY), glm::vec3(0.0f, 1.0f, 0.0f));
-            terrainModelMatrix = glm::scale(terrainModelMatrix, glm::vec3(terrainDimension));
-        }else{
-            terrainModelMatrix = glm::mat4(1.0f);
-            terrainModelMatrix = glm::rotate(terrainModelMatrix, glm::radians((GLfloat)90.0), glm::vec3(1.0f, 0.0f, 0.0f));
-            terrainModelMatrix = glm::rotate(terrainModelMatrix, glm::radians((GLfloat)180.0), glm::vec3(0.0f, 1.0f, 0.0f));
-            terrainModelMatrix = glm::scale(terrainModelMatrix, glm::vec3(terrainDimension/4.0f));
-        }
+        terrainModelMatrix = calc_TerrainModelMatrix(orientationY);
         terrainNormalMatrix = glm::inverseTranspose(glm::mat3(view*terrainModelMatrix));
 
-        // Uniforms passed to the shaders
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "modelMatrix"), 1, GL_FALSE, glm::value_ptr(terrainModelMatrix));
-        glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(terrainNormalMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniform3fv(glGetUniformLocation(illumination_shader.Program, "pointLightWorldPosition"), 1, glm::value_ptr(lightPosition));
-        glUniform3fv(glGetUniformLocation(illumination_shader.Program, "cameraWorldPosition"), 1, glm::value_ptr(camera.Position));
-        glUniform1f(glGetUniformLocation(illumination_shader.Program, "contourLimit"), contourLimit);
-        glUniform1f(glGetUniformLocation(illumination_shader.Program, "directionalDerivativeLimit"), directionalDerivativeLimit);
-        glUniform3fv(glGetUniformLocation(illumination_shader.Program, "warmColor"), 1, warmColor);
-        glUniform3fv(glGetUniformLocation(illumination_shader.Program, "coldColor"), 1, coldColor);
-        glUniform3fv(glGetUniformLocation(illumination_shader.Program, "strokeColor"), 1, strokeColor);
-        glUniform1i(glGetUniformLocation(illumination_shader.Program, "shininessFactor"), shininessFactor);
-        glUniform1i(glGetUniformLocation(illumination_shader.Program, "celShadingSize"), celShadingSize);
-        glUniform2fv(glGetUniformLocation(illumination_shader.Program, "viewportResolution"), 1, viewportResolution );
-        glUniform1i(glGetUniformLocation(illumination_shader.Program, "shadingType"), shadingType);
-        glUniform1i(glGetUniformLocation(illumination_shader.Program, "enableContours"), enableContours);
-        glUniform1i(glGetUniformLocation(illumination_shader.Program, "enableSuggestiveContours"), enableSuggestiveContours);
+        // Uniform blocks shared by the programs (uploaded only if a value changed since the last frame)
+        CameraBlock cameraBlock;
+        cameraBlock.viewMatrix = view;
+        cameraBlock.projectionMatrix = projection;
+        cameraBlock.cameraWorldPosition = glm::vec4(camera.Position, 1.0f);
+        cameraBlock.viewportResolution = glm::make_vec2(viewportResolution);
+        cameraBuffer.update(cameraBlock);
+        styleBuffer.update(CurrentStyleBlock());
+        // Uniforms of the terrain program
+        illumination_shader.setMat4(UniformNames::modelMatrix, terrainModelMatrix);
+        illumination_shader.setMat3(UniformNames::normalMatrix, terrainNormalMatrix);
+        illumination_shader.setVec3(UniformNames::pointLightWorldPosition, lightPosition);
+        // the evaluation shader reads the view independent geometry of the model from the curvature cache
+        const bool curvatureCacheActive = CurvatureCacheActive();
+        illumination_shader.setInt(UniformNames::curvatureCacheEnabled, curvatureCacheActive);
+        if (curvatureCacheActive)
+        {
+            illumination_shader.setInt(UniformNames::curvatureCacheTilesPerRow, curvatureCache.tilesPerRow());
+            illumination_shader.setInt(UniformNames::curvatureCacheResolution, curvatureCache.resolution());
+            curvatureCache.bind(CURVATURE_CACHE_TEXTURE_UNIT);
+        }
         
-        // Draw call for the terrain
-        terrainModel.Draw();
+        // Vertex cache: the triangles captured by a previous frame are drawn again if nothing that changes the tessellation or the
+        // outputs of the evaluation shader changed (camera, model, light, tessellation parameters, patches and their level of detail)
+        VertexCacheAction cacheAction = VERTEX_CACHE_SKIP;
+        if (VertexCacheActive())
+        {
+            const NPRVariant variant = CurrentNPRVariant();
+            VertexCacheKey key;
+            key.add(cameraBlock).add(terrainModelMatrix).add(terrainNormalMatrix).add(lightPosition).add(variant)
+               .add(tessellationTriangleSize).add(enablePatchCulling).add(terrainModel.revision()).add(showingTerrain).add(curvatureCacheActive);
+            if (TerrainLODActive())
+                key.add(terrainLODTolerance).add(terrainLOD.fingerprint());
+            terrainVertexCache.setLayout(NPRVariantCachedVaryings[variant]);
+            cacheAction = terrainVertexCache.prepare(key.value);
+            if (cacheAction == VERTEX_CACHE_CAPTURE)
+                terrainVertexCache.beginCapture(key.value);
+        }
+        // Draw call for the terrain (timed on the GPU, the frames of the vertex cache apart)
+        GpuTimer& frameTimer = cacheAction == VERTEX_CACHE_HIT ? terrainVertexCache.hitTimer
+                             : cacheAction == VERTEX_CACHE_CAPTURE ? terrainVertexCache.captureTimer : terrainTimer;
+        frameTimer.begin();
+        if (cacheAction == VERTEX_CACHE_HIT)
+        {
+            // the uniform blocks are the only inputs of the fragment shader
+            vertex_cache_shaders[CurrentNPRVariant()].Use();
+            terrainVertexCache.Draw();
+        }
+        else if (showingTerrain && streamingTerrain && terrainTiles)
+        {
+            // the tiles are streamed around the camera, expressed in the terrain model space
+            glm::mat4 inverseModelMatrix = glm::inverse(terrainModelMatrix);
+            terrainTiles->update(glm::vec3(inverseModelMatrix * glm::vec4(camera.Position, 1.0f)), glm::mat3(inverseModelMatrix) * camera.Front);
+            terrainTiles->Draw();
+        }
+        else if (TerrainLODActive())
+        {
+            // the nodes of the tree are chosen from the camera every frame
+            terrainLOD.select(terrainModelMatrix, camera.Position, projection, viewportResolution[1], terrainLODTolerance);
+            terrainLOD.Draw();
+        }
+        else if (curvatureCacheActive)
+            // the same patches, drawn without indices so that the shaders know the index of each patch
+            curvatureCache.Draw();
+        else
+            terrainModel.Draw();
+        if (cacheAction == VERTEX_CACHE_CAPTURE)
+            terrainVertexCache.endCapture();
+        frameTimer.end();
+        if (flyThroughPass >= 0)
+        {
+            flyThroughDrawnPatches = flyThroughPass == 1 ? terrainLOD.lodStats().selectedPatches : terrainModel.drawStats().patches;
+            flyThroughDrawn = true;
+        }
+
+        // Object space lines: only the patches whose view changed are extracted again, the buffer is uploaded if the lines changed
+        if (ObjectSpaceLinesActive())
+        {
+            const auto& patches = terrainModel.patches();
+            if (terrainModel.revision() != contourLinesRevision || contourLinesLevel != contourLinesSourceLevel)
+            {
+                contourExtractor.setPatches(patches, contourLinesLevel, &get_GenerationPool());
+                contourLinesRevision = terrainModel.revision();
+                contourLinesSourceLevel = contourLinesLevel;
+            }
+            if (contourExtractor.settings.contours != enableContours || contourExtractor.settings.suggestiveContours != enableSuggestiveContours)
+            {
+                contourExtractor.settings.contours = enableContours;
+                contourExtractor.settings.suggestiveContours = enableSuggestiveContours;
+                contourExtractor.invalidate();
+            }
+            if (contourExtractor.update(terrainModelMatrix, camera.Position, &get_GenerationPool()))
+                contourLineMesh.upload(contourExtractor.lines());
+            contour_lines_shader.Use();
+            contour_lines_shader.setMat4(UniformNames::modelMatrix, terrainModelMatrix);
+            contour_lines_shader.setVec3(UniformNames::lineColor, glm::make_vec3(strokeColor));
+            contourLineMesh.Draw(NPR_CONTOUR_LINE);
+            // same color of the suggestive contours of the fragment shader
+            contour_lines_shader.setVec3(UniformNames::lineColor, glm::mix(glm::vec3(1.0f), glm::make_vec3(strokeColor), 0.75f));
+            contourLineMesh.Draw(NPR_SUGGESTIVE_CONTOUR_LINE);
+        }
         
         // Skybox Rendering
         // we use the cube to attach the 6 textures of the environment map.
@@ -305,18 +760,21 @@ int main()
         skybox_shader.Use();
         glActiveTexture(GL_TEXTURE2);
         glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-         // we pass projection and view matrices to the Shader Program of the skybox
-        glUniformMatrix4fv(glGetUniformLocation(skybox_shader.Program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projection));
-        // to have the background fixed during camera movements, we have to remove the translations from the view matrix
-        // thus, we consider only the top-left submatrix, and we create a new 4x4 matrix
-        view = glm::mat4(glm::mat3(view));
-        glUniformMatrix4fv(glGetUniformLocation(skybox_shader.Program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniform3fv(glGetUniformLocation(skybox_shader.Program, "backgroundColor"), 1, backgroundColor);
-        glUniform1i(glGetUniformLocation(skybox_shader.Program, "skyboxCube"), 2);
+        // projection and view matrices come from the camera block, the skybox shader removes the translations from the view matrix
+        skybox_shader.setVec3(UniformNames::backgroundColor, glm::make_vec3(backgroundColor));
         // Draw call for the background skybox
         cubeModel.Draw();
         glDepthFunc(GL_LESS);
         glEnable(GL_CULL_FACE);
+
+        // Headless: the readback of the frame is queued (no UI, no swap), the loop ends with the camera path
+        if (headless.enabled)
+        {
+            frameDumper->capture(headlessFrame);
+            if (++headlessFrame == cameraPath.size())
+                break;
+            continue;
+        }
         
         // Render UI Window
         ImGui::Begin("Project Settings",0, ImGuiWindowFlags_AlwaysAutoResize);
@@ -344,6 +802,68 @@ int main()
             ImGui::NewLine();
             ImGui::Text( "Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate );
             ImGui::NewLine();
+            if (ImGui::Checkbox("Batched patch buffer", &batchedPatches))
+                terrainModel.setBatched(batchedPatches);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Store all the patches in a single indexed control net and draw them with a single draw call.");
+            ImGui::Text( "Terrain draw calls: %u (%u patches)", terrainModel.drawStats().drawCalls, terrainModel.drawStats().patches );
+            ImGui::Text( "Terrain CPU submit time: %.3f ms", terrainModel.drawStats().submitTimeMs );
+            ImGui::Text( "Terrain control points: %zu (%.2f MB on GPU)", terrainModel.drawStats().controlPoints, terrainModel.drawStats().gpuBytes / (1024.0 * 1024.0) );
+            {
+                const TerrainBufferStats& bufferStats = get_TerrainBufferPool().bufferStats();
+                ImGui::Text( "Terrain GL buffers: %zu owned, %zu pooled (%zu created, %zu recycled, %zu deleted)",
+                    bufferStats.owned, bufferStats.pooled, bufferStats.created, bufferStats.recycled, bufferStats.deleted );
+            }
+            ImGui::Text( "Terrain GPU time: %.3f ms", terrainTimer.lastMs );
+            ImGui::Checkbox("Vertex cache", &vertexCacheEnabled);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Capture the tessellated terrain while the view does not change and draw it again without tessellation.\n"
+                                  "Not used by the tiles, the curvature debug view, the spinning model and the fly-through.");
+            ImGui::SameLine();
+            if (ImGui::Button("Reset cache stats"))
+            {
+                terrainVertexCache.resetStats();
+                terrainTimer.reset();
+            }
+            ImGui::Text( "Vertex cache: %.1f%% hits (%zu hits, %zu misses, %zu captures, %zu overflows), %zu triangles (%.1f MB)",
+                100.0 * terrainVertexCache.hitRate(), terrainVertexCache.hits, terrainVertexCache.misses, terrainVertexCache.captures,
+                terrainVertexCache.overflows, terrainVertexCache.capturedTriangles(), terrainVertexCache.gpuBytes() / (1024.0 * 1024.0) );
+            ImGui::Text( "Vertex cache GPU time: %.3f ms cached, %.3f ms captured, %.3f ms tessellated, %.1f ms saved",
+                terrainVertexCache.hitTimer.averageMs(), terrainVertexCache.captureTimer.averageMs(), terrainTimer.averageMs(),
+                terrainVertexCache.savedMs(terrainTimer) );
+            ImGui::SliderFloat("Triangle size (px)", &tessellationTriangleSize, 2.0f, 40.0f);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Target length in pixels of the tessellated triangle edges: smaller values tessellate the patches more.");
+            ImGui::Checkbox("Patch culling", &enablePatchCulling);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Discard the patches outside the view or entirely back facing before tessellation.");
+            ImGui::SameLine();
+            if (ImGui::Button("Measure culling"))
+            {
+                // same test of the control shader, on the CPU, from the current camera along a full turn of the model (36 views)
+                cullingMeasure = PatchCullingStats();
+                glm::mat4 viewProjection = projection * camera.GetViewMatrix();
+                for (int step = 0; step != 36; step++)
+                    calc_PatchCulling(terrainModel.patches(), calc_TerrainModelMatrix(orientationY + 10.0f * step), viewProjection, camera.Position, cullingMeasure);
+            }
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Ratio of culled patches from the current camera while the model turns around (P key).");
+            if (cullingMeasure.views)
+                ImGui::Text( "Culled patches: %.1f%% (%.1f%% outside the view, %.1f%% back facing)", 100.0 * cullingMeasure.culledRatio(),
+                    100.0 * cullingMeasure.outsideFrustum / cullingMeasure.patches, 100.0 * cullingMeasure.backFacing / cullingMeasure.patches );
+            ImGui::Text( "Shader startup: %.1f ms (read %.1f, compile %.1f, link %.1f, cache %.1f), %u/%u programs from the cache",
+                shaderStartupTimings.totalMs(), shaderStartupTimings.readMs, shaderStartupTimings.compileMs, shaderStartupTimings.linkMs,
+                shaderStartupTimings.cacheLoadMs, shaderCacheHits, shaderPrograms );
+            ImGui::Checkbox("Shader hot reload", &shaderHotReload);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Rebuild the shader programs when their files are saved (the last working program is kept on errors).");
+            if (!shaderReloadStatus.empty())
+            {
+                ImGui::SameLine();
+                ImGui::Text( "%s", shaderReloadStatus.c_str() );
+            }
+            ImGui::Text( "Uniform buffer uploads: camera %zu, style %zu in %zu frames", cameraBuffer.uploads, styleBuffer.uploads, cameraBuffer.updates );
+            ImGui::NewLine();
             
             break;
         case 1:
@@ -361,8 +881,10 @@ int main()
                 styleIndex++;
                 styleIndex = styleIndex % std::size(Styles);
                 Styles[styleIndex]();
-                showingTerrain = true;
-                terrainModel = TerrainModel(numPatches, generationSeed, consideredOctaves, consideredFrequency);
+                regenerationResetsCamera = false;
+                RequestTerrainRegeneration();
+                if (terrainTiles)
+                    terrainTiles->reset(CurrentTileSettings());
             }
             ImGui::NewLine();
             ImGui::Separator();
@@ -383,13 +905,27 @@ int main()
             ImGui::NewLine();
             if( ImGui::Button( "Regenerate terrain" ) )
             {
-                showingTerrain = true;
-                camera.Position = cameraPosition;
-                // Reloading the mesh
-                terrainModel = TerrainModel(numPatches, generationSeed, consideredOctaves, consideredFrequency);
+                // Reloading the mesh (in background, the terrain is swapped in when it is ready)
+                regenerationResetsCamera = true;
+                RequestTerrainRegeneration();
+                if (terrainTiles)
+                    terrainTiles->reset(CurrentTileSettings());
             }
             if (ImGui::IsItemHovered())
                 ImGui::SetTooltip("Generate the terrain using above settings.");
+            if (terrainRegenerator && terrainRegenerator->isBusy())
+            {
+                ImGui::ProgressBar(terrainRegenerator->progress(), ImVec2(200.0f, 0.0f), terrainRegenerator->currentStage() == REGEN_GENERATING ? "Generating" : "Uploading");
+                ImGui::SameLine();
+                if( ImGui::Button( "Cancel" ) )
+                    terrainRegenerator->cancel();
+            }
+            else if (terrainRegenerator && terrainRegenerator->regenStats().completedJobs)
+            {
+                const TerrainRegenStats& regenStats = terrainRegenerator->regenStats();
+                ImGui::Text( "Last regeneration: %.1f ms in background, upload %.2f ms in %u frames (max %.2f ms in a frame)",
+                    regenStats.generationMs, regenStats.uploadMs, regenStats.uploadFrames, regenStats.maxFrameUploadMs );
+            }
             ImGui::SameLine();
             if( ImGui::Button( "Load Teapot" ) )
             {
@@ -397,8 +933,10 @@ int main()
                 enableSuggestiveContours = true;
                 showingTerrain = false;
                 camera.Position = glm::vec3(0,350,770);
-                // Loading teapot from disk (expressed with bezier surfaces)
-                terrainModel = TerrainModel("../../models/teapot.bez");
+                // Loading teapot from disk (expressed with bezier surfaces), a terrain still regenerating is dropped
+                if (terrainRegenerator)
+                    terrainRegenerator->cancel();
+                terrainModel = TerrainModel("../../models/teapot.bez", batchedPatches);
                 
             }
             if (ImGui::IsItemHovered())
@@ -410,13 +948,138 @@ int main()
                 enableSuggestiveContours = false;
                 showingTerrain = false;
                 camera.Position = glm::vec3(0,350,770);
-                // Loading shuttle from disk (expressed with bezier surfaces)
-                terrainModel = TerrainModel("../../models/shuttle.bez");
+                // Loading shuttle from disk (expressed with bezier surfaces), a terrain still regenerating is dropped
+                if (terrainRegenerator)
+                    terrainRegenerator->cancel();
+                terrainModel = TerrainModel("../../models/shuttle.bez", batchedPatches);
                 
             }
             if (ImGui::IsItemHovered())
                 ImGui::SetTooltip("Load Shuttle model expressed with bezier surfaces.");
             ImGui::NewLine();
+            if (ImGui::Checkbox("Streaming tiles", &streamingTerrain))
+            {
+                if (streamingTerrain && !terrainTiles)
+                    terrainTiles = std::make_unique<TerrainTileManager>(CurrentTileSettings());
+                else if (terrainTiles)
+                    terrainTiles->reset(CurrentTileSettings());
+            }
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Generate an infinite terrain in tiles around the camera on background threads.");
+            if (streamingTerrain && terrainTiles)
+            {
+                bool changed = ImGui::SliderInt("Tile radius", (int*)&tileViewRadius, 1, 12);
+                changed |= ImGui::SliderInt("Tile budget (MB)", (int*)&tileMemoryBudgetMB, 4, 256);
+                if (changed)
+                    terrainTiles->reset(CurrentTileSettings());
+                const TerrainTileStats& tileStats = terrainTiles->tileStats();
+                ImGui::Text( "Resident tiles: %zu (%zu pending, %zu evicted)", tileStats.residentTiles, tileStats.pendingTiles, tileStats.evictedTiles );
+                ImGui::Text( "Tile generation: %.2f ms (avg %.2f ms), latency %.1f ms", tileStats.lastGenerationMs, tileStats.averageGenerationMs, tileStats.lastLatencyMs );
+                ImGui::Text( "Tile memory: %.2f / %.2f MB, %u draw calls (%u patches)", tileStats.gpuBytes / (1024.0 * 1024.0), tileStats.budgetBytes / (1024.0 * 1024.0), tileStats.drawCalls, tileStats.patches );
+            }
+            ImGui::Text( "Last generation: %.1f ms (%u threads)", terrainModel.generationTime(), get_GenerationPool().size() );
+            ImGui::Text( "Terrain fingerprint: %016llx", (unsigned long long)terrainModel.fingerprint() );
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Same seed and settings always generate the same terrain (and fingerprint).");
+            if (terrainModel.buildAllocations().valid)
+                ImGui::Text( "Model build: %llu allocations, peak %.2f MB (patches %.2f MB)", (unsigned long long)terrainModel.buildAllocations().count,
+                    terrainModel.buildAllocations().peakBytes / (1024.0 * 1024.0), terrainModel.patchBytes() / (1024.0 * 1024.0) );
+            else
+                ImGui::Text( "Model build: allocations n/a (patches %.2f MB)", terrainModel.patchBytes() / (1024.0 * 1024.0) );
+            if( ImGui::Button( "Benchmark patch storage" ) )
+                storageBenchmark = bench_TerrainStorage(numPatches, generationSeed, consideredOctaves, consideredFrequency);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Build the terrain with separate buffers (masks, surfaces, control net) and in place in the patch store,\ncounting the heap allocations (only in a build with BEZIER_ALLOC_STATS defined).");
+            if (storageBenchmark.patches && storageBenchmark.store.valid)
+            {
+                ImGui::Text( "Buffers: %llu allocations, peak %.2f MB, %.1f ms", (unsigned long long)storageBenchmark.buffers.count, storageBenchmark.buffers.peakBytes / (1024.0 * 1024.0), storageBenchmark.buffersMs );
+                ImGui::Text( "Store:   %llu allocations, peak %.2f MB, %.1f ms (%s)", (unsigned long long)storageBenchmark.store.count, storageBenchmark.store.peakBytes / (1024.0 * 1024.0), storageBenchmark.storeMs,
+                    storageBenchmark.identical ? "same patches" : "DIFFERENT patches" );
+            }
+            else if (storageBenchmark.patches)
+            {
+                ImGui::Text( "Buffers: allocations n/a, %.1f ms", storageBenchmark.buffersMs );
+                ImGui::Text( "Store:   allocations n/a, %.1f ms (%s)", storageBenchmark.storeMs, storageBenchmark.identical ? "same patches" : "DIFFERENT patches" );
+            }
+            if( ImGui::Button( "Benchmark generation" ) )
+                generationBenchmark = bench_TerrainGeneration(numPatches, generationSeed, consideredOctaves, consideredFrequency);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Generate the terrain with an increasing number of threads and measure the patches generated per second.");
+            for (const auto& result : generationBenchmark)
+                ImGui::Text( "%2u threads: %8.1f ms  %10.0f patches/s", result.threads, result.milliseconds, result.patchesPerSecond );
+            if( ImGui::Button( "Benchmark noise" ) )
+                noiseBenchmark = bench_PerlinBatch(8);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Compare the scalar and the batch (SIMD) Perlin noise evaluation with 8 octaves.");
+            if (noiseBenchmark.scalarSamplesPerSecond > 0.0)
+                ImGui::Text( "Noise samples/s: scalar %.0f, batch %.0f", noiseBenchmark.scalarSamplesPerSecond, noiseBenchmark.batchSamplesPerSecond );
+            if( ImGui::Button( "Benchmark model loading" ) )
+            {
+                loadingBenchmark.clear();
+                for (const auto& name : BenchmarkModels)
+                {
+                    // the binary models are converted from the text ones on the fly
+                    string textPath = "../../models/" + name + ".bez";
+                    string binaryPath = "../../models/" + name + ".bbez";
+                    if (convert_BezToBinary(textPath, binaryPath))
+                        loadingBenchmark.push_back(bench_BezLoading(textPath, binaryPath));
+                }
+            }
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Compare the loading time of the .bez text models against the .bbez binary ones,\nand the text parser against the previous getline/istringstream reader.");
+            for (const auto& result : loadingBenchmark)
+            {
+                ImGui::Text( "%-8s %4zu patches: text %7.3f ms, binary %7.3f ms", result.model.c_str(), result.patches, result.textMs, result.binaryMs );
+                ImGui::Text( "         parser %7.3f ms, previous parser %7.3f ms (%.1fx)", result.parseMs, result.legacyParseMs,
+                             result.parseMs > 0.0 ? result.legacyParseMs / result.parseMs : 0.0 );
+            }
+            if( ImGui::Button( "Benchmark Bezier kernels" ) )
+                bezierMathBenchmark = bench_BezierMath(terrainModel.patches());
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Evaluation of the current model on a 17 x 17 grid: one sample at a time, batched (u, v) pairs and basis tables.");
+            if (bezierMathBenchmark.samples)
+                ImGui::Text( "Bezier samples/s: scalar %.1fM, %s x%d batch %.1fM, grid %.1fM (error %.1e); subdivisions/s %.1fM",
+                    bezierMathBenchmark.scalarSamplesPerSecond * 1e-6, bezierMathBenchmark.simdName, bezierMathBenchmark.simdWidth,
+                    bezierMathBenchmark.batchSamplesPerSecond * 1e-6, bezierMathBenchmark.gridSamplesPerSecond * 1e-6,
+                    bezierMathBenchmark.maxPositionError, bezierMathBenchmark.subdivisionsPerSecond * 1e-6 );
+            if( ImGui::Button( "Export mesh" ) )
+                meshExportStatus = write_BezierSurfacesOBJ("terrain_mesh.obj", terrainModel.patches(), 8, calc_TerrainModelMatrix(orientationY))
+                    ? "Tessellated patches written to terrain_mesh.obj" : "Cannot write terrain_mesh.obj";
+            ImGui::SameLine();
+            ImGui::Text( "%s", meshExportStatus.c_str() );
+            ImGui::Checkbox("Terrain collision", &terrainCollision);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Keep the camera above the surface of the terrain (ray casting on the patches).");
+            ImGui::Text( "Left click on the terrain to pick a patch. %s", pickStatus.c_str() );
+            ImGui::NewLine();
+            ImGui::Checkbox("Terrain LOD", &terrainLODEnabled);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Draw the far terrain with merged patches (least squares fits of 2 x 2 patches, recursively) chosen by their error on the screen.");
+            ImGui::SameLine();
+            ImGui::SliderFloat("LOD error (px)", &terrainLODTolerance, 0.5f, 16.0f);
+            if (terrainLOD.isReady())
+            {
+                const TerrainLODStats& lodStats = terrainLOD.lodStats();
+                ImGui::Text( "LOD tree: %zu nodes in %u levels (%.2f MB on GPU), built in %.1f ms, root error %.3f",
+                    lodStats.nodes, lodStats.levels, terrainLOD.gpuBytes() / (1024.0 * 1024.0), lodStats.buildMs, lodStats.rootError * terrainDimension );
+                ImGui::Text( "LOD selection: %zu patches (%zu generated) of %zu in %.3f ms", lodStats.selectedPatches, lodStats.selectedLeaves, lodStats.leaves, lodStats.selectMs );
+            }
+            if (terrainLOD.isBuilding())
+                ImGui::Text( "Building the LOD tree of the new terrain..." );
+            if( ImGui::Button( "Benchmark fly-through" ) && flyThroughPass < 0 )
+                StartFlyThrough();
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Fly low over the terrain along a fixed path, once with the generated patches and once with the LOD.");
+            if (flyThroughPass >= 0)
+            {
+                ImGui::SameLine();
+                ImGui::Text( "%s pass, frame %zu/%zu", flyThroughPass == 0 ? "Full" : "LOD", flyThroughFrame, flyThroughPath.size() );
+            }
+            for (int pass = 0; pass != 2; pass++)
+                if (flyThroughResults[pass].frames)
+                    ImGui::Text( "%s: %8.0f patches/frame (%zu - %zu), frame %.2f ms, terrain GPU %.3f ms", pass == 0 ? "Full" : "LOD ",
+                        flyThroughResults[pass].averagePatches(), flyThroughResults[pass].minPatches, flyThroughResults[pass].maxPatches,
+                        flyThroughResults[pass].averageFrameMs(), flyThroughResults[pass].gpuMs / flyThroughResults[pass].frames );
             ImGui::Separator();
             break;
         case 3:
@@ -472,6 +1135,94 @@ int main()
             ImGui::SliderFloat("Directional Derivative Limit",&directionalDerivativeLimit, 3, 20);
             if (ImGui::IsItemHovered())
                 ImGui::SetTooltip("Parameter that increases or decreases the regions to be considered as suggestive contours.");
+            ImGui::Checkbox("Object Space Lines", &objectSpaceLines);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Extract the contours and suggestive contours on the CPU as polylines (only the patches whose view changed) and draw them as lines. Not used while the terrain LOD is drawn.");
+            if (objectSpaceLines)
+            {
+                ImGui::SliderInt("Line Extraction Level", (int*)&contourLinesLevel, 2, 32);
+                ImGui::SliderFloat("View Tolerance", &contourExtractor.settings.viewTolerance, 0.0f, 0.1f);
+                if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip("A patch is extracted again when the camera moved by more than this fraction of its distance from the patch.");
+                const auto& lineStats = contourExtractor.lastStats();
+                ImGui::Text( "%zu/%zu patches extracted in %.2f ms, %zu segments chained in %.2f ms into %zu polylines",
+                    lineStats.extractedPatches, lineStats.patches, lineStats.extractMs, lineStats.segments, lineStats.chainMs, lineStats.polylines );
+                if( ImGui::Button( "Export lines" ) )
+                    contourLinesStatus = write_ContourPolylinesOBJ("contour_lines.obj", contourExtractor.lines(), calc_TerrainModelMatrix(orientationY))
+                        ? "Lines written to contour_lines.obj" : "Cannot write contour_lines.obj";
+                ImGui::SameLine();
+                ImGui::Text( "%s", contourLinesStatus.c_str() );
+            }
+            ImGui::NewLine();
+            ImGui::Text("Curvature view:");
+            ImGui::RadioButton("Off", &curvatureDebugView, 0); ImGui::SameLine();
+            ImGui::RadioButton("Mean", &curvatureDebugView, 1); ImGui::SameLine();
+            ImGui::RadioButton("Gaussian", &curvatureDebugView, 2); ImGui::SameLine();
+            ImGui::RadioButton("Direction", &curvatureDebugView, 3); ImGui::SameLine();
+            ImGui::RadioButton("Radial", &curvatureDebugView, 4);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Shows the curvature computed by the evaluation shader (debug program with the full curvature block).");
+            ImGui::SliderFloat("Curvature Scale", &curvatureDebugScale, 0.01f, 100.0f, "%.2f", ImGuiSliderFlags_Logarithmic);
+            ImGui::NewLine();
+            if( ImGui::Button( "Check curvature solver" ) )
+            {
+                curvatureCheck.clear();
+                for (const auto& name : BenchmarkModels)
+                    curvatureCheck.push_back(check_CurvatureSolver(name, read_BezText("../../models/" + name + ".bez")));
+            }
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Compare the closed form curvature solver of the shader (CPU reference) with the previous solver and a double precision solution.");
+            for (const auto& result : curvatureCheck)
+                ImGui::Text( "%-8s %6zu samples: k error %.1e, direction error %.1e rad, previous solver wrong on %zu", result.model.c_str(), result.samples, result.maxCurvatureError, result.maxDirectionError, result.legacyCurvatureMismatches );
+            ImGui::NewLine();
+            ImGui::Checkbox("Curvature cache", &curvatureCacheEnabled);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Sample normals, principal curvatures and directions once for each patch: the evaluation shader only computes the view dependent terms.\n"
+                                  "Not used by the tiles, the LOD, the separate patch buffers and the curvature view.");
+            ImGui::SameLine();
+            if( ImGui::Button( "Check curvature cache" ) )
+                curvatureCacheCheck = check_CurvatureCache(terrainModel.patches());
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Compare the radial curvature of the cache (Euler formula, bilinear filtering) with II(w, w) / I(w, w) of the surface.");
+            if (curvatureCache.isReady())
+                ImGui::Text( "Curvature cache: %zu patches, %ux%u samples each, %.1f MB, built in %.1f ms%s", curvatureCache.patches(),
+                    curvatureCache.resolution(), curvatureCache.resolution(), curvatureCache.gpuBytes() / (1024.0 * 1024.0), curvatureCache.buildTime(),
+                    CurvatureCacheActive() ? "" : " (not used)" );
+            if (curvatureCacheCheck.samples)
+                ImGui::Text( "%zu samples of %zu patches: kr error %.1e on the grid, %.1e max (%.1e average) between, normal error %.1e rad",
+                    curvatureCacheCheck.samples, curvatureCacheCheck.patches, curvatureCacheCheck.maxGridError, curvatureCacheCheck.maxInterpolatedError,
+                    curvatureCacheCheck.averageInterpolatedError, curvatureCacheCheck.maxNormalError );
+            ImGui::NewLine();
+            ImGui::SliderInt("CPU Tessellation Level", (int*)&tessellatorLevel, 1, 64);
+            {
+                // same transformations and contour parameters of the current frame
+                TessellationView tessellationView;
+                tessellationView.modelMatrix = calc_TerrainModelMatrix(orientationY);
+                tessellationView.normalMatrix = glm::inverseTranspose(glm::mat3(camera.GetViewMatrix() * tessellationView.modelMatrix));
+                tessellationView.viewMatrix = camera.GetViewMatrix();
+                tessellationView.projectionMatrix = projection;
+                tessellationView.viewportResolution = glm::make_vec2(viewportResolution);
+                NPRLineSettings lineSettings{ contourLimit, directionalDerivativeLimit, enableContours, enableSuggestiveContours };
+                if( ImGui::Button( "Check CPU tessellator" ) )
+                    tessellatorCheck = check_CPUTessellator(terrainModel.patches(), tessellatorLevel, tessellationView, lineSettings);
+                if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Compare the CPU reference of the evaluation shader with the single sample evaluation, and its vectorized kernel with the scalar one.");
+                ImGui::SameLine();
+                if( ImGui::Button( "Benchmark CPU tessellator" ) )
+                    tessellatorBenchmark = bench_CPUTessellator(terrainModel.patches(), tessellatorLevel, tessellationView, lineSettings, get_GenerationPool());
+            }
+            if (tessellatorCheck.samples)
+                ImGui::Text( "%zu samples: position error %.1e, normal error %.1e, k error %.1e, vectorized kernel differs on %zu samples (%zu classes)",
+                    tessellatorCheck.samples, tessellatorCheck.maxPositionError, tessellatorCheck.maxNormalError, tessellatorCheck.maxCurvatureError,
+                    tessellatorCheck.simdMismatches, tessellatorCheck.classMismatches );
+            if (tessellatorBenchmark.samples)
+            {
+                ImGui::Text( "%zu samples of %zu patches: scalar %.1f, %s x%d %.1f, %u threads %.1f, classifier %.1f Msamples/s",
+                    tessellatorBenchmark.samples, tessellatorBenchmark.patches, tessellatorBenchmark.scalarSamplesPerSecond * 1e-6,
+                    tessellatorBenchmark.simdName, tessellatorBenchmark.simdWidth, tessellatorBenchmark.simdSamplesPerSecond * 1e-6,
+                    tessellatorBenchmark.threads, tessellatorBenchmark.threadedSamplesPerSecond * 1e-6, tessellatorBenchmark.classifierSamplesPerSecond * 1e-6 );
+                ImGui::Text( "Contour samples %.1f%%, suggestive contour samples %.1f%%", 100.0 * tessellatorBenchmark.contourRatio, 100.0 * tessellatorBenchmark.suggestiveContourRatio );
+            }
             ImGui::NewLine();
             ImGui::Separator();
             break;
@@ -483,14 +1234,45 @@ int main()
         glfwSwapBuffers(window);
     }
 
-    // Destroy UI Objects
-    ImGui_ImplGlfw_Shutdown();
-    ImGui_ImplOpenGL3_Shutdown();
-    ImGui::DestroyContext();
+    if (headless.enabled)
+    {
+        // the frames still in flight are written before the GL objects are released
+        frameDumper->finish();
+        double totalMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - headlessStart).count();
+        std::cout << "Headless: " << frameDumper->writtenFrames() << " frames written (" << frameDumper->failedFrames() << " failed) in "
+                  << totalMs << " ms, " << 1000.0 * headlessFrame / totalMs << " frames/s; waits of the render thread: readback "
+                  << frameDumper->readbackWaitMs << " ms, writers " << frameDumper->writerWaitMs << " ms; PNG encoding "
+                  << frameDumper->averageWriteMs() << " ms/frame on the writer threads" << std::endl;
+        frameDumper.reset();
+        offscreenTarget.reset();
+    }
+    else
+    {
+        // Destroy UI Objects
+        ImGui_ImplGlfw_Shutdown();
+        ImGui_ImplOpenGL3_Shutdown();
+        ImGui::DestroyContext();
+    }
     // when I exit from the graphics loop, it is because the application is closing
     // we delete the Shader Program
-    illumination_shader.Delete();
+    for (auto& illumination_shader : illumination_shaders)
+        illumination_shader.Delete();
+    for (auto& vertex_cache_shader : vertex_cache_shaders)
+        vertex_cache_shader.Delete();
     skybox_shader.Delete();
+    contour_lines_shader.Delete();
+    contourLineMesh.Delete();
+    cameraBuffer.Delete();
+    styleBuffer.Delete();
+    // the tiles (and a terrain still uploading) own GPU buffers: they are released while the context is still alive
+    terrainTiles.reset();
+    terrainRegenerator.reset();
+    terrainModel = TerrainModel();
+    terrainLOD.clear();
+    terrainTimer.release();
+    terrainVertexCache.release();
+    curvatureCache.release();
+    get_TerrainBufferPool().clear();
     // we close and delete the created context
     glfwTerminate();
     return 0;
@@ -571,6 +1353,17 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
 
 }
 
+//////////////////////////////////////////
+// callback for mouse buttons: the pick is done in the render loop, where the matrices of the frame are known
+void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && ImGui::GetCurrentContext() && !ImGui::GetIO().WantCaptureMouse)
+    {
+        glfwGetCursorPos(window, &pickX, &pickY);
+        pickRequested = true;
+    }
+}
+
 ///////////////////////////////////////////
 // load one side of the cubemap, passing the name of the file and the side of the corresponding OpenGL cubemap
 void LoadTextureCubeSide(string path, string side_image, GLuint side_name)
@@ -666,6 +1459,181 @@ GLint LoadTexture(const char* path)
 
 }
 
+//////////////////////////////////////////
+// model matrix of the terrain (or of the loaded model) rotated by orientation degrees around the Y axis
+glm::mat4 calc_TerrainModelMatrix(GLfloat orientation)
+{
+    glm::mat4 modelMatrix = glm::mat4(1.0f);
+    if(showingTerrain){
+        modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, 0.0f, 0.0f));
+        modelMatrix = glm::rotate(modelMatrix, glm::radians(orientation), glm::vec3(0.0f, 1.0f, 0.0f));
+        modelMatrix = glm::scale(modelMatrix, glm::vec3(terrainDimension));
+    }else{
+        modelMatrix = glm::rotate(modelMatrix, glm::radians((GLfloat)90.0), glm::vec3(1.0f, 0.0f, 0.0f));
+        modelMatrix = glm::rotate(modelMatrix, glm::radians((GLfloat)180.0), glm::vec3(0.0f, 1.0f, 0.0f));
+        modelMatrix = glm::scale(modelMatrix, glm::vec3(terrainDimension/4.0f));
+    }
+    return modelMatrix;
+}
+
+//////////////////////////////////////////
+// parameters of the generated terrain (regenerated in the background) from the current UI settings
+TerrainGenSettings CurrentGenSettings()
+{
+    TerrainGenSettings settings;
+    settings.n = numPatches;
+    settings.seed = generationSeed;
+    settings.octaves = consideredOctaves;
+    settings.freq = consideredFrequency;
+    return settings;
+}
+
+void RequestTerrainRegeneration()
+{
+    if (!terrainRegenerator)
+        terrainRegenerator = std::make_unique<TerrainRegenerator>();
+    terrainRegenerator->request(CurrentGenSettings(), batchedPatches);
+}
+
+// The vertex cache is used only for views that can stay still: the tiles are streamed, the model spinning, the fly-through and
+// the headless camera paths move at every frame, and the curvature debug variant has too many varyings to capture
+bool VertexCacheActive()
+{
+    return vertexCacheEnabled && !NPRVariantCachedVaryings[CurrentNPRVariant()].empty() && !spinning && flyThroughPass < 0
+        && !(showingTerrain && streamingTerrain && terrainTiles);
+}
+
+// The curvature cache draws all the patches of the model in their order (the shaders find the tile of a patch from its index): it
+// is sampled again for every new model
+bool CurvatureCacheActive()
+{
+    if (!curvatureCacheEnabled || CurrentNPRVariant() == NPR_VARIANT_CURVATURE_DEBUG || !batchedPatches
+        || (showingTerrain && streamingTerrain && terrainTiles) || TerrainLODActive())
+        return false;
+    if (curvatureCacheRevision != terrainModel.revision())
+    {
+        curvatureCache.build(terrainModel.patches(), &get_GenerationPool());
+        curvatureCacheRevision = terrainModel.revision();
+    }
+    return curvatureCache.isReady();
+}
+
+// The LOD replaces the generated patches of the single terrain: its tree is built again in the background when the terrain changes,
+// the full terrain is drawn until the new tree is uploaded
+bool TerrainLODActive()
+{
+    const bool enabled = flyThroughPass >= 0 ? flyThroughPass == 1 : terrainLODEnabled;
+    if (!enabled || !showingTerrain || streamingTerrain || !terrainModel.patchStore().isGrid())
+        return false;
+    terrainLOD.requestBuild(terrainModel.patchStore(), terrainModel.fingerprint());
+    terrainLOD.update();
+    return terrainLOD.isReady() && terrainLOD.fingerprint() == terrainModel.fingerprint();
+}
+
+// The path is computed once from the current terrain, the rotation is paused until the end of the benchmark
+void StartFlyThrough()
+{
+    if (!showingTerrain || streamingTerrain || !terrainModel.patchStore().isGrid())
+        return;
+    // the benchmark needs the tree from its start
+    if (!terrainLOD.isReady() || terrainLOD.fingerprint() != terrainModel.fingerprint())
+        terrainLOD.build(terrainModel.patchStore(), terrainModel.fingerprint());
+    flyThroughPath = gen_FlyThroughPath(terrainLOD.boundsMin(), terrainLOD.boundsMax(), calc_TerrainModelMatrix(orientationY), 300);
+    flyThroughResults[0] = flyThroughResults[1] = FlyThroughStats();
+    flyThroughSpinning = spinning;
+    spinning = GL_FALSE;
+    flyThroughPass = 0;
+    flyThroughFrame = 0;
+    flyThroughDrawn = false;
+    terrainTimer.reset();
+}
+
+// Called at the start of the frame after every frame of the benchmark (deltaTime is the duration of that frame): the GPU times
+// of a pass are waited for at its end
+void UpdateFlyThrough()
+{
+    flyThroughResults[flyThroughPass].add(flyThroughDrawnPatches, 1000.0 * deltaTime);
+    flyThroughDrawn = false;
+    if (++flyThroughFrame != flyThroughPath.size())
+        return;
+    terrainTimer.flush();
+    flyThroughResults[flyThroughPass].gpuMs = terrainTimer.totalMs;
+    terrainTimer.reset();
+    flyThroughFrame = 0;
+    if (++flyThroughPass == 2)
+    {
+        flyThroughPass = -1;
+        spinning = flyThroughSpinning;
+        camera.LookAt(cameraPosition, cameraPosition + cameraInitialOrientation);
+    }
+}
+
+// parameters of the streamed terrain from the current UI settings
+TerrainTileSettings CurrentTileSettings()
+{
+    TerrainTileSettings settings;
+    settings.n = numPatches;
+    settings.seed = generationSeed;
+    settings.octaves = consideredOctaves;
+    settings.freq = consideredFrequency;
+    settings.viewRadius = tileViewRadius;
+    settings.memoryBudgetBytes = (std::size_t)tileMemoryBudgetMB << 20;
+    return settings;
+}
+
+void AddShaderStartupTimings(const Shader& shader)
+{
+    shaderStartupTimings.readMs += shader.timings.readMs;
+    shaderStartupTimings.compileMs += shader.timings.compileMs;
+    shaderStartupTimings.linkMs += shader.timings.linkMs;
+    shaderStartupTimings.cacheLoadMs += shader.timings.cacheLoadMs;
+    shaderPrograms++;
+    shaderCacheHits += shader.timings.cacheHit;
+}
+
+// Style parameters of the UI in the std140 layout of the NPRStyleBlock of the shaders
+NPRStyleBlock CurrentStyleBlock()
+{
+    NPRStyleBlock style;
+    style.warmColor = glm::make_vec3(warmColor);
+    style.coldColor = glm::make_vec3(coldColor);
+    style.strokeColor = glm::make_vec3(strokeColor);
+    style.contourLimit = contourLimit;
+    style.directionalDerivativeLimit = directionalDerivativeLimit;
+    style.tessellationTriangleSize = tessellationTriangleSize;
+    style.shadingType = shadingType;
+    style.celShadingSize = celShadingSize;
+    style.shininessFactor = shininessFactor;
+    style.curvatureDebugView = curvatureDebugView;
+    // the object space lines replace the per pixel test
+    style.enableContours = enableContours && !ObjectSpaceLinesActive();
+    style.enableSuggestiveContours = enableSuggestiveContours && !ObjectSpaceLinesActive();
+    style.enablePatchCulling = enablePatchCulling;
+    style.curvatureDebugScale = curvatureDebugScale;
+    return style;
+}
+
+// Lines extracted on the CPU: for the generated terrain and the loaded models (not for the streamed tiles, nor for the LOD, whose
+// merged patches are not the ones extracted)
+bool ObjectSpaceLinesActive()
+{
+    return objectSpaceLines && !(showingTerrain && streamingTerrain) && !TerrainLODActive();
+}
+
+// Program variant of the current render mode (suggestive contours also need n dot v, so they include the contours)
+NPRVariant CurrentNPRVariant()
+{
+    if (curvatureDebugView != 0)
+        return NPR_VARIANT_CURVATURE_DEBUG;
+    if (ObjectSpaceLinesActive())
+        return NPR_VARIANT_SHADING;
+    if (enableSuggestiveContours)
+        return NPR_VARIANT_SUGGESTIVE_CONTOURS;
+    if (enableContours)
+        return NPR_VARIANT_CONTOURS;
+    return NPR_VARIANT_SHADING;
+}
+
 //Styles buttons are just predefined set of values for all our variables
 void ReddishStyle(){
     